@@ -0,0 +1,87 @@
+#include "deferredShading.h"
+#include <iostream>
+#include "glad/glad.h"
+#include "memoryTracker.h"
+
+DeferredShading::DeferredShading() : _width(0), _height(0), _fbo(0), _normalTexture(0), _albedoTexture(0), _depthTexture(0)
+{
+}
+
+bool DeferredShading::Create(int width, int height, unsigned int depthTexture)
+{
+	Shutdown();
+	MemoryScope memoryScope(MemorySubsystem::Textures);
+	_width = width;
+	_height = height;
+	_depthTexture = depthTexture;
+
+	auto CreateTarget = [&](unsigned int& texture, GLenum internalFormat, const char* name)
+	{
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, _width, _height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Read with texelFetch, one texel per pixel
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		TrackGpuResource(GpuResourceType::Texture, texture, TextureByteSize(_width, _height, internalFormat), name);
+	};
+	glGenFramebuffers(1, &_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+	CreateTarget(_normalTexture, GL_RG16, "G-buffer normals");
+	CreateTarget(_albedoTexture, GL_RGBA8, "G-buffer albedo");
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _normalTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _albedoTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depthTexture, 0);
+	unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, attachments);
+	bool bComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	if (!bComplete)
+	{
+		std::cerr << "ERROR: G-buffer framebuffer not complete" << std::endl;
+		Shutdown();
+		return false;
+	}
+	return true;
+}
+
+void DeferredShading::BeginGeometry(Shader& terrainShader)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+	glViewport(0, 0, _width, _height);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	terrainShader.use();
+	terrainShader.setBool("bGBufferPass", true);
+}
+
+void DeferredShading::EndGeometry(Shader& terrainShader, unsigned int sceneFramebuffer)
+{
+	terrainShader.use();
+	terrainShader.setBool("bGBufferPass", false);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+}
+
+void DeferredShading::Bind(Shader& lightingShader, int firstUnit) const
+{
+	lightingShader.use();
+	const unsigned int textures[3] = { _normalTexture, _albedoTexture, _depthTexture };
+	const char* samplers[3] = { "gNormal", "gAlbedo", "gDepth" };
+	for (int i = 0; i < 3; ++i)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		lightingShader.setInt(samplers[i], firstUnit + i);
+	}
+}
+
+void DeferredShading::Shutdown()
+{
+	if (!IsCreated()) return;
+	UntrackGpuResource(GpuResourceType::Texture, _normalTexture);
+	UntrackGpuResource(GpuResourceType::Texture, _albedoTexture);
+	glDeleteTextures(1, &_normalTexture);
+	glDeleteTextures(1, &_albedoTexture);
+	glDeleteFramebuffers(1, &_fbo);
+	_fbo = _normalTexture = _albedoTexture = _depthTexture = 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "shader.h"
+
+const int MAX_FILL_LIGHTS = 4; // Must match deferredLighting.FRAG
+
+/// <summary>
+/// A directional light that only adds diffuse light (moonlight, bounce light, ...). Only the deferred path has them.
+/// </summary>
+struct FillLight
+{
+	glm::vec3 direction; // Towards the light, world space
+	glm::vec3 color;
+};
+
+/// <summary>
+/// Optional deferred path for the terrain. Forward shading runs the parallax march, the material fetches, lighting and fog in
+/// one fragment shader; here the terrain only writes a thin G-buffer, and deferredLighting.FRAG lights and fogs each pixel
+/// once in a fullscreen pass, so more lights cost a few ALU ops per pixel instead of another terrain pass.
+///  - Normal: GL_RG16, the world space normal octahedrally encoded (even precision in every direction, two channels)
+///  - Albedo: GL_RGBA8, the blended material layers, alpha 1 where the terrain covers the pixel
+///  - Depth: the scene's own depth texture, shared with the HDR framebuffer, so the sun and skybox drawn afterwards are
+///    depth tested against the terrain as before, and the lighting pass rebuilds positions from it
+/// Everything the lighting needs besides these is per frame (the sun, the camera), not per pixel.
+/// </summary>
+class DeferredShading
+{
+public:
+	DeferredShading();
+	~DeferredShading() { Shutdown(); }
+
+	bool Create(int width, int height, unsigned int depthTexture); // Allocates the G-buffer around the scene's depth texture
+	bool IsCreated() const { return _fbo != 0; }
+
+	/// <summary>
+	/// Bind the G-buffer and switch procTerrain.FRAG to writing it. Depth isn't cleared: it belongs to the scene framebuffer,
+	/// which has just been cleared.
+	/// </summary>
+	void BeginGeometry(Shader& terrainShader);
+	void EndGeometry(Shader& terrainShader, unsigned int sceneFramebuffer); // Back to forward shading, sceneFramebuffer bound
+
+	void Bind(Shader& lightingShader, int firstUnit) const; // The G-buffer's textures on three units from firstUnit, for deferredLighting.FRAG
+	void Shutdown(); // Releases the G-buffer (needs the GL context)
+
+private:
+	int _width, _height;
+	unsigned int _fbo;
+	unsigned int _normalTexture;
+	unsigned int _albedoTexture;
+	unsigned int _depthTexture; // Not owned
+};
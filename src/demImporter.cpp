@@ -0,0 +1,854 @@
+#include "demImporter.h"
+#include "memoryTracker.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+const int RESAMPLE_BAND_ROWS = 64;
+static_assert(DemPyramid::TILE_SIZE == HEIGHT_TILE_SIZE, "Pyramid tiles are copied into height containers as they are");
+
+/// <summary>
+/// Start of both cache files. The samples follow at CACHE_DATA_OFFSET. bComplete is only set once everything has been written,
+/// so a cache left behind by an interrupted run is rebuilt.
+/// </summary>
+struct DemCacheHeader
+{
+	char magic[8];
+	uint64_t sourceBytes;
+	int32_t width, height;
+	uint16_t minElevation, maxElevation;
+	uint32_t bComplete;
+};
+const size_t CACHE_DATA_OFFSET = 64;
+const char RAW_CACHE_MAGIC[8] = { 'D', 'E', 'M', 'R', '1', '6', 0, 1 };
+const char MIP_CACHE_MAGIC[8] = { 'D', 'E', 'M', 'M', 'I', 'P', 0, 1 };
+
+static bool IsCacheValid(const MappedFile& cache, const char* magic, uint64_t sourceBytes, int width, int height, size_t size)
+{
+	if (cache.Size() != size || size < CACHE_DATA_OFFSET) return false;
+	DemCacheHeader header;
+	std::memcpy(&header, cache.Data(), sizeof(header));
+	return std::memcmp(header.magic, magic, sizeof(header.magic)) == 0 && header.sourceBytes == sourceBytes &&
+		header.width == width && header.height == height && header.bComplete;
+}
+
+static void WriteCacheHeader(MappedFile& cache, const char* magic, uint64_t sourceBytes, int width, int height, uint16_t minElevation, uint16_t maxElevation, bool bComplete)
+{
+	DemCacheHeader header;
+	std::memcpy(header.magic, magic, sizeof(header.magic));
+	header.sourceBytes = sourceBytes;
+	header.width = width;
+	header.height = height;
+	header.minElevation = minElevation;
+	header.maxElevation = maxElevation;
+	header.bComplete = bComplete ? 1 : 0;
+	std::memcpy(cache.MutableData(), &header, sizeof(header));
+}
+
+static bool FileExists(const std::string& path)
+{
+	return std::ifstream(path.c_str()).good();
+}
+
+static uint32_t ReadBigEndian32(const unsigned char* bytes)
+{
+	return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) | (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+// ------------------------------------ Inflate -------------------------------------------------------------------
+/// <summary>
+/// Canonical Huffman decoding table: codes up to FAST_BITS long resolve with one lookup, longer ones by code length.
+/// </summary>
+struct HuffmanTable
+{
+	static const int FAST_BITS = 9;
+	uint16_t fast[1 << FAST_BITS]; // (length << 9) | symbol, 0 when the code is longer than FAST_BITS
+	uint32_t maxCode[17];          // Exclusive upper bound of each length's codes, left aligned to 16 bits
+	uint16_t firstCode[16];
+	uint16_t firstSymbol[16];
+	uint16_t symbols[288];
+
+	bool Build(const uint8_t* codeLengths, int count)
+	{
+		int lengthCounts[16] = {};
+		for (int i = 0; i < count; ++i)
+			++lengthCounts[codeLengths[i]];
+		lengthCounts[0] = 0;
+		std::memset(fast, 0, sizeof(fast));
+
+		int nextCode[16];
+		int code = 0, symbol = 0;
+		for (int length = 1; length < 16; ++length)
+		{
+			nextCode[length] = code;
+			firstCode[length] = static_cast<uint16_t>(code);
+			firstSymbol[length] = static_cast<uint16_t>(symbol);
+			code += lengthCounts[length];
+			if (lengthCounts[length] && code - 1 >= (1 << length)) return false; // Over-subscribed
+			maxCode[length] = static_cast<uint32_t>(code) << (16 - length);
+			code <<= 1;
+			symbol += lengthCounts[length];
+		}
+		maxCode[16] = 0x10000;
+
+		for (int i = 0; i < count; ++i)
+		{
+			int length = codeLengths[i];
+			if (!length) continue;
+			int slot = nextCode[length] - firstCode[length] + firstSymbol[length];
+			symbols[slot] = static_cast<uint16_t>(i);
+			if (length <= FAST_BITS)
+			{
+				// Deflate sends codes most significant bit first into an LSB-first stream, so index by the reversed code
+				int reversed = 0;
+				for (int bit = 0; bit < length; ++bit)
+					reversed |= ((nextCode[length] >> bit) & 1) << (length - 1 - bit);
+				for (int j = reversed; j < (1 << FAST_BITS); j += 1 << length)
+					fast[j] = static_cast<uint16_t>((length << 9) | i);
+			}
+			++nextCode[length];
+		}
+		return true;
+	}
+};
+
+/// <summary>
+/// Streaming zlib decoder (RFC 1950/ 1951) reading a stream split over several byte ranges of one buffer, such as a PNG's IDAT
+/// chunks. Output goes through a 64K buffer whose last 32K are the back-reference window, and is handed to the sink each
+/// time the buffer fills, so memory use doesn't depend on the size of the data.
+/// </summary>
+template<typename Sink>
+class Inflater
+{
+public:
+	Inflater(const unsigned char* base, const std::vector<std::pair<size_t, size_t>>& ranges, Sink& sink) :
+		_base(base), _ranges(ranges), _range(0), _rangeOffset(0), _bits(0), _bitCount(0), _bOverrun(false),
+		_window(WINDOW_SIZE * 2), _position(0), _flushed(0), _sink(sink)
+	{
+	}
+
+	bool Run()
+	{
+		Refill();
+		if ((Bits(8) & 0x0F) != 8) return false; // Compression method must be deflate
+		if (Bits(8) & 0x20) return false;        // No preset dictionary
+
+		bool bFinal = false;
+		while (!bFinal)
+		{
+			bFinal = Bits(1) != 0;
+			int type = static_cast<int>(Bits(2));
+			bool bOk = type == 0 ? StoredBlock() : type == 1 ? HuffmanBlock(FixedLiterals(), FixedDistances()) : type == 2 ? DynamicBlock() : false;
+			if (!bOk || _bOverrun) return false;
+		}
+		return Flush();
+	}
+
+private:
+	static const size_t WINDOW_SIZE = 32768;
+
+	bool HasInput()
+	{
+		while (_range < _ranges.size() && _rangeOffset == _ranges[_range].second)
+		{
+			++_range;
+			_rangeOffset = 0;
+		}
+		return _range < _ranges.size();
+	}
+
+	void Refill()
+	{
+		while (_bitCount <= 56 && HasInput())
+		{
+			_bits |= static_cast<uint64_t>(_base[_ranges[_range].first + _rangeOffset++]) << _bitCount;
+			_bitCount += 8;
+		}
+	}
+
+	uint32_t Bits(int count)
+	{
+		if (_bitCount < count) Refill();
+		if (_bitCount < count)
+		{
+			_bOverrun = true;
+			_bitCount = 0;
+			return 0;
+		}
+		uint32_t value = static_cast<uint32_t>(_bits & ((1ull << count) - 1));
+		_bits >>= count;
+		_bitCount -= count;
+		return value;
+	}
+
+	int Decode(const HuffmanTable& table)
+	{
+		if (_bitCount < 16) Refill();
+		int entry = table.fast[_bits & ((1 << HuffmanTable::FAST_BITS) - 1)];
+		if (entry)
+		{
+			int length = entry >> 9;
+			if (length > _bitCount) return -1; // Ran out of input
+			_bits >>= length;
+			_bitCount -= length;
+			return entry & 511;
+		}
+
+		int reversed = 0; // Next 16 bits, most significant first
+		for (int bit = 0; bit < 16; ++bit)
+			reversed |= static_cast<int>((_bits >> bit) & 1) << (15 - bit);
+		int length = HuffmanTable::FAST_BITS + 1;
+		while (length < 16 && static_cast<uint32_t>(reversed) >= table.maxCode[length]) ++length;
+		if (length == 16 || length > _bitCount) return -1;
+		int slot = (reversed >> (16 - length)) - table.firstCode[length] + table.firstSymbol[length];
+		_bits >>= length;
+		_bitCount -= length;
+		return table.symbols[slot];
+	}
+
+	bool Put(unsigned char byte)
+	{
+		if (_position == _window.size())
+		{
+			if (!Flush()) return false;
+			std::memmove(_window.data(), _window.data() + WINDOW_SIZE, WINDOW_SIZE);
+			_position = _flushed = WINDOW_SIZE;
+		}
+		_window[_position++] = byte;
+		return true;
+	}
+
+	bool Flush()
+	{
+		bool bOk = _sink(_window.data() + _flushed, _position - _flushed);
+		_flushed = _position;
+		return bOk;
+	}
+
+	bool StoredBlock()
+	{
+		Bits(_bitCount & 7); // Skip to the byte boundary
+		uint32_t length = Bits(16);
+		if ((Bits(16) ^ 0xFFFF) != length) return false;
+		for (uint32_t i = 0; i < length; ++i)
+			if (!Put(static_cast<unsigned char>(Bits(8)))) return false;
+		return true;
+	}
+
+	bool HuffmanBlock(const HuffmanTable& literals, const HuffmanTable& distances)
+	{
+		static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		for (;;)
+		{
+			int symbol = Decode(literals);
+			if (symbol < 0 || _bOverrun) return false;
+			if (symbol < 256)
+			{
+				if (!Put(static_cast<unsigned char>(symbol))) return false;
+				continue;
+			}
+			if (symbol == 256) return true;
+
+			symbol -= 257;
+			if (symbol >= 29) return false;
+			int length = lengthBase[symbol] + static_cast<int>(Bits(lengthExtra[symbol]));
+			int distanceSymbol = Decode(distances);
+			if (distanceSymbol < 0 || distanceSymbol >= 30) return false;
+			size_t distance = distanceBase[distanceSymbol] + Bits(distanceExtra[distanceSymbol]);
+			if (distance > _position) return false; // Before the start of the data
+			for (int i = 0; i < length; ++i)
+				if (!Put(_window[_position - distance])) return false; // Put() may slide the window, so index afresh each byte
+		}
+	}
+
+	bool DynamicBlock()
+	{
+		static const uint8_t codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		int literalCount = static_cast<int>(Bits(5)) + 257;
+		int distanceCount = static_cast<int>(Bits(5)) + 1;
+		int codeLengthCount = static_cast<int>(Bits(4)) + 4;
+
+		uint8_t codeLengthLengths[19] = {};
+		for (int i = 0; i < codeLengthCount; ++i)
+			codeLengthLengths[codeLengthOrder[i]] = static_cast<uint8_t>(Bits(3));
+		HuffmanTable codeLengths;
+		if (!codeLengths.Build(codeLengthLengths, 19)) return false;
+
+		uint8_t lengths[286 + 32] = {};
+		int count = 0;
+		while (count < literalCount + distanceCount)
+		{
+			int symbol = Decode(codeLengths);
+			if (symbol < 0 || _bOverrun) return false;
+			if (symbol < 16)
+			{
+				lengths[count++] = static_cast<uint8_t>(symbol);
+				continue;
+			}
+			int repeat = symbol == 16 ? 3 + static_cast<int>(Bits(2)) : symbol == 17 ? 3 + static_cast<int>(Bits(3)) : 11 + static_cast<int>(Bits(7));
+			if (symbol == 16 && count == 0) return false;
+			uint8_t value = symbol == 16 ? lengths[count - 1] : 0;
+			if (count + repeat > literalCount + distanceCount) return false;
+			while (repeat--) lengths[count++] = value;
+		}
+
+		HuffmanTable literals, distances;
+		return literals.Build(lengths, literalCount) && distances.Build(lengths + literalCount, distanceCount) && HuffmanBlock(literals, distances);
+	}
+
+	static const HuffmanTable& FixedLiterals()
+	{
+		struct FixedTable : HuffmanTable
+		{
+			FixedTable()
+			{
+				uint8_t lengths[288];
+				for (int i = 0; i < 288; ++i)
+					lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+				Build(lengths, 288);
+			}
+		};
+		static const FixedTable table;
+		return table;
+	}
+
+	static const HuffmanTable& FixedDistances()
+	{
+		struct FixedTable : HuffmanTable
+		{
+			FixedTable()
+			{
+				uint8_t lengths[30];
+				std::fill(lengths, lengths + 30, static_cast<uint8_t>(5));
+				Build(lengths, 30);
+			}
+		};
+		static const FixedTable table;
+		return table;
+	}
+
+	const unsigned char* _base;
+	const std::vector<std::pair<size_t, size_t>>& _ranges;
+	size_t _range, _rangeOffset;
+	uint64_t _bits;
+	int _bitCount;
+	bool _bOverrun;
+	std::vector<unsigned char> _window;
+	size_t _position, _flushed;
+	Sink& _sink;
+};
+// ----------------------------------------------------------------------------------------------------------------
+
+DemPyramid::DemPyramid() :
+	_samples(nullptr),
+	_format(DemSampleFormat::U16LE),
+	_pngBitDepth(0),
+	_bPngDecoded(false),
+	_bMipsBuilt(false),
+	_decodedLevelIndex(-1),
+	_resampleFailures(0),
+	_minElevation(0xFFFF),
+	_maxElevation(0)
+{
+}
+
+bool DemPyramid::Open(const char* path, const DemRawLayout& rawLayout)
+{
+	_path = path;
+	std::string extension = _path.substr(_path.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(std::tolower(c)); });
+	if (extension == "thm") return OpenContainer();
+	if (!_source.OpenRead(path)) return false;
+
+	bool bOpened = extension == "png" ? OpenPng() : extension == "pgm" ? OpenPgm() : OpenRaw(rawLayout);
+	if (!bOpened) return false;
+
+	// Halve (rounding up) until a level fits in one tile
+	Level level = { _levels[0].width, _levels[0].height, 0, 0, CACHE_DATA_OFFSET };
+	while (std::max(level.width, level.height) > TILE_SIZE)
+	{
+		level.width = (level.width + 1) / 2;
+		level.height = (level.height + 1) / 2;
+		level.tilesX = (level.width + TILE_SIZE - 1) / TILE_SIZE;
+		level.tilesY = (level.height + TILE_SIZE - 1) / TILE_SIZE;
+		_levels.push_back(level);
+		level.offset += static_cast<size_t>(level.tilesX) * level.tilesY * TILE_SIZE * TILE_SIZE * sizeof(uint16_t);
+	}
+	if (!OpenCaches()) return false;
+
+	std::cout << "DEM " << path << ": " << _levels[0].width << "x" << _levels[0].height << ", " << _levels.size() << " levels"
+		<< (_bMipsBuilt ? " (cached)" : "") << std::endl;
+	return true;
+}
+
+/// <summary>
+/// A packed pyramid: all levels and the elevation range are in the container already, there is nothing to build.
+/// </summary>
+bool DemPyramid::OpenContainer()
+{
+	if (!_container.Open(_path.c_str())) return false;
+	for (int i = 0; i < _container.LevelCount(); ++i)
+	{
+		Level level = { _container.LevelWidth(i), _container.LevelHeight(i), _container.TilesX(i), _container.TilesY(i), 0 };
+		_levels.push_back(level);
+	}
+	_minElevation = _container.MinElevation();
+	_maxElevation = _container.MaxElevation();
+	_bMipsBuilt = true;
+	std::cout << "DEM " << _path << ": " << _levels[0].width << "x" << _levels[0].height << ", " << _levels.size() << " levels (height container)" << std::endl;
+	return true;
+}
+
+bool DemPyramid::WriteContainer(const char* path, JobSystem& jobSystem, int maxError) const
+{
+	std::vector<HeightLevelSize> sizes;
+	for (const Level& level : _levels)
+	{
+		HeightLevelSize size = { level.width, level.height };
+		sizes.push_back(size);
+	}
+	return WriteHeightContainer(path, sizes, _minElevation, _maxElevation,
+		[this](int level, int tileX, int tileY, uint16_t* tile) { ReadTile(level, tileX, tileY, tile); }, jobSystem, maxError);
+}
+
+bool DemPyramid::OpenPng()
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	const unsigned char* data = _source.Data();
+	const size_t size = _source.Size();
+	if (size < 8 + 25 || std::memcmp(data, signature, 8) != 0)
+	{
+		std::cerr << "ERROR: " << _path << " is not a PNG file" << std::endl;
+		return false;
+	}
+
+	int width = 0, height = 0, colorType = -1, interlace = 0;
+	for (size_t offset = 8; offset + 12 <= size;)
+	{
+		size_t length = ReadBigEndian32(data + offset);
+		const unsigned char* type = data + offset + 4;
+		if (offset + 12 + length > size) break;
+		if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13)
+		{
+			width = static_cast<int>(ReadBigEndian32(type + 4));
+			height = static_cast<int>(ReadBigEndian32(type + 8));
+			_pngBitDepth = type[12];
+			colorType = type[13];
+			interlace = type[16];
+		}
+		else if (std::memcmp(type, "IDAT", 4) == 0)
+			_pngData.push_back(std::make_pair(offset + 8, length));
+		else if (std::memcmp(type, "IEND", 4) == 0)
+			break;
+		offset += 12 + length;
+	}
+
+	if (colorType != 0 || (_pngBitDepth != 8 && _pngBitDepth != 16) || interlace != 0 || width <= 0 || height <= 0 || _pngData.empty())
+	{
+		std::cerr << "ERROR: " << _path << " must be a non-interlaced 8 or 16 bit greyscale PNG" << std::endl;
+		return false;
+	}
+	Level level0 = { width, height, 0, 0, 0 };
+	_levels.push_back(level0);
+	_format = DemSampleFormat::U16LE; // What the decoded cache holds
+	return true;
+}
+
+bool DemPyramid::OpenPgm()
+{
+	// "P5" <width> <height> <maxval>, separated by whitespace with '#' comments, then a single whitespace and the samples
+	const char* data = reinterpret_cast<const char*>(_source.Data());
+	const size_t size = _source.Size();
+	size_t offset = 2;
+	int fields[3] = {};
+	bool bOk = size > 2 && data[0] == 'P' && data[1] == '5';
+	for (int i = 0; i < 3 && bOk; ++i)
+	{
+		while (offset < size && (std::isspace(static_cast<unsigned char>(data[offset])) || data[offset] == '#'))
+		{
+			if (data[offset] == '#')
+				while (offset < size && data[offset] != '\n') ++offset;
+			else
+				++offset;
+		}
+		bOk = offset < size && std::isdigit(static_cast<unsigned char>(data[offset]));
+		while (offset < size && std::isdigit(static_cast<unsigned char>(data[offset])))
+			fields[i] = fields[i] * 10 + (data[offset++] - '0');
+	}
+	++offset;
+
+	_format = fields[2] < 256 ? DemSampleFormat::U8 : DemSampleFormat::U16BE;
+	size_t sampleBytes = _format == DemSampleFormat::U8 ? 1 : 2;
+	if (!bOk || fields[0] <= 0 || fields[1] <= 0 || fields[2] <= 0 || fields[2] > 65535 ||
+		offset + static_cast<size_t>(fields[0]) * fields[1] * sampleBytes > size)
+	{
+		std::cerr << "ERROR: " << _path << " is not a binary (P5) PGM file" << std::endl;
+		return false;
+	}
+	Level level0 = { fields[0], fields[1], 0, 0, 0 };
+	_levels.push_back(level0);
+	_samples = _source.Data() + offset;
+	return true;
+}
+
+bool DemPyramid::OpenRaw(const DemRawLayout& rawLayout)
+{
+	_format = rawLayout.format;
+	size_t sampleBytes = _format == DemSampleFormat::U8 ? 1 : 2;
+	int width = rawLayout.width, height = rawLayout.height;
+	if (width <= 0 || height <= 0)
+	{
+		// Square heightmaps (.r16 exports and the like) don't need their size spelled out
+		width = height = static_cast<int>(std::sqrt(static_cast<double>(_source.Size() / sampleBytes)) + 0.5);
+		if (static_cast<size_t>(width) * height * sampleBytes != _source.Size())
+		{
+			std::cerr << "ERROR: " << _path << " isn't square, pass its size with --dem-size <W>x<H>" << std::endl;
+			return false;
+		}
+	}
+	if (static_cast<size_t>(width) * height * sampleBytes > _source.Size())
+	{
+		std::cerr << "ERROR: " << _path << " is smaller than " << width << "x" << height << " samples" << std::endl;
+		return false;
+	}
+	Level level0 = { width, height, 0, 0, 0 };
+	_levels.push_back(level0);
+	_samples = _source.Data();
+	return true;
+}
+
+/// <summary>
+/// Map the caches from an earlier run if they match the source, or create them empty to be filled by the build.
+/// </summary>
+bool DemPyramid::OpenCaches()
+{
+	const uint64_t sourceBytes = _source.Size();
+	const int width = _levels[0].width, height = _levels[0].height;
+
+	if (!_pngData.empty())
+	{
+		std::string rawPath = _path + ".r16";
+		size_t rawSize = CACHE_DATA_OFFSET + static_cast<size_t>(width) * height * sizeof(uint16_t);
+		_bPngDecoded = FileExists(rawPath) && _rawCache.OpenRead(rawPath.c_str()) && IsCacheValid(_rawCache, RAW_CACHE_MAGIC, sourceBytes, width, height, rawSize);
+		if (!_bPngDecoded && !_rawCache.Create(rawPath.c_str(), rawSize)) return false;
+		_samples = _rawCache.Data() + CACHE_DATA_OFFSET;
+	}
+
+	std::string mipPath = _path + ".mips";
+	const Level& last = _levels.back();
+	size_t mipSize = _levels.size() > 1 ? last.offset + static_cast<size_t>(last.tilesX) * last.tilesY * TILE_SIZE * TILE_SIZE * sizeof(uint16_t) : CACHE_DATA_OFFSET;
+	bool bLevel0Ready = _pngData.empty() || _bPngDecoded;
+	_bMipsBuilt = bLevel0Ready && FileExists(mipPath) && _mips.OpenRead(mipPath.c_str()) && IsCacheValid(_mips, MIP_CACHE_MAGIC, sourceBytes, width, height, mipSize);
+	if (_bMipsBuilt)
+	{
+		DemCacheHeader header;
+		std::memcpy(&header, _mips.Data(), sizeof(header));
+		_minElevation = header.minElevation;
+		_maxElevation = header.maxElevation;
+		return true;
+	}
+	return _mips.Create(mipPath.c_str(), mipSize);
+}
+
+/// <summary>
+/// Inflate the PNG into the raw cache one row at a time, undoing the row filters against the previous row only.
+/// </summary>
+bool DemPyramid::ConvertPng()
+{
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	const int width = _levels[0].width, height = _levels[0].height;
+	const size_t bytesPerSample = _pngBitDepth / 8;
+	const size_t rowBytes = width * bytesPerSample;
+	std::vector<unsigned char> row(rowBytes + 1), previous(rowBytes, 0);
+	size_t rowFill = 0;
+	int y = 0;
+	uint16_t* out = reinterpret_cast<uint16_t*>(_rawCache.MutableData() + CACHE_DATA_OFFSET);
+
+	auto Sink = [&](const unsigned char* data, size_t size) -> bool
+	{
+		while (size > 0)
+		{
+			if (y == height) return true; // Trailing bytes after the last row are ignored, as other decoders do
+			size_t take = std::min(size, row.size() - rowFill);
+			std::memcpy(row.data() + rowFill, data, take);
+			rowFill += take;
+			data += take;
+			size -= take;
+			if (rowFill < row.size()) break;
+
+			unsigned char* current = row.data() + 1;
+			for (size_t i = 0; i < rowBytes; ++i)
+			{
+				int left = i >= bytesPerSample ? current[i - bytesPerSample] : 0;
+				int up = previous[i];
+				int upLeft = i >= bytesPerSample ? previous[i - bytesPerSample] : 0;
+				int predictor = 0;
+				switch (row[0])
+				{
+				case 0: break;
+				case 1: predictor = left; break;
+				case 2: predictor = up; break;
+				case 3: predictor = (left + up) / 2; break;
+				case 4:
+				{
+					int estimate = left + up - upLeft;
+					int distanceLeft = std::abs(estimate - left), distanceUp = std::abs(estimate - up), distanceUpLeft = std::abs(estimate - upLeft);
+					predictor = distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft ? left : distanceUp <= distanceUpLeft ? up : upLeft;
+					break;
+				}
+				default: return false;
+				}
+				current[i] = static_cast<unsigned char>(current[i] + predictor);
+			}
+
+			uint16_t* outRow = out + static_cast<size_t>(y) * width;
+			for (int x = 0; x < width; ++x)
+				outRow[x] = bytesPerSample == 2 ? static_cast<uint16_t>((current[x * 2] << 8) | current[x * 2 + 1]) : static_cast<uint16_t>(current[x] * 257);
+			std::memcpy(previous.data(), current, rowBytes);
+			rowFill = 0;
+			++y;
+		}
+		return true;
+	};
+
+	Inflater<decltype(Sink)> inflater(_source.Data(), _pngData, Sink);
+	if (!inflater.Run() || y != height)
+	{
+		std::cerr << "ERROR: " << _path << " is corrupt (decoded " << y << " of " << height << " rows)" << std::endl;
+		return false;
+	}
+	WriteCacheHeader(_rawCache, RAW_CACHE_MAGIC, _source.Size(), width, height, 0, 0, true);
+	_rawCache.Flush();
+	return true;
+}
+
+JobHandle DemPyramid::ScheduleBuild(JobSystem& jobSystem)
+{
+	if (_bMipsBuilt)
+		return jobSystem.Schedule([] {});
+
+	std::vector<JobHandle> level0Ready;
+	if (!_bPngDecoded && !_pngData.empty())
+	{
+		level0Ready.push_back(jobSystem.Schedule([this]
+		{
+			auto start = std::chrono::steady_clock::now();
+			if (ConvertPng())
+				std::cout << "DEM decoded in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+		}));
+	}
+
+	// Each tile row only needs the two tile rows above it in the previous level
+	std::vector<JobHandle> allJobs = level0Ready;
+	std::vector<JobHandle> previousRows;
+	for (size_t level = 1; level < _levels.size(); ++level)
+	{
+		std::vector<JobHandle> rows;
+		for (int tileRow = 0; tileRow < _levels[level].tilesY; ++tileRow)
+		{
+			std::vector<JobHandle> dependencies = level0Ready;
+			if (level > 1)
+			{
+				dependencies.push_back(previousRows[tileRow * 2]);
+				if (tileRow * 2 + 1 < static_cast<int>(previousRows.size())) dependencies.push_back(previousRows[tileRow * 2 + 1]);
+			}
+			rows.push_back(jobSystem.Schedule([this, level, tileRow] { DownsampleTileRow(static_cast<int>(level), tileRow); }, dependencies));
+		}
+		allJobs.insert(allJobs.end(), rows.begin(), rows.end());
+		previousRows.swap(rows);
+	}
+
+	return jobSystem.Schedule([this]
+	{
+		// Levels 1 and up saw every level 0 sample while downsampling; a DEM that fits in one tile has no levels to build
+		if (_levels.size() == 1)
+		{
+			for (int y = 0; y < _levels[0].height; ++y)
+			{
+				for (int x = 0; x < _levels[0].width; ++x)
+				{
+					uint16_t elevation = Sample(0, x, y);
+					IncludeRange(elevation, elevation);
+				}
+			}
+		}
+		WriteCacheHeader(_mips, MIP_CACHE_MAGIC, _source.Size(), _levels[0].width, _levels[0].height, _minElevation, _maxElevation, true);
+		_mips.Flush();
+	}, allJobs);
+}
+
+void DemPyramid::IncludeRange(uint16_t minElevation, uint16_t maxElevation)
+{
+	std::lock_guard<std::mutex> lock(_rangeMutex);
+	_minElevation = std::min(_minElevation, minElevation);
+	_maxElevation = std::max(_maxElevation, maxElevation);
+}
+
+/// <summary>
+/// Box filter one row of tiles of a level from the level above it. The tiles' padding past the level's edge repeats the
+/// edge samples, so whole tiles can be copied without clamping.
+/// </summary>
+void DemPyramid::DownsampleTileRow(int level, int tileRow)
+{
+	const Level& destination = _levels[level];
+	const Level& source = _levels[level - 1];
+	uint16_t* tiles = reinterpret_cast<uint16_t*>(_mips.MutableData() + destination.offset);
+	uint16_t minElevation = 0xFFFF, maxElevation = 0;
+
+	for (int tileY = 0; tileY < TILE_SIZE; ++tileY)
+	{
+		const int y = std::min(tileRow * TILE_SIZE + tileY, destination.height - 1);
+		const int sourceY0 = y * 2, sourceY1 = std::min(y * 2 + 1, source.height - 1);
+		for (int tileX = 0; tileX < destination.tilesX; ++tileX)
+		{
+			uint16_t* out = tiles + (static_cast<size_t>(tileRow) * destination.tilesX + tileX) * TILE_SIZE * TILE_SIZE + static_cast<size_t>(tileY) * TILE_SIZE;
+			for (int i = 0; i < TILE_SIZE; ++i)
+			{
+				const int x = std::min(tileX * TILE_SIZE + i, destination.width - 1);
+				const int sourceX0 = x * 2, sourceX1 = std::min(x * 2 + 1, source.width - 1);
+				uint16_t a = Sample(level - 1, sourceX0, sourceY0), b = Sample(level - 1, sourceX1, sourceY0);
+				uint16_t c = Sample(level - 1, sourceX0, sourceY1), d = Sample(level - 1, sourceX1, sourceY1);
+				out[i] = static_cast<uint16_t>((a + b + c + d + 2) >> 2);
+				if (level == 1)
+				{
+					minElevation = std::min(minElevation, std::min(std::min(a, b), std::min(c, d)));
+					maxElevation = std::max(maxElevation, std::max(std::max(a, b), std::max(c, d)));
+				}
+			}
+		}
+	}
+	if (level == 1) IncludeRange(minElevation, maxElevation);
+}
+
+uint16_t DemPyramid::Sample(int level, int x, int y) const
+{
+	const Level& info = _levels[level];
+	x = std::max(0, std::min(x, info.width - 1));
+	y = std::max(0, std::min(y, info.height - 1));
+	if (_container.IsOpen())
+	{
+		if (level == _decodedLevelIndex)
+			return _decodedLevel[static_cast<size_t>(y) * info.width + x];
+		std::vector<uint16_t> tile(TILE_SIZE * TILE_SIZE);
+		_container.DecodeTile(level, x / TILE_SIZE, y / TILE_SIZE, tile.data());
+		return tile[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+	}
+	if (level > 0)
+	{
+		const uint16_t* tiles = reinterpret_cast<const uint16_t*>(_mips.Data() + info.offset);
+		size_t tile = static_cast<size_t>(y / TILE_SIZE) * info.tilesX + x / TILE_SIZE;
+		return tiles[tile * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+	}
+
+	size_t index = static_cast<size_t>(y) * info.width + x;
+	switch (_format)
+	{
+	case DemSampleFormat::U8: return static_cast<uint16_t>(_samples[index] * 257);
+	case DemSampleFormat::U16BE: return static_cast<uint16_t>((_samples[index * 2] << 8) | _samples[index * 2 + 1]);
+	default: return static_cast<uint16_t>(_samples[index * 2] | (_samples[index * 2 + 1] << 8));
+	}
+}
+
+void DemPyramid::ReadTile(int level, int tileX, int tileY, uint16_t* tile) const
+{
+	const Level& info = _levels[level];
+	if (_container.IsOpen())
+	{
+		_container.DecodeTile(level, tileX, tileY, tile);
+		return;
+	}
+	if (level > 0)
+	{
+		const uint16_t* tiles = reinterpret_cast<const uint16_t*>(_mips.Data() + info.offset);
+		std::memcpy(tile, tiles + (static_cast<size_t>(tileY) * info.tilesX + tileX) * TILE_SIZE * TILE_SIZE, TILE_SIZE * TILE_SIZE * sizeof(uint16_t));
+		return;
+	}
+	for (int y = 0; y < TILE_SIZE; ++y)
+		for (int x = 0; x < TILE_SIZE; ++x)
+			tile[y * TILE_SIZE + x] = Sample(0, tileX * TILE_SIZE + x, tileY * TILE_SIZE + y);
+}
+
+float DemPyramid::Bilinear(int level, float x, float y) const
+{
+	int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+	float fx = x - x0, fy = y - y0;
+	float top = Sample(level, x0, y0) * (1.0f - fx) + Sample(level, x0 + 1, y0) * fx;
+	float bottom = Sample(level, x0, y0 + 1) * (1.0f - fx) + Sample(level, x0 + 1, y0 + 1) * fx;
+	return top * (1.0f - fy) + bottom * fy;
+}
+
+JobHandle DemPyramid::ScheduleResample(JobSystem& jobSystem, int textureSize, std::vector<unsigned char>& heightMap, const std::vector<JobHandle>& dependencies)
+{
+	int level = 0;
+	while (level + 1 < LevelCount() && std::min(_levels[level + 1].width, _levels[level + 1].height) >= textureSize)
+		++level;
+
+	heightMap.resize(static_cast<size_t>(textureSize) * textureSize);
+	_resampleFailures = 0;
+	std::vector<JobHandle> bandDependencies = dependencies;
+	if (_container.IsOpen() && level != _decodedLevelIndex)
+	{
+		// Decompress the level once, a tile row per job, so the bilinear taps below are plain loads
+		const Level& info = _levels[level];
+		_decodedLevel.assign(static_cast<size_t>(info.width) * info.height, 0);
+		_decodedLevelIndex = level;
+		for (int tileY = 0; tileY < info.tilesY; ++tileY)
+		{
+			bandDependencies.push_back(jobSystem.Schedule([this, level, tileY]
+			{
+				MemoryScope memoryScope(MemorySubsystem::Terrain);
+				const Level& info = _levels[level];
+				std::vector<uint16_t> tile(TILE_SIZE * TILE_SIZE);
+				for (int tileX = 0; tileX < info.tilesX; ++tileX)
+				{
+					if (!_container.DecodeTile(level, tileX, tileY, tile.data()))
+					{
+						++_resampleFailures;
+						continue;
+					}
+					const int rows = std::min(TILE_SIZE, info.height - tileY * TILE_SIZE), columns = std::min(TILE_SIZE, info.width - tileX * TILE_SIZE);
+					for (int row = 0; row < rows; ++row)
+						std::memcpy(&_decodedLevel[static_cast<size_t>(tileY * TILE_SIZE + row) * info.width + tileX * TILE_SIZE], &tile[row * TILE_SIZE], columns * sizeof(uint16_t));
+				}
+			}, dependencies));
+		}
+	}
+
+	std::vector<JobHandle> bands = jobSystem.ScheduleRows(textureSize, RESAMPLE_BAND_ROWS, bandDependencies, [this, level, textureSize, &heightMap](int firstRow, int lastRow)
+	{
+		if (_resampleFailures)
+			return;
+		const Level& info = _levels[level];
+		const float side = static_cast<float>(std::min(info.width, info.height));
+		const float originX = (info.width - side) * 0.5f, originY = (info.height - side) * 0.5f;
+		const float step = side / textureSize;
+		const float range = std::max(1.0f, static_cast<float>(_maxElevation) - _minElevation);
+
+		for (int y = firstRow; y < lastRow; ++y)
+		{
+			// Texture rows go bottom-up, DEM rows top-down (as the diffuse textures are flipped on load)
+			unsigned char* out = &heightMap[static_cast<size_t>(textureSize - 1 - y) * textureSize];
+			float sourceY = originY + (y + 0.5f) * step - 0.5f;
+			for (int x = 0; x < textureSize; ++x)
+			{
+				float elevation = (Bilinear(level, originX + (x + 0.5f) * step - 0.5f, sourceY) - _minElevation) / range;
+				out[x] = static_cast<unsigned char>(255.0f - std::min(std::max(elevation, 0.0f), 1.0f) * 255.0f + 0.5f);
+			}
+		}
+	});
+	return jobSystem.Schedule([this, level]
+	{
+		if (!_resampleFailures)
+			return;
+		std::cerr << "ERROR: " << _path << " has " << _resampleFailures << " corrupt tiles in level " << level << ", the import failed" << std::endl;
+		_decodedLevelIndex = -1; // Half decoded, so decode it again next time
+	}, bands);
+}
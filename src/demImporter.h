@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "heightContainer.h"
+#include "jobSystem.h"
+#include "mappedFile.h"
+
+enum class DemSampleFormat : uint8_t
+{
+	U8, U16LE, U16BE
+};
+
+/// <summary>
+/// Layout of a headerless .raw/ .r16 file. A zero size means square, inferred from the file size.
+/// </summary>
+struct DemRawLayout
+{
+	int width;
+	int height;
+	DemSampleFormat format;
+
+	DemRawLayout() : width(0), height(0), format(DemSampleFormat::U16LE) {}
+};
+
+/// <summary>
+/// Real-world elevation data (a digital elevation model) imported from a raw, binary PGM or 16 bit greyscale PNG file, with a
+/// mip pyramid for tiled access at any resolution.
+/// Nothing is loaded into RAM: raw and PGM files are memory-mapped as they are, PNGs are inflated once, a row at a time, into
+/// a raw cache next to the source ([path].r16), which is then mapped. Mip levels 1 and up are box-filtered into a second
+/// mapped cache ([path].mips), stored in TILE_SIZE x TILE_SIZE tiles so a tile is one contiguous read, and kept for the next
+/// run. Building is a job graph: each tile row of a level only waits for the two tile rows of the level above it.
+/// A pyramid can be packed into a compressed height container (.thm, see heightContainer.h) with WriteContainer(), and .thm
+/// files open like any other DEM; their tiles are decoded on the workers for the level being resampled.
+/// </summary>
+class DemPyramid
+{
+public:
+	static const int TILE_SIZE = 256;
+
+	DemPyramid();
+
+	bool Open(const char* path, const DemRawLayout& rawLayout = DemRawLayout()); // Reads the header only
+	JobHandle ScheduleBuild(JobSystem& jobSystem);
+	bool WriteContainer(const char* path, JobSystem& jobSystem, int maxError = 0) const; // Once built
+
+	/// <summary>
+	/// Resample the largest centered square of the DEM to textureSize x textureSize, from the smallest mip level that still has
+	/// at least textureSize samples across, into heightMap in GenerateHeightMap()'s format (normalized, 0 at the highest point,
+	/// since the terrain shader treats the height map as depth). Runs in row bands on the workers after dependencies.
+	/// </summary>
+	JobHandle ScheduleResample(JobSystem& jobSystem, int textureSize, std::vector<unsigned char>& heightMap, const std::vector<JobHandle>& dependencies);
+	bool ResampleFailed() const { return _resampleFailures > 0; } // Corrupt .thm tiles, the height map is left unset. Valid once the resample has finished
+
+	int LevelCount() const { return static_cast<int>(_levels.size()); }
+	int LevelWidth(int level) const { return _levels[level].width; }
+	int LevelHeight(int level) const { return _levels[level].height; }
+	uint16_t Sample(int level, int x, int y) const; // Clamped to the level's edges. Decodes a whole tile for .thm levels not resampled yet
+	void ReadTile(int level, int tileX, int tileY, uint16_t* tile) const; // TILE_SIZE x TILE_SIZE samples, edges clamped
+	uint16_t MinElevation() const { return _minElevation; } // Valid once the build has finished
+	uint16_t MaxElevation() const { return _maxElevation; }
+
+private:
+	struct Level
+	{
+		int width, height;
+		int tilesX, tilesY;
+		size_t offset; // Into the mips cache, for levels 1 and up
+	};
+
+	bool OpenPng();
+	bool OpenPgm();
+	bool OpenRaw(const DemRawLayout& rawLayout);
+	bool OpenCaches();
+	bool OpenContainer();
+	bool ConvertPng();
+	float Bilinear(int level, float x, float y) const;
+	void DownsampleTileRow(int level, int tileRow);
+	void IncludeRange(uint16_t minElevation, uint16_t maxElevation);
+
+	std::string _path;
+	MappedFile _source;              // The DEM file itself
+	MappedFile _rawCache;            // PNGs only: the decoded samples
+	MappedFile _mips;                // Levels 1 and up, and the elevation range
+	const unsigned char* _samples;   // Level 0, row-major
+	DemSampleFormat _format;
+	std::vector<Level> _levels;
+	std::vector<std::pair<size_t, size_t>> _pngData; // Offset and size of each IDAT chunk, in order
+	int _pngBitDepth;
+	bool _bPngDecoded, _bMipsBuilt;  // Caches from an earlier run that are still valid
+	HeightContainer _container;      // .thm files: every level, compressed
+	std::vector<uint16_t> _decodedLevel; // .thm files: the level being resampled, row-major
+	int _decodedLevelIndex;
+	std::atomic<int> _resampleFailures; // .thm tiles that failed to decode in the last resample
+	uint16_t _minElevation, _maxElevation;
+	std::mutex _rangeMutex;
+};
@@ -0,0 +1,74 @@
+#include "frameArena.h"
+#include <cstdint>
+#include <iostream>
+
+LinearArena::LinearArena(size_t capacity) :
+	_memory(new char[capacity]),
+	_capacity(capacity),
+	_offset(0),
+	_highWaterMark(0),
+	_overflowBytes(0),
+	_overflowCount(0)
+{
+}
+
+void* LinearArena::Allocate(size_t size, size_t alignment)
+{
+	uintptr_t base = reinterpret_cast<uintptr_t>(_memory.get());
+	uintptr_t aligned = (base + _offset + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+	size_t newOffset = (aligned - base) + size;
+
+	if (newOffset <= _capacity)
+	{
+		_offset = newOffset;
+		if (Used() > _highWaterMark) _highWaterMark = Used();
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	// Out of room this frame: fall back to a heap block, and remember to grow on the next Reset()
+	_overflowBlocks.emplace_back(new char[size + alignment]);
+	_overflowBytes += size + alignment;
+	_overflowCount++;
+	if (Used() > _highWaterMark) _highWaterMark = Used();
+
+	uintptr_t block = reinterpret_cast<uintptr_t>(_overflowBlocks.back().get());
+	return reinterpret_cast<void*>((block + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1));
+}
+
+void LinearArena::Reset()
+{
+	if (!_overflowBlocks.empty())
+	{
+		// Grow with some headroom so the same workload fits next time
+		_capacity = _highWaterMark + _highWaterMark / 2;
+		_memory.reset(new char[_capacity]);
+		_overflowBlocks.clear();
+		_overflowBytes = 0;
+	}
+	_offset = 0;
+}
+
+FrameArena::FrameArena(size_t capacityPerFrame) : _current(0), _frameCount(0)
+{
+	_arenas[0].reset(new LinearArena(capacityPerFrame));
+	_arenas[1].reset(new LinearArena(capacityPerFrame));
+}
+
+void FrameArena::BeginFrame()
+{
+	_current = 1 - _current;
+	_arenas[_current]->Reset();
+	_frameCount++;
+}
+
+/// <summary>
+/// Print high-water marks and overflow counts for both arenas. An overflow count that keeps rising means the initial capacity is too small.
+/// </summary>
+void FrameArena::PrintStats() const
+{
+	for (unsigned int i = 0; i < 2; ++i)
+	{
+		std::cout << "Frame arena " << i << ": high-water mark " << _arenas[i]->HighWaterMark() / 1024.0 << " KB of "
+			<< _arenas[i]->Capacity() / 1024.0 << " KB, " << _arenas[i]->OverflowCount() << " overflow allocations over " << _frameCount << " frames" << std::endl;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/// <summary>
+/// Bump allocator: allocations are a pointer increment, and everything is released at once with Reset().
+/// If a frame needs more than the arena holds, the extra goes into overflow blocks and the arena grows to the
+/// high-water mark on the next Reset(), so after the first few frames a steady workload makes no heap allocations.
+/// Not thread-safe, each arena belongs to one thread.
+/// </summary>
+class LinearArena
+{
+public:
+	explicit LinearArena(size_t capacity);
+
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+	void Reset();
+
+	size_t Used() const { return _offset + _overflowBytes; }
+	size_t Capacity() const { return _capacity; }
+	size_t HighWaterMark() const { return _highWaterMark; }
+	unsigned int OverflowCount() const { return _overflowCount; } // Heap allocations made since construction because the arena was full
+
+private:
+	std::unique_ptr<char[]> _memory;
+	size_t _capacity;
+	size_t _offset;
+	size_t _highWaterMark;
+	size_t _overflowBytes;
+	unsigned int _overflowCount;
+	std::vector<std::unique_ptr<char[]>> _overflowBlocks;
+};
+
+/// <summary>
+/// STL-compatible allocator adaptor over a LinearArena. deallocate() is a no-op, memory comes back when the arena is reset,
+/// so containers using it must not outlive the arena's current frame.
+/// </summary>
+template <typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(LinearArena& arena) : _arena(&arena) {}
+	template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) : _arena(other._arena) {}
+
+	T* allocate(size_t count) { return static_cast<T*>(_arena->Allocate(count * sizeof(T), alignof(T))); }
+	void deallocate(T*, size_t) {}
+
+	template <typename U> bool operator==(const ArenaAllocator<U>& other) const { return _arena == other._arena; }
+	template <typename U> bool operator!=(const ArenaAllocator<U>& other) const { return _arena != other._arena; }
+
+private:
+	template <typename U> friend class ArenaAllocator;
+	LinearArena* _arena;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+/// <summary>
+/// Double-buffered per-frame arena. BeginFrame() switches to the other arena and resets it, so data built for the previous
+/// frame (e.g. still being consumed by the GPU or another thread) stays valid for one more frame.
+/// </summary>
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t capacityPerFrame);
+
+	void BeginFrame();
+	LinearArena& Current() { return *_arenas[_current]; }
+
+	template <typename T>
+	ArenaVector<T> MakeVector() { return ArenaVector<T>(ArenaAllocator<T>(Current())); }
+
+	void PrintStats() const;
+
+private:
+	std::unique_ptr<LinearArena> _arenas[2];
+	unsigned int _current;
+	unsigned long long _frameCount;
+};
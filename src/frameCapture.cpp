@@ -0,0 +1,255 @@
+#include "frameCapture.h"
+#include "memoryTracker.h"
+#include "yuvConvert.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <glad/glad.h>
+
+const GLuint64 FENCE_TIMEOUT = 1000000000; // 1 second, in nanoseconds. Only hit if the GPU has hung
+
+FrameCapture::FrameCapture(int width, int height, CaptureFormat format, const std::string& filePrefix, unsigned int ringSize, unsigned int workerCount) :
+	_width(width),
+	_height(height),
+	_frameBytes(static_cast<size_t>(width) * height * 4),
+	_format(format),
+	_filePrefix(filePrefix),
+	_ring(ringSize),
+	_ringHead(0),
+	_captureIndex(0),
+	_bScreenshotRequested(false),
+	_bContinuous(false),
+	_stallCount(0),
+	_droppedCount(0),
+	_framesInEncoder(0),
+	_maxFramesInEncoder(workerCount * 2),
+	_bShuttingDown(false),
+	_nextVideoSequence(0),
+	_videoWriteSequence(0),
+	_videoFrameCount(0)
+{
+	for (PendingReadback& readback : _ring)
+	{
+		glGenBuffers(1, &readback.pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, _frameBytes, nullptr, GL_STREAM_READ);
+		TrackGpuResource(GpuResourceType::Buffer, readback.pbo, _frameBytes, "capture PBO");
+		readback.fence = nullptr;
+		readback.frameIndex = 0;
+		readback.bInFlight = false;
+		readback.bToImage = false;
+		readback.bToVideo = false;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	for (unsigned int i = 0; i < workerCount; ++i)
+		_workers.emplace_back(&FrameCapture::WorkerLoop, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_bShuttingDown = true;
+	}
+	_workAvailable.notify_all();
+	for (std::thread& worker : _workers)
+		worker.join();
+}
+
+bool FrameCapture::OpenVideoStream(const std::string& path, int framesPerSecond)
+{
+	return _video.Open(path.c_str(), _width, _height, framesPerSecond);
+}
+
+/// <summary>
+/// Hand every finished read back to the encoders (oldest first, without blocking), then start this frame's read back if a capture was requested.
+/// </summary>
+void FrameCapture::EndFrame(unsigned int framebuffer)
+{
+	if (_ring.empty()) return; // Already shut down
+	for (size_t i = 0; i < _ring.size(); ++i)
+	{
+		PendingReadback& readback = _ring[(_ringHead + i) % _ring.size()];
+		if (!readback.bInFlight) continue;
+		GLenum status = glClientWaitSync(static_cast<GLsync>(readback.fence), 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break; // Later ones can't be done either
+		Collect(readback, false);
+	}
+
+	if (!_bContinuous && !_bScreenshotRequested) return;
+	bool bToVideo = _bContinuous && _video.IsOpen();
+	bool bToImage = _bScreenshotRequested || (_bContinuous && !bToVideo);
+	_bScreenshotRequested = false;
+
+	// The ring is full: the GPU is more than ringSize frames behind, so there's nothing to do but wait for the oldest one
+	PendingReadback& readback = _ring[_ringHead];
+	if (readback.bInFlight)
+	{
+		_stallCount++;
+		glClientWaitSync(static_cast<GLsync>(readback.fence), GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+		Collect(readback, false);
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+	glReadPixels(0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr); // Into the PBO, returns without waiting
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readback.frameIndex = _captureIndex++;
+	readback.bInFlight = true;
+	readback.bToImage = bToImage;
+	readback.bToVideo = bToVideo;
+	_ringHead = (_ringHead + 1) % _ring.size();
+}
+
+/// <summary>
+/// Copy a finished read back out of its PBO (flipping it upright) and queue it for encoding. If the encoders are too far
+/// behind an image frame is dropped, unless bWaitForEncoder is set. Video frames always wait, a gap in the stream would be worse.
+/// </summary>
+void FrameCapture::Collect(PendingReadback& readback, bool bWaitForEncoder)
+{
+	glDeleteSync(static_cast<GLsync>(readback.fence));
+	readback.fence = nullptr;
+	readback.bInFlight = false;
+
+	CapturedFrame frame;
+	frame.frameIndex = readback.frameIndex;
+	frame.videoSequence = 0;
+	frame.bToImage = readback.bToImage;
+	frame.bToVideo = readback.bToVideo;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (_framesInEncoder >= _maxFramesInEncoder)
+		{
+			if (!bWaitForEncoder && !frame.bToVideo)
+			{
+				_droppedCount++;
+				return;
+			}
+			if (!bWaitForEncoder)
+				_stallCount++;
+			_workDone.wait(lock, [this] { return _framesInEncoder < _maxFramesInEncoder; });
+		}
+		_framesInEncoder++;
+		if (frame.bToVideo)
+			frame.videoSequence = _nextVideoSequence++;
+		if (!_freeBuffers.empty())
+		{
+			frame.pixels.swap(_freeBuffers.back());
+			_freeBuffers.pop_back();
+		}
+	}
+	if (frame.pixels.empty())
+	{
+		MemoryScope memoryScope(MemorySubsystem::Capture);
+		frame.pixels.resize(_frameBytes);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+	const unsigned char* mapped = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, _frameBytes, GL_MAP_READ_BIT));
+	if (mapped)
+	{
+		const size_t rowBytes = static_cast<size_t>(_width) * 4;
+		for (int y = 0; y < _height; ++y)
+			std::memcpy(&frame.pixels[y * rowBytes], mapped + (_height - 1 - y) * rowBytes, rowBytes);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queue.push_back(std::move(frame));
+	}
+	_workAvailable.notify_one();
+}
+
+void FrameCapture::WorkerLoop()
+{
+	MemoryScope memoryScope(MemorySubsystem::Capture);
+	std::vector<unsigned char> yuv; // Per worker conversion buffer, sized on first use
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_workAvailable.wait(lock, [this] { return _bShuttingDown || !_queue.empty(); });
+		if (_queue.empty()) return; // Only when shutting down
+
+		CapturedFrame frame = std::move(_queue.front());
+		_queue.pop_front();
+		lock.unlock();
+		Encode(frame, yuv);
+		lock.lock();
+
+		_freeBuffers.push_back(std::move(frame.pixels));
+		_framesInEncoder--;
+		_workDone.notify_all();
+	}
+}
+
+void FrameCapture::Encode(const CapturedFrame& frame, std::vector<unsigned char>& yuv)
+{
+	if (frame.bToImage)
+	{
+		char name[64];
+		if (_format == CaptureFormat::Png)
+		{
+			std::snprintf(name, sizeof(name), "%05llu.png", frame.frameIndex);
+			WritePng((_filePrefix + name).c_str(), _width, _height, 4, frame.pixels.data());
+		}
+		else
+		{
+			std::snprintf(name, sizeof(name), "%05llu_%dx%d.rgba", frame.frameIndex, _width, _height);
+			WriteRaw((_filePrefix + name).c_str(), frame.pixels.data(), frame.pixels.size());
+		}
+	}
+
+	if (frame.bToVideo)
+	{
+		// Convert in parallel with the other workers, then wait for this frame's turn to be written
+		const size_t lumaBytes = static_cast<size_t>(_width) * _height;
+		const size_t chromaBytes = static_cast<size_t>((_width + 1) / 2) * ((_height + 1) / 2);
+		yuv.resize(lumaBytes + 2 * chromaBytes);
+		ConvertRgbaToYuv420(frame.pixels.data(), _width, _height, &yuv[0], &yuv[lumaBytes], &yuv[lumaBytes + chromaBytes]);
+
+		std::unique_lock<std::mutex> lock(_videoMutex);
+		_videoTurn.wait(lock, [this, &frame] { return _videoWriteSequence == frame.videoSequence; });
+		_video.WriteFrame(yuv.data(), yuv.size());
+		_videoWriteSequence++;
+		_videoFrameCount++;
+		lock.unlock();
+		_videoTurn.notify_all();
+	}
+}
+
+void FrameCapture::Shutdown()
+{
+	if (_ring.empty()) return;
+
+	// Finish everything that's already been read back, in order
+	for (size_t i = 0; i < _ring.size(); ++i)
+	{
+		PendingReadback& readback = _ring[(_ringHead + i) % _ring.size()];
+		if (!readback.bInFlight) continue;
+		glClientWaitSync(static_cast<GLsync>(readback.fence), GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+		Collect(readback, true);
+	}
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_workDone.wait(lock, [this] { return _framesInEncoder == 0; });
+	}
+
+	for (PendingReadback& readback : _ring)
+	{
+		UntrackGpuResource(GpuResourceType::Buffer, readback.pbo);
+		glDeleteBuffers(1, &readback.pbo);
+	}
+	_ring.clear();
+
+	if (_video.IsOpen())
+	{
+		_video.Close();
+		std::cout << "Wrote " << _videoFrameCount << " frames to the video stream" << std::endl;
+	}
+	if (_captureIndex > 0)
+		std::cout << "Captured " << _captureIndex << " frames (" << _stallCount << " stalls waiting on the GPU or encoders, " << _droppedCount << " dropped by the encoders)" << std::endl;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "imageWriter.h"
+
+enum class CaptureFormat : uint8_t
+{
+	Png, Raw
+};
+
+/// <summary>
+/// Asynchronous frame capture. The framebuffer is read into one of a ring of pixel buffer objects with a fence behind it,
+/// so glReadPixels returns immediately, and the buffer is only mapped once its fence has signalled, normally a couple of
+/// frames later. The pixels are then copied out and encoded/ written by worker threads, keeping the render thread free of
+/// both the GPU stall and the file I/O. All GL calls happen in EndFrame()/ Shutdown(), on the context thread.
+/// With a video stream open, continuous capture goes to a Y4M stream instead of image files: each worker converts whole
+/// frames to YUV in parallel, and the frames are then written strictly in capture order.
+/// </summary>
+class FrameCapture
+{
+public:
+	FrameCapture(int width, int height, CaptureFormat format = CaptureFormat::Png, const std::string& filePrefix = "capture_",
+		unsigned int ringSize = 3, unsigned int workerCount = 2);
+	~FrameCapture();
+
+	void RequestScreenshot() { _bScreenshotRequested = true; }
+	void SetContinuous(bool bContinuous) { _bContinuous = bContinuous; }
+	bool IsContinuous() const { return _bContinuous; }
+	bool OpenVideoStream(const std::string& path, int framesPerSecond); // "-" streams to stdout
+
+	void EndFrame(unsigned int framebuffer = 0); // Call after the final pass has been drawn, before swapping
+	void Shutdown();  // Drains outstanding read backs and encodes, and releases the PBOs (needs the GL context)
+
+	unsigned int StallCount() const { return _stallCount; }     // Frames where the ring was full and we had to wait on the GPU (or on the encoders, for video)
+	unsigned int DroppedCount() const { return _droppedCount; } // Image frames dropped because the encoders fell too far behind (video frames wait instead)
+
+private:
+	struct PendingReadback
+	{
+		unsigned int pbo;
+		void* fence;           // GLsync
+		unsigned long long frameIndex;
+		bool bInFlight;
+		bool bToImage;
+		bool bToVideo;
+	};
+
+	struct CapturedFrame
+	{
+		unsigned long long frameIndex;
+		unsigned long long videoSequence; // Position in the video stream, frames are written in this order
+		bool bToImage;
+		bool bToVideo;
+		std::vector<unsigned char> pixels;
+	};
+
+	void Collect(PendingReadback& readback, bool bWaitForEncoder);
+	void WorkerLoop();
+	void Encode(const CapturedFrame& frame, std::vector<unsigned char>& yuv);
+
+	int _width, _height;
+	size_t _frameBytes;
+	CaptureFormat _format;
+	std::string _filePrefix;
+	std::vector<PendingReadback> _ring;
+	unsigned int _ringHead; // Next slot to read into, also the oldest in-flight slot once the ring wraps
+	unsigned long long _captureIndex;
+	bool _bScreenshotRequested;
+	bool _bContinuous;
+	unsigned int _stallCount;
+	unsigned int _droppedCount;
+
+	// --- Encoder side, guarded by _mutex. Pixel buffers are recycled through _freeBuffers, so steady capture doesn't allocate.
+	std::vector<std::thread> _workers;
+	std::deque<CapturedFrame> _queue;
+	std::vector<std::vector<unsigned char>> _freeBuffers;
+	unsigned int _framesInEncoder; // Queued + being encoded
+	unsigned int _maxFramesInEncoder;
+	std::mutex _mutex;
+	std::condition_variable _workAvailable;
+	std::condition_variable _workDone;
+	bool _bShuttingDown;
+
+	// --- Video stream, written by whichever worker holds the next frame in sequence
+	Y4mWriter _video;
+	unsigned long long _nextVideoSequence;  // Next sequence number to hand out (render thread)
+	unsigned long long _videoWriteSequence; // Next sequence number to write, guarded by _videoMutex
+	unsigned long long _videoFrameCount;
+	std::mutex _videoMutex;
+	std::condition_variable _videoTurn;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+/// <summary>
+/// A view frustum as six planes pointing inwards (left, right, bottom, top, near, far), for culling bounding boxes on the CPU.
+/// </summary>
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	/// <summary>
+	/// The planes straight from the rows of a projection * view matrix (Gribb/ Hartmann), in the space the matrix maps from.
+	/// </summary>
+	static Frustum FromViewProjection(const glm::mat4& viewProjection)
+	{
+		Frustum frustum;
+		const glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+		for (int i = 0; i < 3; ++i)
+		{
+			glm::vec4 row(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+			frustum.planes[2 * i] = w + row;
+			frustum.planes[2 * i + 1] = w - row;
+		}
+		return frustum;
+	}
+
+	/// <summary>
+	/// False only if the box is entirely behind one of the planes. Conservative: a box near a corner of the frustum can pass
+	/// without being inside.
+	/// </summary>
+	bool IntersectsBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const
+	{
+		for (const glm::vec4& plane : planes)
+		{
+			// The box's corner furthest along the plane's normal
+			glm::vec3 farthest(plane.x >= 0.0f ? boundsMax.x : boundsMin.x, plane.y >= 0.0f ? boundsMax.y : boundsMin.y, plane.z >= 0.0f ? boundsMax.z : boundsMin.z);
+			if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,551 @@
+#include "heightContainer.h"
+#include "memoryTracker.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEIGHT_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// The file is a header, the level table, the tile index (level by level, row-major), then the tile payloads.
+// All fields are little-endian.
+struct ContainerHeader
+{
+	char magic[8];
+	uint32_t levelCount;
+	uint32_t tileSize;
+	uint16_t minElevation, maxElevation;
+	uint32_t reserved;
+};
+
+struct ContainerLevel
+{
+	uint32_t width, height, tilesX, tilesY;
+	uint64_t firstTile;
+};
+
+struct ContainerTile
+{
+	uint64_t offset; // Of the payload, 0 for constant tiles
+	uint32_t size;
+	uint16_t minElevation, maxElevation;
+	uint16_t step;   // Quantization: samples are stored as round((height - min) / step)
+	uint8_t reserved[6];
+};
+
+const char CONTAINER_MAGIC[8] = { 'T', 'H', 'M', 'A', 'P', 0, 0, 1 };
+const int TILE_SAMPLES = HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE;
+
+// rANS with byte-wise renormalization (as in Fabian Giesen's ryg_rans), four interleaved states
+const int RANS_SCALE_BITS = 12;
+const uint32_t RANS_SCALE = 1u << RANS_SCALE_BITS;
+const uint32_t RANS_LOW = 1u << 23;
+const int RANS_STATES = 4;
+const int ESCAPE_SYMBOL = 255; // Residuals that don't fit in a byte are sent raw in the escape list
+
+// ------------------------------------ Encoding ------------------------------------------------------------------
+static inline uint16_t ZigZag(uint16_t residual)
+{
+	int16_t value = static_cast<int16_t>(residual);
+	return static_cast<uint16_t>((value << 1) ^ (value >> 15));
+}
+
+/// <summary>
+/// Scale the histogram to frequencies summing to RANS_SCALE, keeping every used symbol at 1 or more.
+/// </summary>
+static void NormalizeFrequencies(const uint32_t* counts, uint32_t total, uint32_t* frequencies)
+{
+	uint32_t sum = 0;
+	for (int symbol = 0; symbol < 256; ++symbol)
+	{
+		frequencies[symbol] = counts[symbol] ? std::max(1u, static_cast<uint32_t>(static_cast<uint64_t>(counts[symbol]) * RANS_SCALE / total)) : 0;
+		sum += frequencies[symbol];
+	}
+	while (sum != RANS_SCALE)
+	{
+		// Rounding error goes to/ comes from the most frequent symbol, where it costs the least
+		int largest = static_cast<int>(std::max_element(frequencies, frequencies + 256) - frequencies);
+		if (sum < RANS_SCALE)
+		{
+			frequencies[largest] += RANS_SCALE - sum;
+			sum = RANS_SCALE;
+		}
+		else
+		{
+			uint32_t take = std::min(sum - RANS_SCALE, frequencies[largest] - 1);
+			frequencies[largest] -= take;
+			sum -= take;
+		}
+	}
+}
+
+static void PutBytes(std::vector<unsigned char>& out, uint32_t value, int count)
+{
+	for (int i = 0; i < count; ++i)
+		out.push_back(static_cast<unsigned char>(value >> (i * 8)));
+}
+
+static void EncodeTile(const uint16_t* tile, int maxError, ContainerTile& entry, std::vector<unsigned char>& payload)
+{
+	uint16_t minElevation = *std::min_element(tile, tile + TILE_SAMPLES);
+	uint16_t maxElevation = *std::max_element(tile, tile + TILE_SAMPLES);
+	std::memset(&entry, 0, sizeof(entry));
+	entry.minElevation = minElevation;
+	entry.maxElevation = maxElevation;
+	if (minElevation == maxElevation) return; // Flat, nothing else to store
+
+	// Quantize: a step of 2 * maxError + 1 rounded to nearest keeps the error within maxError, and if every sample is a
+	// multiple of a larger step apart (8 bit data scaled to 16 bits, say) that step is lossless. Clamping so q * step fits
+	// in 16 bits can add to the error right at the top of a full 16 bit range.
+	int step = 0;
+	for (int i = 0; i < TILE_SAMPLES && step != 1; ++i)
+	{
+		int a = step, b = tile[i] - minElevation;
+		while (b) { int t = a % b; a = b; b = t; } // gcd
+		step = a;
+	}
+	step = std::max(step, std::min(2 * maxError + 1, 0xFFFF));
+	entry.step = static_cast<uint16_t>(step);
+	const int half = step / 2;
+	const int maxQuantized = 0xFFFF / step;
+
+	// Gradient predictor: residual = q - (left + up - upLeft), i.e. the horizontal difference of the vertical differences
+	std::vector<uint16_t> symbols(TILE_SAMPLES);
+	std::vector<uint16_t> escapes;
+	std::vector<uint16_t> previous(HEIGHT_TILE_SIZE, 0), current(HEIGHT_TILE_SIZE);
+	uint32_t counts[256] = {};
+	for (int y = 0; y < HEIGHT_TILE_SIZE; ++y)
+	{
+		uint16_t previousDelta = 0;
+		for (int x = 0; x < HEIGHT_TILE_SIZE; ++x)
+		{
+			current[x] = static_cast<uint16_t>(std::min((tile[y * HEIGHT_TILE_SIZE + x] - minElevation + half) / step, maxQuantized));
+			uint16_t delta = static_cast<uint16_t>(current[x] - previous[x]);
+			uint16_t zigZag = ZigZag(static_cast<uint16_t>(delta - previousDelta));
+			previousDelta = delta;
+
+			uint16_t symbol = zigZag < ESCAPE_SYMBOL ? zigZag : static_cast<uint16_t>(ESCAPE_SYMBOL);
+			if (symbol == ESCAPE_SYMBOL) escapes.push_back(zigZag);
+			symbols[y * HEIGHT_TILE_SIZE + x] = symbol;
+			++counts[symbol];
+		}
+		previous.swap(current);
+	}
+
+	uint32_t frequencies[256], starts[256];
+	NormalizeFrequencies(counts, TILE_SAMPLES, frequencies);
+	for (int symbol = 0, start = 0; symbol < 256; ++symbol)
+	{
+		starts[symbol] = start;
+		start += frequencies[symbol];
+	}
+
+	// rANS codes backwards, into the end of a buffer that can hold the worst case (2 bytes per symbol at 12 bit precision)
+	std::vector<unsigned char> stream(TILE_SAMPLES * 2 + RANS_STATES * 4);
+	unsigned char* end = stream.data() + stream.size();
+	unsigned char* cursor = end;
+	uint32_t states[RANS_STATES] = { RANS_LOW, RANS_LOW, RANS_LOW, RANS_LOW };
+	for (int i = TILE_SAMPLES - 1; i >= 0; --i)
+	{
+		uint32_t& state = states[i & (RANS_STATES - 1)];
+		uint32_t frequency = frequencies[symbols[i]];
+		uint32_t stateMax = ((RANS_LOW >> RANS_SCALE_BITS) << 8) * frequency;
+		while (state >= stateMax)
+		{
+			*--cursor = static_cast<unsigned char>(state);
+			state >>= 8;
+		}
+		state = ((state / frequency) << RANS_SCALE_BITS) + (state % frequency) + starts[symbols[i]];
+	}
+	for (int i = RANS_STATES - 1; i >= 0; --i)
+	{
+		cursor -= 4;
+		for (int byte = 0; byte < 4; ++byte)
+			cursor[byte] = static_cast<unsigned char>(states[i] >> (byte * 8));
+	}
+
+	// Payload: symbol table, escapes, rANS stream
+	int usedSymbols = static_cast<int>(std::count_if(frequencies, frequencies + 256, [](uint32_t frequency) { return frequency != 0; }));
+	PutBytes(payload, usedSymbols, 2);
+	for (int symbol = 0; symbol < 256; ++symbol)
+	{
+		if (!frequencies[symbol]) continue;
+		payload.push_back(static_cast<unsigned char>(symbol));
+		PutBytes(payload, frequencies[symbol], 2);
+	}
+	PutBytes(payload, static_cast<uint32_t>(escapes.size()), 4);
+	for (uint16_t escape : escapes)
+		PutBytes(payload, escape, 2);
+	payload.insert(payload.end(), cursor, end);
+}
+
+bool WriteHeightContainer(const char* path, const std::vector<HeightLevelSize>& levels, uint16_t minElevation, uint16_t maxElevation,
+	const ReadHeightTileFunction& readTile, JobSystem& jobSystem, int maxError)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "ERROR: Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+
+	ContainerHeader header;
+	std::memcpy(header.magic, CONTAINER_MAGIC, sizeof(header.magic));
+	header.levelCount = static_cast<uint32_t>(levels.size());
+	header.tileSize = HEIGHT_TILE_SIZE;
+	header.minElevation = minElevation;
+	header.maxElevation = maxElevation;
+	header.reserved = 0;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::vector<ContainerLevel> levelTable(levels.size());
+	uint64_t tileCount = 0;
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		levelTable[i].width = levels[i].width;
+		levelTable[i].height = levels[i].height;
+		levelTable[i].tilesX = (levels[i].width + HEIGHT_TILE_SIZE - 1) / HEIGHT_TILE_SIZE;
+		levelTable[i].tilesY = (levels[i].height + HEIGHT_TILE_SIZE - 1) / HEIGHT_TILE_SIZE;
+		levelTable[i].firstTile = tileCount;
+		tileCount += static_cast<uint64_t>(levelTable[i].tilesX) * levelTable[i].tilesY;
+	}
+	file.write(reinterpret_cast<const char*>(levelTable.data()), levelTable.size() * sizeof(ContainerLevel));
+
+	// The index is filled in as the payloads are written and rewritten at the end
+	const std::streamoff indexStart = file.tellp();
+	std::vector<ContainerTile> index(static_cast<size_t>(tileCount));
+	file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(ContainerTile));
+
+	// One job per tile row, its payloads written back to back
+	struct TileRow
+	{
+		size_t firstTile;
+		std::vector<ContainerTile> entries;
+		std::vector<std::vector<unsigned char>> payloads;
+	};
+	uint64_t payloadBytes = 0;
+	OrderedRowWriter<TileRow> writer(jobSystem, [&](TileRow& row)
+	{
+		for (size_t i = 0; i < row.entries.size(); ++i)
+		{
+			ContainerTile& entry = row.entries[i];
+			entry.offset = row.payloads[i].empty() ? 0 : static_cast<uint64_t>(file.tellp());
+			entry.size = static_cast<uint32_t>(row.payloads[i].size());
+			file.write(reinterpret_cast<const char*>(row.payloads[i].data()), row.payloads[i].size());
+			index[row.firstTile + i] = entry;
+			payloadBytes += entry.size;
+		}
+	});
+
+	for (size_t level = 0; level < levels.size(); ++level)
+	{
+		const ContainerLevel& info = levelTable[level];
+		for (uint32_t tileY = 0; tileY < info.tilesY; ++tileY)
+		{
+			std::shared_ptr<TileRow> tileRow = std::make_shared<TileRow>();
+			tileRow->firstTile = static_cast<size_t>(info.firstTile + static_cast<uint64_t>(tileY) * info.tilesX);
+			tileRow->entries.resize(info.tilesX);
+			tileRow->payloads.resize(info.tilesX);
+			writer.Add(tileRow, [&readTile, level, tileY, maxError](TileRow& row)
+			{
+				MemoryScope memoryScope(MemorySubsystem::Terrain);
+				std::vector<uint16_t> tile(TILE_SAMPLES);
+				for (size_t tileX = 0; tileX < row.entries.size(); ++tileX)
+				{
+					readTile(static_cast<int>(level), static_cast<int>(tileX), static_cast<int>(tileY), tile.data());
+					EncodeTile(tile.data(), maxError, row.entries[tileX], row.payloads[tileX]);
+				}
+			});
+		}
+	}
+	writer.Flush();
+
+	file.seekp(indexStart);
+	file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(ContainerTile));
+	if (!file)
+	{
+		std::cerr << "ERROR: Failed writing " << path << std::endl;
+		return false;
+	}
+	std::cout << "Height container " << path << ": " << tileCount << " tiles, " << payloadBytes / (1024.0 * 1024.0) << " MB of tile data" << std::endl;
+	return true;
+}
+
+// ------------------------------------ Decoding ------------------------------------------------------------------
+static inline uint32_t GetBytes(const unsigned char* bytes, int count)
+{
+	uint32_t value = 0;
+	for (int i = 0; i < count; ++i)
+		value |= static_cast<uint32_t>(bytes[i]) << (i * 8);
+	return value;
+}
+
+/// <summary>
+/// Undo the prediction for one row: unzigzag the residuals, prefix-sum them along the row (giving the vertical differences),
+/// add the row above, then dequantize. quantized holds the row above on entry and this row on exit.
+/// </summary>
+static void ReconstructRow(const uint16_t* zigZags, uint16_t* quantized, uint16_t minElevation, uint16_t range, uint16_t step, uint16_t* out)
+{
+	int x = 0;
+#ifdef HEIGHT_USE_SSE2
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i minimum = _mm_set1_epi16(static_cast<short>(minElevation));
+	const __m128i maximumOffset = _mm_set1_epi16(static_cast<short>(range));
+	const __m128i stepSize = _mm_set1_epi16(static_cast<short>(step));
+	__m128i carry = _mm_setzero_si128(); // Running sum so far, in every lane
+	for (; x + 8 <= HEIGHT_TILE_SIZE; x += 8)
+	{
+		__m128i zigZag = _mm_loadu_si128(reinterpret_cast<const __m128i*>(zigZags + x));
+		__m128i residual = _mm_xor_si128(_mm_srli_epi16(zigZag, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(zigZag, one)));
+
+		// Inclusive prefix sum across the 8 lanes in three shifted adds
+		residual = _mm_add_epi16(residual, _mm_slli_si128(residual, 2));
+		residual = _mm_add_epi16(residual, _mm_slli_si128(residual, 4));
+		residual = _mm_add_epi16(residual, _mm_slli_si128(residual, 8));
+		__m128i delta = _mm_add_epi16(residual, carry);
+		carry = _mm_shufflehi_epi16(delta, 0xFF);
+		carry = _mm_unpackhi_epi64(carry, carry);
+
+		__m128i value = _mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(quantized + x)), delta);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(quantized + x), value);
+
+		// min(q * step, range) + min, with the unsigned minimum built from saturating subtracts
+		__m128i offset = _mm_mullo_epi16(value, stepSize);
+		offset = _mm_sub_epi16(offset, _mm_subs_epu16(offset, maximumOffset));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_add_epi16(offset, minimum));
+	}
+	uint16_t delta = static_cast<uint16_t>(_mm_cvtsi128_si32(carry));
+#else
+	uint16_t delta = 0;
+#endif
+	for (; x < HEIGHT_TILE_SIZE; ++x)
+	{
+		uint16_t zigZag = zigZags[x];
+		delta = static_cast<uint16_t>(delta + ((zigZag >> 1) ^ (0u - (zigZag & 1u))));
+		quantized[x] = static_cast<uint16_t>(quantized[x] + delta);
+		uint32_t offset = std::min<uint32_t>(static_cast<uint16_t>(quantized[x] * step), range);
+		out[x] = static_cast<uint16_t>(minElevation + offset);
+	}
+}
+
+/// <summary>
+/// Widen one row of byte symbols to 16 bits, replacing escape symbols with the next raw value from the escape list.
+/// </summary>
+static bool ExpandSymbols(const unsigned char* symbols, const unsigned char*& escapes, const unsigned char* escapesEnd, uint16_t* zigZags)
+{
+	int x = 0;
+#ifdef HEIGHT_USE_SSE2
+	const __m128i escapeSymbol = _mm_set1_epi8(static_cast<char>(ESCAPE_SYMBOL));
+	for (; x + 16 <= HEIGHT_TILE_SIZE; x += 16)
+	{
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(symbols + x));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, escapeSymbol)))
+			break; // Rare, finish the row on the scalar path
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(zigZags + x), _mm_unpacklo_epi8(bytes, _mm_setzero_si128()));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(zigZags + x + 8), _mm_unpackhi_epi8(bytes, _mm_setzero_si128()));
+	}
+#endif
+	for (; x < HEIGHT_TILE_SIZE; ++x)
+	{
+		if (symbols[x] != ESCAPE_SYMBOL)
+		{
+			zigZags[x] = symbols[x];
+			continue;
+		}
+		if (escapes + 2 > escapesEnd) return false;
+		zigZags[x] = static_cast<uint16_t>(GetBytes(escapes, 2));
+		escapes += 2;
+	}
+	return true;
+}
+
+bool HeightContainer::Open(const char* path)
+{
+	if (!_file.OpenRead(path)) return false;
+	ContainerHeader header;
+	if (_file.Size() < sizeof(header)) return false;
+	std::memcpy(&header, _file.Data(), sizeof(header));
+	if (std::memcmp(header.magic, CONTAINER_MAGIC, sizeof(header.magic)) != 0 || header.tileSize != HEIGHT_TILE_SIZE ||
+		sizeof(header) + header.levelCount * sizeof(ContainerLevel) > _file.Size())
+	{
+		std::cerr << "ERROR: " << path << " is not a height container" << std::endl;
+		_file.Close();
+		return false;
+	}
+	_minElevation = header.minElevation;
+	_maxElevation = header.maxElevation;
+
+	_levels.clear();
+	size_t tileCount = 0;
+	for (uint32_t i = 0; i < header.levelCount; ++i)
+	{
+		ContainerLevel info;
+		std::memcpy(&info, _file.Data() + sizeof(header) + i * sizeof(ContainerLevel), sizeof(info));
+		Level level = { static_cast<int>(info.width), static_cast<int>(info.height), static_cast<int>(info.tilesX), static_cast<int>(info.tilesY), static_cast<size_t>(info.firstTile) };
+		_levels.push_back(level);
+		tileCount += static_cast<size_t>(info.tilesX) * info.tilesY;
+	}
+	if (sizeof(header) + header.levelCount * sizeof(ContainerLevel) + tileCount * sizeof(ContainerTile) > _file.Size())
+	{
+		std::cerr << "ERROR: " << path << " is truncated" << std::endl;
+		_file.Close();
+		return false;
+	}
+	return true;
+}
+
+const unsigned char* HeightContainer::TileEntry(int level, int tileX, int tileY) const
+{
+	size_t index = _levels[level].firstTile + static_cast<size_t>(tileY) * _levels[level].tilesX + tileX;
+	return _file.Data() + sizeof(ContainerHeader) + _levels.size() * sizeof(ContainerLevel) + index * sizeof(ContainerTile);
+}
+
+uint16_t HeightContainer::TileMinElevation(int level, int tileX, int tileY) const
+{
+	ContainerTile entry;
+	std::memcpy(&entry, TileEntry(level, tileX, tileY), sizeof(entry));
+	return entry.minElevation;
+}
+
+uint16_t HeightContainer::TileMaxElevation(int level, int tileX, int tileY) const
+{
+	ContainerTile entry;
+	std::memcpy(&entry, TileEntry(level, tileX, tileY), sizeof(entry));
+	return entry.maxElevation;
+}
+
+size_t HeightContainer::TileBytes(int level, int tileX, int tileY) const
+{
+	ContainerTile entry;
+	std::memcpy(&entry, TileEntry(level, tileX, tileY), sizeof(entry));
+	return entry.size;
+}
+
+bool HeightContainer::DecodeTile(int level, int tileX, int tileY, uint16_t* tile) const
+{
+	ContainerTile entry;
+	std::memcpy(&entry, TileEntry(level, tileX, tileY), sizeof(entry));
+	if (entry.minElevation == entry.maxElevation || entry.size == 0 || entry.step == 0)
+	{
+		std::fill(tile, tile + TILE_SAMPLES, entry.minElevation);
+		return true;
+	}
+	if (entry.offset + entry.size > _file.Size()) return false;
+	const unsigned char* data = _file.Data() + entry.offset;
+	const unsigned char* end = data + entry.size;
+
+	// Slot table: for each of the RANS_SCALE slots its symbol, frequency - 1 and position within the symbol's range
+	uint32_t slots[RANS_SCALE];
+	int usedSymbols = static_cast<int>(GetBytes(data, 2));
+	data += 2;
+	uint32_t start = 0;
+	for (int i = 0; i < usedSymbols; ++i)
+	{
+		if (data + 3 > end) return false;
+		uint32_t symbol = data[0], frequency = GetBytes(data + 1, 2);
+		data += 3;
+		if (frequency == 0 || start + frequency > RANS_SCALE) return false;
+		for (uint32_t slot = 0; slot < frequency; ++slot)
+			slots[start + slot] = symbol | ((frequency - 1) << 8) | (slot << 20);
+		start += frequency;
+	}
+	if (start != RANS_SCALE || data + 4 > end) return false;
+	uint32_t escapeCount = GetBytes(data, 4);
+	data += 4;
+	const unsigned char* escapes = data;
+	data += static_cast<size_t>(escapeCount) * 2;
+	if (data + RANS_STATES * 4 > end) return false;
+
+	uint32_t states[RANS_STATES];
+	for (int i = 0; i < RANS_STATES; ++i, data += 4)
+		states[i] = GetBytes(data, 4);
+
+	// Entropy decode a row of symbols at a time and reconstruct it straight away, while it's in cache
+	unsigned char symbols[HEIGHT_TILE_SIZE];
+	uint16_t zigZags[HEIGHT_TILE_SIZE];
+	uint16_t quantized[HEIGHT_TILE_SIZE] = {};
+	const uint16_t range = static_cast<uint16_t>(entry.maxElevation - entry.minElevation);
+	for (int y = 0; y < HEIGHT_TILE_SIZE; ++y)
+	{
+		// A symbol takes at most two bytes to renormalize. While a whole row's worth is left, do both steps without
+		// branches (the renormalization is taken about half the time, so a branch would mispredict constantly)
+		const bool bBoundsFree = end - data >= HEIGHT_TILE_SIZE * 2;
+		for (int x = 0; x < HEIGHT_TILE_SIZE; x += RANS_STATES)
+		{
+			for (int i = 0; i < RANS_STATES; ++i)
+			{
+				uint32_t slot = slots[states[i] & (RANS_SCALE - 1)];
+				symbols[x + i] = static_cast<unsigned char>(slot);
+				uint32_t state = (((slot >> 8) & 0xFFF) + 1) * (states[i] >> RANS_SCALE_BITS) + (slot >> 20);
+				if (bBoundsFree)
+				{
+					uint32_t renormalize = state < RANS_LOW;
+					state = renormalize ? (state << 8) | data[0] : state;
+					data += renormalize;
+					renormalize = state < RANS_LOW;
+					state = renormalize ? (state << 8) | data[0] : state;
+					data += renormalize;
+				}
+				else
+				{
+					while (state < RANS_LOW && data < end)
+						state = (state << 8) | *data++;
+				}
+				states[i] = state;
+			}
+		}
+		if (!ExpandSymbols(symbols, escapes, escapes + static_cast<size_t>(escapeCount) * 2, zigZags)) return false;
+		ReconstructRow(zigZags, quantized, entry.minElevation, range, entry.step, tile + y * HEIGHT_TILE_SIZE);
+	}
+	return true;
+}
+
+void BenchmarkHeightContainer(const char* path, JobSystem& jobSystem)
+{
+	HeightContainer container;
+	if (!container.Open(path)) return;
+
+	// Touch the whole file first so the timing is of the decoder, not the disk
+	std::ifstream(path, std::ios::binary).ignore(std::numeric_limits<std::streamsize>::max());
+
+	std::atomic<uint64_t> samples(0), compressedBytes(0);
+	std::atomic<int> failures(0);
+	auto start = std::chrono::steady_clock::now();
+	for (int level = 0; level < container.LevelCount(); ++level)
+	{
+		for (int tileY = 0; tileY < container.TilesY(level); ++tileY)
+		{
+			jobSystem.Schedule([&, level, tileY]
+			{
+				std::vector<uint16_t> tile(TILE_SAMPLES);
+				for (int tileX = 0; tileX < container.TilesX(level); ++tileX)
+				{
+					if (!container.DecodeTile(level, tileX, tileY, tile.data())) ++failures;
+					samples += TILE_SAMPLES;
+					compressedBytes += container.TileBytes(level, tileX, tileY);
+				}
+			});
+		}
+	}
+	jobSystem.WaitAll();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint64_t levelSamples = 0;
+	for (int level = 0; level < container.LevelCount(); ++level)
+		levelSamples += static_cast<uint64_t>(container.LevelWidth(level)) * container.LevelHeight(level);
+	const double MB = 1024.0 * 1024.0;
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	double fileMB = static_cast<double>(file.tellg()) / MB;
+	std::cout << "Height container: " << fileMB << " MB on disk vs " << levelSamples * 4 / MB << " MB as float ("
+		<< levelSamples * 4 / MB / fileMB << "x) and " << levelSamples * 2 / MB << " MB as 16 bit (" << levelSamples * 2 / MB / fileMB << "x)" << std::endl;
+	std::cout << "Height container: decoded " << samples / 1e6 << " M samples in " << seconds * 1000.0 << " ms on " << jobSystem.WorkerCount()
+		<< " workers, " << compressedBytes / MB / seconds << " MB/s compressed in, " << samples * 2 / MB / seconds << " MB/s out"
+		<< (failures ? ", CORRUPT TILES" : "") << std::endl;
+}
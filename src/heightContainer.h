@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "jobSystem.h"
+#include "mappedFile.h"
+
+const int HEIGHT_TILE_SIZE = 256;
+
+struct HeightLevelSize
+{
+	int width, height;
+};
+
+typedef std::function<void(int level, int tileX, int tileY, uint16_t* tile)> ReadHeightTileFunction; // HEIGHT_TILE_SIZE^2 samples
+
+/// <summary>
+/// Write a tiled, mip-mapped 16 bit height map as a compressed container (.thm). Every tile is coded on its own, so any tile of
+/// any level can be decoded without touching the others: its samples are offset by the tile's minimum and quantized (losslessly
+/// unless maxError > 0, which allows that much error per sample), predicted from their left, upper and upper-left neighbours,
+/// and the residuals are entropy coded with rANS. Tiles are encoded in parallel on the job system and streamed to the file
+/// a tile row at a time. readTile is called from the workers.
+/// </summary>
+bool WriteHeightContainer(const char* path, const std::vector<HeightLevelSize>& levels, uint16_t minElevation, uint16_t maxElevation,
+	const ReadHeightTileFunction& readTile, JobSystem& jobSystem, int maxError = 0);
+
+/// <summary>
+/// Random access reader for .thm files. The file is memory-mapped, DecodeTile() is thread-safe, and the reconstruction
+/// after the entropy decoder uses SSE2 when available.
+/// </summary>
+class HeightContainer
+{
+public:
+	bool Open(const char* path);
+	bool IsOpen() const { return _file.IsOpen(); }
+
+	int LevelCount() const { return static_cast<int>(_levels.size()); }
+	int LevelWidth(int level) const { return _levels[level].width; }
+	int LevelHeight(int level) const { return _levels[level].height; }
+	int TilesX(int level) const { return _levels[level].tilesX; }
+	int TilesY(int level) const { return _levels[level].tilesY; }
+	uint16_t MinElevation() const { return _minElevation; }
+	uint16_t MaxElevation() const { return _maxElevation; }
+	uint16_t TileMinElevation(int level, int tileX, int tileY) const; // Without decoding the tile
+	uint16_t TileMaxElevation(int level, int tileX, int tileY) const;
+	size_t TileBytes(int level, int tileX, int tileY) const;
+
+	bool DecodeTile(int level, int tileX, int tileY, uint16_t* tile) const;
+
+private:
+	struct Level
+	{
+		int width, height, tilesX, tilesY;
+		size_t firstTile;
+	};
+
+	const unsigned char* TileEntry(int level, int tileX, int tileY) const;
+
+	MappedFile _file;
+	std::vector<Level> _levels;
+	uint16_t _minElevation, _maxElevation;
+};
+
+/// <summary>
+/// Decode every tile of the container on the workers and report the throughput next to the size on disk.
+/// </summary>
+void BenchmarkHeightContainer(const char* path, JobSystem& jobSystem);
@@ -0,0 +1,450 @@
+#include "imageWriter.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// ------------------------------------ Deflate -------------------------------------------------------------------
+const int WINDOW_SIZE = 32768;
+const int HASH_BITS = 15;
+const int MAX_CHAIN = 32;   // How many earlier positions are tried per match, trades speed for ratio
+const int MIN_MATCH = 3;
+const int MAX_MATCH = 258;
+
+static const unsigned short lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char lengthExtraBits[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char distanceExtraBits[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/// <summary>
+/// Deflate packs bits LSB first, except Huffman codes, which are stored MSB first.
+/// </summary>
+class BitWriter
+{
+public:
+	explicit BitWriter(std::vector<unsigned char>& out) : _out(out), _bitBuffer(0), _bitCount(0) {}
+
+	void Write(uint32_t bits, int count)
+	{
+		_bitBuffer |= bits << _bitCount;
+		_bitCount += count;
+		while (_bitCount >= 8)
+		{
+			_out.push_back(static_cast<unsigned char>(_bitBuffer));
+			_bitBuffer >>= 8;
+			_bitCount -= 8;
+		}
+	}
+
+	void WriteHuffman(uint32_t code, int length)
+	{
+		uint32_t reversed = 0;
+		for (int i = 0; i < length; ++i)
+			reversed |= ((code >> i) & 1) << (length - 1 - i);
+		Write(reversed, length);
+	}
+
+	void Flush()
+	{
+		if (_bitCount > 0)
+			_out.push_back(static_cast<unsigned char>(_bitBuffer));
+		_bitBuffer = 0;
+		_bitCount = 0;
+	}
+
+private:
+	std::vector<unsigned char>& _out;
+	uint32_t _bitBuffer;
+	int _bitCount;
+};
+
+static void WriteLiteral(BitWriter& bits, int symbol)
+{
+	// Fixed literal/ length code (RFC 1951, 3.2.6)
+	if (symbol < 144) bits.WriteHuffman(0x30 + symbol, 8);
+	else if (symbol < 256) bits.WriteHuffman(0x190 + symbol - 144, 9);
+	else if (symbol < 280) bits.WriteHuffman(symbol - 256, 7);
+	else bits.WriteHuffman(0xC0 + symbol - 280, 8);
+}
+
+static void WriteMatch(BitWriter& bits, int length, int distance)
+{
+	int lengthCode = 0;
+	while (lengthCode < 28 && lengthBase[lengthCode + 1] <= length) lengthCode++;
+	WriteLiteral(bits, 257 + lengthCode);
+	bits.Write(length - lengthBase[lengthCode], lengthExtraBits[lengthCode]);
+
+	int distanceCode = 0;
+	while (distanceCode < 29 && distanceBase[distanceCode + 1] <= distance) distanceCode++;
+	bits.WriteHuffman(distanceCode, 5);
+	bits.Write(distance - distanceBase[distanceCode], distanceExtraBits[distanceCode]);
+}
+
+static inline uint32_t Hash3(const unsigned char* p)
+{
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/// <summary>
+/// Compress data as one fixed Huffman block. A non-final block is followed by an empty stored block, which byte aligns the
+/// output (a zlib "sync flush"), so separately compressed pieces can simply be concatenated.
+/// </summary>
+static void Deflate(BitWriter& bits, const unsigned char* data, size_t size, bool bFinal)
+{
+	bits.Write(bFinal ? 1 : 0, 1); // BFINAL
+	bits.Write(1, 2);              // BTYPE = fixed Huffman
+
+	std::vector<int> head(1 << HASH_BITS, -1);
+	std::vector<int> previous(WINDOW_SIZE, -1);
+	size_t i = 0;
+	while (i < size)
+	{
+		int bestLength = 0, bestDistance = 0;
+		if (i + MIN_MATCH <= size)
+		{
+			uint32_t hash = Hash3(data + i);
+			size_t maxLength = size - i < MAX_MATCH ? size - i : MAX_MATCH;
+			int candidate = head[hash];
+			for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 && i - candidate <= WINDOW_SIZE; ++chain)
+			{
+				const unsigned char* a = data + candidate;
+				const unsigned char* b = data + i;
+				if (a[bestLength] == b[bestLength]) // Can't beat the current best unless this byte matches
+				{
+					size_t length = 0;
+					while (length < maxLength && a[length] == b[length]) length++;
+					if (static_cast<int>(length) > bestLength)
+					{
+						bestLength = static_cast<int>(length);
+						bestDistance = static_cast<int>(i - candidate);
+						if (length == maxLength) break;
+					}
+				}
+				int next = previous[candidate & (WINDOW_SIZE - 1)];
+				if (next >= candidate) break; // Slot was overwritten by a newer position
+				candidate = next;
+			}
+		}
+
+		size_t advance = bestLength >= MIN_MATCH ? bestLength : 1;
+		if (bestLength >= MIN_MATCH)
+			WriteMatch(bits, bestLength, bestDistance);
+		else
+			WriteLiteral(bits, data[i]);
+
+		// Insert every position we step over into the hash chains
+		for (size_t end = i + advance; i < end; ++i)
+		{
+			if (i + MIN_MATCH > size) continue;
+			uint32_t hash = Hash3(data + i);
+			previous[i & (WINDOW_SIZE - 1)] = head[hash];
+			head[hash] = static_cast<int>(i);
+		}
+	}
+	WriteLiteral(bits, 256); // End of block
+	if (!bFinal)
+	{
+		bits.Write(0, 3); // BFINAL = 0, BTYPE = stored
+		bits.Flush();
+		bits.Write(0x0000, 16); // LEN
+		bits.Write(0xFFFF, 16); // NLEN
+	}
+	bits.Flush();
+}
+
+static uint32_t Adler32(const unsigned char* data, size_t size)
+{
+	uint32_t a = 1, b = 0;
+	while (size > 0)
+	{
+		size_t chunk = size < 5552 ? size : 5552; // Largest run that can't overflow before the modulo
+		size -= chunk;
+		while (chunk--)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+/// <summary>
+/// Checksum of A followed by B, from the checksums of each and the length of B (as zlib's adler32_combine).
+/// </summary>
+static uint32_t Adler32Combine(uint32_t adlerA, uint32_t adlerB, size_t sizeB)
+{
+	const uint32_t BASE = 65521;
+	uint32_t remainder = static_cast<uint32_t>(sizeB % BASE);
+	uint32_t sum1 = adlerA & 0xFFFF;
+	uint32_t sum2 = (remainder * sum1) % BASE;
+	sum1 += (adlerB & 0xFFFF) + BASE - 1;
+	sum2 += (adlerA >> 16) + (adlerB >> 16) + BASE - remainder;
+	if (sum1 >= BASE) sum1 -= BASE;
+	if (sum1 >= BASE) sum1 -= BASE;
+	if (sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+	if (sum2 >= BASE) sum2 -= BASE;
+	return sum1 | (sum2 << 16);
+}
+
+static void WriteBigEndian(std::vector<unsigned char>& out, uint32_t value)
+{
+	out.push_back(static_cast<unsigned char>(value >> 24));
+	out.push_back(static_cast<unsigned char>(value >> 16));
+	out.push_back(static_cast<unsigned char>(value >> 8));
+	out.push_back(static_cast<unsigned char>(value));
+}
+
+std::vector<unsigned char> ZlibCompress(const unsigned char* data, size_t size)
+{
+	std::vector<unsigned char> out;
+	out.reserve(size / 2 + 64);
+	out.push_back(0x78); // CM = deflate, 32K window
+	out.push_back(0x01); // FCHECK, no preset dictionary
+	BitWriter bits(out);
+	Deflate(bits, data, size, true);
+	WriteBigEndian(out, Adler32(data, size));
+	return out;
+}
+// ----------------------------------------------------------------------------------------------------------------
+
+// ------------------------------------ PNG -----------------------------------------------------------------------
+struct CrcTable
+{
+	uint32_t entries[256];
+	CrcTable()
+	{
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			entries[n] = c;
+		}
+	}
+};
+
+static uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+	static const CrcTable table; // Thread-safe one time init
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void WriteChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& data)
+{
+	WriteBigEndian(png, static_cast<uint32_t>(data.size()));
+	size_t start = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), data.begin(), data.end());
+	WriteBigEndian(png, Crc32(&png[start], png.size() - start));
+}
+
+static inline int Paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	return pb <= pc ? b : c;
+}
+
+/// <summary>
+/// Filter one scanline with the given PNG filter type. The previous row is null for the first row.
+/// </summary>
+static void FilterRow(int filter, const unsigned char* row, const unsigned char* previous, int rowBytes, int channels, unsigned char* out)
+{
+	for (int i = 0; i < rowBytes; ++i)
+	{
+		int left = i >= channels ? row[i - channels] : 0;
+		int up = previous ? previous[i] : 0;
+		int upLeft = previous && i >= channels ? previous[i - channels] : 0;
+		int predicted = 0;
+		switch (filter)
+		{
+		case 1: predicted = left; break;
+		case 2: predicted = up; break;
+		case 3: predicted = (left + up) >> 1; break;
+		case 4: predicted = Paeth(left, up, upLeft); break;
+		}
+		out[i] = static_cast<unsigned char>(row[i] - predicted);
+	}
+}
+
+/// <summary>
+/// Filter and deflate rows [firstRow, lastRow) of the image. The rows only reference each other through the PNG filters, which read
+/// the unfiltered source, so any split of the image into row bands can be encoded on separate threads.
+/// </summary>
+PngChunk EncodePngRows(int width, int height, int channels, const unsigned char* pixels, int firstRow, int lastRow, bool bFlipVertically)
+{
+	const int rowBytes = width * channels;
+
+	// Pick the filter per row that minimizes the sum of absolute residuals, the usual heuristic
+	std::vector<unsigned char> filtered(static_cast<size_t>(rowBytes + 1) * (lastRow - firstRow));
+	std::vector<unsigned char> candidate(rowBytes);
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		int sourceRow = bFlipVertically ? height - 1 - y : y;
+		int previousRow = bFlipVertically ? sourceRow + 1 : sourceRow - 1;
+		const unsigned char* row = pixels + static_cast<size_t>(sourceRow) * rowBytes;
+		const unsigned char* previous = y > 0 ? pixels + static_cast<size_t>(previousRow) * rowBytes : nullptr;
+		unsigned char* out = &filtered[static_cast<size_t>(y - firstRow) * (rowBytes + 1)];
+
+		int bestFilter = 0;
+		long bestScore = -1;
+		for (int filter = 0; filter < 5; ++filter)
+		{
+			FilterRow(filter, row, previous, rowBytes, channels, candidate.data());
+			long score = 0;
+			for (int i = 0; i < rowBytes; ++i)
+				score += std::abs(static_cast<signed char>(candidate[i]));
+			if (bestScore < 0 || score < bestScore)
+			{
+				bestScore = score;
+				bestFilter = filter;
+				std::memcpy(out + 1, candidate.data(), rowBytes);
+			}
+		}
+		out[0] = static_cast<unsigned char>(bestFilter);
+	}
+
+	PngChunk chunk;
+	BitWriter bits(chunk.deflated);
+	Deflate(bits, filtered.data(), filtered.size(), lastRow == height);
+	chunk.adler = Adler32(filtered.data(), filtered.size());
+	chunk.rawSize = filtered.size();
+	return chunk;
+}
+
+std::vector<unsigned char> AssemblePng(int width, int height, int channels, const std::vector<PngChunk>& chunks)
+{
+	static const unsigned char colorTypes[] = { 0, 0, 4, 2, 6 }; // Indexed by channel count
+
+	std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	std::vector<unsigned char> header;
+	WriteBigEndian(header, width);
+	WriteBigEndian(header, height);
+	header.push_back(8);                     // Bit depth
+	header.push_back(colorTypes[channels]);
+	header.push_back(0);                     // Compression
+	header.push_back(0);                     // Filter method
+	header.push_back(0);                     // No interlacing
+	WriteChunk(png, "IHDR", header);
+
+	// One zlib stream: header, the deflate pieces back to back, and the checksum of everything they encode
+	std::vector<unsigned char> zlib = { 0x78, 0x01 };
+	uint32_t adler = 1;
+	for (const PngChunk& chunk : chunks)
+	{
+		zlib.insert(zlib.end(), chunk.deflated.begin(), chunk.deflated.end());
+		adler = Adler32Combine(adler, chunk.adler, chunk.rawSize);
+	}
+	WriteBigEndian(zlib, adler);
+	WriteChunk(png, "IDAT", zlib);
+	WriteChunk(png, "IEND", std::vector<unsigned char>());
+	return png;
+}
+
+std::vector<unsigned char> EncodePng(int width, int height, int channels, const unsigned char* pixels, bool bFlipVertically)
+{
+	return AssemblePng(width, height, channels, std::vector<PngChunk>(1, EncodePngRows(width, height, channels, pixels, 0, height, bFlipVertically)));
+}
+
+bool WritePng(const char* path, int width, int height, int channels, const unsigned char* pixels, bool bFlipVertically)
+{
+	std::vector<unsigned char> png = EncodePng(width, height, channels, pixels, bFlipVertically);
+	return WriteRaw(path, png.data(), png.size());
+}
+// ----------------------------------------------------------------------------------------------------------------
+
+bool WriteRaw(const char* path, const unsigned char* data, size_t size)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "ERROR: Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+	file.write(reinterpret_cast<const char*>(data), size);
+	return static_cast<bool>(file);
+}
+
+bool Y4mWriter::Open(const char* path, int width, int height, int framesPerSecond)
+{
+	Close();
+	_bStdout = std::strcmp(path, "-") == 0;
+	if (_bStdout)
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY); // Don't let the runtime turn \n into \r\n inside the frames
+#endif
+		_file = stdout;
+	}
+	else
+		_file = std::fopen(path, "wb");
+
+	if (!_file)
+	{
+		std::cerr << "ERROR: Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+	std::setvbuf(_file, nullptr, _IOFBF, 1 << 20);
+	// C420jpeg = centered chroma, which is what averaging each 2x2 block gives
+	std::fprintf(_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, framesPerSecond);
+	return true;
+}
+
+bool Y4mWriter::WriteFrame(const unsigned char* yuv, size_t size)
+{
+	if (!_file) return false;
+	std::fputs("FRAME\n", _file);
+	return std::fwrite(yuv, 1, size, _file) == size;
+}
+
+void Y4mWriter::Close()
+{
+	if (!_file) return;
+	if (_bStdout)
+		std::fflush(_file);
+	else
+		std::fclose(_file);
+	_file = nullptr;
+}
+
+bool TiledPpmWriter::Open(const char* path, int width, int height)
+{
+	_file.open(path, std::ios::binary);
+	if (!_file)
+	{
+		std::cerr << "ERROR: Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+	_width = width;
+	_height = height;
+	_file << "P6\n" << width << " " << height << "\n255\n";
+	_dataStart = _file.tellp();
+
+	// Size the file up front, so regions can be written anywhere in it
+	_file.seekp(_dataStart + static_cast<std::streamoff>(width) * height * 3 - 1);
+	_file.put('\0');
+	return static_cast<bool>(_file);
+}
+
+bool TiledPpmWriter::WriteRegion(int x, int y, int width, int height, const unsigned char* rgb, bool bFlipVertically)
+{
+	const size_t rowBytes = static_cast<size_t>(width) * 3;
+	for (int row = 0; row < height; ++row)
+	{
+		int sourceRow = bFlipVertically ? height - 1 - row : row;
+		_file.seekp(_dataStart + (static_cast<std::streamoff>(y + row) * _width + x) * 3);
+		_file.write(reinterpret_cast<const char*>(rgb + sourceRow * rowBytes), rowBytes);
+	}
+	return static_cast<bool>(_file);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+/// <summary>
+/// zlib stream (RFC 1950/ 1951) using LZ77 with hash chains and the fixed Huffman code. Not as small as zlib's output,
+/// but needs no dependency and is fast enough to run per frame on a worker thread.
+/// </summary>
+std::vector<unsigned char> ZlibCompress(const unsigned char* data, size_t size);
+
+// --- PNG (8 bits per channel, 1-4 channels). GL read backs are bottom-up, pass bFlipVertically to store them upright.
+std::vector<unsigned char> EncodePng(int width, int height, int channels, const unsigned char* pixels, bool bFlipVertically = false);
+bool WritePng(const char* path, int width, int height, int channels, const unsigned char* pixels, bool bFlipVertically = false);
+
+// --- The same PNG, encoded as independent row bands (e.g. one per thread) and then stitched together
+struct PngChunk
+{
+	std::vector<unsigned char> deflated; // Byte aligned deflate data, final block only for the last band
+	unsigned int adler;                  // Adler-32 of the filtered rows, combined across bands by AssemblePng()
+	size_t rawSize;
+};
+PngChunk EncodePngRows(int width, int height, int channels, const unsigned char* pixels, int firstRow, int lastRow, bool bFlipVertically = false);
+std::vector<unsigned char> AssemblePng(int width, int height, int channels, const std::vector<PngChunk>& chunks); // Bands in row order
+
+bool WriteRaw(const char* path, const unsigned char* data, size_t size); // Pixels as-is, no header
+
+/// <summary>
+/// YUV4MPEG2 stream: a one line header, then "FRAME\n" plus the planar 4:2:0 Y, U and V planes for every frame. Can be piped
+/// straight into an external encoder, e.g. ffmpeg -i - out.mp4.
+/// </summary>
+class Y4mWriter
+{
+public:
+	Y4mWriter() : _file(nullptr), _bStdout(false) {}
+	~Y4mWriter() { Close(); }
+
+	bool Open(const char* path, int width, int height, int framesPerSecond); // "-" writes to stdout
+	bool WriteFrame(const unsigned char* yuv, size_t size);
+	void Close();
+	bool IsOpen() const { return _file != nullptr; }
+
+private:
+	Y4mWriter(const Y4mWriter&) = delete;
+	Y4mWriter& operator=(const Y4mWriter&) = delete;
+
+	FILE* _file;
+	bool _bStdout;
+};
+
+/// <summary>
+/// Binary PPM (P6) written one rectangle at a time at its final offset in the file, so images far larger than memory can be
+/// assembled from tiles in any order. Regions are in image coordinates, top row first.
+/// </summary>
+class TiledPpmWriter
+{
+public:
+	bool Open(const char* path, int width, int height);
+	bool WriteRegion(int x, int y, int width, int height, const unsigned char* rgb, bool bFlipVertically = false); // Tightly packed rows
+	void Close() { _file.close(); }
+
+private:
+	std::ofstream _file;
+	std::streamoff _dataStart;
+	int _width, _height;
+};
@@ -0,0 +1,606 @@
+#include "instanceRenderer.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include "frustum.h"
+#include "glad/glad.h"
+#include "memoryTracker.h"
+#include "meshOptimizer.h"
+#include "SimplexNoise.h"
+
+static const float INSTANCE_LOD_PIXELS[INSTANCE_MESH_LODS] = { 48.0f, 16.0f }; // Bounding sphere radius on screen at which each mesh level still holds up
+static const float INSTANCE_MIN_PIXELS = 1.0f; // Below this the chunk isn't drawn at all
+static const uint32_t IMPOSTOR_VERTICES = 4;
+
+// ------------------------------------ Models ---------------------------------------------------------------------
+
+static ModelVertex MakeModelVertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& color)
+{
+	ModelVertex vertex;
+	vertex.position = position;
+	glm::vec3 n = glm::normalize(normal);
+	for (int i = 0; i < 3; ++i)
+	{
+		vertex.normal[i] = static_cast<int8_t>(std::lround(glm::clamp(n[i], -1.0f, 1.0f) * 127.0f));
+		vertex.color[i] = static_cast<uint8_t>(std::lround(glm::clamp(color[i], 0.0f, 1.0f) * 255.0f));
+	}
+	vertex.normal[3] = 0;
+	vertex.color[3] = 255;
+	return vertex;
+}
+
+/// <summary>
+/// Add one level's vertices and (level local) indices to the model, optimized: triangles for the vertex cache, then in
+/// clusters ordered for overdraw (these are drawn thousands of times, without culling), then vertices in fetch order.
+/// </summary>
+static void AppendLod(InstancedMeshData& data, const char* name, std::vector<ModelVertex> vertices, std::vector<uint16_t> indices)
+{
+	const VertexCacheStats generated = AnalyzeVertexCache(indices.data(), indices.size(), vertices.size());
+	OptimizeVertexCache(indices.data(), indices.size(), vertices.size());
+	OptimizeOverdraw(indices.data(), indices.size(), &vertices[0].position, sizeof(ModelVertex));
+	RemapVertices(vertices, OptimizeVertexFetch(indices.data(), indices.size(), vertices.size()));
+	const std::string meshName = std::string(name) + " level " + std::to_string(data.lods.size());
+	CheckVertexCacheGain(meshName.c_str(), generated, AnalyzeVertexCache(indices.data(), indices.size(), vertices.size()));
+
+	InstancedMeshData::Lod lod;
+	lod.firstIndex = static_cast<uint32_t>(data.indices.size());
+	lod.indexCount = static_cast<uint32_t>(indices.size());
+	lod.baseVertex = static_cast<int32_t>(data.vertices.size());
+	lod.vertexCount = static_cast<uint32_t>(vertices.size());
+	data.vertices.insert(data.vertices.end(), vertices.begin(), vertices.end());
+	data.indices.insert(data.indices.end(), indices.begin(), indices.end());
+	data.lods.push_back(lod);
+}
+
+/// <summary>
+/// The sphere around all levels: centered on their box, out to the farthest vertex.
+/// </summary>
+static void ComputeModelBounds(InstancedMeshData& data)
+{
+	glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+	for (const ModelVertex& vertex : data.vertices)
+	{
+		boundsMin = glm::min(boundsMin, vertex.position);
+		boundsMax = glm::max(boundsMax, vertex.position);
+	}
+	data.boundsCenter = (boundsMin + boundsMax) * 0.5f;
+	data.boundsRadius = 0.0f;
+	for (const ModelVertex& vertex : data.vertices)
+		data.boundsRadius = std::max(data.boundsRadius, glm::length(vertex.position - data.boundsCenter));
+}
+
+InstancedMeshData BuildRockMesh()
+{
+	const float radius = 0.008f, flatten = 0.6f, sink = 0.35f; // Squashed, and its lower part buried
+	const float t = (1.0f + std::sqrt(5.0f)) * 0.5f;
+	const glm::vec3 icosahedron[12] =
+	{
+		{ -1.0f, t, 0.0f }, { 1.0f, t, 0.0f }, { -1.0f, -t, 0.0f }, { 1.0f, -t, 0.0f },
+		{ 0.0f, -1.0f, t }, { 0.0f, 1.0f, t }, { 0.0f, -1.0f, -t }, { 0.0f, 1.0f, -t },
+		{ t, 0.0f, -1.0f }, { t, 0.0f, 1.0f }, { -t, 0.0f, -1.0f }, { -t, 0.0f, 1.0f }
+	};
+	const uint16_t faces[60] =
+	{
+		0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,  1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+		3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,  4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
+	};
+
+	InstancedMeshData data;
+	for (int lod = 0; lod < INSTANCE_MESH_LODS; ++lod)
+	{
+		// Each level halves the edges of the one after it, and every level samples the same lumps
+		std::vector<glm::vec3> directions;
+		for (const glm::vec3& corner : icosahedron)
+			directions.push_back(glm::normalize(corner));
+		std::vector<uint16_t> triangles(faces, faces + 60);
+		for (int subdivision = 0; subdivision < INSTANCE_MESH_LODS - lod; ++subdivision)
+		{
+			std::map<std::pair<uint16_t, uint16_t>, uint16_t> midpoints;
+			auto Midpoint = [&](uint16_t a, uint16_t b)
+			{
+				std::pair<uint16_t, uint16_t> key(std::min(a, b), std::max(a, b));
+				auto found = midpoints.find(key);
+				if (found != midpoints.end()) return found->second;
+				directions.push_back(glm::normalize(directions[a] + directions[b]));
+				uint16_t index = static_cast<uint16_t>(directions.size() - 1);
+				midpoints[key] = index;
+				return index;
+			};
+			std::vector<uint16_t> finer;
+			for (size_t i = 0; i < triangles.size(); i += 3)
+			{
+				uint16_t a = triangles[i], b = triangles[i + 1], c = triangles[i + 2];
+				uint16_t ab = Midpoint(a, b), bc = Midpoint(b, c), ca = Midpoint(c, a);
+				const uint16_t split[12] = { a, ab, ca,  b, bc, ab,  c, ca, bc,  ab, bc, ca };
+				finer.insert(finer.end(), split, split + 12);
+			}
+			triangles.swap(finer);
+		}
+
+		std::vector<glm::vec3> positions, normals(directions.size(), glm::vec3(0.0f));
+		for (const glm::vec3& direction : directions)
+		{
+			float lumps = 1.0f + 0.25f * SimplexNoise::noise(direction.x * 1.7f, direction.y * 1.7f, direction.z * 1.7f + 3.1f);
+			glm::vec3 position = direction * radius * lumps;
+			position.y = (position.y + sink * radius) * flatten;
+			positions.push_back(position);
+		}
+		for (size_t i = 0; i < triangles.size(); i += 3)
+		{
+			const glm::vec3& a = positions[triangles[i]];
+			glm::vec3 faceNormal = glm::cross(positions[triangles[i + 1]] - a, positions[triangles[i + 2]] - a); // Area weighted
+			for (int corner = 0; corner < 3; ++corner)
+				normals[triangles[i + corner]] += faceNormal;
+		}
+		std::vector<ModelVertex> vertices;
+		for (size_t i = 0; i < positions.size(); ++i)
+		{
+			float shade = 0.42f + 0.08f * SimplexNoise::noise(directions[i].x * 3.0f, directions[i].y * 3.0f, directions[i].z * 3.0f);
+			vertices.push_back(MakeModelVertex(positions[i], normals[i], glm::vec3(shade, shade * 0.97f, shade * 0.92f)));
+		}
+		AppendLod(data, "the rock model", vertices, triangles);
+	}
+	ComputeModelBounds(data);
+	return data;
+}
+
+/// <summary>
+/// An open cylinder around the y axis (the trunk: the foliage hides its ends).
+/// </summary>
+static void AppendCylinder(std::vector<ModelVertex>& vertices, std::vector<uint16_t>& indices, float radius, float y0, float y1, int segments, const glm::vec3& color)
+{
+	const float PI = 3.14159265359f;
+	const uint16_t first = static_cast<uint16_t>(vertices.size());
+	for (int i = 0; i <= segments; ++i) // The seam is doubled, like the sun's sphere
+	{
+		float angle = 2.0f * PI * i / segments;
+		glm::vec3 normal(std::cos(angle), 0.0f, std::sin(angle));
+		vertices.push_back(MakeModelVertex(glm::vec3(normal.x * radius, y0, normal.z * radius), normal, color));
+		vertices.push_back(MakeModelVertex(glm::vec3(normal.x * radius, y1, normal.z * radius), normal, color));
+	}
+	for (int i = 0; i < segments; ++i)
+	{
+		uint16_t bottom = static_cast<uint16_t>(first + 2 * i), next = static_cast<uint16_t>(bottom + 2);
+		const uint16_t quad[6] = { bottom, static_cast<uint16_t>(bottom + 1), next,  next, static_cast<uint16_t>(bottom + 1), static_cast<uint16_t>(next + 1) };
+		indices.insert(indices.end(), quad, quad + 6);
+	}
+}
+
+/// <summary>
+/// A cone around the y axis with its base at y0, closed underneath. The apex is one vertex per segment, each with the normal
+/// halfway between the segment's edges, so the sides shade smoothly.
+/// </summary>
+static void AppendCone(std::vector<ModelVertex>& vertices, std::vector<uint16_t>& indices, float radius, float y0, float height, int segments, const glm::vec3& color)
+{
+	const float PI = 3.14159265359f;
+	auto SideNormal = [&](float angle) { return glm::vec3(std::cos(angle) * height, radius, std::sin(angle) * height); };
+	const uint16_t ring = static_cast<uint16_t>(vertices.size());
+	for (int i = 0; i <= segments; ++i)
+	{
+		float angle = 2.0f * PI * i / segments;
+		vertices.push_back(MakeModelVertex(glm::vec3(std::cos(angle) * radius, y0, std::sin(angle) * radius), SideNormal(angle), color));
+	}
+	const uint16_t apex = static_cast<uint16_t>(vertices.size());
+	for (int i = 0; i < segments; ++i)
+		vertices.push_back(MakeModelVertex(glm::vec3(0.0f, y0 + height, 0.0f), SideNormal(2.0f * PI * (i + 0.5f) / segments), color));
+	const uint16_t capCenter = static_cast<uint16_t>(vertices.size());
+	vertices.push_back(MakeModelVertex(glm::vec3(0.0f, y0, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), color * 0.6f));
+	for (int i = 0; i < segments; ++i)
+	{
+		float angle = 2.0f * PI * i / segments;
+		vertices.push_back(MakeModelVertex(glm::vec3(std::cos(angle) * radius, y0, std::sin(angle) * radius), glm::vec3(0.0f, -1.0f, 0.0f), color * 0.6f));
+	}
+	for (int i = 0; i < segments; ++i)
+	{
+		const uint16_t side[3] = { static_cast<uint16_t>(ring + i), static_cast<uint16_t>(apex + i), static_cast<uint16_t>(ring + i + 1) };
+		const uint16_t cap[3] = { capCenter, static_cast<uint16_t>(capCenter + 1 + i), static_cast<uint16_t>(capCenter + 1 + (i + 1) % segments) };
+		indices.insert(indices.end(), side, side + 3);
+		indices.insert(indices.end(), cap, cap + 3);
+	}
+}
+
+InstancedMeshData BuildTreeMesh()
+{
+	const glm::vec3 bark(0.30f, 0.20f, 0.12f), needles(0.16f, 0.34f, 0.13f);
+	InstancedMeshData data;
+	for (int lod = 0; lod < INSTANCE_MESH_LODS; ++lod)
+	{
+		std::vector<ModelVertex> vertices;
+		std::vector<uint16_t> indices;
+		if (lod == 0)
+		{
+			AppendCylinder(vertices, indices, 0.0012f, -0.002f, 0.008f, 6, bark);
+			AppendCone(vertices, indices, 0.0060f, 0.0050f, 0.0100f, 10, needles);
+			AppendCone(vertices, indices, 0.0048f, 0.0105f, 0.0090f, 10, needles * 1.08f);
+			AppendCone(vertices, indices, 0.0035f, 0.0160f, 0.0080f, 10, needles * 1.16f);
+		}
+		else
+		{
+			// The same outline from two cones
+			AppendCylinder(vertices, indices, 0.0012f, -0.002f, 0.006f, 4, bark);
+			AppendCone(vertices, indices, 0.0060f, 0.0050f, 0.0130f, 6, needles);
+			AppendCone(vertices, indices, 0.0042f, 0.0130f, 0.0110f, 6, needles * 1.12f);
+		}
+		AppendLod(data, "the tree model", vertices, indices);
+	}
+	ComputeModelBounds(data);
+	return data;
+}
+
+// ------------------------------------ Impostors ------------------------------------------------------------------
+
+/// <summary>
+/// The direction (from the model towards the viewer) a view of the atlas was baked from: hemi-octahedral, the upper
+/// hemisphere folded onto a diamond and turned 45 degrees to fill the square. Matches impostor.VERT.
+/// </summary>
+static glm::vec3 ImpostorFrameDirection(int frameX, int frameY)
+{
+	glm::vec2 e = (glm::vec2(static_cast<float>(frameX), static_cast<float>(frameY)) + 0.5f) / static_cast<float>(IMPOSTOR_FRAMES) * 2.0f - 1.0f;
+	float x = (e.x + e.y) * 0.5f, z = (e.x - e.y) * 0.5f;
+	return glm::normalize(glm::vec3(x, 1.0f - std::abs(x) - std::abs(z), z));
+}
+
+InstanceRenderer::InstanceRenderer() : _generation(0), _indirectBuffer(0), _indirectBufferBytes(0),
+	_instanceCount(0), _frames(0), _budgetFrames(0), _vertices(0), _drawCalls(0), _commandCount(0), _instancesDrawn()
+{
+}
+
+bool InstanceRenderer::Create(const std::vector<InstancedMeshData>& models, Shader& bakeShader)
+{
+	Shutdown();
+	MemoryScope memoryScope(MemorySubsystem::Meshes);
+	InstancedMeshData quad; // The impostors' card, its corners at -1..1
+	const glm::vec2 corners[4] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+	std::vector<ModelVertex> quadVertices;
+	for (const glm::vec2& corner : corners)
+		quadVertices.push_back(MakeModelVertex(glm::vec3(corner, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f)));
+	AppendLod(quad, "the impostor card", quadVertices, { 0, 1, 2, 0, 2, 3 });
+
+	for (const InstancedMeshData& model : models)
+	{
+		_layers.emplace_back(); // Zeroed, so Shutdown() can tell what has been created
+		Layer& layer = _layers.back();
+		layer.mesh.reset(new Mesh(model));
+		layer.impostor.reset(new Mesh(quad));
+		layer.boundsCenter = model.boundsCenter;
+		layer.boundsRadius = model.boundsRadius;
+		layer.maxScale = 1.0f;
+		if (!BakeImpostor(layer, bakeShader)) // Before the instance attributes: the bake draws a single copy
+		{
+			Shutdown();
+			return false;
+		}
+		glGenBuffers(1, &layer.instanceBuffer);
+		layer.mesh->SetInstanceBuffer(layer.instanceBuffer);
+		layer.impostor->SetInstanceBuffer(layer.instanceBuffer);
+	}
+	glGenBuffers(1, &_indirectBuffer);
+	_generation = 0;
+	return true;
+}
+
+/// <summary>
+/// Render the model's finest level from every view direction into its cell of the atlases: albedo with coverage in alpha,
+/// and the model space normal. Orthographic, fitted to the bounding sphere, so every view has the same scale and the
+/// impostor's quad is the sphere's size whichever view it shows.
+/// </summary>
+bool InstanceRenderer::BakeImpostor(Layer& layer, Shader& bakeShader)
+{
+	MemoryScope memoryScope(MemorySubsystem::Textures);
+	const int atlasSize = IMPOSTOR_FRAMES * IMPOSTOR_FRAME_TEXELS;
+	for (unsigned int* atlas : { &layer.albedoAtlas, &layer.normalAtlas })
+	{
+		glGenTextures(1, atlas);
+		glBindTexture(GL_TEXTURE_2D, *atlas);
+		glTexStorage2D(GL_TEXTURE_2D, IMPOSTOR_MIP_LEVELS, GL_RGBA8, atlasSize, atlasSize);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		TrackGpuResource(GpuResourceType::Texture, *atlas, TextureByteSize(atlasSize, atlasSize, GL_RGBA8, IMPOSTOR_MIP_LEVELS),
+			atlas == &layer.albedoAtlas ? "impostor albedo atlas" : "impostor normal atlas");
+	}
+	unsigned int fbo, depth;
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlasSize, atlasSize);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer.albedoAtlas, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, layer.normalAtlas, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, attachments);
+	bool bComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	if (bComplete)
+	{
+		GLboolean bDepthTest = glIsEnabled(GL_DEPTH_TEST);
+		glEnable(GL_DEPTH_TEST);
+		glViewport(0, 0, atlasSize, atlasSize);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		bakeShader.use();
+		const float radius = layer.boundsRadius;
+		const glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.5f * radius, 3.5f * radius);
+		for (int frameY = 0; frameY < IMPOSTOR_FRAMES; ++frameY)
+		{
+			for (int frameX = 0; frameX < IMPOSTOR_FRAMES; ++frameX)
+			{
+				// The same basis as impostor.VERT's quad: right = cross(up reference, direction), up = cross(direction, right)
+				glm::vec3 direction = ImpostorFrameDirection(frameX, frameY);
+				glm::vec3 reference = std::abs(direction.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+				glm::mat4 view = glm::lookAt(layer.boundsCenter + direction * 2.0f * radius, layer.boundsCenter, reference);
+				bakeShader.setMat4("viewProjection", projection * view);
+				glViewport(frameX * IMPOSTOR_FRAME_TEXELS, frameY * IMPOSTOR_FRAME_TEXELS, IMPOSTOR_FRAME_TEXELS, IMPOSTOR_FRAME_TEXELS);
+				layer.mesh->DrawLod(0);
+			}
+		}
+		if (!bDepthTest)
+			glDisable(GL_DEPTH_TEST);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &depth);
+	if (!bComplete)
+	{
+		std::cerr << "ERROR: Impostor bake framebuffer not complete" << std::endl;
+		return false;
+	}
+
+	// The views are powers of two across and aligned, so down to IMPOSTOR_MIP_LEVELS no texel mixes two of them
+	for (unsigned int atlas : { layer.albedoAtlas, layer.normalAtlas })
+	{
+		glBindTexture(GL_TEXTURE_2D, atlas);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return true;
+}
+
+void InstanceRenderer::Update(const TerrainScatter& scatter)
+{
+	if (!IsCreated() || scatter.Generation() == _generation) return;
+	MemoryScope memoryScope(MemorySubsystem::Meshes);
+	_generation = scatter.Generation();
+	const std::vector<ScatterInstances>& instances = scatter.Instances();
+	_instanceCount = 0;
+	for (size_t i = 0; i < _layers.size(); ++i)
+	{
+		Layer& layer = _layers[i];
+		layer.tileOffsets.clear();
+		layer.chunkMin.clear();
+		layer.chunkMax.clear();
+		if (i >= instances.size() || instances[i].instances.empty())
+			continue;
+		const ScatterInstances& scattered = instances[i];
+		layer.maxScale = scatter.Layers()[i].maxScale;
+		glBindBuffer(GL_ARRAY_BUFFER, layer.instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, scattered.instances.size() * sizeof(ScatterInstance), scattered.instances.data(), GL_STATIC_DRAW);
+		TrackGpuResource(GpuResourceType::Buffer, layer.instanceBuffer, scattered.instances.size() * sizeof(ScatterInstance), "scatter instances");
+		layer.tileOffsets = scattered.tileOffsets;
+		_instanceCount += scattered.instances.size();
+
+		// Any yaw, at most maxScale: the model stays within its bounding sphere's reach around the instance's origin
+		const float reach = (glm::length(layer.boundsCenter) + layer.boundsRadius) * layer.maxScale;
+		const size_t chunkCount = layer.tileOffsets.size() - 1;
+		layer.chunkMin.assign(chunkCount, glm::vec3(1e30f));
+		layer.chunkMax.assign(chunkCount, glm::vec3(-1e30f));
+		for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			for (uint32_t instance = layer.tileOffsets[chunk]; instance < layer.tileOffsets[chunk + 1]; ++instance)
+			{
+				layer.chunkMin[chunk] = glm::min(layer.chunkMin[chunk], scattered.instances[instance].position - reach);
+				layer.chunkMax[chunk] = glm::max(layer.chunkMax[chunk], scattered.instances[instance].position + reach);
+			}
+		}
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+size_t InstanceRenderer::VertexCost(const Layer& layer, int lod, uint32_t instances) const
+{
+	if (lod < 0) return 0;
+	return static_cast<size_t>(instances) * (lod == IMPOSTOR_LOD ? IMPOSTOR_VERTICES : layer.mesh->Lods()[lod].vertexCount);
+}
+
+void InstanceRenderer::Draw(Shader& instanceShader, Shader& impostorShader, const glm::mat4& projection, const glm::mat4& view, const glm::vec3& cameraPos,
+	const glm::vec3& lightPos, int viewportHeight, size_t vertexBudget, LinearArena& frameArena)
+{
+	if (!IsCreated()) return;
+
+	const Frustum frustum = Frustum::FromViewProjection(projection * view);
+	const float pixelsPerUnit = viewportHeight * 0.5f * projection[1][1]; // At a distance of one unit
+
+	// Visible chunks and their level, from the size of an instance's bounding sphere at the chunk's closest point. The
+	// list is reserved for every chunk up front: in the arena, growing would leave each smaller copy behind until reset.
+	size_t chunkCount = 0;
+	for (const Layer& layer : _layers)
+		chunkCount += layer.chunkMin.size();
+	ArenaVector<ChunkDraw> chunks{ ArenaAllocator<ChunkDraw>(frameArena) };
+	chunks.reserve(chunkCount);
+	size_t vertices = 0;
+	for (size_t l = 0; l < _layers.size(); ++l)
+	{
+		const Layer& layer = _layers[l];
+		const float radiusPixels = layer.boundsRadius * layer.maxScale * pixelsPerUnit;
+		for (size_t chunk = 0; chunk < layer.chunkMin.size(); ++chunk)
+		{
+			const uint32_t instances = layer.tileOffsets[chunk + 1] - layer.tileOffsets[chunk];
+			if (instances == 0) continue;
+			const glm::vec3& boundsMin = layer.chunkMin[chunk];
+			const glm::vec3& boundsMax = layer.chunkMax[chunk];
+			if (!frustum.IntersectsBox(boundsMin, boundsMax)) continue;
+
+			float distance = glm::length(glm::max(glm::max(boundsMin - cameraPos, cameraPos - boundsMax), glm::vec3(0.0f)));
+			float pixels = radiusPixels / std::max(distance, 1e-3f);
+			if (pixels < INSTANCE_MIN_PIXELS) continue;
+			int lod = 0;
+			while (lod < INSTANCE_MESH_LODS && pixels < INSTANCE_LOD_PIXELS[lod])
+				++lod;
+			ChunkDraw draw = { distance, static_cast<uint16_t>(l), static_cast<uint16_t>(chunk), lod };
+			chunks.push_back(draw);
+			vertices += VertexCost(layer, lod, instances);
+		}
+	}
+
+	// Over budget: demote the farthest chunks a level at a time, then drop the farthest impostors
+	if (vertices > vertexBudget)
+	{
+		++_budgetFrames;
+		std::sort(chunks.begin(), chunks.end(), [](const ChunkDraw& a, const ChunkDraw& b) { return a.distance > b.distance; });
+		for (int level = 0; level <= IMPOSTOR_LOD && vertices > vertexBudget; ++level)
+		{
+			for (ChunkDraw& draw : chunks)
+			{
+				if (vertices <= vertexBudget) break;
+				if (draw.lod != level) continue;
+				const Layer& layer = _layers[draw.layer];
+				const uint32_t instances = layer.tileOffsets[draw.chunk + 1] - layer.tileOffsets[draw.chunk];
+				vertices -= VertexCost(layer, draw.lod, instances);
+				draw.lod = level < IMPOSTOR_LOD ? level + 1 : -1;
+				vertices += VertexCost(layer, draw.lod, instances);
+			}
+		}
+	}
+
+	// One command per run of neighbouring chunks at the same level, grouped by layer and level
+	std::sort(chunks.begin(), chunks.end(), [](const ChunkDraw& a, const ChunkDraw& b)
+	{
+		if (a.layer != b.layer) return a.layer < b.layer;
+		if (a.lod != b.lod) return a.lod < b.lod;
+		return a.chunk < b.chunk;
+	});
+	ArenaVector<DrawElementsIndirectCommand> commands{ ArenaAllocator<DrawElementsIndirectCommand>(frameArena) };
+	ArenaVector<DrawGroup> groups{ ArenaAllocator<DrawGroup>(frameArena) };
+	commands.reserve(chunks.size());
+	groups.reserve(_layers.size() * (IMPOSTOR_LOD + 1));
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		const ChunkDraw& draw = chunks[i];
+		if (draw.lod < 0) continue;
+		const Layer& layer = _layers[draw.layer];
+		const uint32_t first = layer.tileOffsets[draw.chunk], instances = layer.tileOffsets[draw.chunk + 1] - first;
+		_instancesDrawn[draw.lod] += instances;
+		if (groups.empty() || groups.back().layer != draw.layer || groups.back().lod != draw.lod)
+		{
+			DrawGroup group = { draw.layer, draw.lod, commands.size(), 0 };
+			groups.push_back(group);
+		}
+		else if (commands.back().baseInstance + commands.back().instanceCount == first)
+		{
+			commands.back().instanceCount += instances;
+			continue;
+		}
+		DrawElementsIndirectCommand command;
+		if (draw.lod == IMPOSTOR_LOD)
+		{
+			command.count = 6;
+			command.firstIndex = 0;
+			command.baseVertex = 0;
+		}
+		else
+		{
+			const InstancedMeshData::Lod& lod = layer.mesh->Lods()[draw.lod];
+			command.count = lod.indexCount;
+			command.firstIndex = lod.firstIndex;
+			command.baseVertex = lod.baseVertex;
+		}
+		command.instanceCount = instances;
+		command.baseInstance = first;
+		commands.push_back(command);
+		++groups.back().commandCount;
+	}
+	++_frames;
+	_vertices += vertices;
+	if (commands.empty()) return;
+
+	// All of this frame's commands in one upload, into a fresh buffer (the previous frame's draws may still read the old one)
+	const size_t commandBytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuffer);
+	if (commandBytes > _indirectBufferBytes)
+	{
+		_indirectBufferBytes = std::max(commandBytes, _indirectBufferBytes * 2);
+		TrackGpuResource(GpuResourceType::Buffer, _indirectBuffer, _indirectBufferBytes, "instance draw commands");
+	}
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, _indirectBufferBytes, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commandBytes, commands.data());
+
+	for (Shader* shader : { &instanceShader, &impostorShader })
+	{
+		shader->use();
+		shader->setMat4("projection", projection);
+		shader->setMat4("view", view);
+		shader->setVec3("viewPos", cameraPos);
+		shader->setVec3("lightPos", lightPos);
+	}
+	impostorShader.setInt("albedoAtlas", 0);
+	impostorShader.setInt("normalAtlas", 1);
+	for (const DrawGroup& group : groups)
+	{
+		const Layer& layer = _layers[group.layer];
+		const void* offset = reinterpret_cast<const void*>(group.firstCommand * sizeof(DrawElementsIndirectCommand));
+		if (group.lod == IMPOSTOR_LOD)
+		{
+			impostorShader.use();
+			impostorShader.setFloat("maxScale", layer.maxScale);
+			impostorShader.setVec3("boundsCenter", layer.boundsCenter);
+			impostorShader.setFloat("boundsRadius", layer.boundsRadius);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, layer.albedoAtlas);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, layer.normalAtlas);
+			layer.impostor->DrawIndirect(offset, group.commandCount);
+		}
+		else
+		{
+			instanceShader.use();
+			instanceShader.setFloat("maxScale", layer.maxScale);
+			layer.mesh->DrawIndirect(offset, group.commandCount);
+		}
+		++_drawCalls;
+		_commandCount += group.commandCount;
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void InstanceRenderer::PrintStats() const
+{
+	if (_frames == 0) return;
+	std::cout << "Instances: " << _instanceCount << " placed, per frame on average " << _instancesDrawn[0] / _frames;
+	for (int lod = 1; lod < INSTANCE_MESH_LODS; ++lod)
+		std::cout << " / " << _instancesDrawn[lod] / _frames;
+	std::cout << " / " << _instancesDrawn[IMPOSTOR_LOD] / _frames << " drawn (mesh levels / impostors), ~" << _vertices / _frames
+		<< " vertices in " << static_cast<double>(_drawCalls) / _frames << " draws of " << static_cast<double>(_commandCount) / _frames
+		<< " commands. Over the vertex budget in " << _budgetFrames << " of " << _frames << " frames" << std::endl;
+}
+
+void InstanceRenderer::Shutdown()
+{
+	for (Layer& layer : _layers)
+	{
+		if (layer.mesh) layer.mesh->Release();
+		if (layer.impostor) layer.impostor->Release();
+		for (unsigned int* atlas : { &layer.albedoAtlas, &layer.normalAtlas })
+		{
+			if (!*atlas) continue;
+			UntrackGpuResource(GpuResourceType::Texture, *atlas);
+			glDeleteTextures(1, atlas);
+		}
+		if (layer.instanceBuffer)
+		{
+			UntrackGpuResource(GpuResourceType::Buffer, layer.instanceBuffer);
+			glDeleteBuffers(1, &layer.instanceBuffer);
+		}
+	}
+	_layers.clear();
+	if (_indirectBuffer)
+	{
+		UntrackGpuResource(GpuResourceType::Buffer, _indirectBuffer);
+		glDeleteBuffers(1, &_indirectBuffer);
+		_indirectBuffer = 0;
+		_indirectBufferBytes = 0;
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "frameArena.h"
+#include "mesh.h"
+#include "shader.h"
+#include "terrainScatter.h"
+
+const int INSTANCE_MESH_LODS = 2;        // Mesh levels per model, the impostor comes after them
+const int IMPOSTOR_FRAMES = 8;           // Views across the octahedral atlas, must match impostor.VERT
+const int IMPOSTOR_FRAME_TEXELS = 64;    // Texels across one view
+const int IMPOSTOR_MIP_LEVELS = 5;       // Down to 4 texels per view, still within the view's own square
+
+/// <summary>
+/// The procedural models for the scatter layers: a lumpy, flattened icosphere and a conifer (trunk and stacked cones), each
+/// with INSTANCE_MESH_LODS levels in world units (at a scale of 1), standing on y = 0.
+/// </summary>
+InstancedMeshData BuildRockMesh();
+InstancedMeshData BuildTreeMesh();
+
+/// <summary>
+/// Draws TerrainScatter's instances. Each layer's instances live in one instance buffer, in the scatter's tile order, so a
+/// tile (a chunk) is a contiguous range of it and any chunk can be drawn by one indirect command whose baseInstance is the
+/// chunk's offset. Every frame, on the CPU:
+///  - chunks are culled against the view frustum (their instances' bounds, grown by the model),
+///  - each visible chunk picks a level from how large its closest instance's bounding sphere is on screen: the two mesh
+///    levels up close, then an impostor, and nothing once it is under a pixel,
+///  - if the vertices of all of that are over the budget, the farthest chunks are demoted first (mesh level by mesh level,
+///    then to impostors) and, if that isn't enough, the farthest impostor chunks are dropped,
+///  - neighbouring chunks at the same level are merged into one command, and all commands go into one indirect buffer.
+/// That makes one glMultiDrawElementsIndirect per layer and level, six draws for two layers however many instances there are.
+///
+/// Impostors are octahedral: at startup each model is rendered from IMPOSTOR_FRAMES^2 directions over the upper hemisphere
+/// (hemi-octahedral mapping, y up) into an albedo and a normal atlas. impostor.VERT picks the view closest to the camera's
+/// direction in the instance's own frame (its yaw undone) and turns the quad to face that view, so a distant rock or tree
+/// still shows its side facing the camera and is lit by its baked normals.
+/// </summary>
+class InstanceRenderer
+{
+public:
+	InstanceRenderer();
+	~InstanceRenderer() { Shutdown(); }
+
+	/// <summary>
+	/// One model per scatter layer, in the layers' order. Uploads the models and bakes their impostors with bakeShader
+	/// (impostorBake.*), so it needs the GL context and leaves the framebuffer binding at 0.
+	/// </summary>
+	bool Create(const std::vector<InstancedMeshData>& models, Shader& bakeShader);
+	bool IsCreated() const { return !_layers.empty(); }
+
+	void Update(const TerrainScatter& scatter); // Uploads the scatter's instances whenever they have been replaced
+
+	/// <summary>
+	/// Pick this frame's levels and draw the mesh levels with instanceShader (instance.*) and the impostors with
+	/// impostorShader (impostor.*) into the bound framebuffer. vertexBudget caps the vertices the instances may take.
+	/// The chunk list and the draw commands are built in frameArena.
+	/// </summary>
+	void Draw(Shader& instanceShader, Shader& impostorShader, const glm::mat4& projection, const glm::mat4& view, const glm::vec3& cameraPos,
+		const glm::vec3& lightPos, int viewportHeight, size_t vertexBudget, LinearArena& frameArena);
+
+	void PrintStats() const;
+	void Shutdown(); // Releases the meshes, atlases and buffers (needs the GL context)
+
+private:
+	static const int IMPOSTOR_LOD = INSTANCE_MESH_LODS;
+
+	struct Layer
+	{
+		std::unique_ptr<Mesh> mesh;
+		std::unique_ptr<Mesh> impostor; // A quad, reading the same instance buffer
+		glm::vec3 boundsCenter;
+		float boundsRadius;
+		unsigned int albedoAtlas, normalAtlas;
+		unsigned int instanceBuffer;
+		float maxScale;
+		std::vector<uint32_t> tileOffsets;        // As ScatterInstances'
+		std::vector<glm::vec3> chunkMin, chunkMax; // Per tile, around its instances' models
+	};
+
+	struct ChunkDraw
+	{
+		float distance; // From the camera to the chunk's bounds
+		uint16_t layer;
+		uint16_t chunk;
+		int lod;        // IMPOSTOR_LOD for the impostor, -1 once dropped
+	};
+
+	struct DrawGroup // One multi-draw: a layer's commands at one level
+	{
+		int layer, lod;
+		size_t firstCommand;
+		int commandCount;
+	};
+
+	bool BakeImpostor(Layer& layer, Shader& bakeShader);
+	size_t VertexCost(const Layer& layer, int lod, uint32_t instances) const;
+
+	std::vector<Layer> _layers;
+	unsigned int _generation; // Of the scatter's instances last uploaded
+	unsigned int _indirectBuffer;
+	size_t _indirectBufferBytes;
+
+	// --- Stats
+	size_t _instanceCount;
+	unsigned long long _frames, _budgetFrames, _vertices, _drawCalls, _commandCount;
+	unsigned long long _instancesDrawn[INSTANCE_MESH_LODS + 1];
+};
@@ -0,0 +1,192 @@
+#include "jobSystem.h"
+#include <algorithm>
+#include <cassert>
+
+/// <summary>
+/// A node in the job graph. Only touched with JobSystem::_mutex held, apart from running the work itself.
+/// </summary>
+struct Job
+{
+	std::function<void()> work;
+	std::vector<JobHandle> dependents; // Jobs waiting on this one
+	unsigned int pendingDependencies;
+	JobThread thread;
+	bool bDone;
+};
+
+JobSystem::JobSystem(unsigned int workerCount) : _mainThreadId(std::this_thread::get_id()), _unfinishedJobs(0), _bShuttingDown(false)
+{
+	if (workerCount == 0)
+	{
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	for (unsigned int i = 0; i < workerCount; ++i)
+		_workers.emplace_back(&JobSystem::WorkerLoop, this);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_bShuttingDown = true;
+	}
+	_workerCondition.notify_all();
+	for (std::thread& worker : _workers)
+		worker.join();
+}
+
+/// <summary>
+/// Add a job to the graph. It runs once every job in dependencies has finished (immediately if there are none).
+/// </summary>
+JobHandle JobSystem::Schedule(std::function<void()> work, const std::vector<JobHandle>& dependencies, JobThread thread)
+{
+	JobHandle job = std::make_shared<Job>();
+	job->work = std::move(work);
+	job->pendingDependencies = 0;
+	job->thread = thread;
+	job->bDone = false;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_unfinishedJobs++;
+	for (const JobHandle& dependency : dependencies)
+	{
+		if (dependency && !dependency->bDone)
+		{
+			dependency->dependents.push_back(job);
+			job->pendingDependencies++;
+		}
+	}
+	if (job->pendingDependencies == 0)
+		Enqueue(job);
+	return job;
+}
+
+JobHandle JobSystem::ScheduleOnMainThread(std::function<void()> work, const std::vector<JobHandle>& dependencies)
+{
+	return Schedule(std::move(work), dependencies, JobThread::MainThread);
+}
+
+/// <summary>
+/// Split rows [0, rows) into bands of bandRows and schedule work(firstRow, lastRow) for each band on a worker, all waiting
+/// for dependencies. The handles are the pass's, to wait on or to make the next pass depend on.
+/// </summary>
+std::vector<JobHandle> JobSystem::ScheduleRows(int rows, int bandRows, const std::vector<JobHandle>& dependencies, std::function<void(int, int)> work)
+{
+	std::vector<JobHandle> bands;
+	bands.reserve(static_cast<size_t>((rows + bandRows - 1) / bandRows));
+	for (int firstRow = 0; firstRow < rows; firstRow += bandRows)
+	{
+		const int lastRow = std::min(firstRow + bandRows, rows);
+		bands.push_back(Schedule([work, firstRow, lastRow] { work(firstRow, lastRow); }, dependencies));
+	}
+	return bands;
+}
+
+void JobSystem::RunMainThreadJobs()
+{
+	assert(IsMainThread() && "Main thread jobs need the GL context's thread");
+	if (!IsMainThread()) return;
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (!_mainThreadQueue.empty())
+	{
+		JobHandle job = _mainThreadQueue.front();
+		_mainThreadQueue.pop_front();
+		lock.unlock();
+		Execute(job);
+		lock.lock();
+	}
+}
+
+void JobSystem::Wait(const JobHandle& job)
+{
+	const bool bMainThread = IsMainThread(); // Anywhere else, main thread jobs are left to the main thread
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (!job->bDone)
+	{
+		if (bMainThread && !_mainThreadQueue.empty())
+		{
+			JobHandle mainThreadJob = _mainThreadQueue.front();
+			_mainThreadQueue.pop_front();
+			lock.unlock();
+			Execute(mainThreadJob);
+			lock.lock();
+		}
+		else
+			_mainThreadCondition.wait(lock);
+	}
+}
+
+void JobSystem::WaitAll()
+{
+	assert(IsMainThread() && "WaitAll() from a job would wait for itself, and main thread jobs need the GL context's thread");
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (_unfinishedJobs > 0)
+	{
+		if (!_mainThreadQueue.empty())
+		{
+			JobHandle mainThreadJob = _mainThreadQueue.front();
+			_mainThreadQueue.pop_front();
+			lock.unlock();
+			Execute(mainThreadJob);
+			lock.lock();
+		}
+		else
+			_mainThreadCondition.wait(lock);
+	}
+}
+
+void JobSystem::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_workerCondition.wait(lock, [this] { return _bShuttingDown || !_workerQueue.empty(); });
+		if (_workerQueue.empty()) // Shutting down with nothing left to do
+			return;
+
+		JobHandle job = _workerQueue.front();
+		_workerQueue.pop_front();
+		lock.unlock();
+		Execute(job);
+		lock.lock();
+	}
+}
+
+/// <summary>
+/// Run a job's work, then release its dependents. Called without the lock held.
+/// </summary>
+void JobSystem::Execute(const JobHandle& job)
+{
+	job->work();
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	job->bDone = true;
+	job->work = nullptr; // Drop captured state as soon as possible
+	for (const JobHandle& dependent : job->dependents)
+	{
+		if (--dependent->pendingDependencies == 0)
+			Enqueue(dependent);
+	}
+	job->dependents.clear();
+	_unfinishedJobs--;
+
+	// Waiters on the main thread check both for finished jobs and for newly runnable main thread jobs
+	_mainThreadCondition.notify_all();
+}
+
+// Expects _mutex to be held
+void JobSystem::Enqueue(const JobHandle& job)
+{
+	if (job->thread == JobThread::MainThread)
+	{
+		_mainThreadQueue.push_back(job);
+		_mainThreadCondition.notify_all();
+	}
+	else
+	{
+		_workerQueue.push_back(job);
+		_workerCondition.notify_one();
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Where a job is allowed to run. OpenGL calls must stay on the thread that owns the context, so uploads and shader
+/// compiles are scheduled as MainThread jobs and only run inside JobSystem::RunMainThreadJobs()/ Wait()/ WaitAll() called
+/// on the main thread (the one that constructed the JobSystem).
+/// </summary>
+enum class JobThread : uint8_t
+{
+	Worker, MainThread
+};
+
+struct Job;
+typedef std::shared_ptr<Job> JobHandle;
+
+/// <summary>
+/// Small job system with a dependency graph. Jobs are scheduled with the handles of the jobs they depend on and become
+/// runnable once all of them have finished, so independent chains (e.g. decode -> upload for each texture) overlap
+/// and the total time approaches the longest chain instead of the sum of all steps.
+/// </summary>
+class JobSystem
+{
+public:
+	explicit JobSystem(unsigned int workerCount = 0); // 0 = one worker per hardware thread, minus the main thread
+	~JobSystem();
+
+	JobHandle Schedule(std::function<void()> work, const std::vector<JobHandle>& dependencies = std::vector<JobHandle>(), JobThread thread = JobThread::Worker);
+	JobHandle ScheduleOnMainThread(std::function<void()> work, const std::vector<JobHandle>& dependencies = std::vector<JobHandle>());
+	std::vector<JobHandle> ScheduleRows(int rows, int bandRows, const std::vector<JobHandle>& dependencies, std::function<void(int, int)> work);
+
+	/// <summary>
+	/// The main thread is the one that constructed the JobSystem, which must be the one owning the GL context. Only there do
+	/// these run main thread jobs: RunMainThreadJobs() and WaitAll() must be called from it (asserted, WaitAll() from a job
+	/// would wait for itself), while Wait() from a worker just blocks until the main thread has run whatever the job needs.
+	/// </summary>
+	void RunMainThreadJobs();        // Run every main thread job that is ready right now, then return
+	void Wait(const JobHandle& job); // Block until the job is done, running main thread jobs in the meantime (on the main thread)
+	void WaitAll();                  // Block until every scheduled job is done, running main thread jobs in the meantime
+	bool IsMainThread() const { return std::this_thread::get_id() == _mainThreadId; }
+
+	unsigned int WorkerCount() const { return static_cast<unsigned int>(_workers.size()); }
+
+private:
+	void WorkerLoop();
+	void Execute(const JobHandle& job);
+	void Enqueue(const JobHandle& job);
+
+	std::thread::id _mainThreadId;
+	std::vector<std::thread> _workers;
+	std::deque<JobHandle> _workerQueue;
+	std::deque<JobHandle> _mainThreadQueue;
+	std::mutex _mutex;
+	std::condition_variable _workerCondition;
+	std::condition_variable _mainThreadCondition;
+	unsigned int _unfinishedJobs;
+	bool _bShuttingDown;
+};
+
+/// <summary>
+/// Rows of a file computed on the workers and written in order: each Add()ed row is filled by a job, and write() gets them
+/// back on the calling thread in the order they were added. At most two rows per worker are in flight, so Add() writes the
+/// oldest (waiting for it if needed) before scheduling another, and memory stays bounded however large the file is.
+/// </summary>
+template <typename Row>
+class OrderedRowWriter
+{
+public:
+	OrderedRowWriter(JobSystem& jobSystem, std::function<void(Row&)> write)
+		: _jobSystem(jobSystem), _write(std::move(write)), _maxInFlight(jobSystem.WorkerCount() * 2) {}
+	~OrderedRowWriter()
+	{
+		// Rows not flushed are dropped, but their jobs may still reference the caller's data
+		for (const Pending& pending : _pending)
+			_jobSystem.Wait(pending.job);
+	}
+
+	void Add(std::shared_ptr<Row> row, std::function<void(Row&)> fill)
+	{
+		while (_pending.size() >= _maxInFlight)
+			WriteOldest();
+		Pending pending = { _jobSystem.Schedule([row, fill] { fill(*row); }), row };
+		_pending.push_back(pending);
+	}
+
+	void Flush() // Write every row still in flight
+	{
+		while (!_pending.empty())
+			WriteOldest();
+	}
+
+private:
+	struct Pending
+	{
+		JobHandle job;
+		std::shared_ptr<Row> row;
+	};
+
+	void WriteOldest()
+	{
+		_jobSystem.Wait(_pending.front().job);
+		_write(*_pending.front().row);
+		_pending.pop_front();
+	}
+
+	JobSystem& _jobSystem;
+	std::function<void(Row&)> _write;
+	size_t _maxInFlight;
+	std::deque<Pending> _pending;
+};
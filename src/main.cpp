@@ -4,18 +4,38 @@
  * Features: 
  *		- Heightmap generation done with random Simplex noise and fractional brownian motion.
  *		- Normal map generation done by calculating the gradients of each point of the heightmap.
- *		- Parallax Occlusion Mapping to give the illusion of a flat quad looking like it has depth.
+ *		- Parallax Occlusion Mapping to give the illusion of a flat quad looking like it has depth, including in the depth buffer.
+ *		- Optional hardware tessellation instead: patch levels picked on the CPU from each patch's roughness and screen space error, crack free. 
+ *		- Or an error bounded RTIN mesh of the height map, built per tile on the worker threads. 
+ *		- Walk/ fly camera modes that collide with the terrain: sphere sweeps against a min/max tree of the height map. 
+ *		- Rocks and trees scattered as blue noise by height and slope rules, deterministic per tile and in parallel. 
+ *		- Instanced rocks and trees: per chunk LOD picked on the CPU, octahedral impostors in the distance, a handful of indirect draws within a vertex budget. 
+ *		- Generated index buffers reordered for the vertex cache, vertex fetch and (for instanced models) overdraw. 
  *		- Blinn-Phong Lighting Model. 
- *		- Height function which determines when to use the Snow Texture --> used for texturing snowy mountain peaks. 
+ *		- Optional deferred shading: a thin G-buffer pass, then lighting (plus a moonlight fill) and fog once per pixel. 
+ *		- Material layers (a texture array) blended by a splat map generated on the CPU from height, slope and curvature rules --> snowy peaks, bare cliffs. 
+ *		- Slope-aware material coordinates (a least squares fit to the surface, solved on the CPU) so cliffs aren't stretched. 
  *		- Fog effect when camera is far away from the scene. 
  *		- Skybox cubemap. 
  *		- Gaussian Blurring using a downsampled framebuffer object for increased performance. 
  *		- Post-Processing Effects such as HDR & Tonemapping, Bloom, and Screen-Space Lens-Flares. 
+ *		- CPU/ GPU memory accounting, shown in the window title and dumped to JSON with F9. 
+ *		- Asynchronous screenshots (F12) and frame capture (F11) through a PBO read back ring, optionally as a Y4M video stream. 
+ *		- Offline tiled poster rendering at any resolution, streamed to disk tile by tile. 
+ *		- Headless terrain farm: batch height/ normal map generation to PNG on a bounded worker pool. 
+ *		- Real-world DEM import (raw/ PGM/ 16 bit PNG), memory-mapped with a tiled mip pyramid. 
+ *		- Compressed tiled height container (predictive coding + rANS, SSE2 decode) with random access to any tile. 
+ *		- Sparse virtual texturing for the diffuse textures: feedback pass, LRU page cache, BC7 pages streamed in by workers. 
+ *		- Texture resolution tiers picked from a memory budget: low tier first, upgraded in the background, downgraded under pressure. 
  * 
  * You can checkout my other projects at https://github.com/JonathanBenz, or visit my website at https://sites.google.com/view/jonathan-benz! 
  */
 
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <thread>
 #include <vector>
 #include <glad/glad.h>    // For getting OpenGL function pointers from drivers
 #include <GLFW/glfw3.h>   // Windowing and User Input
@@ -23,25 +43,42 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/constants.hpp>
-#include "SimplexNoise.h" // Sbastien Rombauts' SimplexNoise implementation: https://github.com/SRombauts/SimplexNoise
 #include "shader.h"       // Helper Class for binding shaders and updating Uniforms
 #include "texture.h"      // Helper Class for loading textures and creating textures
 #include "mesh.h"
+#include "terrainGenerator.h" // CPU and compute shader heightmap/ normal map generation
+#include "jobSystem.h"        // Worker threads + dependency graph used for startup
+#include "simulation.h"       // Camera/ sun simulation thread
+#include "frameArena.h"       // Per-frame bump allocator for transient CPU data
+#include "memoryTracker.h"    // CPU allocation/ GPU resource accounting
+#include "frameCapture.h"     // Non-blocking screenshots and frame capture
+#include "posterRenderer.h"    // Tiled rendering of images larger than the framebuffer
+#include "terrainFarm.h"      // Batch height/ normal map generation without a window
+#include "demImporter.h"      // Real-world elevation data in place of the generated height map
+#include "virtualTexture.h"   // Diffuse textures streamed in as pages within a fixed memory budget
+#include "textureManager.h"   // Diffuse texture resolution picked from a memory budget
+#include "materialLayers.h"   // Terrain materials and the splat map that blends them
+#include "slopeUvMap.h"       // Material coordinates that follow the terrain's slopes
+#include "deferredShading.h"  // G-buffer and lighting pass for the terrain
+#include "terrainTessellation.h" // Displaced patches in place of the parallax march
+#include "rtinMesher.h"          // Or an adaptive triangle mesh of the height map
+#include "terrainQuery.h"        // Height, normal and ray queries against the terrain on the CPU
+#include "terrainScatter.h"      // Rocks and trees placed on the terrain by height and slope rules
+#include "instanceRenderer.h"    // And drawn, instanced per chunk with levels of detail and impostors
 
 // ------------------------------------ Prototype Functions -------------------------------------------------------
 int Init();
-void ProcessInput(GLFWwindow* window);
-float FBM(float x, float y, int octaves, float lacunarity, float persistence);
-std::vector<unsigned char> GenerateHeightMap(int textureSize, float scale = 0.005f, int octaves = 6, float persistence = 0.5f, float lacunarity = 2.0f);
-std::vector<glm::vec3> GenerateNormalMap(const std::vector<unsigned char>& heightMap, int textureSize);
-float EaseInOutSine(float x);
+void ProcessInput(GLFWwindow* window, InputState& inputState);
+void GenerateTerrain(ComputeTerrain& computeTerrain, Texture& heightMapTexture, Texture& normalMapTexture);
+void LoadTextureAsync(JobSystem& jobSystem, Texture& texture, Image& image, const char* path, bool clamp = false);
 void RenderPostProcessQuad();
-void RenderProceduralTerrain(Shader& proceduralTerrain, glm::mat4& projection, glm::mat4& view, Texture& diffuseMapTextureRocks, Texture& diffuseMapTextureSnow, Texture& normalMapTexture, Texture& heightMapTexture, Mesh& terrainMesh);
-void RenderSun(Shader& sunShader, glm::mat4& projection, glm::mat4& view, glm::mat4& model, Mesh& sun);
-void RenderSkybox(Shader& skyboxShader, glm::mat4& view, glm::mat4& projection, Mesh& skybox, Texture& skyboxTexture);
-void AnimateSun(Shader& sunShader);
+void RenderProceduralTerrain(const FrameState& frame, Shader& proceduralTerrain, glm::mat4& projection, glm::mat4& view, Texture& materialAlbedoTexture, SplatMap& splatMap, SlopeUvMap& slopeUvMap, Texture& normalMapTexture, Texture& heightMapTexture, VirtualTexture& virtualTexture, Mesh& terrainMesh, const TerrainTessellation* tessellation = nullptr);
+void RenderDeferredLighting(const FrameState& frame, Shader& deferredLightingShader, const glm::mat4& projection, const glm::mat4& view, DeferredShading& deferredShading);
+void RenderSun(const FrameState& frame, Shader& sunShader, glm::mat4& projection, glm::mat4& view, glm::mat4& model, Mesh& sun);
+void RenderSkybox(const FrameState& frame, Shader& skyboxShader, glm::mat4& view, glm::mat4& projection, Mesh& skybox, Texture& skyboxTexture);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 // ----------------------------------------------------------------------------------------------------------------
 
 // ------------------------------------ Global Variables ----------------------------------------------------------
@@ -50,74 +87,281 @@ const unsigned int SCR_WIDTH = 1920;
 const unsigned int SCR_HEIGHT = 1080;
 GLFWwindow* window = nullptr;
 
-// --- Camera Settings
-glm::vec3 cameraPos = glm::vec3(-3.08f, 3.07f, 3.26f);
-glm::vec3 cameraFront = glm::vec3(0.51f, -0.66f, -0.55f);
-glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
-bool firstMouse = true;                                    // To prevent huge jump on screen when first starting program
-float pitch = -45.0f;                                      // Up-Down camera rotation (around the X-axis)
-float yaw = -45.0f;                                        // Left-Right camera rotation (around the Y-axis). Init to face forward. 
-float lastX = SCR_WIDTH / 2.0f, lastY = SCR_HEIGHT / 2.0f; // Init to middle of the screen
-float FOV = 50.0f;                                         // Default FOV value
-float cameraSpeed = 2.5f;
-float cameraSensitivity = 0.1f;
+// --- Input (the camera itself lives on the simulation thread)
+bool bHasCursor = false; // Latest cursor position, forwarded to the simulation every frame
+double cursorX = 0.0, cursorY = 0.0;
 
 // --- Delta Time 
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
-float timer = 0.0f;
+
+// --- Memory Accounting
+const char* memoryReportPath = nullptr; // --memory-report <path>, written on exit
+size_t memoryBudgetBytes = 0;           // --memory-budget-mb <N>, 0 means no budget
+bool bMemoryReportRequested = false;    // F9
+const float memoryOverlayInterval = 0.5f;
+
+// --- Frame Capture
+CaptureFormat captureFormat = CaptureFormat::Png; // --capture-format png|raw
+std::string capturePrefix = "capture_";           // --capture-prefix <path prefix>
+bool bScreenshotRequested = false;                // F12
+bool bToggleContinuousCapture = false;            // F11
+const char* videoPath = nullptr;                  // --y4m <path|->, records every frame from startup as a Y4M stream
+int videoFramesPerSecond = 60;                    // --y4m-fps <N>
+
+// --- Poster Rendering (--poster <W>x<H> <path.ppm>, renders the start view and exits)
+const char* posterPath = nullptr;
+int posterWidth = 0, posterHeight = 0;
+int posterMargin = 64; // --poster-margin <N>, overlap between tiles in pixels. Has to cover the bloom blur's reach
+
+// --- Terrain Farm (--farm <job list>, writes the maps of every job to disk and exits without opening a window)
+const char* farmJobsPath = nullptr;
+TerrainFarmSettings farmSettings; // --farm-out <dir>, --farm-workers <N>, --farm-max-in-flight <N>, --farm-memory-mb <N>
 
 // --- Terrain Params
+const int textureSize = 512;
+bool bUseComputeTerrain = true;  // Generate the height/ normal maps with compute shaders instead of on the CPU (toggle with C)
+bool bRegenerateTerrain = false; // Set by the key callback, handled at the start of the next frame
+glm::vec2 terrainOffset(0.0f);   // Offset into noise space, R picks a new one
+const char* demPath = nullptr;   // --dem <path.raw|.r16|.pgm|.png>, use real elevation data instead of noise
+DemRawLayout demRawLayout;       // --dem-size <W>x<H> and --dem-format u16le|u16be|u8 for headerless files
+std::vector<unsigned char> demHeightMap; // The DEM resampled to textureSize, regenerating terrain only rebuilds the normals
+const char* demPackPath = nullptr; // --dem-pack <out.thm>, compress the DEM's pyramid into a height container and exit
+int demPackMaxError = 0;           // --dem-pack-error <N>, allowed error per sample in the container, 0 is lossless
+bool bVirtualTexturing = false;    // --virtual-texturing, stream the diffuse textures in as pages instead of loading them whole
+size_t virtualTextureBudgetBytes = 32 * 1024 * 1024; // --vt-budget-mb <N>, size of the page atlas
+const int virtualTextureFeedbackDivisor = 8;         // The feedback pass renders at 1/8th of the screen's width and height
+size_t textureBudgetBytes = 0;     // --texture-budget-mb <N>, GPU memory for the diffuse textures' resolution tiers, 0 means no limit
 const float scaleAmt = 2.0f; // scale in the xy-direction
 const float heightScale = 0.15f;
-const float snowThreshold = 0.69f;
+bool bSlopeAwareUVs = true;  // --planar-uvs turns it off, U toggles it
+bool bParallaxDepth = true;  // Depth, light and fog at the parallax mapped surface rather than the flat quad. --flat-terrain-depth turns it off
+bool bDepthPrepass = false;  // --depth-prepass, lay down the terrain's depth before shading anything
+enum class TerrainGeometry { Parallax, Tessellated, RtinMesh };
+TerrainGeometry terrainGeometry = TerrainGeometry::Parallax; // --tessellation or --rtin-mesh, T cycles through them
+CameraMode cameraMode = CameraMode::Free; // --camera <free|fly|walk>, F cycles through them
+float tessellationPixelError = 1.0f; // --tess-pixel-error <N>, how far (in pixels) the tessellated surface may stray from the height map
+float rtinMaxError = 2.0f;           // --rtin-error <N>, how far (in height map steps) the RTIN mesh may stray from the height map
+const float snowThreshold = 0.69f; // Snow starts at 31% of the way up, see materialLayers below
+
+// --- Material Layers, bottom first: each covers the ones below it where its rules hold (see materialLayers.h)
+const std::vector<MaterialLayer> materialLayers =
+{
+	{ "textures/aerial_rocks/aerial_rocks_04_diff_8k.jpg", MaterialRule(), MaterialRule(), MaterialRule() },
+	// Snow: on the peaks, sliding off faces steeper than ~50 degrees, and blown off sharp ridges
+	{ "textures/snow/snow_field_aerial_diff_8k.jpg", MaterialRule(1.0f - snowThreshold, 1.0f), MaterialRule(62.0f, 50.0f), MaterialRule(-0.03f, -0.01f) },
+};
+
+// --- Scatter Layers: instances placed with at least `spacing` between them where their rules hold (see terrainScatter.h)
+uint32_t scatterSeed = 1; // --scatter-seed <N>, the same seed on the same terrain places the same instances
+const std::vector<ScatterLayer> scatterLayers =
+{
+	// Rocks: anywhere but sheer faces
+	{ "rocks", 0.03f, MaterialRule(), MaterialRule(60.0f, 45.0f), 0.5f, 1.0f },
+	// Trees: on gentle slopes, thinning out towards the snow line
+	{ "trees", 0.012f, MaterialRule(1.0f - snowThreshold, 1.0f - snowThreshold - 0.1f), MaterialRule(35.0f, 20.0f), 0.7f, 1.0f },
+};
+size_t instanceVertexBudget = 2000000; // --instance-vertex-budget <N>, vertices the scattered instances may take per frame
 const float fogDensity = 0.1f;
 glm::vec3 fogColor(0.8f, 0.8f, 0.8f);
 
 // --- Lighting Params
 const float gaussianBlurIntensity = 10.0f;
-const float bloomFactor = 5.0f;
-const glm::vec3 WHITE = glm::vec3(1.0f, 0.85f, 0.55f) * bloomFactor;
-const glm::vec3 ORANGE = glm::vec3(1.0f, 0.5f, 0.05f) * bloomFactor;
-glm::vec3 lightPos(0.0f, 0.1f, 0.0f);
 glm::vec3 lightAmbience(0.1f, 0.05f, 0.35f);
 glm::vec3 lightDiffuse = WHITE;
 glm::vec3 lightSpecular = glm::vec3(0.9f, 0.7f, 0.4f) * bloomFactor;
-const float maxExposure = 0.75f;
-const float minExposure = 0.05f;
-float exposure = maxExposure;
-
-// --- Sun Params
-const float sunRadius = 1.7f; // Radius of orbit from center
-float sunDesiredSpeed = 0.4f; // The speed we want to lerp to
-float sunAngle = 999.99f;     // Default init value
-float sunVel = 0.0f;          // Sun's speed + direction
-float idleTime = 1.0f;
-const bool bIsSunStationary = false;
-bool bReverseSun = false;
-bool bWaiting = false;
+bool bDeferredShading = false; // --deferred, G toggles it. The G-buffer is allocated the first time it is used
+const std::vector<FillLight> fillLights = // Deferred shading only, at most MAX_FILL_LIGHTS
+{
+	{ glm::normalize(glm::vec3(-0.4f, 1.0f, 0.6f)), glm::vec3(0.1f, 0.15f, 0.4f) }, // Moonlight, high up and away from the sun's path
+};
 // ----------------------------------------------------------------------------------------------------------------
 
-int main()
+int main(int argc, char** argv)
 {
+	bool bVerifyComputeTerrain = false;
+	bool bVerifyVertexPacking = false;
+	bool bVerifyTerrainQuery = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--cpu-terrain") bUseComputeTerrain = false;
+		else if (arg == "--verify-compute-terrain") bVerifyComputeTerrain = true;
+		else if (arg == "--verify-vertex-packing") bVerifyVertexPacking = true;
+		else if (arg == "--verify-terrain-query") bVerifyTerrainQuery = true;
+		else if (arg == "--memory-report" && i + 1 < argc) memoryReportPath = argv[++i];
+		else if (arg == "--memory-budget-mb" && i + 1 < argc) memoryBudgetBytes = std::stoul(argv[++i]) * 1024 * 1024;
+		else if (arg == "--capture-format" && i + 1 < argc) captureFormat = std::string(argv[++i]) == "raw" ? CaptureFormat::Raw : CaptureFormat::Png;
+		else if (arg == "--capture-prefix" && i + 1 < argc) capturePrefix = argv[++i];
+		else if (arg == "--y4m" && i + 1 < argc) videoPath = argv[++i];
+		else if (arg == "--y4m-fps" && i + 1 < argc) videoFramesPerSecond = std::stoi(argv[++i]);
+		else if (arg == "--poster" && i + 2 < argc && std::sscanf(argv[i + 1], "%dx%d", &posterWidth, &posterHeight) == 2) { posterPath = argv[i + 2]; i += 2; }
+		else if (arg == "--poster-margin" && i + 1 < argc) posterMargin = std::stoi(argv[++i]);
+		else if (arg == "--dem" && i + 1 < argc) demPath = argv[++i];
+		else if (arg == "--dem-size" && i + 1 < argc) std::sscanf(argv[++i], "%dx%d", &demRawLayout.width, &demRawLayout.height);
+		else if (arg == "--dem-format" && i + 1 < argc)
+		{
+			std::string format = argv[++i];
+			demRawLayout.format = format == "u8" ? DemSampleFormat::U8 : format == "u16be" ? DemSampleFormat::U16BE : DemSampleFormat::U16LE;
+		}
+		else if (arg == "--dem-pack" && i + 1 < argc) demPackPath = argv[++i];
+		else if (arg == "--dem-pack-error" && i + 1 < argc) demPackMaxError = std::stoi(argv[++i]);
+		else if (arg == "--virtual-texturing") bVirtualTexturing = true;
+		else if (arg == "--vt-budget-mb" && i + 1 < argc) virtualTextureBudgetBytes = std::stoul(argv[++i]) * 1024 * 1024;
+		else if (arg == "--planar-uvs") bSlopeAwareUVs = false;
+		else if (arg == "--deferred") bDeferredShading = true;
+		else if (arg == "--flat-terrain-depth") bParallaxDepth = false;
+		else if (arg == "--depth-prepass") bDepthPrepass = true;
+		else if (arg == "--tessellation") terrainGeometry = TerrainGeometry::Tessellated;
+		else if (arg == "--tess-pixel-error" && i + 1 < argc) tessellationPixelError = std::stof(argv[++i]);
+		else if (arg == "--rtin-mesh") terrainGeometry = TerrainGeometry::RtinMesh;
+		else if (arg == "--rtin-error" && i + 1 < argc) rtinMaxError = std::stof(argv[++i]);
+		else if (arg == "--scatter-seed" && i + 1 < argc) scatterSeed = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--instance-vertex-budget" && i + 1 < argc) instanceVertexBudget = std::stoul(argv[++i]);
+		else if (arg == "--camera" && i + 1 < argc)
+		{
+			std::string mode = argv[++i];
+			cameraMode = mode == "walk" ? CameraMode::Walk : mode == "fly" ? CameraMode::Fly : CameraMode::Free;
+		}
+		else if (arg == "--texture-budget-mb" && i + 1 < argc) textureBudgetBytes = std::stoul(argv[++i]) * 1024 * 1024;
+		else if (arg == "--farm" && i + 1 < argc) farmJobsPath = argv[++i];
+		else if (arg == "--farm-out" && i + 1 < argc) farmSettings.outputDirectory = argv[++i];
+		else if (arg == "--farm-workers" && i + 1 < argc) farmSettings.workerCount = std::stoul(argv[++i]);
+		else if (arg == "--farm-max-in-flight" && i + 1 < argc) farmSettings.maxMapsInFlight = std::stoul(argv[++i]);
+		else if (arg == "--farm-memory-mb" && i + 1 < argc) farmSettings.memoryBudgetBytes = std::stoul(argv[++i]) * 1024 * 1024;
+	}
+
+	// Round trip terrain vertices through their 16 byte packing and exit, no GL context needed
+	if (bVerifyVertexPacking)
+		return VerifyVertexPacking() ? 0 : 1;
+	// Likewise the CPU terrain queries against a brute force march
+	if (bVerifyTerrainQuery)
+		return VerifyTerrainQuery(textureSize) ? 0 : 1;
+
+	// Packing a DEM is CPU only as well
+	if (demPath && demPackPath)
+	{
+		JobSystem jobSystem(std::max(1u, std::thread::hardware_concurrency()));
+		DemPyramid dem;
+		if (!dem.Open(demPath, demRawLayout)) return -1;
+		jobSystem.Wait(dem.ScheduleBuild(jobSystem));
+		if (!dem.WriteContainer(demPackPath, jobSystem, demPackMaxError)) return -1;
+		BenchmarkHeightContainer(demPackPath, jobSystem);
+		return 0;
+	}
+
+	// Batch terrain generation runs entirely on the CPU, no window or GL context
+	if (farmJobsPath)
+	{
+		std::vector<TerrainFarmJob> farmJobs;
+		if (!ParseTerrainFarmJobs(farmJobsPath, farmJobs)) return -1;
+		return RunTerrainFarm(farmJobs, farmSettings) == 0 ? 0 : -1;
+	}
+
+	// When the video goes to stdout, keep log output out of the stream
+	if (videoPath && std::string(videoPath) == "-")
+		std::cout.rdbuf(std::cerr.rdbuf());
+
 	// Initialize GLFW window and GLAD function pointers. Exit out of program early and terminate if -1 is returned
 	if (Init() == -1) return -1;
+
+	// Compare the compute shader terrain against the CPU path and exit
+	if (bVerifyComputeTerrain)
+	{
+		bool bPassed = VerifyComputeTerrainParity(textureSize);
+		glfwTerminate();
+		return bPassed ? 0 : 1;
+	}
 	
-	// --------------------------------- TEXTURES -----------------------------------------------------------------
-	// Generate a heightmap
-	int textureSize = 512;
-	std::vector<unsigned char> simplexHeightMap = GenerateHeightMap(textureSize);
-	Texture heightMapTexture(simplexHeightMap, textureSize);
+	// ------------------------------- STARTUP JOBS ---------------------------------------------------------------
+	// Everything below is scheduled as a dependency graph: decoding and CPU generation run on worker threads while this
+	// (the GL context) thread compiles shaders and uploads each texture as soon as its data is ready.
+	double startupTime = glfwGetTime();
+	JobSystem jobSystem;
 
-	// Generate a normal map
-	std::vector<glm::vec3> normalMap = GenerateNormalMap(simplexHeightMap, textureSize);
-	Texture normalMapTexture(normalMap, textureSize);
+	// --------------------------------- TEXTURES -----------------------------------------------------------------
+	// Generate a heightmap and normal map (storage is shared by the CPU and compute shader paths)
+	std::unique_ptr<ComputeTerrain> computeTerrain;
+	Texture heightMapTexture, normalMapTexture;
+	std::vector<unsigned char> simplexHeightMap;
+	std::vector<glm::vec3> normalMap;
+	JobHandle terrainStorageJob = jobSystem.ScheduleOnMainThread([&]
+	{
+		computeTerrain.reset(new ComputeTerrain());
+		heightMapTexture = Texture(textureSize, GL_R8);
+		normalMapTexture = Texture(textureSize, GL_RGBA32F);
+		if (bUseComputeTerrain && !demPath)
+			GenerateTerrain(*computeTerrain, heightMapTexture, normalMapTexture);
+	});
+	JobHandle heightMapReady = terrainStorageJob;
+	DemPyramid dem;
+	if (demPath)
+	{
+		// Mip levels are built (or found in the cache) on the workers, then the DEM is resampled and the normals derived as usual
+		if (!dem.Open(demPath, demRawLayout))
+		{
+			glfwTerminate();
+			return -1;
+		}
+		JobHandle resampleJob = dem.ScheduleResample(jobSystem, textureSize, demHeightMap, { dem.ScheduleBuild(jobSystem) });
+		heightMapReady = jobSystem.ScheduleOnMainThread([&]
+		{
+			// Nothing to show from a corrupt container: close the window and fail the run
+			if (dem.ResampleFailed())
+			{
+				glfwSetWindowShouldClose(window, true);
+				return;
+			}
+			GenerateTerrain(*computeTerrain, heightMapTexture, normalMapTexture);
+		}, { resampleJob, terrainStorageJob });
+	}
+	else if (!bUseComputeTerrain)
+	{
+		JobHandle heightMapJob = jobSystem.Schedule([&] { simplexHeightMap = GenerateHeightMap(textureSize, 0.005f, 6, 0.5f, 2.0f, terrainOffset); });
+		JobHandle normalMapJob = jobSystem.Schedule([&] { normalMap = GenerateNormalMap(simplexHeightMap, textureSize); }, { heightMapJob });
+		heightMapReady = jobSystem.ScheduleOnMainThread([&] { heightMapTexture.Upload(simplexHeightMap, textureSize); }, { heightMapJob, terrainStorageJob });
+		jobSystem.ScheduleOnMainThread([&] { normalMapTexture.Upload(normalMap, textureSize); }, { normalMapJob, terrainStorageJob });
+	}
 
-	// Load diffuse textures
-	Texture diffuseMapTextureRocks("textures/aerial_rocks/aerial_rocks_04_diff_8k.jpg");
-	Texture diffuseMapTextureSnow("textures/snow/snow_field_aerial_diff_8k.jpg");
+	// The splat map, the slope-aware material coordinates, the tessellation's patch errors, the RTIN mesh and the CPU height
+	// field (and the instances scattered on it) are derived from the finished height map, whichever path produced it
+	SplatMap splatMap;
+	SlopeUvMap slopeUvMap;
+	TerrainTessellation terrainTessellation;
+	RtinMesher rtinMesher;
+	TerrainQuery terrainQuery;
+	TerrainScatter terrainScatter;
+	// The height map is read back once (on the GL thread) and the same bytes handed to all of them
+	auto DeriveFromHeightMap = [&]
+	{
+		MemoryScope memoryScope(MemorySubsystem::Terrain);
+		SharedHeightMap heightMap = heightMapTexture.Download(textureSize);
+		splatMap.Generate(jobSystem, heightMap, textureSize, heightScale, materialLayers);
+		slopeUvMap.Generate(jobSystem, heightMap, textureSize, heightScale);
+		terrainTessellation.Analyze(jobSystem, heightMap, textureSize, heightScale, 2.0f * scaleAmt);
+		rtinMesher.Generate(jobSystem, heightMap, textureSize, heightScale, rtinMaxError);
+		JobHandle heightFieldReady = terrainQuery.Build(jobSystem, heightMap, textureSize, 2.0f * scaleAmt, heightScale * 2.0f * scaleAmt);
+		terrainScatter.Generate(jobSystem, terrainQuery.Building(), heightFieldReady, scatterLayers, scatterSeed);
+	};
+	jobSystem.ScheduleOnMainThread(DeriveFromHeightMap, { heightMapReady });
+
+	// Load the material layers' albedo as one texture array (its lowest resolution now, higher ones as the budget allows once
+	// running), or open them as a virtual texture (its pages are built on the workers the first time)
+	Texture materialAlbedoTexture;
+	std::vector<std::string> materialAlbedoPaths;
+	for (const MaterialLayer& layer : materialLayers)
+		materialAlbedoPaths.push_back(layer.albedoPath);
+	TextureManager textureManager(jobSystem, textureBudgetBytes, memoryBudgetBytes);
+	VirtualTexture virtualTexture(jobSystem);
+	if (bVirtualTexturing && !virtualTexture.Open(materialAlbedoPaths,
+		virtualTextureBudgetBytes, SCR_WIDTH / virtualTextureFeedbackDivisor, SCR_HEIGHT / virtualTextureFeedbackDivisor, virtualTextureFeedbackDivisor))
+		std::cerr << "ERROR: Virtual texturing is unavailable, loading the whole textures instead" << std::endl;
+	if (!virtualTexture.IsOpen())
+	{
+		textureManager.LoadArray(materialAlbedoTexture, materialAlbedoPaths);
+	}
 
-	// Load cubemap skybox texture
+	// Load cubemap skybox texture (one decode job per face, a single upload once all six are done)
 	std::vector<std::string> faces
 	{
 		std::string("textures/skybox/right.png"),
@@ -127,23 +371,46 @@ int main()
 		std::string("textures/skybox/front.png"),
 		std::string("textures/skybox/back.png")
 	};
-	Texture skyboxTexture(faces);
+	Texture skyboxTexture;
+	std::vector<Image> faceImages(faces.size());
+	std::vector<JobHandle> faceJobs;
+	for (size_t i = 0; i < faces.size(); ++i)
+		faceJobs.push_back(jobSystem.Schedule([&, i] { faceImages[i] = DecodeImage(faces[i].c_str(), false, 4); }));
+	jobSystem.ScheduleOnMainThread([&]
+	{
+		skyboxTexture = Texture(faceImages);
+		for (Image& image : faceImages)
+			FreeImage(image);
+	}, faceJobs);
 	
 	// Load lens flare textures
-	Texture colorGradientTex("textures/lens_flare/colorGradient.png", true);
-	Texture lensDirtTex("textures/lens_flare/lensDirt.png", true);
-	Texture starBurstTex("textures/lens_flare/starBurst.png");
+	Texture colorGradientTex, lensDirtTex, starBurstTex;
+	Image colorGradientImage, lensDirtImage, starBurstImage;
+	LoadTextureAsync(jobSystem, colorGradientTex, colorGradientImage, "textures/lens_flare/colorGradient.png", true);
+	LoadTextureAsync(jobSystem, lensDirtTex, lensDirtImage, "textures/lens_flare/lensDirt.png", true);
+	LoadTextureAsync(jobSystem, starBurstTex, starBurstImage, "textures/lens_flare/starBurst.png");
 	// -----------------------------------------------------------------------------------------------------------
 
 	// --------------------------------- SHADERS -----------------------------------------------------------------
-	// --- Build and compile shaders
-	Shader proceduralTerrain("shaders/procTerrain.VERT", "shaders/procTerrain.FRAG");
-	Shader skyboxShader("shaders/skybox.VERT", "shaders/skybox.FRAG");
-	Shader sunShader("shaders/sun.VERT", "shaders/sun.FRAG");
-	Shader downSampleShader("shaders/downSample.VERT", "shaders/downSample.FRAG");
-	Shader blurShader("shaders/gaussianBlur.VERT", "shaders/gaussianBlur.FRAG");
-	Shader postProcessShader("shaders/postProcess.VERT", "shaders/postProcess.FRAG");
+	// --- Build and compile shaders (on this thread, while the workers decode)
+	Shader proceduralTerrain, tessellatedTerrain, meshTerrain, deferredLightingShader, skyboxShader, sunShader, downSampleShader, blurShader, postProcessShader;
+	Shader instanceShader, impostorShader, impostorBakeShader;
+	jobSystem.ScheduleOnMainThread([&] { proceduralTerrain = Shader("shaders/procTerrain.VERT", "shaders/procTerrain.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { tessellatedTerrain = Shader("shaders/procTerrainTess.VERT", "shaders/procTerrainTess.TESC", "shaders/procTerrainTess.TESE", "shaders/procTerrain.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { meshTerrain = Shader("shaders/procTerrain.VERT", "shaders/procTerrain.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { deferredLightingShader = Shader("shaders/deferredLighting.VERT", "shaders/deferredLighting.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { skyboxShader = Shader("shaders/skybox.VERT", "shaders/skybox.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { sunShader = Shader("shaders/sun.VERT", "shaders/sun.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { downSampleShader = Shader("shaders/downSample.VERT", "shaders/downSample.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { blurShader = Shader("shaders/gaussianBlur.VERT", "shaders/gaussianBlur.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { postProcessShader = Shader("shaders/postProcess.VERT", "shaders/postProcess.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { instanceShader = Shader("shaders/instance.VERT", "shaders/instance.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { impostorShader = Shader("shaders/impostor.VERT", "shaders/impostor.FRAG"); });
+	jobSystem.ScheduleOnMainThread([&] { impostorBakeShader = Shader("shaders/impostorBake.VERT", "shaders/impostorBake.FRAG"); });
 	// -----------------------------------------------------------------------------------------------------------
+
+	jobSystem.WaitAll();
+	std::cout << "Startup jobs finished in " << (glfwGetTime() - startupTime) * 1000.0 << " ms using " << jobSystem.WorkerCount() << " worker threads" << std::endl;
 	
 	// ----------------------------- BUFFERS, MESH CREATION ------------------------------------------------------
 	// --- Generate VBOs and VAOs for terrain, the skybox, and the spherical sun
@@ -151,6 +418,11 @@ int main()
 	Mesh skybox(skyboxShader, MeshType::Skybox);
 	Mesh sun(sunShader, MeshType::Sun);
 
+	// --- The scatter layers' models (in scatterLayers' order) and their impostors, baked here once
+	InstanceRenderer instanceRenderer;
+	if (!instanceRenderer.Create({ BuildRockMesh(), BuildTreeMesh() }, impostorBakeShader))
+		std::cerr << "ERROR: Scattered instances won't be drawn" << std::endl;
+
 	// --- Setup HDR framebuffer
 	unsigned int hdrFBO;
 	glGenFramebuffers(1, &hdrFBO);
@@ -166,12 +438,17 @@ int main()
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorBuffer[i], 0);
+		TrackGpuResource(GpuResourceType::Texture, colorBuffer[i], TextureByteSize(SCR_WIDTH, SCR_HEIGHT, GL_RGBA16F), "HDR color buffer");
 	}
-	unsigned int rboDepth; // create depth buffer (renderbuffer)
-	glGenRenderbuffers(1, &rboDepth);
-	glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth); // attach the texture and render buffers together
+	unsigned int sceneDepthTexture; // create depth buffer (a texture, so the deferred lighting pass can read it)
+	glGenTextures(1, &sceneDepthTexture);
+	glBindTexture(GL_TEXTURE_2D, sceneDepthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, SCR_WIDTH, SCR_HEIGHT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	TrackGpuResource(GpuResourceType::Texture, sceneDepthTexture, TextureByteSize(SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_COMPONENT24), "HDR depth buffer");
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, sceneDepthTexture, 0); // attach the color and depth textures together
+	DeferredShading deferredShading; // Shares the depth texture
 	unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
 	glDrawBuffers(2, attachments); 
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
@@ -200,6 +477,7 @@ int main()
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); // we clamp to the edge as the blur filter would otherwise sample repeated texture values!
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pingpongColorbuffers[i], 0);
+		TrackGpuResource(GpuResourceType::Texture, pingpongColorbuffers[i], TextureByteSize(SCR_WIDTH, SCR_HEIGHT, GL_RGBA16F), "blur ping-pong buffer");
 		// also check if framebuffers are complete (no need for depth buffer)
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "Framebuffer not complete!" << std::endl;
@@ -220,6 +498,7 @@ int main()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, downSampledTex, 0);
+	TrackGpuResource(GpuResourceType::Texture, downSampledTex, TextureByteSize(SCR_WIDTH / downSampleFactor, SCR_HEIGHT / downSampleFactor, GL_RGBA16F), "downsampled bright pass");
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		std::cout << "Flare framebuffer not complete!" << std::endl;
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -228,25 +507,54 @@ int main()
 	// -----------------------------------------------------------------------------------------------------------
 
 	// --- Init one-time Uniform values 
-	// Set terrain
-	proceduralTerrain.use();
-	proceduralTerrain.setInt("rocksDiffuseMap", 0);
-	proceduralTerrain.setInt("snowDiffuseMap", 1);
-	proceduralTerrain.setInt("normalMap", 2);
-	proceduralTerrain.setInt("depthMap", 3);
-	proceduralTerrain.setFloat("heightScale", heightScale);
-	proceduralTerrain.setFloat("snowThreshold", snowThreshold);
-	proceduralTerrain.setFloat("fogDensity", fogDensity);
-	proceduralTerrain.setVec3("fogColor", fogColor);
+	// Set terrain (both ways of drawing it share procTerrain.FRAG)
 	// Rotate terrain to lay flat on the XY-plane
 	glm::mat4 model = glm::mat4(1.0f);
 	model = glm::rotate(model, glm::radians(270.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 	model = glm::scale(model, glm::vec3(scaleAmt, scaleAmt, scaleAmt));
-	proceduralTerrain.setMat4("model", model);
-	// Set lighting 
-	proceduralTerrain.setVec3("light.ambient", lightAmbience);
-	proceduralTerrain.setVec3("light.diffuse", lightDiffuse);
-	proceduralTerrain.setVec3("light.specular", lightSpecular);
+	const glm::mat4 terrainModel = model; // RenderSun reuses model for the sun
+	for (Shader* terrainShader : { &proceduralTerrain, &tessellatedTerrain, &meshTerrain })
+	{
+		terrainShader->use();
+		terrainShader->setInt("materialAlbedo", 0);
+		terrainShader->setInt("splatMap", 1);
+		terrainShader->setInt("normalMap", 2);
+		terrainShader->setInt("depthMap", 3);
+		terrainShader->setInt("pageTable", 4);     // Set even without virtual texturing: samplers of different types can't share a unit
+		terrainShader->setInt("physicalPages", 5);
+		terrainShader->setInt("slopeUvMap", 6);
+		terrainShader->setFloat("heightScale", heightScale);
+		terrainShader->setFloat("terrainSize", 2.0f * scaleAmt); // The quad spans -1..1 before scaling
+		terrainShader->setFloat("fogDensity", fogDensity);
+		terrainShader->setVec3("fogColor", fogColor);
+		terrainShader->setMat4("model", model);
+		// Set lighting
+		terrainShader->setVec3("light.ambient", lightAmbience);
+		terrainShader->setVec3("light.diffuse", lightDiffuse);
+		terrainShader->setVec3("light.specular", lightSpecular);
+		terrainShader->setVec3("material.specular", terrainMesh.material.specular); // terrainMesh only set them on proceduralTerrain
+		terrainShader->setFloat("material.shininess", terrainMesh.material.shininess);
+		terrainShader->setBool("bDisplacedGeometry", terrainShader != &proceduralTerrain);
+	}
+	tessellatedTerrain.use();
+	tessellatedTerrain.setInt("patchesAcross", textureSize / TESSELLATION_PATCH_TEXELS);
+
+	// Set deferred lighting (the terrain's lighting uniforms, and the fill lights)
+	deferredLightingShader.use();
+	deferredLightingShader.setFloat("fogDensity", fogDensity);
+	deferredLightingShader.setVec3("fogColor", fogColor);
+	deferredLightingShader.setVec3("light.ambient", lightAmbience);
+	deferredLightingShader.setVec3("light.diffuse", lightDiffuse);
+	deferredLightingShader.setVec3("light.specular", lightSpecular);
+	deferredLightingShader.setVec3("material.specular", terrainMesh.material.specular);
+	deferredLightingShader.setFloat("material.shininess", terrainMesh.material.shininess);
+	const int fillLightCount = std::min(static_cast<int>(fillLights.size()), MAX_FILL_LIGHTS);
+	deferredLightingShader.setInt("fillLightCount", fillLightCount);
+	for (int i = 0; i < fillLightCount; ++i)
+	{
+		deferredLightingShader.setVec3("fillLightDirections[" + std::to_string(i) + "]", fillLights[i].direction);
+		deferredLightingShader.setVec3("fillLightColors[" + std::to_string(i) + "]", fillLights[i].color);
+	}
 
 	// Set skybox
 	skyboxShader.use();
@@ -257,6 +565,19 @@ int main()
 	sunShader.setVec3("glowColor", lightDiffuse);
 	sunShader.setFloat("fogDensity", fogDensity);
 	sunShader.setVec3("fogColor", fogColor);
+
+	// Set instances (meshes and impostors alike): the terrain's light and fog, and a dull specular
+	for (Shader* shader : { &instanceShader, &impostorShader })
+	{
+		shader->use();
+		shader->setFloat("fogDensity", fogDensity);
+		shader->setVec3("fogColor", fogColor);
+		shader->setVec3("light.ambient", lightAmbience);
+		shader->setVec3("light.diffuse", lightDiffuse);
+		shader->setVec3("light.specular", lightSpecular);
+		shader->setVec3("material.specular", glm::vec3(0.05f));
+		shader->setFloat("material.shininess", 16.0f);
+	}
 	// -----------------------------------------------------------------------------------------------------------
 
 	// Enable depth testing, MSAA, and gamma correction
@@ -264,30 +585,81 @@ int main()
 	glEnable(GL_MULTISAMPLE);
 	glEnable(GL_FRAMEBUFFER_SRGB);
 
-	// -------------------------------- MAIN RENDER LOOP ---------------------------------------------------------
-	while (!glfwWindowShouldClose(window))
+	// Camera and sun run on their own thread from here on, colliding the camera with the terrain's height field in Fly/ Walk mode
+	Simulation simulation;
+	simulation.SetTerrain(&terrainQuery);
+	simulation.Start();
+
+	// Transient per-frame CPU data (tessellation levels, instance culling results and draw commands) is allocated from here
+	// and released wholesale every frame
+	FrameArena frameArena(1024 * 1024);
+	float lastMemoryOverlay = 0.0f;
+	bool bWarnedOverBudget = false;
+
+	// Screenshots/ frame capture, read back through a PBO ring and written out by worker threads
+	FrameCapture frameCapture(SCR_WIDTH, SCR_HEIGHT, captureFormat, capturePrefix);
+	if (videoPath && frameCapture.OpenVideoStream(videoPath, videoFramesPerSecond))
+		frameCapture.SetContinuous(true);
+
+	// --- One frame: the scene into the HDR framebuffer, bloom, then tonemapping and lens flare into targetFramebuffer.
+	// screenRegion and flareSource only differ from the defaults for poster tiles, see posterRenderer.h.
+	auto RenderFrame = [&](const FrameState& frame, const glm::mat4& cameraProjection, unsigned int targetFramebuffer, const ScreenRegion& screenRegion, unsigned int flareSource, float starburstOffset)
 	{
-		// Calculate delta time
-		float currentFrame = static_cast<float>(glfwGetTime());
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
-		// Get user input
-		ProcessInput(window);
-
-		// ------------------------------ Render stuff here... ---------------------------------------------------
+		glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
 		glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// Render the regular scene into the hdr floating point framebuffer
 		glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+			glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			glm::mat4 projection = glm::perspective(glm::radians(FOV), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-			glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-			RenderProceduralTerrain(proceduralTerrain, projection, view, diffuseMapTextureRocks, diffuseMapTextureSnow, normalMapTexture, heightMapTexture, terrainMesh);
-			RenderSun(sunShader, projection, view, model, sun);
-			RenderSkybox(skyboxShader, view, projection, skybox, skyboxTexture);
-			AnimateSun(sunShader);
+			glm::mat4 projection = cameraProjection;
+			glm::mat4 view = glm::lookAt(frame.cameraPos, frame.cameraPos + frame.cameraFront, frame.cameraUp);
+			const TerrainTessellation* tessellation = nullptr;
+			Mesh* rtinMesh = terrainGeometry == TerrainGeometry::RtinMesh ? rtinMesher.GetMesh() : nullptr;
+			if (terrainGeometry == TerrainGeometry::Tessellated && terrainTessellation.IsReady())
+			{
+				terrainTessellation.Update(projection, view, terrainModel, frame.cameraPos, SCR_HEIGHT, tessellationPixelError, frameArena.Current());
+				tessellation = &terrainTessellation;
+			}
+			Shader& terrainShader = tessellation ? tessellatedTerrain : rtinMesh ? meshTerrain : proceduralTerrain;
+			Mesh& terrainGeometryMesh = rtinMesh ? *rtinMesh : terrainMesh;
+			if (bDepthPrepass)
+			{
+				// The terrain's depth first (the parallax march, no shading), then the sun against it. The terrain's shading
+				// pass then only passes the depth test where it is visible, and the skybox is rejected wherever anything is
+				terrainShader.use();
+				terrainShader.setBool("bDepthOnly", true);
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				RenderProceduralTerrain(frame, terrainShader, projection, view, materialAlbedoTexture, splatMap, slopeUvMap, normalMapTexture, heightMapTexture, virtualTexture, terrainGeometryMesh, tessellation);
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				terrainShader.setBool("bDepthOnly", false);
+				RenderSun(frame, sunShader, projection, view, model, sun);
+				glDepthFunc(GL_LEQUAL);
+				glDepthMask(GL_FALSE);
+			}
+			if (bDeferredShading && !deferredShading.IsCreated() && !deferredShading.Create(SCR_WIDTH, SCR_HEIGHT, sceneDepthTexture))
+				bDeferredShading = false;
+			if (bDeferredShading)
+			{
+				// Parallax and materials into the G-buffer, then lighting and fog once per pixel
+				deferredShading.BeginGeometry(terrainShader);
+				RenderProceduralTerrain(frame, terrainShader, projection, view, materialAlbedoTexture, splatMap, slopeUvMap, normalMapTexture, heightMapTexture, virtualTexture, terrainGeometryMesh, tessellation);
+				deferredShading.EndGeometry(terrainShader, hdrFBO);
+				RenderDeferredLighting(frame, deferredLightingShader, projection, view, deferredShading);
+			}
+			else
+				RenderProceduralTerrain(frame, terrainShader, projection, view, materialAlbedoTexture, splatMap, slopeUvMap, normalMapTexture, heightMapTexture, virtualTexture, terrainGeometryMesh, tessellation);
+			if (bDepthPrepass)
+			{
+				glDepthMask(GL_TRUE);
+				glDepthFunc(GL_LESS);
+			}
+			else
+				RenderSun(frame, sunShader, projection, view, model, sun); // Behind the terrain's depth, so hidden by mountains
+			instanceRenderer.Update(terrainScatter);
+			instanceRenderer.Draw(instanceShader, impostorShader, projection, view, frame.cameraPos, frame.lightPos, SCR_HEIGHT, instanceVertexBudget, frameArena.Current());
+			RenderSkybox(frame, skyboxShader, view, projection, skybox, skyboxTexture);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 		// Downsample the bright pass to a smaller FBO for better performance
@@ -315,7 +687,7 @@ int main()
 			if (first_iteration)
 				first_iteration = false;
 		}
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
 
 		// Render the floating point hdr color buffer to a 2D quad and tonemap the HDR colors in addition to other post-process effects (e.g., lens flare)
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -325,25 +697,176 @@ int main()
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);
 		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, downSampledTex);
+		glBindTexture(GL_TEXTURE_2D, flareSource);
 		glActiveTexture(GL_TEXTURE3);
 		glBindTexture(GL_TEXTURE_2D, colorGradientTex._textureID);
 		glActiveTexture(GL_TEXTURE4);
 		glBindTexture(GL_TEXTURE_2D, lensDirtTex._textureID);
 		glActiveTexture(GL_TEXTURE5);
 		glBindTexture(GL_TEXTURE_2D, starBurstTex._textureID);
-		postProcessShader.setFloat("exposure", exposure);
-		postProcessShader.setFloat("starburstOffset", glfwGetTime() * deltaTime);
+		postProcessShader.setFloat("exposure", frame.exposure);
+		postProcessShader.setFloat("starburstOffset", starburstOffset);
 		postProcessShader.setFloat("aspectRatio", SCR_WIDTH / SCR_HEIGHT);
+		postProcessShader.setVec2("screenOffset", screenRegion.offset);
+		postProcessShader.setVec2("screenScale", screenRegion.scale);
 		RenderPostProcessQuad();
+	};
+
+	// --- The terrain alone, into the virtual texture's feedback buffer (which is bound by the caller)
+	auto RenderVirtualTextureFeedback = [&](const FrameState& frame, const glm::mat4& cameraProjection)
+	{
+		glm::mat4 projection = cameraProjection;
+		glm::mat4 view = glm::lookAt(frame.cameraPos, frame.cameraPos + frame.cameraFront, frame.cameraUp);
+		RenderProceduralTerrain(frame, proceduralTerrain, projection, view, materialAlbedoTexture, splatMap, slopeUvMap, normalMapTexture, heightMapTexture, virtualTexture, terrainMesh);
+	};
+
+	// -------------------------------- POSTER MODE --------------------------------------------------------------
+	if (posterPath)
+	{
+		simulation.frames.Update();
+		FrameState frame = simulation.frames.ReadBuffer();
+		float posterAspect = static_cast<float>(posterWidth) / static_cast<float>(posterHeight);
+
+		// The lens flare mirrors bright spots across the whole screen, which a tile can't see. Render the full view once at the
+		// normal size and let every tile take its flare from that bright pass instead.
+		glm::mat4 fullViewProjection = glm::perspective(glm::radians(frame.FOV), posterAspect, 0.1f, 100.0f);
+		textureManager.FinishUpgrades();
+		frameArena.BeginFrame(); // Every render below is a frame of its own for the arena, like the main loop's
+		virtualTexture.LoadVisiblePages(proceduralTerrain, [&] { RenderVirtualTextureFeedback(frame, fullViewProjection); }, SCR_WIDTH, SCR_HEIGHT);
+		RenderFrame(frame, fullViewProjection, 0, ScreenRegion(), downSampledTex, 0.0f);
+		unsigned int posterFlareTex;
+		glGenTextures(1, &posterFlareTex);
+		glBindTexture(GL_TEXTURE_2D, posterFlareTex);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, SCR_WIDTH / downSampleFactor, SCR_HEIGHT / downSampleFactor);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glCopyImageSubData(downSampledTex, GL_TEXTURE_2D, 0, 0, 0, 0, posterFlareTex, GL_TEXTURE_2D, 0, 0, 0, 0, SCR_WIDTH / downSampleFactor, SCR_HEIGHT / downSampleFactor, 1);
+
+		// Keep tile origins on the bloom downsample grid so neighbouring tiles blur identically
+		posterMargin = (posterMargin + downSampleFactor - 1) / downSampleFactor * downSampleFactor;
+		double posterStartTime = glfwGetTime();
+		bool bPosterWritten = RenderPoster(posterPath, posterWidth, posterHeight, SCR_WIDTH, SCR_HEIGHT, posterMargin, frame.FOV, 0.1f, 100.0f, [&](const PosterTile& tile)
+		{
+			// Tiles zoom in on the view, so each one needs finer pages than the last frame asked for: load them before rendering
+			frameArena.BeginFrame();
+			virtualTexture.LoadVisiblePages(proceduralTerrain, [&] { RenderVirtualTextureFeedback(frame, tile.projection); }, SCR_WIDTH, SCR_HEIGHT);
+			RenderFrame(frame, tile.projection, tile.framebuffer, tile.region, posterFlareTex, 0.0f);
+		});
+		if (bPosterWritten)
+			std::cout << "Poster " << posterWidth << "x" << posterHeight << " written to " << posterPath << " in " << glfwGetTime() - posterStartTime << " s" << std::endl;
+
+		glDeleteTextures(1, &posterFlareTex);
+		instanceRenderer.Shutdown();
+		terrainTessellation.Shutdown();
+		rtinMesher.Shutdown();
+		deferredShading.Shutdown();
+		virtualTexture.Shutdown();
+		textureManager.Shutdown();
+		frameCapture.Shutdown();
+		simulation.Stop();
+		glfwTerminate();
+		return bPosterWritten ? 0 : 1;
+	}
+
+	// -------------------------------- MAIN RENDER LOOP ---------------------------------------------------------
+	while (!glfwWindowShouldClose(window))
+	{
+		// Calculate delta time
+		float currentFrame = static_cast<float>(glfwGetTime());
+		deltaTime = currentFrame - lastFrame;
+		lastFrame = currentFrame;
+		frameArena.BeginFrame();
+		BeginMemoryFrame();
+
+		// Refresh the memory overlay (the window title) a couple of times a second, and warn once if over budget
+		if (currentFrame - lastMemoryOverlay >= memoryOverlayInterval)
+		{
+			lastMemoryOverlay = currentFrame;
+			glfwSetWindowTitle(window, MemoryOverlayText().c_str());
+			MemoryStats memoryStats = GetMemoryStats();
+			if (memoryBudgetBytes && !bWarnedOverBudget && memoryStats.cpuTotalLiveBytes + memoryStats.gpuTotalLiveBytes > memoryBudgetBytes)
+			{
+				std::cout << "WARNING: Memory use is over the " << memoryBudgetBytes / (1024 * 1024) << " MB budget: " << MemoryOverlayText() << std::endl;
+				bWarnedOverBudget = true;
+			}
+		}
+		if (bMemoryReportRequested)
+		{
+			if (WriteMemoryReport("memory_report.json"))
+				std::cout << "Memory report written to memory_report.json" << std::endl;
+			bMemoryReportRequested = false;
+		}
+
+		// Hand the latest input to the simulation thread and pick up its newest snapshot
+		ProcessInput(window, simulation.input.WriteBuffer());
+		simulation.input.Publish();
+		simulation.frames.Update();
+		const FrameState& frame = simulation.frames.ReadBuffer();
+		if (bRegenerateTerrain)
+		{
+			GenerateTerrain(*computeTerrain, heightMapTexture, normalMapTexture);
+			DeriveFromHeightMap();
+			bRegenerateTerrain = false;
+		}
+
+		// ------------------------------ Render stuff here... ---------------------------------------------------
+		glm::mat4 projection = glm::perspective(glm::radians(frame.FOV), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		// Main thread jobs (uploads, the derived terrain data) that became ready since last frame, before anything reads them
+		jobSystem.RunMainThreadJobs();
+		textureManager.Update();
+		if (virtualTexture.IsOpen())
+		{
+			// Upload the pages earlier feedback asked for, then render this frame's feedback (read back in a frame or two)
+			virtualTexture.Update();
+			virtualTexture.BeginFeedback(proceduralTerrain);
+			RenderVirtualTextureFeedback(frame, projection);
+			virtualTexture.EndFeedback(proceduralTerrain, SCR_WIDTH, SCR_HEIGHT);
+		}
+		RenderFrame(frame, projection, 0, ScreenRegion(), downSampledTex, glfwGetTime() * deltaTime);
 		// ----------------------------- Rendering Complete ------------------------------------------------------
+
+		// Kick off this frame's read back (if capturing) and hand finished ones from earlier frames to the encoders
+		if (bScreenshotRequested)
+		{
+			frameCapture.RequestScreenshot();
+			bScreenshotRequested = false;
+		}
+		if (bToggleContinuousCapture)
+		{
+			frameCapture.SetContinuous(!frameCapture.IsContinuous());
+			std::cout << "Continuous capture " << (frameCapture.IsContinuous() ? "started" : "stopped") << std::endl;
+			bToggleContinuousCapture = false;
+		}
+		frameCapture.EndFrame();
 		
 		// Check and call events/ callback functions, then swap the buffer
 		glfwPollEvents();
 		glfwSwapBuffers(window);
 	}
 
+	if (virtualTexture.IsOpen())
+		virtualTexture.PrintStats();
+	else
+		textureManager.PrintStats();
+	terrainTessellation.PrintStats();
+	instanceRenderer.PrintStats();
+	instanceRenderer.Shutdown();
+	terrainTessellation.Shutdown();
+	rtinMesher.Shutdown();
+	deferredShading.Shutdown();
+	virtualTexture.Shutdown();
+	textureManager.Shutdown();
+	frameCapture.Shutdown();
+	simulation.Stop();
+#ifndef NDEBUG
+	frameArena.PrintStats();
+#endif
+	if (memoryReportPath)
+		WriteMemoryReport(memoryReportPath);
 	glfwTerminate();
+	return dem.ResampleFailed() ? 1 : 0;
 }
 
 // ------------------------------------ Functions ----------------------------------------------------------------
@@ -381,120 +904,72 @@ int Init()
 	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 	// Set a callback function for resizing the window
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	glfwSetKeyCallback(window, key_callback);
+	return 0;
 }
 
 /// <summary>
 /// Poll for any of the specified inputs. Mainly used for exiting the program with Escape, controlling the camera with WASD, and to move faster with Left Shift. 
-/// Used with GLFW. 
+/// Used with GLFW, so this has to run on the main thread; the camera itself is moved by the simulation thread.
 /// </summary>
-void ProcessInput(GLFWwindow* window)
+void ProcessInput(GLFWwindow* window, InputState& inputState)
 {
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) // ESC
 		glfwSetWindowShouldClose(window, true);
 
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) // UP
-		cameraPos += cameraFront * cameraSpeed * deltaTime;
-
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) // LEFT
-		cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed * deltaTime;
-
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) // DOWN
-		cameraPos -= cameraFront * cameraSpeed * deltaTime;
-
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) // RIGHT
-		cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed * deltaTime;
-
-	if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) // LEFT SHIFT
-		cameraSpeed = 10.0f;
-	else if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_RELEASE)
-		cameraSpeed = 2.5f;
+	inputState.bForward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS; // UP
+	inputState.bLeft = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;    // LEFT
+	inputState.bBack = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;    // DOWN
+	inputState.bRight = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;   // RIGHT
+	inputState.bSprint = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS; // LEFT SHIFT
+	inputState.cameraMode = cameraMode;
+	inputState.bHasCursor = bHasCursor;
+	inputState.cursorX = cursorX;
+	inputState.cursorY = cursorY;
 }
 
 /// <summary>
-/// Fractional Brownian Motion function. Used to make terrain look less terrible by layering octaves of noise values on top of each other. 
+/// Fill the terrain height and normal map textures, either with the compute shaders or on the CPU followed by an upload.
 /// </summary>
-/// <param name="x"> Heightmap X Value. </param>
-/// <param name="y"> Heightmap Y Value. </param>
-/// <param name="octaves"> Think of this like the layers of an onion bro. </param>
-/// <param name="lacunarity"> Controls increase in frequency between the octaves. </param>
-/// <param name="persistence"> Controls decrease in amplitude between the octaves. </param>
-float FBM(float x, float y, int octaves, float lacunarity, float persistence)
+void GenerateTerrain(ComputeTerrain& computeTerrain, Texture& heightMapTexture, Texture& normalMapTexture)
 {
-	float total = 0.0f;
-	float amplitude = 1.0f;
-	float frequency = 1.0f;
-	float maxValue = 0.0f;
-
-	for (int i = 0; i < octaves; ++i)
+	double startTime = glfwGetTime();
+	if (!demHeightMap.empty())
 	{
-		total += SimplexNoise::noise(x * frequency, y * frequency) * amplitude;
-		maxValue += amplitude;
-
-		amplitude *= persistence;
-		frequency *= lacunarity;
+		heightMapTexture.Upload(demHeightMap, textureSize);
+		if (bUseComputeTerrain)
+			computeTerrain.GenerateNormalMap(heightMapTexture, normalMapTexture, textureSize);
+		else
+			normalMapTexture.Upload(GenerateNormalMap(demHeightMap, textureSize), textureSize);
 	}
-	float fbmValue = total / maxValue; // -1 to 1 range
-
-	return (fbmValue + 1.0f) * 0.5f;  // 0 to 1 range
-}
-
-/// <summary>
-/// Generate a flattened 1D heightmap with 1-byte accuracy. 
-/// </summary>
-/// <param name="textureSize"> The size of one side of a quad texture. E.g., 512 for a 512x512 texture. </param>
-/// <param name="scale"> Amount to scale the noise values by. Scaling down (e.g., using fractional values) will yield smoother results. </param>
-std::vector<unsigned char> GenerateHeightMap(int textureSize, float scale, int octaves, float persistence, float lacunarity)
-{
-	std::vector<unsigned char> heightMap(textureSize * textureSize);
-
-	for (int y = 0; y < textureSize; ++y)
+	else if (bUseComputeTerrain)
 	{
-		for (int x = 0; x < textureSize; ++x)
-		{
-			// Divide int values to small fractional values for better noise results
-			float dx = x * scale;
-			float dy = y * scale;
-			float noiseValue = FBM(dx, dy, octaves, lacunarity, persistence); // Apply fractal brownian motion 
-			heightMap[(y * textureSize) + x] = static_cast<unsigned char>(noiseValue * 255);
-		}
+		computeTerrain.GenerateHeightMap(heightMapTexture, textureSize, 0.005f, 6, 0.5f, 2.0f, terrainOffset);
+		computeTerrain.GenerateNormalMap(heightMapTexture, normalMapTexture, textureSize);
+		glFinish(); // Only so the timing below measures the dispatches
 	}
-	return heightMap;
-}
-
-/// <summary>
-/// Given a height map of 1-byte accuracy, generate a normal map by calculating the partial derivatives at each point of the height map.
-/// Math from this StackOverflow post helped me: https://stackoverflow.com/questions/5281261/generating-a-normal-map-from-a-height-map.
-/// </summary>
-std::vector<glm::vec3> GenerateNormalMap(const std::vector<unsigned char>& heightMap, int textureSize)
-{
-	std::vector<glm::vec3> normalMap(heightMap.size());
-
-	for (int y = 1; y < textureSize - 1; ++y)
+	else
 	{
-		for (int x = 1; x < textureSize - 1; ++x)
-		{
-			float heightLeft = heightMap[y * textureSize + (x - 1)] / 255.0f;
-			float heightRight = heightMap[y * textureSize + (x + 1)] / 255.0f;
-			float heightDown = heightMap[(y + 1) * textureSize + x] / 255.0f;
-			float heightUp = heightMap[(y - 1) * textureSize + x] / 255.0f;
-
-			float dx = heightLeft - heightRight;
-			float dy = heightUp - heightDown;
-
-			glm::vec3 normal = glm::normalize(glm::vec3(dx, dy, 1.0f));
-			normalMap[(y * textureSize) + x] = normal * 0.5f + 0.5f; // normalize between 0-1
-		}
+		std::vector<unsigned char> simplexHeightMap = GenerateHeightMap(textureSize, 0.005f, 6, 0.5f, 2.0f, terrainOffset);
+		std::vector<glm::vec3> normalMap = GenerateNormalMap(simplexHeightMap, textureSize);
+		heightMapTexture.Upload(simplexHeightMap, textureSize);
+		normalMapTexture.Upload(normalMap, textureSize);
 	}
-	return normalMap;
+	std::cout << "Terrain generated on the " << (bUseComputeTerrain ? "GPU" : "CPU") << " in " << (glfwGetTime() - startTime) * 1000.0 << " ms" << std::endl;
 }
 
 /// <summary>
-/// Ease Out function used for linearly interpolating --> glm::mix(a, b, easeInOutSine(x)). 
+/// Schedule a texture load as two jobs: decode the file on a worker, then upload it on the GL thread once decoded.
+/// The image must stay alive until the jobs have run.
 /// </summary>
-/// <param name="x"> Usually will be set to deltaTime. </param>
-float EaseInOutSine(float x) // This website has good references for different easing functions: https://easings.net/#easeInOutSine
+void LoadTextureAsync(JobSystem& jobSystem, Texture& texture, Image& image, const char* path, bool clamp)
 {
-	return -(glm::cos(glm::pi<float>() * x) - 1) / 2;
+	JobHandle decodeJob = jobSystem.Schedule([&image, path] { image = DecodeImage(path, true); });
+	jobSystem.ScheduleOnMainThread([&texture, &image, clamp]
+	{
+		texture = Texture(image, clamp);
+		FreeImage(image);
+	}, { decodeJob });
 }
 
 /// <summary>
@@ -519,6 +994,7 @@ void RenderPostProcessQuad()
 		glBindVertexArray(postProcessVAO);
 		glBindBuffer(GL_ARRAY_BUFFER, postProcessVBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+		TrackGpuResource(GpuResourceType::Buffer, postProcessVBO, sizeof(quadVertices), "post-process quad VBO");
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
 		glEnableVertexAttribArray(1);
@@ -530,50 +1006,84 @@ void RenderPostProcessQuad()
 }
 
 /// <summary>
-/// Renders the parallax mapped procedural terrain quad with the appropriate required textures. 
+/// Renders the parallax mapped procedural terrain quad with the appropriate required textures. With a tessellation, draws its
+/// patches instead (proceduralTerrain has to be the tessellated shader then), and terrainMesh may also be the RTIN mesh.
 /// </summary>
-void RenderProceduralTerrain(Shader& proceduralTerrain, glm::mat4& projection, glm::mat4& view, Texture& diffuseMapTextureRocks, Texture& diffuseMapTextureSnow, Texture& normalMapTexture, Texture& heightMapTexture, Mesh& terrainMesh)
+void RenderProceduralTerrain(const FrameState& frame, Shader& proceduralTerrain, glm::mat4& projection, glm::mat4& view, Texture& materialAlbedoTexture, SplatMap& splatMap, SlopeUvMap& slopeUvMap, Texture& normalMapTexture, Texture& heightMapTexture, VirtualTexture& virtualTexture, Mesh& terrainMesh, const TerrainTessellation* tessellation)
 {
 	proceduralTerrain.use();
 	proceduralTerrain.setMat4("projection", projection);
 	proceduralTerrain.setMat4("view", view);
-	proceduralTerrain.setVec3("viewPos", cameraPos);
-	proceduralTerrain.setVec3("lightPos", lightPos);
+	proceduralTerrain.setVec3("viewPos", frame.cameraPos);
+	proceduralTerrain.setVec3("lightPos", frame.lightPos);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, diffuseMapTextureRocks._textureID);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, materialAlbedoTexture._textureID);
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, diffuseMapTextureSnow._textureID);
+	glBindTexture(GL_TEXTURE_2D, splatMap.TextureID());
 	glActiveTexture(GL_TEXTURE2);
 	glBindTexture(GL_TEXTURE_2D, normalMapTexture._textureID);
 	glActiveTexture(GL_TEXTURE3);
 	glBindTexture(GL_TEXTURE_2D, heightMapTexture._textureID);
-	terrainMesh.DrawQuad();
+	glActiveTexture(GL_TEXTURE6);
+	glBindTexture(GL_TEXTURE_2D, slopeUvMap.TextureID());
+	proceduralTerrain.setBool("bSlopeAwareUVs", bSlopeAwareUVs);
+	proceduralTerrain.setBool("bParallaxDepth", bParallaxDepth);
+	if (virtualTexture.IsOpen())
+		virtualTexture.Bind(proceduralTerrain, 4, 5);
+	else
+		proceduralTerrain.setBool("bVirtualTexturing", false);
+	if (tessellation)
+		tessellation->Draw();
+	else
+	{
+		proceduralTerrain.setVec3("positionMin", terrainMesh.bounds.min);
+		proceduralTerrain.setVec3("positionExtent", terrainMesh.bounds.extent);
+		terrainMesh.Draw();
+	}
+}
+
+/// <summary>
+/// Lights and fogs the terrain from the G-buffer with a fullscreen pass into the bound HDR framebuffer. Pixels the terrain didn't
+/// cover are discarded, and depth is neither tested nor written: it is the texture being read.
+/// </summary>
+void RenderDeferredLighting(const FrameState& frame, Shader& deferredLightingShader, const glm::mat4& projection, const glm::mat4& view, DeferredShading& deferredShading)
+{
+	deferredShading.Bind(deferredLightingShader, 0);
+	deferredLightingShader.setMat4("inverseViewProjection", glm::inverse(projection * view));
+	deferredLightingShader.setVec3("viewPos", frame.cameraPos);
+	deferredLightingShader.setVec3("lightPos", frame.lightPos);
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+	RenderPostProcessQuad();
+	glDepthMask(GL_TRUE);
+	glEnable(GL_DEPTH_TEST);
 }
 
 /// <summary>
 /// Renders the sun as a sphere. 
 /// </summary>
-void RenderSun(Shader& sunShader, glm::mat4& projection, glm::mat4& view, glm::mat4& model, Mesh& sun)
+void RenderSun(const FrameState& frame, Shader& sunShader, glm::mat4& projection, glm::mat4& view, glm::mat4& model, Mesh& sun)
 {
 	sunShader.use();
 	sunShader.setMat4("projection", projection);
 	sunShader.setMat4("view", view);
 	model = glm::mat4(1.0f);
-	model = glm::translate(model, lightPos);
+	model = glm::translate(model, frame.lightPos);
 	model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
 	sunShader.setMat4("model", model);
-	sunShader.setVec3("viewPos", cameraPos);
+	sunShader.setVec3("viewPos", frame.cameraPos);
+	sunShader.setVec3("glowColor", frame.lightDiffuse);
 	sun.DrawSphere();
 }
 
 /// <summary>
 /// Renders a cubemapped skybox. 
 /// </summary>
-void RenderSkybox(Shader& skyboxShader, glm::mat4& view, glm::mat4& projection, Mesh& skybox, Texture& skyboxTexture)
+void RenderSkybox(const FrameState& frame, Shader& skyboxShader, glm::mat4& view, glm::mat4& projection, Mesh& skybox, Texture& skyboxTexture)
 {
 	glDepthFunc(GL_LEQUAL);
 	skyboxShader.use();
-	view = glm::mat4(glm::mat3(glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp))); // Needed to make skybox appear to extend infinitely
+	view = glm::mat4(glm::mat3(glm::lookAt(frame.cameraPos, frame.cameraPos + frame.cameraFront, frame.cameraUp))); // Needed to make skybox appear to extend infinitely
 	skyboxShader.setMat4("projection", projection);
 	skyboxShader.setMat4("view", view);
 	glBindVertexArray(skybox.VAO);
@@ -584,114 +1094,52 @@ void RenderSkybox(Shader& skyboxShader, glm::mat4& view, glm::mat4& projection,
 	glDepthFunc(GL_LESS);
 }
 
-/// <summary>
-/// Checks if Sun should be stationary or animated. 
-/// If animated, the sun travels in a semicircle trajectory from one side of the horizon of the terrain to the the other side. 
-/// As the sun approaches either sides of the horizon, it decelerates, its color changes to an orange hue, and the brightness of the scene also dims. 
-/// As the sun approaches the zenith, it accelerates, its color changes to a white hue, and the brightness of the scene increases.
-/// When the sun hits the horizon, it waits in place for the specified idleTime until it can reverse its direction and start moving again. 
-/// </summary>
-void AnimateSun(Shader& sunShader)
-{
-	if (bIsSunStationary)
-		lightPos = glm::vec3(1.0f, 0.75f, 1.0f);
-
-	// Update position of the sun to orbit 
-	else 
-	{
-		// Sun waits for a bit before reversing direction and moving again. 
-		if (bWaiting)
-		{
-			timer += deltaTime;
-			if (timer >= idleTime)
-			{
-				bWaiting = false;
-				timer = 0.0f;
-			}
-		}
-
-		// Sun is in motion. 
-		else
-		{
-			sunAngle = glm::degrees(glm::acos(glm::dot(glm::normalize(lightPos), glm::normalize(glm::vec3(1.0f, 0.0f, 1.0f)))));
-			float dir = bReverseSun ? -1.0f : 1.0f;
-			float targetSpeed = sunDesiredSpeed * dir;
-
-			// If sun is approaching the horizon
-			if ((sunAngle < 89.9f && !bReverseSun) || (sunAngle > 90.1f && bReverseSun))
-			{
-				sunVel += glm::mix(deltaTime * sunDesiredSpeed * dir, 0.0f, EaseInOutSine(deltaTime) * 120);	  // Slow down
-				lightDiffuse = glm::mix(lightDiffuse, ORANGE, EaseInOutSine(deltaTime) * 10);					  // Appear orange
-				exposure = glm::mix(exposure, minExposure, EaseInOutSine(deltaTime) * 10);						  // Make scene dimmer
-			}
-
-			// If sun is approaching the zenith
-			else
-			{
-				sunVel += glm::mix(deltaTime * sunDesiredSpeed * dir, targetSpeed, EaseInOutSine(deltaTime) * 3); // Speed up
-				lightDiffuse = glm::mix(lightDiffuse, WHITE, EaseInOutSine(deltaTime) * 10);					  // Appear white
-				exposure = glm::mix(exposure, maxExposure, EaseInOutSine(deltaTime) * 10);						  // Make scene brighter
-			}
-
-			// Update the Sun's color to the shader. 
-			sunShader.use();
-			sunShader.setVec3("glowColor", lightDiffuse);
-
-			// Travel diagonally across the terrain in a semicircle
-			lightPos.x = sunRadius * -cos(sunVel);
-			lightPos.z = sunRadius * -cos(sunVel);
-			lightPos.y = sunRadius * sin(sunVel);
-		}
-
-		// Check if sun is at either horizon
-		if (sunAngle < 5.0f && !bReverseSun)
-		{
-			bWaiting = true;
-			bReverseSun = true;
-		}
-		else if (sunAngle > 175.0f && bReverseSun)
-		{
-			bWaiting = true;
-			bReverseSun = false;
-		}
-	}
-}
-
 /// <summary>
 /// GLFW callback function for checking if the window needs to resize. 
 /// </summary>
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) { glViewport(0, 0, width, height); }
 
 /// <summary>
-/// GLFW callback function for mouse input.
+/// GLFW callback function for mouse input. Only records the cursor position, the simulation thread turns it into camera rotation.
 /// </summary>
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
-	// To prevent huge jump on screen when first starting program
-	if (firstMouse) { lastX = xpos; lastY = ypos; firstMouse = false; }
-
-	// Calculate mouse offset since last frame
-	float xoffset = xpos - lastX;
-	float yoffset = lastY - ypos; // reversed: y ranges from bottom to top
-	lastX = xpos;
-	lastY = ypos;
-
-	// Adjust according to camera sensitivity
-	xoffset *= cameraSensitivity;
-	yoffset *= cameraSensitivity;
-
-	// Add the offsets to the yaw and pitch
-	yaw += xoffset;
-	pitch += yoffset;
-
-	// Prevent LookAt Flip if pitch matches the World Up vector
-	if (pitch > 89.0f) pitch = 89.0f;
-	if (pitch < -89.0f) pitch = -89.0f;
-
-	// Do trig calculations to determine the direction vector
-	glm::vec3 direction;
-	direction.x = glm::cos(glm::radians(yaw)) * glm::cos(glm::radians(pitch));
-	direction.y = glm::sin(glm::radians(pitch));
-	direction.z = glm::sin(glm::radians(yaw)) * glm::cos(glm::radians(pitch));
-	cameraFront = glm::normalize(direction);
+	cursorX = xpos;
+	cursorY = ypos;
+	bHasCursor = true;
+}
+
+/// <summary>
+/// GLFW callback function for single key presses. R regenerates the terrain at a new spot in noise space, C switches between CPU and compute shader generation,
+/// U switches between slope-aware and planar material coordinates, G between forward and deferred shading,
+/// T cycles through parallax occlusion mapping, tessellation and the RTIN mesh, F through the free, fly and walk cameras, F9 writes a memory report, F12 takes a screenshot and F11 starts/ stops capturing every frame.
+/// </summary>
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	if (action != GLFW_PRESS) return;
+
+	if (key == GLFW_KEY_R)
+	{
+		terrainOffset += glm::vec2(37.0f, 11.0f);
+		bRegenerateTerrain = true;
+	}
+	else if (key == GLFW_KEY_C)
+	{
+		bUseComputeTerrain = !bUseComputeTerrain;
+		bRegenerateTerrain = true;
+	}
+	else if (key == GLFW_KEY_U)
+		bSlopeAwareUVs = !bSlopeAwareUVs;
+	else if (key == GLFW_KEY_G)
+		bDeferredShading = !bDeferredShading;
+	else if (key == GLFW_KEY_T)
+		terrainGeometry = static_cast<TerrainGeometry>((static_cast<int>(terrainGeometry) + 1) % 3);
+	else if (key == GLFW_KEY_F)
+		cameraMode = static_cast<CameraMode>((static_cast<int>(cameraMode) + 1) % 3);
+	else if (key == GLFW_KEY_F9)
+		bMemoryReportRequested = true;
+	else if (key == GLFW_KEY_F12)
+		bScreenshotRequested = true;
+	else if (key == GLFW_KEY_F11)
+		bToggleContinuousCapture = true;
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "mappedFile.h"
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : _data(nullptr), _size(0), _bWritable(false), _bEmpty(false), _file(INVALID_HANDLE_VALUE), _mapping(nullptr) {}
+#else
+MappedFile::MappedFile() : _data(nullptr), _size(0), _bWritable(false), _bEmpty(false), _file(-1) {}
+#endif
+
+bool MappedFile::OpenRead(const char* path)
+{
+	return Map(path, 0, false);
+}
+
+bool MappedFile::Create(const char* path, size_t size)
+{
+	return Map(path, size, true);
+}
+
+#ifdef _WIN32
+bool MappedFile::Map(const char* path, size_t size, bool bWritable)
+{
+	Close();
+	_file = CreateFileA(path, bWritable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+		bWritable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+	{
+		std::cerr << "ERROR: Could not open " << path << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (bWritable)
+		fileSize.QuadPart = static_cast<LONGLONG>(size);
+	else
+		GetFileSizeEx(_file, &fileSize);
+	_size = static_cast<size_t>(fileSize.QuadPart);
+	_bWritable = bWritable;
+	if (_size == 0)
+	{
+		_bEmpty = true;
+		return true;
+	}
+
+	_mapping = CreateFileMappingA(_file, nullptr, bWritable ? PAGE_READWRITE : PAGE_READONLY, fileSize.HighPart, fileSize.LowPart, nullptr);
+	if (_mapping)
+		_data = static_cast<unsigned char*>(MapViewOfFile(_mapping, bWritable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+	if (!_data)
+	{
+		std::cerr << "ERROR: Could not map " << path << std::endl;
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Flush()
+{
+	if (_data && _bWritable)
+	{
+		FlushViewOfFile(_data, 0);
+		FlushFileBuffers(_file);
+	}
+}
+
+void MappedFile::Close()
+{
+	if (_data) UnmapViewOfFile(_data);
+	if (_mapping) CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+	_data = nullptr;
+	_mapping = nullptr;
+	_file = INVALID_HANDLE_VALUE;
+	_size = 0;
+	_bWritable = false;
+	_bEmpty = false;
+}
+#else
+bool MappedFile::Map(const char* path, size_t size, bool bWritable)
+{
+	Close();
+	_file = open(path, bWritable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+	if (_file < 0)
+	{
+		std::cerr << "ERROR: Could not open " << path << std::endl;
+		return false;
+	}
+
+	if (bWritable)
+	{
+		if (ftruncate(_file, static_cast<off_t>(size)) != 0)
+		{
+			std::cerr << "ERROR: Could not resize " << path << " to " << size << " bytes" << std::endl;
+			Close();
+			return false;
+		}
+		_size = size;
+	}
+	else
+	{
+		struct stat status;
+		fstat(_file, &status);
+		_size = static_cast<size_t>(status.st_size);
+	}
+	_bWritable = bWritable;
+	if (_size == 0)
+	{
+		_bEmpty = true;
+		return true;
+	}
+
+	void* data = mmap(nullptr, _size, bWritable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, _file, 0);
+	if (data == MAP_FAILED)
+	{
+		std::cerr << "ERROR: Could not map " << path << std::endl;
+		Close();
+		return false;
+	}
+	_data = static_cast<unsigned char*>(data);
+	return true;
+}
+
+void MappedFile::Flush()
+{
+	if (_data && _bWritable)
+		msync(_data, _size, MS_SYNC);
+}
+
+void MappedFile::Close()
+{
+	if (_data) munmap(_data, _size);
+	if (_file >= 0) close(_file);
+	_data = nullptr;
+	_file = -1;
+	_size = 0;
+	_bWritable = false;
+	_bEmpty = false;
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+
+/// <summary>
+/// A file mapped into the address space. Pages are read in by the OS on first touch and can be dropped again under memory
+/// pressure, so files far larger than RAM can be accessed as one array without loading them.
+/// </summary>
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile() { Close(); }
+
+	bool OpenRead(const char* path);
+	bool Create(const char* path, size_t size); // Create/ truncate the file to size and map it writable
+	void Flush();                               // Write dirty pages of a writable mapping back to the file
+	void Close();
+
+	const unsigned char* Data() const { return _data; }
+	unsigned char* MutableData() { return _bWritable ? _data : nullptr; }
+	size_t Size() const { return _size; }
+	bool IsOpen() const { return _data != nullptr || _bEmpty; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Map(const char* path, size_t size, bool bWritable);
+
+	unsigned char* _data;
+	size_t _size;
+	bool _bWritable;
+	bool _bEmpty; // Zero byte files can't be mapped, but open fine
+#ifdef _WIN32
+	void* _file;
+	void* _mapping;
+#else
+	int _file;
+#endif
+};
@@ -0,0 +1,115 @@
+#include "materialLayers.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "glad/glad.h"
+#include "memoryTracker.h"
+
+static const int SPLAT_BAND_ROWS = 32; // Rows per job
+static const int MAX_MATERIAL_LAYERS = 256; // Layer indices are 8 bit
+
+float MaterialRule::Coverage(float value) const
+{
+	if (from == to) return 1.0f;
+	float t = std::min(std::max((value - from) / (to - from), 0.0f), 1.0f);
+	return t * t * (3.0f - 2.0f * t);
+}
+
+SplatMap::SplatMap() : _size(0), _heightScale(0.0f)
+{
+}
+
+JobHandle SplatMap::Generate(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float heightScale, const std::vector<MaterialLayer>& layers)
+{
+	if (_pending)
+		jobSystem.Wait(_pending);
+	if (layers.empty() || layers.size() > MAX_MATERIAL_LAYERS)
+	{
+		std::cerr << "ERROR: The splat map needs between 1 and " << MAX_MATERIAL_LAYERS << " material layers" << std::endl;
+		return _pending = JobHandle();
+	}
+
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	if (_size != textureSize)
+	{
+		_texture.Release();
+		_texture = Texture(textureSize, GL_RGBA8UI);
+		glBindTexture(GL_TEXTURE_2D, _texture._textureID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Integer textures can't be filtered
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		_size = textureSize;
+	}
+	_heightScale = heightScale;
+	_layers = layers;
+
+	_heightMap = heightMap;
+	_splat.resize(_heightMap->size() * 4);
+
+	std::vector<JobHandle> bands = jobSystem.ScheduleRows(textureSize, SPLAT_BAND_ROWS, {}, [this](int firstRow, int lastRow) { GenerateRows(firstRow, lastRow); });
+	_pending = jobSystem.ScheduleOnMainThread([this]
+	{
+		glBindTexture(GL_TEXTURE_2D, _texture._textureID);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _size, _size, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, _splat.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}, bands);
+	return _pending;
+}
+
+/// <summary>
+/// Evaluate every layer's rules for a band of rows and keep the two strongest weights per texel.
+/// </summary>
+void SplatMap::GenerateRows(int firstRow, int lastRow)
+{
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	const int size = _size, layerCount = static_cast<int>(_layers.size());
+	auto Altitude = [&](int x, int y)
+	{
+		x = std::min(std::max(x, 0), size - 1);
+		y = std::min(std::max(y, 0), size - 1);
+		return 1.0f - (*_heightMap)[static_cast<size_t>(y) * size + x] / 255.0f;
+	};
+	const float slopeScale = 0.5f * size * _heightScale; // Central differences span two texels, the terrain is size texels across
+	const float radiansToDegrees = 57.2957795f;
+	std::vector<float> weights(layerCount);
+
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			const float altitude = Altitude(x, y);
+			const float dx = Altitude(x + 1, y) - Altitude(x - 1, y), dy = Altitude(x, y + 1) - Altitude(x, y - 1);
+			const float slope = std::atan(std::sqrt(dx * dx + dy * dy) * slopeScale) * radiansToDegrees;
+			const int r = SPLAT_CURVATURE_RADIUS;
+			const float curvature = 0.25f * (Altitude(x - r, y) + Altitude(x + r, y) + Altitude(x, y - r) + Altitude(x, y + r)) - altitude;
+
+			// Paint from the top down: each layer takes its coverage of whatever the layers above left uncovered
+			float uncovered = 1.0f;
+			for (int layer = layerCount - 1; layer > 0; --layer)
+			{
+				const MaterialLayer& material = _layers[layer];
+				float coverage = material.altitude.Coverage(altitude) * material.slope.Coverage(slope) * material.curvature.Coverage(curvature);
+				weights[layer] = coverage * uncovered;
+				uncovered -= weights[layer];
+			}
+			weights[0] = uncovered;
+
+			int first = 0, second = -1;
+			for (int layer = 1; layer < layerCount; ++layer)
+			{
+				if (weights[layer] > weights[first]) { second = first; first = layer; }
+				else if (second < 0 || weights[layer] > weights[second]) second = layer;
+			}
+			float secondWeight = second >= 0 ? weights[second] : 0.0f;
+			float pairWeight = weights[first] + secondWeight;
+
+			uint8_t* texel = &_splat[(static_cast<size_t>(y) * size + x) * 4];
+			texel[0] = static_cast<uint8_t>(first);
+			texel[1] = static_cast<uint8_t>(second >= 0 ? second : first);
+			texel[2] = static_cast<uint8_t>(pairWeight > 0.0f ? secondWeight / pairWeight * 255.0f + 0.5f : 0.0f);
+			texel[3] = 255;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "jobSystem.h"
+#include "texture.h"
+
+/// <summary>
+/// A ramp over one terrain property: a layer's coverage is 0 at `from` and 1 at `to`, smoothstepped in between (from may be
+/// larger than to, for rules that fall off as the property grows). from == to means no rule.
+/// </summary>
+struct MaterialRule
+{
+	float from, to;
+
+	MaterialRule() : from(0.0f), to(0.0f) {}
+	MaterialRule(float from, float to) : from(from), to(to) {}
+	float Coverage(float value) const;
+};
+
+/// <summary>
+/// One terrain material: its albedo (a layer of the material texture array, or of the virtual texture) and where it covers
+/// the layers below it. A layer's coverage is the product of its rules:
+///  - altitude: a fraction of the height range, 0 at the bottom of the range and 1 at its top (not the map's own lowest and
+///    highest points)
+///  - slope: steepness of the rendered terrain in degrees (the height map scaled by heightScale over the terrain's width)
+///  - curvature: the average altitude SPLAT_CURVATURE_RADIUS texels away minus the texel's own, > 0 in hollows, < 0 on ridges
+/// </summary>
+struct MaterialLayer
+{
+	std::string albedoPath;
+	MaterialRule altitude, slope, curvature;
+};
+
+const int SPLAT_CURVATURE_RADIUS = 4; // In height map texels, the height map's 8 bit steps are too coarse to take it closer
+
+/// <summary>
+/// Per-texel material weights for N layers, kept to the two strongest so the terrain shader samples at most two albedo
+/// layers a pixel however many there are. Layers are painted bottom first: each covers what is below it by its coverage,
+/// and the bottom layer fills the rest, so with two layers this is exactly mix(bottom, top, coverage).
+/// The texture is GL_RGBA8UI: R and G the indices of the two strongest layers, B the second one's share of the pair in
+/// 255ths. Indices can't be filtered, so procTerrain.FRAG blends the four nearest texels by hand.
+/// </summary>
+class SplatMap
+{
+public:
+	SplatMap();
+
+	/// <summary>
+	/// Schedule the splat map's generation from the read back height map (it may have come from the compute shaders): rows
+	/// are split into bands on the workers, then uploaded on the GL thread. Runs on the GL thread; if an earlier generation
+	/// is still running it is waited for first, so this must not be called from a job once a generation has been scheduled.
+	/// </summary>
+	JobHandle Generate(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float heightScale, const std::vector<MaterialLayer>& layers);
+
+	unsigned int TextureID() const { return _texture._textureID; }
+
+private:
+	void GenerateRows(int firstRow, int lastRow);
+
+	Texture _texture;
+	int _size;
+	float _heightScale;
+	std::vector<MaterialLayer> _layers;
+	SharedHeightMap _heightMap;
+	std::vector<uint8_t> _splat;
+	JobHandle _pending;
+};
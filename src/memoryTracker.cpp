@@ -0,0 +1,279 @@
+#include "memoryTracker.h"
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <utility>
+#include <glad/glad.h>
+
+// ------------------------------------ CPU Allocation Tracking ---------------------------------------------------
+// Every tracked block is prefixed with a header recording its size and owning subsystem, so frees can be attributed
+// without a lookup. The header is 16 bytes to keep the max_align_t alignment operator new has to guarantee.
+struct alignas(16) AllocationHeader
+{
+	size_t size;
+	MemorySubsystem subsystem;
+};
+static_assert(sizeof(AllocationHeader) == 16, "Allocation header must preserve 16 byte alignment");
+
+static std::atomic<size_t> cpuLiveBytes[static_cast<size_t>(MemorySubsystem::Count)];
+static std::atomic<size_t> cpuAllocationsThisFrame[static_cast<size_t>(MemorySubsystem::Count)];
+static std::atomic<size_t> cpuAllocationsLastFrame[static_cast<size_t>(MemorySubsystem::Count)];
+static thread_local MemorySubsystem currentSubsystem = MemorySubsystem::General;
+
+MemoryScope::MemoryScope(MemorySubsystem subsystem) : _previous(currentSubsystem)
+{
+	currentSubsystem = subsystem;
+}
+
+MemoryScope::~MemoryScope()
+{
+	currentSubsystem = _previous;
+}
+
+void* TrackedMalloc(size_t size)
+{
+	AllocationHeader* header = static_cast<AllocationHeader*>(std::malloc(sizeof(AllocationHeader) + size));
+	if (!header) return nullptr;
+
+	header->size = size;
+	header->subsystem = currentSubsystem;
+	cpuLiveBytes[static_cast<size_t>(header->subsystem)].fetch_add(size, std::memory_order_relaxed);
+	cpuAllocationsThisFrame[static_cast<size_t>(header->subsystem)].fetch_add(1, std::memory_order_relaxed);
+	return header + 1;
+}
+
+void TrackedFree(void* pointer)
+{
+	if (!pointer) return;
+
+	AllocationHeader* header = static_cast<AllocationHeader*>(pointer) - 1;
+	cpuLiveBytes[static_cast<size_t>(header->subsystem)].fetch_sub(header->size, std::memory_order_relaxed);
+	std::free(header);
+}
+
+void* TrackedRealloc(void* pointer, size_t size)
+{
+	if (!pointer) return TrackedMalloc(size);
+
+	AllocationHeader* header = static_cast<AllocationHeader*>(pointer) - 1;
+	size_t oldSize = header->size;
+	MemorySubsystem subsystem = header->subsystem;
+	AllocationHeader* resized = static_cast<AllocationHeader*>(std::realloc(header, sizeof(AllocationHeader) + size));
+	if (!resized) return nullptr;
+
+	resized->size = size;
+	cpuLiveBytes[static_cast<size_t>(subsystem)].fetch_sub(oldSize, std::memory_order_relaxed);
+	cpuLiveBytes[static_cast<size_t>(subsystem)].fetch_add(size, std::memory_order_relaxed);
+	cpuAllocationsThisFrame[static_cast<size_t>(subsystem)].fetch_add(1, std::memory_order_relaxed);
+	return resized + 1;
+}
+
+void BeginMemoryFrame()
+{
+	for (size_t i = 0; i < static_cast<size_t>(MemorySubsystem::Count); ++i)
+		cpuAllocationsLastFrame[i].store(cpuAllocationsThisFrame[i].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+// --- Global operator new/ delete replacements, routing every C++ allocation in the program through the tracker
+void* operator new(size_t size)
+{
+	void* pointer = TrackedMalloc(size == 0 ? 1 : size);
+	if (!pointer) throw std::bad_alloc();
+	return pointer;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return TrackedMalloc(size == 0 ? 1 : size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return TrackedMalloc(size == 0 ? 1 : size); }
+void operator delete(void* pointer) noexcept { TrackedFree(pointer); }
+void operator delete[](void* pointer) noexcept { TrackedFree(pointer); }
+void operator delete(void* pointer, size_t) noexcept { TrackedFree(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { TrackedFree(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { TrackedFree(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { TrackedFree(pointer); }
+// ----------------------------------------------------------------------------------------------------------------
+
+// ------------------------------------ GPU Resource Registry -----------------------------------------------------
+struct GpuResource
+{
+	size_t bytes;
+	std::string label;
+};
+
+// Function-local statics so the registry is safe to use regardless of static initialization order
+static std::mutex& RegistryMutex() { static std::mutex mutex; return mutex; }
+static std::map<std::pair<GpuResourceType, unsigned int>, GpuResource>& Registry()
+{
+	static std::map<std::pair<GpuResourceType, unsigned int>, GpuResource> registry;
+	return registry;
+}
+
+void TrackGpuResource(GpuResourceType type, unsigned int id, size_t bytes, const std::string& label)
+{
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+	GpuResource& resource = Registry()[std::make_pair(type, id)];
+	resource.bytes = bytes;
+	resource.label = label;
+}
+
+void UntrackGpuResource(GpuResourceType type, unsigned int id)
+{
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+	Registry().erase(std::make_pair(type, id));
+}
+
+int MipLevelCount(int width, int height)
+{
+	int levels = 1;
+	while (width > 1 || height > 1)
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		levels++;
+	}
+	return levels;
+}
+
+/// <summary>
+/// Bytes used by a texture with the given format, summed over its mip chain. Three component formats are counted as four,
+/// which is how drivers lay them out in practice. BC7 (BPTC) blocks are 16 bytes per 4x4 texels, a byte per texel.
+/// </summary>
+size_t TextureByteSize(int width, int height, unsigned int internalFormat, int mipLevels, int layers)
+{
+	size_t bytesPerTexel = 4;
+	switch (internalFormat)
+	{
+	case GL_RED: case GL_R8: case GL_COMPRESSED_RGBA_BPTC_UNORM: case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: bytesPerTexel = 1; break;
+	case GL_RG: case GL_RG8: case GL_R16F: case GL_R16: bytesPerTexel = 2; break;
+	case GL_RGB: case GL_RGB8: case GL_SRGB8: case GL_RGBA: case GL_RGBA8: case GL_SRGB8_ALPHA8:
+	case GL_RG16: case GL_RG16F: case GL_R32F: case GL_DEPTH_COMPONENT: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: bytesPerTexel = 4; break;
+	case GL_RGB16F: case GL_RGBA16F: case GL_RG32F: bytesPerTexel = 8; break;
+	case GL_RGB32F: case GL_RGBA32F: bytesPerTexel = 16; break;
+	}
+
+	size_t bytes = 0;
+	for (int level = 0; level < mipLevels; ++level)
+	{
+		bytes += static_cast<size_t>(width) * height * bytesPerTexel;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return bytes * layers;
+}
+// ----------------------------------------------------------------------------------------------------------------
+
+// ------------------------------------ Reporting -----------------------------------------------------------------
+const char* MemorySubsystemName(MemorySubsystem subsystem)
+{
+	static const char* names[] = { "general", "textures", "meshes", "terrain", "simulation", "capture" };
+	return names[static_cast<size_t>(subsystem)];
+}
+
+static std::string EscapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\') escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+static const char* GpuResourceTypeName(GpuResourceType type)
+{
+	static const char* names[] = { "texture", "buffer", "renderbuffer" };
+	return names[static_cast<size_t>(type)];
+}
+
+MemoryStats GetMemoryStats()
+{
+	MemoryStats stats = {};
+	for (size_t i = 0; i < static_cast<size_t>(MemorySubsystem::Count); ++i)
+	{
+		stats.cpuLiveBytes[i] = cpuLiveBytes[i].load(std::memory_order_relaxed);
+		stats.cpuTotalLiveBytes += stats.cpuLiveBytes[i];
+		stats.cpuSubsystemAllocationsLastFrame[i] = cpuAllocationsLastFrame[i].load(std::memory_order_relaxed);
+		stats.cpuAllocationsLastFrame += stats.cpuSubsystemAllocationsLastFrame[i];
+		stats.cpuAllocationsThisFrame += cpuAllocationsThisFrame[i].load(std::memory_order_relaxed);
+	}
+
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+	for (const auto& entry : Registry())
+	{
+		stats.gpuLiveBytes[static_cast<size_t>(entry.first.first)] += entry.second.bytes;
+		stats.gpuTotalLiveBytes += entry.second.bytes;
+	}
+	stats.gpuResourceCount = Registry().size();
+	return stats;
+}
+
+std::string MemoryOverlayText()
+{
+	MemoryStats stats = GetMemoryStats();
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(1)
+		<< "CPU " << stats.cpuTotalLiveBytes / (1024.0 * 1024.0) << " MB"
+		<< " (tex " << stats.cpuLiveBytes[static_cast<size_t>(MemorySubsystem::Textures)] / (1024.0 * 1024.0)
+		<< ", terrain " << stats.cpuLiveBytes[static_cast<size_t>(MemorySubsystem::Terrain)] / (1024.0 * 1024.0) << ")"
+		<< " | GPU " << stats.gpuTotalLiveBytes / (1024.0 * 1024.0) << " MB in " << stats.gpuResourceCount << " resources"
+		<< " | " << stats.cpuAllocationsLastFrame << " allocs/frame";
+	// Which subsystems they came from, only the ones that allocated at all
+	bool bFirst = true;
+	for (size_t i = 0; i < static_cast<size_t>(MemorySubsystem::Count); ++i)
+	{
+		if (!stats.cpuSubsystemAllocationsLastFrame[i]) continue;
+		text << (bFirst ? " (" : ", ") << MemorySubsystemName(static_cast<MemorySubsystem>(i)) << " " << stats.cpuSubsystemAllocationsLastFrame[i];
+		bFirst = false;
+	}
+	if (!bFirst)
+		text << ")";
+	return text.str();
+}
+
+std::string MemoryReportJson()
+{
+	MemoryStats stats = GetMemoryStats();
+	std::ostringstream json;
+	json << "{\n  \"cpu\": {\n    \"totalLiveBytes\": " << stats.cpuTotalLiveBytes
+		<< ",\n    \"allocationsLastFrame\": " << stats.cpuAllocationsLastFrame
+		<< ",\n    \"subsystems\": {";
+	for (size_t i = 0; i < static_cast<size_t>(MemorySubsystem::Count); ++i)
+		json << (i ? ", " : " ") << "\"" << MemorySubsystemName(static_cast<MemorySubsystem>(i)) << "\": " << stats.cpuLiveBytes[i];
+	json << " },\n    \"subsystemAllocationsLastFrame\": {";
+	for (size_t i = 0; i < static_cast<size_t>(MemorySubsystem::Count); ++i)
+		json << (i ? ", " : " ") << "\"" << MemorySubsystemName(static_cast<MemorySubsystem>(i)) << "\": " << stats.cpuSubsystemAllocationsLastFrame[i];
+	json << " }\n  },\n  \"gpu\": {\n    \"totalLiveBytes\": " << stats.gpuTotalLiveBytes
+		<< ",\n    \"textureBytes\": " << stats.gpuLiveBytes[static_cast<size_t>(GpuResourceType::Texture)]
+		<< ",\n    \"bufferBytes\": " << stats.gpuLiveBytes[static_cast<size_t>(GpuResourceType::Buffer)]
+		<< ",\n    \"renderbufferBytes\": " << stats.gpuLiveBytes[static_cast<size_t>(GpuResourceType::Renderbuffer)]
+		<< ",\n    \"resources\": [";
+
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+	bool bFirst = true;
+	for (const auto& entry : Registry())
+	{
+		json << (bFirst ? "\n" : ",\n") << "      { \"type\": \"" << GpuResourceTypeName(entry.first.first) << "\", \"id\": " << entry.first.second
+			<< ", \"bytes\": " << entry.second.bytes << ", \"label\": \"" << EscapeJson(entry.second.label) << "\" }";
+		bFirst = false;
+	}
+	json << "\n    ]\n  }\n}\n";
+	return json.str();
+}
+
+bool WriteMemoryReport(const char* path)
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		std::cerr << "ERROR: Could not write memory report to " << path << std::endl;
+		return false;
+	}
+	file << MemoryReportJson();
+	return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// <summary>
+/// CPU allocations are attributed to whichever subsystem is active on the allocating thread (see MemoryScope).
+/// </summary>
+enum class MemorySubsystem : uint8_t
+{
+	General, Textures, Meshes, Terrain, Simulation, Capture, Count
+};
+
+enum class GpuResourceType : uint8_t
+{
+	Texture, Buffer, Renderbuffer
+};
+
+/// <summary>
+/// RAII tag: CPU allocations made on this thread while the scope is alive are counted against the given subsystem.
+/// </summary>
+class MemoryScope
+{
+public:
+	explicit MemoryScope(MemorySubsystem subsystem);
+	~MemoryScope();
+
+private:
+	MemorySubsystem _previous;
+};
+
+struct MemoryStats
+{
+	size_t cpuLiveBytes[static_cast<size_t>(MemorySubsystem::Count)];
+	size_t cpuTotalLiveBytes;
+	size_t cpuAllocationsThisFrame;
+	size_t cpuAllocationsLastFrame;
+	size_t cpuSubsystemAllocationsLastFrame[static_cast<size_t>(MemorySubsystem::Count)]; // Last frame's count, split by subsystem
+	size_t gpuLiveBytes[3]; // Indexed by GpuResourceType
+	size_t gpuTotalLiveBytes;
+	size_t gpuResourceCount;
+};
+
+// --- CPU side (the counters are fed by the global operator new/ delete replacements and the stb_image allocator hooks)
+void* TrackedMalloc(size_t size);
+void* TrackedRealloc(void* pointer, size_t size);
+void TrackedFree(void* pointer);
+void BeginMemoryFrame(); // Rolls the per-frame allocation counters (the total and each subsystem's)
+
+// --- GPU side, every glGen* that allocates storage should be paired with a TrackGpuResource()
+void TrackGpuResource(GpuResourceType type, unsigned int id, size_t bytes, const std::string& label);
+void UntrackGpuResource(GpuResourceType type, unsigned int id);
+size_t TextureByteSize(int width, int height, unsigned int internalFormat, int mipLevels = 1, int layers = 1);
+int MipLevelCount(int width, int height);
+
+// --- Reporting
+MemoryStats GetMemoryStats();
+std::string MemoryOverlayText(); // One-line summary, shown in the window title
+std::string MemoryReportJson();  // Totals plus every tracked GPU resource
+bool WriteMemoryReport(const char* path);
+const char* MemorySubsystemName(MemorySubsystem subsystem);
@@ -1,11 +1,29 @@
 #include "mesh.h"
+#include "frameArena.h"
+#include "meshOptimizer.h"
+#include "memoryTracker.h"
+
+/// <summary>
+/// PackedTerrainVertex's attributes for procTerrain.VERT, on the bound VAO and VBO.
+/// </summary>
+static void SetPackedTerrainVertexAttributes()
+{
+	const int stride = sizeof(PackedTerrainVertex);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedTerrainVertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedTerrainVertex, texCoords));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_BYTE, GL_TRUE, stride, (void*)offsetof(PackedTerrainVertex, normal)); // Normal, then tangent
+}
 
 /// <summary>
 /// Constructor for rendering a quad, and its TBN. Used to construct the procedural terrain.
 /// Taken from https://github.com/JoeyDeVries/LearnOpenGL/blob/master/src/5.advanced_lighting/4.normal_mapping/normal_mapping.cpp and modified.
 /// </summary>
-Mesh::Mesh(Shader& shader)
+Mesh::Mesh(Shader& shader) : _type(TerrainQuad)
 {
+	MemoryScope memoryScope(MemorySubsystem::Meshes);
 	// positions
 	glm::vec3 pos1(-1.0f, 1.0f, 0.0f);
 	glm::vec3 pos2(-1.0f, -1.0f, 0.0f);
@@ -59,17 +77,20 @@ Mesh::Mesh(Shader& shader)
 	bitangent2.y = f * (-deltaUV2.x * edge1.y + deltaUV1.x * edge2.y);
 	bitangent2.z = f * (-deltaUV2.x * edge1.z + deltaUV1.x * edge2.z);
 
-	float quadVertices[] = 
+	const TerrainVertex quadVertices[] =
 	{
-		// positions            // normal         // texcoords  // tangent                          // bitangent
-		pos1.x, pos1.y, pos1.z, nm.x, nm.y, nm.z, uv1.x, uv1.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
-		pos2.x, pos2.y, pos2.z, nm.x, nm.y, nm.z, uv2.x, uv2.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
-		pos3.x, pos3.y, pos3.z, nm.x, nm.y, nm.z, uv3.x, uv3.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
-
-		pos1.x, pos1.y, pos1.z, nm.x, nm.y, nm.z, uv1.x, uv1.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z,
-		pos3.x, pos3.y, pos3.z, nm.x, nm.y, nm.z, uv3.x, uv3.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z,
-		pos4.x, pos4.y, pos4.z, nm.x, nm.y, nm.z, uv4.x, uv4.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z
+		// position, normal, texcoords, tangent, bitangent
+		{ pos1, nm, uv1, tangent1, bitangent1 },
+		{ pos2, nm, uv2, tangent1, bitangent1 },
+		{ pos3, nm, uv3, tangent1, bitangent1 },
+
+		{ pos1, nm, uv1, tangent2, bitangent2 },
+		{ pos3, nm, uv3, tangent2, bitangent2 },
+		{ pos4, nm, uv4, tangent2, bitangent2 }
 	};
+	bounds = { glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(2.0f, 2.0f, 0.0f) };
+	PackedTerrainVertex packedVertices[6];
+	PackTerrainVertices(quadVertices, 6, bounds, packedVertices);
 
 	// configure plane VAO
 	glGenVertexArrays(1, &VAO);
@@ -77,18 +98,9 @@ Mesh::Mesh(Shader& shader)
 
 	glBindVertexArray(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(8 * sizeof(float)));
-	glEnableVertexAttribArray(4);
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(11 * sizeof(float)));
+	glBufferData(GL_ARRAY_BUFFER, sizeof(packedVertices), packedVertices, GL_STATIC_DRAW);
+	TrackGpuResource(GpuResourceType::Buffer, VBO, sizeof(packedVertices), "terrain quad VBO");
+	SetPackedTerrainVertexAttributes();
 
 	// Setup default material values for the procedural terrain. Fallback to these values if texture maps aren't used. 
 	material =
@@ -109,6 +121,7 @@ Mesh::Mesh(Shader& shader)
 // Constructor for rendering a skybox. 
 Mesh::Mesh(Shader& shader, MeshType type)
 {
+	MemoryScope memoryScope(MemorySubsystem::Meshes);
 	if (type == Skybox)
 	{
 		float skyboxVertices[] =
@@ -162,6 +175,7 @@ Mesh::Mesh(Shader& shader, MeshType type)
 		glBindVertexArray(VAO);
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+		TrackGpuResource(GpuResourceType::Buffer, VBO, sizeof(skyboxVertices), "skybox VBO");
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 	}
@@ -175,12 +189,19 @@ Mesh::Mesh(Shader& shader, MeshType type)
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
 
-		std::vector<glm::vec3> positions;
-		std::vector<unsigned int> indices;
-
 		const unsigned int X_SEGMENTS = 64;
 		const unsigned int Y_SEGMENTS = 64;
 		const float PI = 3.14159265359f;
+
+		// Build the sphere in a scratch arena sized up front: one allocation instead of repeated vector growth
+		const size_t vertexCount = (X_SEGMENTS + 1) * (Y_SEGMENTS + 1);
+		const size_t listIndexCount = X_SEGMENTS * Y_SEGMENTS * 6;
+		LinearArena scratch(vertexCount * (2 * sizeof(glm::vec3) + 4 * sizeof(int16_t)) + listIndexCount * sizeof(uint16_t) + 64);
+		ArenaVector<glm::vec3> positions{ ArenaAllocator<glm::vec3>(scratch) };
+		ArenaVector<int16_t> packedPositions{ ArenaAllocator<int16_t>(scratch) };
+		ArenaVector<uint16_t> indices{ ArenaAllocator<uint16_t>(scratch) }; // 65 x 65 vertices fit 16 bits
+		positions.reserve(vertexCount);
+		indices.reserve(listIndexCount);
 		for (unsigned int x = 0; x <= X_SEGMENTS; ++x)
 		{
 			for (unsigned int y = 0; y <= Y_SEGMENTS; ++y)
@@ -195,46 +216,137 @@ Mesh::Mesh(Shader& shader, MeshType type)
 			}
 		}
 
-		bool oddRow = false;
+		// A triangle list rather than a strip: a strip row by row transforms every vertex twice (an ACMR of ~1), the
+		// cache optimized list about two thirds as many. Vertices are then renumbered in the order the list uses them.
 		for (unsigned int y = 0; y < Y_SEGMENTS; ++y)
 		{
-			if (!oddRow) 
-			{
-				for (unsigned int x = 0; x <= X_SEGMENTS; ++x)
-				{
-					indices.push_back(y * (X_SEGMENTS + 1) + x);
-					indices.push_back((y + 1) * (X_SEGMENTS + 1) + x);
-				}
-			}
-			else
+			for (unsigned int x = 0; x < X_SEGMENTS; ++x)
 			{
-				for (int x = X_SEGMENTS; x >= 0; --x)
-				{
-					indices.push_back((y + 1) * (X_SEGMENTS + 1) + x);
-					indices.push_back(y * (X_SEGMENTS + 1) + x);
-				}
+				uint16_t a = static_cast<uint16_t>(y * (X_SEGMENTS + 1) + x), b = static_cast<uint16_t>(a + X_SEGMENTS + 1);
+				const uint16_t quad[6] = { a, b, static_cast<uint16_t>(a + 1), static_cast<uint16_t>(a + 1), b, static_cast<uint16_t>(b + 1) };
+				indices.insert(indices.end(), quad, quad + 6);
 			}
-			oddRow = !oddRow;
 		}
+		const VertexCacheStats generated = AnalyzeVertexCache(indices.data(), indices.size(), positions.size());
+		OptimizeVertexCache(indices.data(), indices.size(), positions.size());
+		RemapVertices(positions, OptimizeVertexFetch(indices.data(), indices.size(), positions.size()));
+		CheckVertexCacheGain("the sun sphere", generated, AnalyzeVertexCache(indices.data(), indices.size(), positions.size()));
 		indexCount = static_cast<unsigned int>(indices.size());
 
-		std::vector<float> data;
-		for (unsigned int i = 0; i < positions.size(); ++i)
-		{
-			data.push_back(positions[i].x);
-			data.push_back(positions[i].y);
-			data.push_back(positions[i].z);
-		}
+		// A unit sphere: 16 bit signed normalized positions (8 bytes with the padding, sun.VERT reads them as floats)
+		packedPositions.resize(positions.size() * 4);
+		PackUnitPositions(positions.data(), positions.size(), packedPositions.data());
 		glBindVertexArray(VAO);
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), &data[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, packedPositions.size() * sizeof(int16_t), packedPositions.data(), GL_STATIC_DRAW);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), &indices[0], GL_STATIC_DRAW);
+		TrackGpuResource(GpuResourceType::Buffer, VBO, packedPositions.size() * sizeof(int16_t), "sun VBO");
+		TrackGpuResource(GpuResourceType::Buffer, EBO, indices.size() * sizeof(uint16_t), "sun EBO");
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, 4 * sizeof(int16_t), (void*)0);
+	}
+}
+
+/// <summary>
+/// Constructor for terrain tiles: one vertex buffer and one 16 bit index buffer for all of them, in the terrain quad's
+/// packed vertex layout.
+/// </summary>
+Mesh::Mesh(const TiledMeshData& data) : material(), bounds(data.bounds), indexCount(static_cast<unsigned int>(data.indices.size())), _type(TerrainTiles)
+{
+	MemoryScope memoryScope(MemorySubsystem::Meshes);
+	glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &_ebo);
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, data.vertices.size() * sizeof(PackedTerrainVertex), data.vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.indices.size() * sizeof(uint16_t), data.indices.data(), GL_STATIC_DRAW);
+	TrackGpuResource(GpuResourceType::Buffer, VBO, data.vertices.size() * sizeof(PackedTerrainVertex), "terrain tiles VBO");
+	TrackGpuResource(GpuResourceType::Buffer, _ebo, data.indices.size() * sizeof(uint16_t), "terrain tiles EBO");
+
+	SetPackedTerrainVertexAttributes();
+	glBindVertexArray(0);
+
+	for (const TiledMeshData::Tile& tile : data.tiles)
+	{
+		_tileIndexCounts.push_back(static_cast<int>(tile.indexCount));
+		_tileIndexOffsets.push_back(reinterpret_cast<const void*>(static_cast<uintptr_t>(tile.firstIndex) * sizeof(uint16_t)));
+		_tileBaseVertices.push_back(tile.baseVertex);
 	}
 }
 
+/// <summary>
+/// Constructor for instanced models: one vertex and one index buffer for all levels of detail. The per instance attributes
+/// come from SetInstanceBuffer(), until then the VAO only feeds the model itself.
+/// </summary>
+Mesh::Mesh(const InstancedMeshData& data) : material(), bounds(), indexCount(static_cast<unsigned int>(data.indices.size())), _type(Instanced), _lods(data.lods)
+{
+	MemoryScope memoryScope(MemorySubsystem::Meshes);
+	glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &_ebo);
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, data.vertices.size() * sizeof(ModelVertex), data.vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.indices.size() * sizeof(uint16_t), data.indices.data(), GL_STATIC_DRAW);
+	TrackGpuResource(GpuResourceType::Buffer, VBO, data.vertices.size() * sizeof(ModelVertex), "instanced model VBO");
+	TrackGpuResource(GpuResourceType::Buffer, _ebo, data.indices.size() * sizeof(uint16_t), "instanced model EBO");
+
+	const int stride = sizeof(ModelVertex);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ModelVertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_BYTE, GL_TRUE, stride, (void*)offsetof(ModelVertex, normal));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(ModelVertex, color));
+	glBindVertexArray(0);
+}
+
+void Mesh::SetInstanceBuffer(unsigned int buffer)
+{
+	if (_type != Instanced) return;
+	// ScatterInstance (terrainScatter.h): a float position, then yaw and scale as 16 bit unsigned normalized values
+	const int stride = 16;
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(4);
+	glVertexAttribPointer(4, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)(3 * sizeof(float)));
+	glVertexAttribDivisor(4, 1);
+	glBindVertexArray(0);
+}
+
+void Mesh::DrawLod(int lod) const
+{
+	if (_type != Instanced || lod < 0 || lod >= static_cast<int>(_lods.size())) return;
+	const InstancedMeshData::Lod& level = _lods[lod];
+	glBindVertexArray(VAO);
+	glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<int>(level.indexCount), GL_UNSIGNED_SHORT,
+		reinterpret_cast<const void*>(static_cast<uintptr_t>(level.firstIndex) * sizeof(uint16_t)), level.baseVertex);
+	glBindVertexArray(0);
+}
+
+void Mesh::DrawIndirect(const void* offset, int count) const
+{
+	if (_type != Instanced || count <= 0) return;
+	glBindVertexArray(VAO);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, offset, count, 0);
+	glBindVertexArray(0);
+}
+
+void Mesh::Draw() const
+{
+	if (_type == TerrainTiles)
+		DrawTiles();
+	else
+		DrawQuad();
+}
+
 void Mesh::DrawQuad() const
 {
 	glBindVertexArray(VAO);
@@ -247,6 +359,28 @@ void Mesh::DrawSphere() const
 	if (_type == Sun)
 	{
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLE_STRIP, indexCount, GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, 0);
+	}
+}
+
+void Mesh::DrawTiles() const
+{
+	if (_type != TerrainTiles || _tileIndexCounts.empty()) return;
+	glBindVertexArray(VAO);
+	glMultiDrawElementsBaseVertex(GL_TRIANGLES, _tileIndexCounts.data(), GL_UNSIGNED_SHORT, _tileIndexOffsets.data(), static_cast<int>(_tileIndexCounts.size()), _tileBaseVertices.data());
+	glBindVertexArray(0);
+}
+
+void Mesh::Release()
+{
+	if (!VAO) return;
+	UntrackGpuResource(GpuResourceType::Buffer, VBO);
+	glDeleteBuffers(1, &VBO);
+	if (_ebo)
+	{
+		UntrackGpuResource(GpuResourceType::Buffer, _ebo);
+		glDeleteBuffers(1, &_ebo);
 	}
-}
\ No newline at end of file
+	glDeleteVertexArrays(1, &VAO);
+	VAO = VBO = _ebo = 0;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <glm/glm.hpp>
@@ -7,6 +8,7 @@
 #include <glm/gtc/type_ptr.hpp>
 #include "shader.h"
 #include "texture.h"
+#include "vertexFormat.h"
 
 struct Material
 {
@@ -18,7 +20,59 @@ struct Material
 
 enum MeshType : uint8_t
 {
-	Skybox, Sun
+	Skybox, Sun, TerrainQuad, TerrainTiles, Instanced
+};
+
+/// <summary>
+/// Indexed terrain geometry in tiles, e.g. from RtinMesher. Every tile indexes its own vertices with 16 bits from its
+/// baseVertex, so the index buffer stays half the size however many vertices the whole mesh has.
+/// </summary>
+struct TiledMeshData
+{
+	struct Tile
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		int32_t baseVertex;
+	};
+
+	std::vector<PackedTerrainVertex> vertices;
+	VertexBounds bounds; // The vertices are quantized in
+	std::vector<uint16_t> indices;
+	std::vector<Tile> tiles;
+};
+
+/// <summary>
+/// A model to draw instanced (see instanceRenderer.h), at a few levels of detail in one vertex and one 16 bit index buffer.
+/// Like TiledMeshData's tiles, every level indexes its own vertices from its baseVertex.
+/// </summary>
+struct InstancedMeshData
+{
+	struct Lod
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		int32_t baseVertex;
+		uint32_t vertexCount;
+	};
+
+	std::vector<ModelVertex> vertices;
+	std::vector<uint16_t> indices;
+	std::vector<Lod> lods;   // Finest first
+	glm::vec3 boundsCenter;  // A sphere around every level, in the model's units
+	float boundsRadius;
+};
+
+/// <summary>
+/// One draw of glMultiDrawElementsIndirect, laid out as GL reads it from the GL_DRAW_INDIRECT_BUFFER.
+/// </summary>
+struct DrawElementsIndirectCommand
+{
+	uint32_t count;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t baseInstance;
 };
 
 /// <summary>
@@ -29,13 +83,32 @@ class Mesh
 public:	
 	unsigned int VAO, VBO;
 	Material material;
+	VertexBounds bounds; // Terrain meshes: the box their packed positions are relative to, procTerrain.VERT's positionMin/ positionExtent
 
 	Mesh(Shader& shader);
 	Mesh(Shader& shader, MeshType type);
+	explicit Mesh(const TiledMeshData& data); // Terrain tiles, drawn with procTerrain.VERT like the quad
+	explicit Mesh(const InstancedMeshData& data); // A model for instance.VERT, per instance attributes from SetInstanceBuffer()
+	void Draw() const; // Whichever kind of terrain mesh this is
 	void DrawQuad() const;
 	void DrawSphere() const;
+	void DrawTiles() const;
+
+	/// <summary>
+	/// Instanced meshes: read attributes 3 and 4 (ScatterInstance's position, yaw and scale) per instance from buffer.
+	/// </summary>
+	void SetInstanceBuffer(unsigned int buffer);
+	void DrawLod(int lod) const; // One copy of a level, without instance attributes (e.g. to bake impostors)
+	void DrawIndirect(const void* offset, int count) const; // count commands from the bound GL_DRAW_INDIRECT_BUFFER, at offset
+	const std::vector<InstancedMeshData::Lod>& Lods() const { return _lods; }
+	void Release(); // Delete the GL buffers, e.g. when the terrain is regenerated
 
 private:
 	unsigned int indexCount;
 	MeshType _type;
+	unsigned int _ebo = 0;
+	std::vector<int> _tileIndexCounts;      // One draw per tile, see TiledMeshData
+	std::vector<const void*> _tileIndexOffsets;
+	std::vector<int> _tileBaseVertices;
+	std::vector<InstancedMeshData::Lod> _lods;
 };
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include "meshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+/// <summary>
+/// A FIFO cache by timestamps: a vertex is cached while fewer than VERTEX_CACHE_SIZE misses came after its own. Reset()
+/// empties it without touching every vertex.
+/// </summary>
+struct FifoCacheSimulation
+{
+	std::vector<uint32_t> cachedAt;
+	uint32_t time;
+
+	explicit FifoCacheSimulation(size_t vertexCount) : cachedAt(vertexCount, 0), time(VERTEX_CACHE_SIZE + 1) {}
+
+	void Reset() { time += VERTEX_CACHE_SIZE + 1; }
+
+	int Misses(const uint16_t* triangle) // Transforms triangle's vertices that aren't cached, caching them
+	{
+		int misses = 0;
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			uint16_t v = triangle[corner];
+			if (time - cachedAt[v] > static_cast<uint32_t>(VERTEX_CACHE_SIZE))
+			{
+				cachedAt[v] = time++;
+				++misses;
+			}
+		}
+		return misses;
+	}
+};
+
+static size_t VertexRange(const uint16_t* indices, size_t indexCount)
+{
+	uint16_t last = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+		last = std::max(last, indices[i]);
+	return indexCount ? static_cast<size_t>(last) + 1 : 0;
+}
+
+VertexCacheStats AnalyzeVertexCache(const uint16_t* indices, size_t indexCount, size_t vertexCount)
+{
+	VertexCacheStats stats;
+	stats.triangles = indexCount / 3;
+	stats.vertices = vertexCount;
+	FifoCacheSimulation cache(std::max(vertexCount, VertexRange(indices, indexCount)));
+	for (size_t triangle = 0; triangle < stats.triangles; ++triangle)
+		stats.transformed += cache.Misses(indices + triangle * 3);
+	return stats;
+}
+
+bool CheckVertexCacheGain(const char* meshName, const VertexCacheStats& generated, const VertexCacheStats& optimized)
+{
+	if (optimized.triangles == generated.triangles && optimized.transformed <= generated.transformed)
+		return true;
+	std::cerr << "ERROR: Optimizing " << meshName << " made its vertex cache use worse: ACMR " << generated.Acmr() << " -> "
+		<< optimized.Acmr() << " over " << generated.triangles << " -> " << optimized.triangles << " triangles" << std::endl;
+	return false;
+}
+
+static const int FORSYTH_CACHE_SIZE = 32; // The LRU cache the scores model; a little larger than the FIFO ages better
+
+static const int FORSYTH_VALENCE_TABLE = 32;  // Triangles left that have their boost looked up rather than computed
+
+/// <summary>
+/// Forsyth's vertex score: the three vertices just used score a flat 0.75 (the next triangle shouldn't prefer one of them),
+/// older entries fall off towards the end of the cache, and a vertex with few triangles left gets a boost so it is finished.
+/// A vertex with none left scores -1 and is never chosen through. Both parts come from tables built once.
+/// </summary>
+struct ForsythScores
+{
+	float cachePosition[FORSYTH_CACHE_SIZE];
+	float valence[FORSYTH_VALENCE_TABLE];
+
+	ForsythScores()
+	{
+		for (int position = 0; position < FORSYTH_CACHE_SIZE; ++position)
+			cachePosition[position] = position < 3 ? 0.75f : std::pow(1.0f - (position - 3) * (1.0f / (FORSYTH_CACHE_SIZE - 3)), 1.5f);
+		valence[0] = 0.0f;
+		for (int trianglesLeft = 1; trianglesLeft < FORSYTH_VALENCE_TABLE; ++trianglesLeft)
+			valence[trianglesLeft] = 2.0f / std::sqrt(static_cast<float>(trianglesLeft));
+	}
+
+	float VertexScore(int position, uint32_t trianglesLeft) const
+	{
+		if (trianglesLeft == 0)
+			return -1.0f;
+		float boost = trianglesLeft < FORSYTH_VALENCE_TABLE ? valence[trianglesLeft] : 2.0f / std::sqrt(static_cast<float>(trianglesLeft));
+		return (position >= 0 ? cachePosition[position] : 0.0f) + boost;
+	}
+};
+
+void OptimizeVertexCache(uint16_t* indices, size_t indexCount, size_t vertexCount)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2)
+		return;
+	vertexCount = std::max(vertexCount, VertexRange(indices, indexCount));
+
+	// Each vertex's triangles, as ranges of one array; the first trianglesLeft of a range haven't been emitted
+	std::vector<uint32_t> trianglesLeft(vertexCount, 0), firstAdjacent(vertexCount + 1, 0), adjacent(triangleCount * 3);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+		++trianglesLeft[indices[i]];
+	for (size_t v = 0; v < vertexCount; ++v)
+		firstAdjacent[v + 1] = firstAdjacent[v] + trianglesLeft[v];
+	{
+		std::vector<uint32_t> filled(firstAdjacent.begin(), firstAdjacent.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+			adjacent[filled[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	static const ForsythScores scores;
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount), triangleScore(triangleCount, 0.0f);
+	for (size_t v = 0; v < vertexCount; ++v)
+		vertexScore[v] = scores.VertexScore(-1, trianglesLeft[v]);
+	size_t best = 0;
+	for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+	{
+		for (int corner = 0; corner < 3; ++corner)
+			triangleScore[triangle] += vertexScore[indices[triangle * 3 + corner]];
+		if (triangleScore[triangle] > triangleScore[best])
+			best = triangle;
+	}
+
+	std::vector<uint16_t> output;
+	output.reserve(triangleCount * 3);
+	std::vector<uint8_t> bEmitted(triangleCount, 0);
+	uint16_t cache[FORSYTH_CACHE_SIZE + 3], grown[FORSYTH_CACHE_SIZE + 3];
+	int cacheCount = 0;
+	size_t nextUnemitted = 0;
+	const size_t none = triangleCount;
+	for (size_t emitted = 0; emitted < triangleCount; ++emitted)
+	{
+		if (best == none)
+		{
+			// Nothing around the cache is left: carry on from the input's order, which is usually close by anyway
+			while (bEmitted[nextUnemitted])
+				++nextUnemitted;
+			best = nextUnemitted;
+		}
+		const uint16_t* triangle = indices + best * 3;
+		output.insert(output.end(), triangle, triangle + 3);
+		bEmitted[best] = 1;
+
+		// Take the triangle off its vertices' lists and put its vertices at the front of the cache
+		int grownCount = 0;
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			uint16_t v = triangle[corner];
+			uint32_t* list = &adjacent[firstAdjacent[v]];
+			uint32_t last = --trianglesLeft[v];
+			for (uint32_t i = 0; i <= last; ++i)
+			{
+				if (list[i] == best)
+				{
+					std::swap(list[i], list[last]);
+					break;
+				}
+			}
+			if (std::find(grown, grown + grownCount, v) == grown + grownCount)
+				grown[grownCount++] = v;
+		}
+		for (int i = 0; i < cacheCount; ++i)
+		{
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				grown[grownCount++] = cache[i];
+		}
+		cacheCount = std::min(grownCount, FORSYTH_CACHE_SIZE);
+		for (int i = 0; i < grownCount; ++i)
+			cachePosition[grown[i]] = i < cacheCount ? i : -1;
+		std::copy(grown, grown + cacheCount, cache);
+
+		// Rescore everything that moved (the vertices that fell out too) and look for the next triangle around the cache
+		for (int i = 0; i < grownCount; ++i)
+		{
+			uint16_t v = grown[i];
+			float score = scores.VertexScore(cachePosition[v], trianglesLeft[v]), change = score - vertexScore[v];
+			vertexScore[v] = score;
+			for (uint32_t j = 0; j < trianglesLeft[v]; ++j)
+				triangleScore[adjacent[firstAdjacent[v] + j]] += change;
+		}
+		best = none;
+		float bestScore = 0.0f;
+		for (int i = 0; i < cacheCount; ++i)
+		{
+			uint16_t v = cache[i];
+			for (uint32_t j = 0; j < trianglesLeft[v]; ++j)
+			{
+				uint32_t candidate = adjacent[firstAdjacent[v] + j];
+				if (best == none || triangleScore[candidate] > bestScore)
+				{
+					best = candidate;
+					bestScore = triangleScore[candidate];
+				}
+			}
+		}
+	}
+	std::memcpy(indices, output.data(), output.size() * sizeof(uint16_t));
+}
+
+void OptimizeOverdraw(uint16_t* indices, size_t indexCount, const glm::vec3* positions, size_t positionStride, float threshold)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2)
+		return;
+	const size_t vertexCount = VertexRange(indices, indexCount);
+	auto Position = [&](uint16_t v)
+	{
+		return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const char*>(positions) + v * positionStride);
+	};
+
+	// Hard boundaries: triangles that miss all three vertices start a cluster anyway, cutting there costs nothing
+	std::vector<size_t> hardStarts;
+	size_t totalMisses = 0;
+	{
+		FifoCacheSimulation cache(vertexCount);
+		for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+		{
+			int misses = cache.Misses(indices + triangle * 3);
+			if (triangle == 0 || misses == 3)
+				hardStarts.push_back(triangle);
+			totalMisses += misses;
+		}
+		hardStarts.push_back(triangleCount);
+	}
+
+	// Soft boundaries: cut a hard cluster again as soon as the part so far, starting cold, is within threshold of the ACMR
+	const float targetAcmr = threshold * totalMisses / triangleCount;
+	std::vector<size_t> starts;
+	{
+		FifoCacheSimulation cache(vertexCount);
+		for (size_t hard = 0; hard + 1 < hardStarts.size(); ++hard)
+		{
+			size_t clusterTriangles = 0, clusterMisses = 0;
+			cache.Reset();
+			starts.push_back(hardStarts[hard]);
+			for (size_t triangle = hardStarts[hard]; triangle < hardStarts[hard + 1]; ++triangle)
+			{
+				clusterMisses += cache.Misses(indices + triangle * 3);
+				++clusterTriangles;
+				if (triangle + 1 < hardStarts[hard + 1] && clusterMisses <= targetAcmr * clusterTriangles)
+				{
+					starts.push_back(triangle + 1);
+					clusterTriangles = clusterMisses = 0;
+					cache.Reset();
+				}
+			}
+		}
+		starts.push_back(triangleCount);
+	}
+
+	// Sort key: how far the cluster's area weighted normal points away from the mesh's center, from the cluster's centroid.
+	// Clusters on the outside facing out can hide the rest from most directions, so they go first.
+	const size_t clusterCount = starts.size() - 1;
+	std::vector<glm::vec3> centroids(clusterCount), normals(clusterCount);
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t cluster = 0; cluster < clusterCount; ++cluster)
+	{
+		glm::vec3 centroid(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t triangle = starts[cluster]; triangle < starts[cluster + 1]; ++triangle)
+		{
+			glm::vec3 a = Position(indices[triangle * 3]), b = Position(indices[triangle * 3 + 1]), c = Position(indices[triangle * 3 + 2]);
+			glm::vec3 cross = glm::cross(b - a, c - a);
+			float twiceArea = glm::length(cross);
+			centroid += (a + b + c) * (twiceArea / 3.0f);
+			normal += cross;
+			area += twiceArea;
+		}
+		meshCentroid += centroid;
+		meshArea += area;
+		centroids[cluster] = area > 0.0f ? centroid / area : Position(indices[starts[cluster] * 3]);
+		normals[cluster] = normal;
+	}
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	std::vector<float> keys(clusterCount);
+	std::vector<uint32_t> order(clusterCount);
+	for (size_t cluster = 0; cluster < clusterCount; ++cluster)
+	{
+		float length = glm::length(normals[cluster]);
+		keys[cluster] = length > 0.0f ? glm::dot(centroids[cluster] - meshCentroid, normals[cluster] / length) : 0.0f;
+		order[cluster] = static_cast<uint32_t>(cluster);
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+	std::vector<uint16_t> output;
+	output.reserve(triangleCount * 3);
+	for (uint32_t cluster : order)
+		output.insert(output.end(), indices + starts[cluster] * 3, indices + starts[cluster + 1] * 3);
+	std::memcpy(indices, output.data(), output.size() * sizeof(uint16_t));
+}
+
+std::vector<uint32_t> OptimizeVertexFetch(uint16_t* indices, size_t indexCount, size_t vertexCount)
+{
+	std::vector<int32_t> remap(std::max(vertexCount, VertexRange(indices, indexCount)), -1);
+	std::vector<uint32_t> order;
+	order.reserve(vertexCount);
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		uint16_t v = indices[i];
+		if (remap[v] < 0)
+		{
+			remap[v] = static_cast<int32_t>(order.size());
+			order.push_back(v);
+		}
+		indices[i] = static_cast<uint16_t>(remap[v]);
+	}
+	return order;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+const int VERTEX_CACHE_SIZE = 16; // Post-transform cache entries (FIFO) the optimizer aims for and the metrics assume
+
+/// <summary>
+/// How often an index buffer makes the GPU transform a vertex it has already transformed, simulated with a
+/// VERTEX_CACHE_SIZE entry FIFO cache:
+///  - ACMR (average cache miss ratio): vertices transformed per triangle. 3 at worst, ~0.5 at best on a regular grid.
+///  - ATVR (average transformed vertex ratio): vertices transformed per vertex. 1 at best, every vertex once.
+/// </summary>
+struct VertexCacheStats
+{
+	size_t triangles = 0;
+	size_t vertices = 0;
+	size_t transformed = 0;
+
+	float Acmr() const { return triangles ? static_cast<float>(transformed) / triangles : 0.0f; }
+	float Atvr() const { return vertices ? static_cast<float>(transformed) / vertices : 0.0f; }
+	VertexCacheStats& operator+=(const VertexCacheStats& other)
+	{
+		triangles += other.triangles;
+		vertices += other.vertices;
+		transformed += other.transformed;
+		return *this;
+	}
+};
+
+VertexCacheStats AnalyzeVertexCache(const uint16_t* indices, size_t indexCount, size_t vertexCount);
+
+/// <summary>
+/// The self-check every generated mesh goes through after optimizing: false, with an error naming the mesh, if the optimized
+/// indices transform more vertices than the order they were generated in.
+/// </summary>
+bool CheckVertexCacheGain(const char* meshName, const VertexCacheStats& generated, const VertexCacheStats& optimized);
+
+/// <summary>
+/// Reorder a triangle list's triangles so consecutive ones share vertices (Tom Forsyth's linear-speed vertex cache
+/// optimization): every vertex is scored by its place in a simulated cache and by how few triangles it has left, and the
+/// next triangle is the best scoring one around the vertices in the cache. Vertices with few triangles left go first, so
+/// the order finishes regions instead of leaving holes to come back to.
+/// </summary>
+void OptimizeVertexCache(uint16_t* indices, size_t indexCount, size_t vertexCount);
+
+/// <summary>
+/// Reorder a cache optimized triangle list's clusters so that the surfaces most likely to hide others are drawn first, for
+/// any view (Sander, Nehab and Barczak's "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"). The list is cut
+/// where the cache would be cold anyway and wherever a cluster's ACMR is within threshold of the whole list's, and the
+/// clusters are sorted by how far they face out from the mesh's center. ACMR grows by roughly threshold.
+/// </summary>
+void OptimizeOverdraw(uint16_t* indices, size_t indexCount, const glm::vec3* positions, size_t positionStride, float threshold = 1.05f);
+
+/// <summary>
+/// Renumber the vertices in the order the indices first use them, so vertex fetches walk the buffer forward. Returns the old
+/// index of every new vertex, for RemapVertices(). Vertices no index uses are dropped.
+/// </summary>
+std::vector<uint32_t> OptimizeVertexFetch(uint16_t* indices, size_t indexCount, size_t vertexCount);
+
+template <typename VertexVector>
+void RemapVertices(VertexVector& vertices, const std::vector<uint32_t>& order)
+{
+	VertexVector reordered(vertices.get_allocator());
+	reordered.reserve(order.size());
+	for (uint32_t old : order)
+		reordered.push_back(vertices[old]);
+	vertices.swap(reordered);
+}
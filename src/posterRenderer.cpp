@@ -0,0 +1,83 @@
+#include "posterRenderer.h"
+#include "imageWriter.h"
+#include "memoryTracker.h"
+#include <iostream>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+bool RenderPoster(const char* path, int width, int height, int tileWidth, int tileHeight, int margin,
+	float fovDegrees, float nearPlane, float farPlane, const RenderPosterTileFunction& renderTile)
+{
+	const int coreWidth = tileWidth - 2 * margin;
+	const int coreHeight = tileHeight - 2 * margin;
+	if (coreWidth <= 0 || coreHeight <= 0)
+	{
+		std::cerr << "ERROR: Poster margin " << margin << " leaves nothing of a " << tileWidth << "x" << tileHeight << " tile" << std::endl;
+		return false;
+	}
+
+	TiledPpmWriter writer;
+	if (!writer.Open(path, width, height)) return false;
+
+	// sRGB target, so the bytes read back are what the window would show with GL_FRAMEBUFFER_SRGB on
+	unsigned int tileFBO, tileTexture;
+	glGenFramebuffers(1, &tileFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, tileFBO);
+	glGenTextures(1, &tileTexture);
+	glBindTexture(GL_TEXTURE_2D, tileTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, tileWidth, tileHeight);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileTexture, 0);
+	TrackGpuResource(GpuResourceType::Texture, tileTexture, TextureByteSize(tileWidth, tileHeight, GL_SRGB8_ALPHA8), "poster tile");
+	bool bComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// The poster's frustum on the near plane; each tile renders an off-center slice of it
+	const float top = nearPlane * glm::tan(glm::radians(fovDegrees) * 0.5f);
+	const float right = top * static_cast<float>(width) / static_cast<float>(height);
+	const int tilesX = (width + coreWidth - 1) / coreWidth;
+	const int tilesY = (height + coreHeight - 1) / coreHeight;
+
+	std::vector<unsigned char> pixels(static_cast<size_t>(coreWidth) * coreHeight * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (int tileY = 0; tileY < tilesY && bComplete; ++tileY)
+	{
+		for (int tileX = 0; tileX < tilesX; ++tileX)
+		{
+			// Poster pixels covered by the whole tile, margins included (y up, like GL)
+			const int x0 = tileX * coreWidth - margin;
+			const int y0 = tileY * coreHeight - margin;
+
+			PosterTile tile;
+			tile.projection = glm::frustum(
+				-right + 2.0f * right * x0 / width, -right + 2.0f * right * (x0 + tileWidth) / width,
+				-top + 2.0f * top * y0 / height, -top + 2.0f * top * (y0 + tileHeight) / height,
+				nearPlane, farPlane);
+			tile.region.offset = glm::vec2(static_cast<float>(x0) / width, static_cast<float>(y0) / height);
+			tile.region.scale = glm::vec2(static_cast<float>(tileWidth) / width, static_cast<float>(tileHeight) / height);
+			tile.framebuffer = tileFBO;
+			renderTile(tile);
+
+			// Keep the core, clipped to the poster, and store it top row first
+			const int keepWidth = glm::min(coreWidth, width - tileX * coreWidth);
+			const int keepHeight = glm::min(coreHeight, height - tileY * coreHeight);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, tileFBO);
+			glReadPixels(margin, margin, keepWidth, keepHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+			const int posterTop = height - (tileY * coreHeight + keepHeight);
+			writer.WriteRegion(tileX * coreWidth, posterTop, keepWidth, keepHeight, pixels.data(), true);
+		}
+		std::cout << "Poster: " << (tileY + 1) * tilesX << "/" << tilesX * tilesY << " tiles" << std::endl;
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	UntrackGpuResource(GpuResourceType::Texture, tileTexture);
+	glDeleteTextures(1, &tileTexture);
+	glDeleteFramebuffers(1, &tileFBO);
+	writer.Close();
+
+	if (!bComplete)
+		std::cerr << "ERROR: Poster tile framebuffer not complete!" << std::endl;
+	return bComplete;
+}
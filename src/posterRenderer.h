@@ -0,0 +1,36 @@
+#pragma once
+
+#include <functional>
+#include <glm/glm.hpp>
+
+/// <summary>
+/// Where the image being rendered sits on the (virtual) screen, in screen UV. The whole screen for normal frames; for a
+/// poster tile it is the tile's part of the poster, so screen-space effects such as the lens flare line up across tiles.
+/// </summary>
+struct ScreenRegion
+{
+	glm::vec2 offset;
+	glm::vec2 scale;
+
+	ScreenRegion() : offset(0.0f), scale(1.0f) {}
+};
+
+struct PosterTile
+{
+	glm::mat4 projection;     // Off-center slice of the poster's frustum covering this tile, margins included
+	ScreenRegion region;
+	unsigned int framebuffer; // Render the final, tonemapped image here (tileWidth x tileHeight, sRGB)
+};
+
+typedef std::function<void(const PosterTile& tile)> RenderPosterTileFunction;
+
+/// <summary>
+/// Render a width x height image by splitting the poster's frustum into tiles of tileWidth x tileHeight (the size of the
+/// regular render targets) and stitching them into a PPM file. Only the centre of each tile is kept: the outer margin pixels
+/// overlap the neighbouring tiles so blurs (bloom) see the same neighbourhood they would in a single huge image. Each tile is
+/// written to disk as soon as it is read back, so memory use stays at one tile whatever the poster size.
+/// Keep the margin and tileWidth/ tileHeight - 2 * margin multiples of any downsampling factor used by the post-process chain,
+/// so the downsampled grids of neighbouring tiles line up.
+/// </summary>
+bool RenderPoster(const char* path, int width, int height, int tileWidth, int tileHeight, int margin,
+	float fovDegrees, float nearPlane, float farPlane, const RenderPosterTileFunction& renderTile);
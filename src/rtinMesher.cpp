@@ -0,0 +1,288 @@
+#include "rtinMesher.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <string>
+#include "glad/glad.h"
+#include "memoryTracker.h"
+
+RtinMesher::RtinMesher() : _gridSize(0), _heightScale(0.0f), _maxError(0.0f), _buildMilliseconds(0.0)
+{
+}
+
+JobHandle RtinMesher::Generate(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float heightScale, float maxError)
+{
+	if (_pending)
+		jobSystem.Wait(_pending);
+	if (textureSize % RTIN_TILE_CELLS != 0 || (textureSize & (textureSize - 1)) != 0)
+	{
+		std::cerr << "ERROR: The RTIN mesh needs a power of two height map size, at least " << RTIN_TILE_CELLS << std::endl;
+		return _pending = JobHandle();
+	}
+
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	_gridSize = textureSize;
+	_heightScale = heightScale;
+	_maxError = maxError;
+	_heightMap = heightMap;
+	const size_t points = static_cast<size_t>(_gridSize + 1) * (_gridSize + 1);
+	_heights.resize(points);
+	_errors.assign(points, 0.0f);
+	const int tilesAcross = _gridSize / RTIN_TILE_CELLS;
+	_tiles.resize(static_cast<size_t>(tilesAcross) * tilesAcross);
+	_tileCacheBefore.resize(_tiles.size());
+	_tileCacheAfter.resize(_tiles.size());
+	_startTime = std::chrono::steady_clock::now();
+
+	// One job per band of tile rows over the grid's points, each pass waiting for the previous one
+	std::vector<JobHandle> pass = jobSystem.ScheduleRows(_gridSize + 1, RTIN_TILE_CELLS, {}, [this](int firstRow, int lastRow) { ComputeHeights(firstRow, lastRow); });
+	for (int cells = 2; cells <= RTIN_TILE_CELLS; cells *= 2) // Coarser triangles are always split
+	{
+		pass = jobSystem.ScheduleRows(_gridSize + 1, RTIN_TILE_CELLS, pass, [this, cells](int firstRow, int lastRow) { ComputeEdgeErrors(cells, firstRow, lastRow); });
+		pass = jobSystem.ScheduleRows(_gridSize + 1, RTIN_TILE_CELLS, pass, [this, cells](int firstRow, int lastRow) { ComputeCenterErrors(cells, firstRow, lastRow); });
+	}
+	std::vector<JobHandle> tiles;
+	for (int tile = 0; tile < static_cast<int>(_tiles.size()); ++tile)
+		tiles.push_back(jobSystem.Schedule([this, tile] { ExtractTile(tile); }, pass));
+	JobHandle merged = jobSystem.Schedule([this] { Merge(); }, tiles);
+	_pending = jobSystem.ScheduleOnMainThread([this]
+	{
+		if (_mesh)
+			_mesh->Release();
+		_mesh.reset(new Mesh(_data));
+		const size_t triangles = _data.indices.size() / 3, gridTriangles = 2 * static_cast<size_t>(_gridSize) * _gridSize;
+		std::cout << "RTIN mesh: " << triangles << " triangles, " << _data.vertices.size() << " vertices ("
+			<< 100.0 * triangles / gridTriangles << "% of the full grid's " << gridTriangles << ") at a max error of " << _maxError
+			<< " in " << _buildMilliseconds << " ms, ACMR " << _cacheBefore.Acmr() << " -> " << _cacheAfter.Acmr()
+			<< ", ATVR " << _cacheBefore.Atvr() << " -> " << _cacheAfter.Atvr() << std::endl;
+	}, { merged });
+	return _pending;
+}
+
+/// <summary>
+/// Grid points sit on the texels' corners, between four texel centers: the bilinear surface procTerrainTess.TESE samples,
+/// clamped at the border.
+/// </summary>
+void RtinMesher::ComputeHeights(int firstRow, int lastRow)
+{
+	const int size = _gridSize;
+	auto Texel = [&](int x, int y)
+	{
+		x = std::min(std::max(x, 0), size - 1);
+		y = std::min(std::max(y, 0), size - 1);
+		return static_cast<float>((*_heightMap)[static_cast<size_t>(y) * size + x]);
+	};
+	for (int y = firstRow; y < lastRow; ++y)
+		for (int x = 0; x <= size; ++x)
+			_heights[static_cast<size_t>(y) * (size + 1) + x] = (Texel(x - 1, y - 1) + Texel(x, y - 1) + Texel(x - 1, y) + Texel(x, y)) * 0.25f;
+}
+
+/// <summary>
+/// How far the heights inside the triangle (a, b, c) stray from its plane, at most.
+/// </summary>
+float RtinMesher::TriangleError(int ax, int ay, int bx, int by, int cx, int cy) const
+{
+	const int area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax); // Twice the signed area
+	const float ha = Height(ax, ay), hb = Height(bx, by), hc = Height(cx, cy);
+	float error = 0.0f;
+	for (int y = std::min(std::min(ay, by), cy); y <= std::max(std::max(ay, by), cy); ++y)
+	{
+		for (int x = std::min(std::min(ax, bx), cx); x <= std::max(std::max(ax, bx), cx); ++x)
+		{
+			// Barycentric weights, times the area: all of the same sign inside
+			int wa = (bx - x) * (cy - y) - (by - y) * (cx - x);
+			int wb = (cx - x) * (ay - y) - (cy - y) * (ax - x);
+			int wc = area - wa - wb;
+			if (area > 0 ? (wa < 0 || wb < 0 || wc < 0) : (wa > 0 || wb > 0 || wc > 0)) continue;
+			float plane = (ha * wa + hb * wb + hc * wc) / area;
+			error = std::max(error, std::abs(Height(x, y) - plane));
+		}
+	}
+	return error;
+}
+
+/// <summary>
+/// Points halfway along the edges of the squares `cells` across: where the triangles with those edges as hypotenuse (and
+/// the centers of the squares on either side as right angle) split. Below them are the centers of the squares half as large.
+/// </summary>
+void RtinMesher::ComputeEdgeErrors(int cells, int firstRow, int lastRow)
+{
+	const int half = cells / 2, quarter = cells / 4, size = _gridSize;
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		if (y % cells == 0) // Horizontal edges
+		{
+			for (int x = half; x < size; x += cells)
+			{
+				float error = 0.0f;
+				if (y > 0)
+				{
+					error = std::max(error, TriangleError(x - half, y, x + half, y, x, y - half));
+					if (quarter > 0) error = std::max(error, std::max(Error(x - quarter, y - quarter), Error(x + quarter, y - quarter)));
+				}
+				if (y < size)
+				{
+					error = std::max(error, TriangleError(x - half, y, x + half, y, x, y + half));
+					if (quarter > 0) error = std::max(error, std::max(Error(x - quarter, y + quarter), Error(x + quarter, y + quarter)));
+				}
+				Error(x, y) = error;
+			}
+		}
+		else if (y % cells == half) // Vertical edges
+		{
+			for (int x = 0; x <= size; x += cells)
+			{
+				float error = 0.0f;
+				if (x > 0)
+				{
+					error = std::max(error, TriangleError(x, y - half, x, y + half, x - half, y));
+					if (quarter > 0) error = std::max(error, std::max(Error(x - quarter, y - quarter), Error(x - quarter, y + quarter)));
+				}
+				if (x < size)
+				{
+					error = std::max(error, TriangleError(x, y - half, x, y + half, x + half, y));
+					if (quarter > 0) error = std::max(error, std::max(Error(x + quarter, y - quarter), Error(x + quarter, y + quarter)));
+				}
+				Error(x, y) = error;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Centers of the squares `cells` across, where the two triangles splitting the square along its diagonal split. Which
+/// diagonal alternates like a checkerboard (it always meets the center of the square twice the size), and the points below
+/// are the midpoints of the square's four edges.
+/// </summary>
+void RtinMesher::ComputeCenterErrors(int cells, int firstRow, int lastRow)
+{
+	const int half = cells / 2, size = _gridSize;
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		if (y % cells != half) continue;
+		for (int x = half; x < size; x += cells)
+		{
+			float error;
+			if ((x / cells + y / cells) % 2 == 0)
+				error = std::max(TriangleError(x - half, y - half, x + half, y + half, x + half, y - half), TriangleError(x - half, y - half, x + half, y + half, x - half, y + half));
+			else
+				error = std::max(TriangleError(x + half, y - half, x - half, y + half, x - half, y - half), TriangleError(x + half, y - half, x - half, y + half, x + half, y + half));
+			error = std::max(error, std::max(std::max(Error(x, y - half), Error(x, y + half)), std::max(Error(x - half, y), Error(x + half, y))));
+			Error(x, y) = error;
+		}
+	}
+}
+
+void RtinMesher::ExtractTile(int tile)
+{
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	const int tilesAcross = _gridSize / RTIN_TILE_CELLS, size = _gridSize;
+	const int x0 = tile % tilesAcross * RTIN_TILE_CELLS, y0 = tile / tilesAcross * RTIN_TILE_CELLS;
+	TiledMeshData& out = _tiles[tile];
+	out.indices.clear();
+	std::vector<TerrainVertex> vertices;
+
+	// Grid point to the tile's vertex, each emitted on first use
+	std::vector<int> vertexOf((RTIN_TILE_CELLS + 1) * (RTIN_TILE_CELLS + 1), -1);
+	auto Vertex = [&](int x, int y)
+	{
+		int& index = vertexOf[(y - y0) * (RTIN_TILE_CELLS + 1) + (x - x0)];
+		if (index < 0)
+		{
+			index = static_cast<int>(vertices.size());
+			float u = static_cast<float>(x) / size, v = static_cast<float>(y) / size;
+			// The quad's tangent frame, pushed down by the height map: it spans 2 units, so the full height range is
+			// heightScale * 2 deep, as procTerrainTess.TESE displaces it
+			vertices.push_back({ glm::vec3(u * 2.0f - 1.0f, v * 2.0f - 1.0f, -Height(x, y) / 255.0f * _heightScale * 2.0f),
+				glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(u, v), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f) });
+		}
+		return static_cast<uint16_t>(index);
+	};
+
+	// Triangle with hypotenuse (a, b) and right angle at c: split at the hypotenuse's midpoint while that is too far off
+	std::function<void(int, int, int, int, int, int)> Triangle = [&](int ax, int ay, int bx, int by, int cx, int cy)
+	{
+		int mx = (ax + bx) / 2, my = (ay + by) / 2;
+		if (std::abs(ax - cx) + std::abs(ay - cy) > 1 && Error(mx, my) > _maxError)
+		{
+			Triangle(cx, cy, ax, ay, mx, my);
+			Triangle(bx, by, cx, cy, mx, my);
+			return;
+		}
+		if ((bx - ax) * (cy - ay) - (by - ay) * (cx - ax) < 0) // Counter-clockwise, like the quad
+		{
+			std::swap(bx, cx);
+			std::swap(by, cy);
+		}
+		out.indices.push_back(Vertex(ax, ay));
+		out.indices.push_back(Vertex(bx, by));
+		out.indices.push_back(Vertex(cx, cy));
+	};
+	const int x1 = x0 + RTIN_TILE_CELLS, y1 = y0 + RTIN_TILE_CELLS;
+	if ((x0 / RTIN_TILE_CELLS + y0 / RTIN_TILE_CELLS) % 2 == 0)
+	{
+		Triangle(x0, y0, x1, y1, x1, y0);
+		Triangle(x1, y1, x0, y0, x0, y1);
+	}
+	else
+	{
+		Triangle(x1, y0, x0, y1, x0, y0);
+		Triangle(x0, y1, x1, y0, x1, y1);
+	}
+
+	// Bisection order already keeps neighbours close; the optimizer mostly stops it from revisiting the larger triangles' corners
+	_tileCacheBefore[tile] = AnalyzeVertexCache(out.indices.data(), out.indices.size(), vertices.size());
+	OptimizeVertexCache(out.indices.data(), out.indices.size(), vertices.size());
+	RemapVertices(vertices, OptimizeVertexFetch(out.indices.data(), out.indices.size(), vertices.size()));
+	_tileCacheAfter[tile] = AnalyzeVertexCache(out.indices.data(), out.indices.size(), vertices.size());
+	const std::string meshName = "RTIN tile " + std::to_string(tile);
+	CheckVertexCacheGain(meshName.c_str(), _tileCacheBefore[tile], _tileCacheAfter[tile]);
+
+	out.bounds = TerrainBounds();
+	out.vertices.resize(vertices.size());
+	PackTerrainVertices(vertices.data(), vertices.size(), out.bounds, out.vertices.data());
+}
+
+VertexBounds RtinMesher::TerrainBounds() const
+{
+	const float depth = _heightScale * 2.0f;
+	return { glm::vec3(-1.0f, -1.0f, -depth), glm::vec3(2.0f, 2.0f, depth) };
+}
+
+void RtinMesher::Merge()
+{
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	size_t vertexCount = 0, indexCount = 0;
+	for (const TiledMeshData& tile : _tiles)
+	{
+		vertexCount += tile.vertices.size();
+		indexCount += tile.indices.size();
+	}
+	_data.vertices.clear();
+	_data.indices.clear();
+	_data.tiles.clear();
+	_data.bounds = TerrainBounds();
+	_cacheBefore = _cacheAfter = VertexCacheStats();
+	for (size_t tile = 0; tile < _tiles.size(); ++tile)
+	{
+		_cacheBefore += _tileCacheBefore[tile];
+		_cacheAfter += _tileCacheAfter[tile];
+	}
+	_data.vertices.reserve(vertexCount);
+	_data.indices.reserve(indexCount);
+	for (const TiledMeshData& tile : _tiles)
+	{
+		_data.tiles.push_back({ static_cast<uint32_t>(_data.indices.size()), static_cast<uint32_t>(tile.indices.size()), static_cast<int32_t>(_data.vertices.size()) });
+		_data.vertices.insert(_data.vertices.end(), tile.vertices.begin(), tile.vertices.end());
+		_data.indices.insert(_data.indices.end(), tile.indices.begin(), tile.indices.end());
+	}
+	_buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _startTime).count();
+}
+
+void RtinMesher::Shutdown()
+{
+	if (!_mesh) return;
+	_mesh->Release();
+	_mesh.reset();
+}
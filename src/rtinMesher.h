@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "jobSystem.h"
+#include "mesh.h"
+#include "meshOptimizer.h"
+#include "texture.h"
+
+const int RTIN_TILE_CELLS = 64; // Grid cells across a tile: a power of two, at most 128 so a tile's vertices fit 16 bit indices
+
+/// <summary>
+/// The height map as real triangles, only as many as it takes to stay within a height error: a right-triangulated irregular
+/// network (RTIN, as in Martini). The grid of corner samples ((size + 1)^2, one between every four texels) is split into
+/// right triangles by recursive bisection of their hypotenuses, so flat ground stays a few large triangles and ridges get
+/// small ones. Such a mesh never has cracks as long as the two triangles sharing a hypotenuse agree on splitting it.
+///
+/// That is what the error map guarantees: every grid point gets the largest error of the diamond it splits, i.e. how far the
+/// heights inside the two triangles sharing it as hypotenuse midpoint stray from their planes, and at least the errors of
+/// the finer points below it on both sides. Unlike Martini's estimate (each point against its own hypotenuse only), that
+/// bounds the finished mesh: every grid point is within maxError of it. The map is built level by level, finest first, in
+/// row bands on the job system: each level only writes its own points and only reads the finer ones, so the bands never
+/// race. Extraction then runs one job per tile of RTIN_TILE_CELLS^2 cells, starting from the tile's two
+/// triangles: the coarser triangles above them are always split, the same way everywhere, and below them the shared error
+/// map keeps neighbouring tiles consistent along their edges. Each tile's triangles are reordered for the post-transform
+/// vertex cache and its vertices for fetch order before they are packed.
+/// </summary>
+class RtinMesher
+{
+public:
+	RtinMesher();
+
+	/// <summary>
+	/// Schedule the meshing of the read back height map. The finished mesh replaces the previous one on the GL thread.
+	/// maxError is in height map steps (1/255 of the height range). Same rules as SplatMap::Generate(): call from the GL
+	/// thread, not from a job once a generation has been scheduled.
+	/// </summary>
+	JobHandle Generate(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float heightScale, float maxError);
+
+	Mesh* GetMesh() const { return _mesh.get(); } // Null until the first mesh is ready
+	void Shutdown(); // Releases the mesh (needs the GL context)
+
+private:
+	float Height(int x, int y) const { return _heights[static_cast<size_t>(y) * (_gridSize + 1) + x]; }
+	float& Error(int x, int y) { return _errors[static_cast<size_t>(y) * (_gridSize + 1) + x]; }
+
+	float TriangleError(int ax, int ay, int bx, int by, int cx, int cy) const;
+	void ComputeHeights(int firstRow, int lastRow);
+	void ComputeEdgeErrors(int cells, int firstRow, int lastRow);   // Midpoints of the edges `cells` long
+	void ComputeCenterErrors(int cells, int firstRow, int lastRow); // Centers of the squares `cells` across
+	void ExtractTile(int tile);
+	void Merge(); // The tiles into one buffer
+	VertexBounds TerrainBounds() const; // The quad's, down to the full height range
+
+	int _gridSize; // Cells across, the height map's size
+	float _heightScale, _maxError;
+	SharedHeightMap _heightMap;
+	std::vector<float> _heights; // Per grid point, in height map steps (0 is the top)
+	std::vector<float> _errors;
+	std::vector<TiledMeshData> _tiles;
+	TiledMeshData _data;
+	std::unique_ptr<Mesh> _mesh;
+	JobHandle _pending;
+
+	// --- Stats
+	std::chrono::steady_clock::time_point _startTime;
+	double _buildMilliseconds;
+	std::vector<VertexCacheStats> _tileCacheBefore, _tileCacheAfter; // Per tile, as extracted and as optimized
+	VertexCacheStats _cacheBefore, _cacheAfter;
+};
@@ -76,4 +76,109 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
 	// Delete shaders after successfully linking them, they're no longer needed
 	glDeleteShader(vertex);
 	glDeleteShader(fragment);
-}
\ No newline at end of file
+}
+
+// Constructor for a compute shader program
+Shader::Shader(const char* computePath)
+{
+	// 1. Retrieve compute shader source code from file path
+	std::string computeCode;
+	std::ifstream computeShaderFile;
+	computeShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	try
+	{
+		computeShaderFile.open(computePath);
+		std::stringstream computeShaderStream;
+		computeShaderStream << computeShaderFile.rdbuf();
+		computeShaderFile.close();
+		computeCode = computeShaderStream.str();
+	}
+	catch (std::ifstream::failure e)
+	{
+		std::cerr << "ERROR: Compute Shader File Not Successfully Read!" << std::endl;
+	}
+	const char* computeShaderCode = computeCode.c_str();
+
+	// 2. Compile and link
+	unsigned int compute;
+	int success;
+	char infoLog[512];
+
+	compute = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(compute, 1, &computeShaderCode, NULL);
+	glCompileShader(compute);
+	glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(compute, 512, NULL, infoLog);
+		std::cerr << "ERROR: Compute Shader Compilation Failed!\n" << infoLog << std::endl;
+	}
+
+	ID = glCreateProgram();
+	glAttachShader(ID, compute);
+	glLinkProgram(ID);
+	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(ID, 512, NULL, infoLog);
+		std::cerr << "ERROR: Compute Shader Program Linkage Failed!\n" << infoLog << std::endl;
+	}
+
+	glDeleteShader(compute);
+}
+
+// Read and compile one stage of a program, 0 if the file can't be read
+static unsigned int CompileShaderStage(GLenum type, const char* path, const char* stageName)
+{
+	std::ifstream shaderFile(path);
+	if (!shaderFile)
+	{
+		std::cerr << "ERROR: " << stageName << " Shader File Not Successfully Read! " << path << std::endl;
+		return 0;
+	}
+	std::stringstream shaderStream;
+	shaderStream << shaderFile.rdbuf();
+	std::string code = shaderStream.str();
+	const char* shaderCode = code.c_str();
+
+	int success;
+	char infoLog[512];
+	unsigned int shader = glCreateShader(type);
+	glShaderSource(shader, 1, &shaderCode, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(shader, 512, NULL, infoLog);
+		std::cerr << "ERROR: " << stageName << " Shader Compilation Failed!\n" << infoLog << std::endl;
+	}
+	return shader;
+}
+
+// Constructor for a program with tessellation stages
+Shader::Shader(const char* vertexPath, const char* tessControlPath, const char* tessEvaluationPath, const char* fragmentPath)
+{
+	unsigned int stages[4] =
+	{
+		CompileShaderStage(GL_VERTEX_SHADER, vertexPath, "Vertex"),
+		CompileShaderStage(GL_TESS_CONTROL_SHADER, tessControlPath, "Tessellation Control"),
+		CompileShaderStage(GL_TESS_EVALUATION_SHADER, tessEvaluationPath, "Tessellation Evaluation"),
+		CompileShaderStage(GL_FRAGMENT_SHADER, fragmentPath, "Fragment")
+	};
+
+	ID = glCreateProgram();
+	for (unsigned int stage : stages)
+		if (stage) glAttachShader(ID, stage);
+	glLinkProgram(ID);
+	int success;
+	char infoLog[512];
+	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(ID, 512, NULL, infoLog);
+		std::cerr << "ERROR: Shader Program Linkage Failed!\n" << infoLog << std::endl;
+	}
+
+	for (unsigned int stage : stages)
+		if (stage) glDeleteShader(stage);
+}
@@ -0,0 +1,312 @@
+#include "simulation.h"
+#include "memoryTracker.h"
+#include <algorithm>
+#include <chrono>
+#include <glm/gtc/constants.hpp>
+
+// --- Simulation rate
+const double SIMULATION_HZ = 120.0;
+
+// --- Camera Settings
+const float cameraSensitivity = 0.1f;
+const float cameraRadius = 0.14f;   // Keeps the near plane's corners (0.1 ahead at 50 degrees, 16:9) out of the terrain
+const float cameraSkin = 1e-4f;     // How far short of the surface the camera stops, so the next sweep starts clear of it
+const int maxCameraSlides = 3;      // Sweeps per move: the first, then slides along whatever it hit
+const float eyeHeight = 0.2f;       // Walk mode's height above the ground
+const float groundFollowRate = 12.0f; // Per second, how quickly walk mode eases towards eye height
+
+// --- Sun Params
+const float sunRadius = 1.7f;       // Radius of orbit from center
+const float sunDesiredSpeed = 0.4f; // The speed we want to lerp to
+const float idleTime = 1.0f;
+const bool bIsSunStationary = false;
+
+/// <summary>
+/// Ease Out function used for linearly interpolating --> glm::mix(a, b, easeInOutSine(x)).
+/// </summary>
+/// <param name="x"> Usually will be set to deltaTime. </param>
+static float EaseInOutSine(float x) // This website has good references for different easing functions: https://easings.net/#easeInOutSine
+{
+	return -(glm::cos(glm::pi<float>() * x) - 1) / 2;
+}
+
+Simulation::Simulation() :
+	_bRunning(false),
+	_cameraPos(-3.08f, 3.07f, 3.26f),
+	_cameraFront(0.51f, -0.66f, -0.55f),
+	_cameraUp(0.0f, 1.0f, 0.0f),
+	_bFirstMouse(true),
+	_pitch(-45.0f),
+	_yaw(-45.0f),
+	_lastX(0.0), _lastY(0.0),
+	_FOV(50.0f),
+	_cameraSpeed(2.5f),
+	_terrainQuery(nullptr),
+	_lightPos(0.0f, 0.1f, 0.0f),
+	_lightDiffuse(WHITE),
+	_exposure(maxExposure),
+	_sunAngle(999.99f), // Default init value
+	_sunVel(0.0f),
+	_timer(0.0f),
+	_bReverseSun(false),
+	_bWaiting(false)
+{
+	// Make sure the renderer has a valid snapshot before the first tick
+	PublishFrame();
+}
+
+Simulation::~Simulation()
+{
+	Stop();
+}
+
+void Simulation::Start()
+{
+	if (_bRunning) return;
+	_bRunning = true;
+	_thread = std::thread(&Simulation::Run, this);
+}
+
+void Simulation::SetTerrain(const TerrainQuery* terrainQuery)
+{
+	_terrainQuery = terrainQuery;
+}
+
+void Simulation::Stop()
+{
+	_bRunning = false;
+	if (_thread.joinable())
+		_thread.join();
+}
+
+/// <summary>
+/// Fixed rate tick loop: take the newest input, advance the camera and sun, publish a snapshot.
+/// </summary>
+void Simulation::Run()
+{
+	MemoryScope memoryScope(MemorySubsystem::Simulation);
+	typedef std::chrono::steady_clock Clock;
+	const Clock::duration step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / SIMULATION_HZ));
+
+	Clock::time_point previousTick = Clock::now();
+	Clock::time_point nextTick = previousTick + step;
+	while (_bRunning)
+	{
+		std::this_thread::sleep_until(nextTick);
+		Clock::time_point now = Clock::now();
+		float deltaTime = std::chrono::duration<float>(now - previousTick).count();
+		previousTick = now;
+
+		// Don't try to catch up after a long hitch (e.g. the window being dragged), just carry on from now
+		nextTick += step;
+		if (nextTick < now)
+			nextTick = now + step;
+
+		input.Update();
+		const InputState& inputState = input.ReadBuffer();
+		if (_terrainQuery)
+			_heightField = _terrainQuery->Current(); // One atomic load a tick, every query below uses the same snapshot
+		ProcessMouse(inputState);
+		ProcessInput(inputState, deltaTime);
+		AnimateSun(deltaTime);
+		PublishFrame();
+	}
+}
+
+/// <summary>
+/// Move the camera with WASD, and move faster with Left Shift. Free mode goes straight there, Fly and Walk keep the camera
+/// out of the terrain (Walk moves level and keeps to eye height) once its height field is there.
+/// </summary>
+void Simulation::ProcessInput(const InputState& inputState, float deltaTime)
+{
+	const bool bCollide = inputState.cameraMode != CameraMode::Free && _heightField;
+	const bool bWalk = bCollide && inputState.cameraMode == CameraMode::Walk;
+
+	// Walking goes along the ground however far up or down the camera looks
+	glm::vec3 front = bWalk ? glm::normalize(glm::vec3(_cameraFront.x, 0.0f, _cameraFront.z)) : _cameraFront;
+	glm::vec3 right = glm::normalize(glm::cross(front, _cameraUp));
+	glm::vec3 offset(0.0f);
+
+	if (inputState.bForward) // UP
+		offset += front * _cameraSpeed * deltaTime;
+
+	if (inputState.bLeft) // LEFT
+		offset -= right * _cameraSpeed * deltaTime;
+
+	if (inputState.bBack) // DOWN
+		offset -= front * _cameraSpeed * deltaTime;
+
+	if (inputState.bRight) // RIGHT
+		offset += right * _cameraSpeed * deltaTime;
+
+	if (bCollide)
+		MoveCamera(offset);
+	else
+		_cameraPos += offset;
+	if (bWalk)
+		FollowGround(deltaTime);
+
+	_cameraSpeed = inputState.bSprint ? 10.0f : 2.5f; // LEFT SHIFT
+}
+
+/// <summary>
+/// Move the camera by offset without letting it into the terrain: sweep its sphere along the way, stop just short of what it
+/// hits and slide the rest of the way along the surface. The sweep covers the whole offset, so however far the camera goes
+/// in one tick (sprinting, a long hitch) it can't pass through a ridge.
+/// </summary>
+void Simulation::MoveCamera(const glm::vec3& offset)
+{
+	// Back out first if the ground came up around the camera (a regenerated terrain, or coming out of Free mode)
+	_cameraPos.y = std::max(_cameraPos.y, _heightField->ClearHeight(_cameraPos.x, _cameraPos.z, cameraRadius) + cameraSkin);
+
+	glm::vec3 remaining = offset;
+	for (int slide = 0; slide < maxCameraSlides; ++slide)
+	{
+		float length = glm::length(remaining);
+		if (length < 1e-6f) break;
+		TerrainHit hit = _heightField->SweepSphere({ _cameraPos, remaining, 1.0f }, cameraRadius);
+		if (!hit.bHit)
+		{
+			_cameraPos += remaining;
+			break;
+		}
+
+		// Distances are fractions of remaining
+		float travel = std::max(hit.distance - cameraSkin / length, 0.0f);
+		_cameraPos += remaining * travel;
+		remaining *= 1.0f - travel;
+		remaining -= hit.normal * glm::dot(remaining, hit.normal); // Keep only the part along the surface
+		// Stopping short along a grazing sweep can leave the camera closer than the skin, lift it back so the slide can start
+		_cameraPos.y = std::max(_cameraPos.y, _heightField->ClearHeight(_cameraPos.x, _cameraPos.z, cameraRadius) + cameraSkin);
+	}
+}
+
+/// <summary>
+/// Walk mode: ease towards eye height above the ground (quickly, so the camera doesn't jolt over bumps), never lower than the
+/// camera's sphere is clear.
+/// </summary>
+void Simulation::FollowGround(float deltaTime)
+{
+	float target = _heightField->Height(_cameraPos.x, _cameraPos.z) + eyeHeight;
+	_cameraPos.y = glm::mix(_cameraPos.y, target, std::min(deltaTime * groundFollowRate, 1.0f));
+	_cameraPos.y = std::max(_cameraPos.y, _heightField->ClearHeight(_cameraPos.x, _cameraPos.z, cameraRadius) + cameraSkin);
+}
+
+/// <summary>
+/// Mouse look, from the latest absolute cursor position.
+/// </summary>
+void Simulation::ProcessMouse(const InputState& inputState)
+{
+	if (!inputState.bHasCursor) return;
+
+	// To prevent huge jump on screen when first starting program
+	if (_bFirstMouse) { _lastX = inputState.cursorX; _lastY = inputState.cursorY; _bFirstMouse = false; }
+
+	// Calculate mouse offset since last tick
+	float xoffset = static_cast<float>(inputState.cursorX - _lastX);
+	float yoffset = static_cast<float>(_lastY - inputState.cursorY); // reversed: y ranges from bottom to top
+	_lastX = inputState.cursorX;
+	_lastY = inputState.cursorY;
+	if (xoffset == 0.0f && yoffset == 0.0f) return;
+
+	// Adjust according to camera sensitivity
+	xoffset *= cameraSensitivity;
+	yoffset *= cameraSensitivity;
+
+	// Add the offsets to the yaw and pitch
+	_yaw += xoffset;
+	_pitch += yoffset;
+
+	// Prevent LookAt Flip if pitch matches the World Up vector
+	if (_pitch > 89.0f) _pitch = 89.0f;
+	if (_pitch < -89.0f) _pitch = -89.0f;
+
+	// Do trig calculations to determine the direction vector
+	glm::vec3 direction;
+	direction.x = glm::cos(glm::radians(_yaw)) * glm::cos(glm::radians(_pitch));
+	direction.y = glm::sin(glm::radians(_pitch));
+	direction.z = glm::sin(glm::radians(_yaw)) * glm::cos(glm::radians(_pitch));
+	_cameraFront = glm::normalize(direction);
+}
+
+/// <summary>
+/// Checks if Sun should be stationary or animated.
+/// If animated, the sun travels in a semicircle trajectory from one side of the horizon of the terrain to the the other side.
+/// As the sun approaches either sides of the horizon, it decelerates, its color changes to an orange hue, and the brightness of the scene also dims.
+/// As the sun approaches the zenith, it accelerates, its color changes to a white hue, and the brightness of the scene increases.
+/// When the sun hits the horizon, it waits in place for the specified idleTime until it can reverse its direction and start moving again.
+/// </summary>
+void Simulation::AnimateSun(float deltaTime)
+{
+	if (bIsSunStationary)
+		_lightPos = glm::vec3(1.0f, 0.75f, 1.0f);
+
+	// Update position of the sun to orbit
+	else
+	{
+		// Sun waits for a bit before reversing direction and moving again.
+		if (_bWaiting)
+		{
+			_timer += deltaTime;
+			if (_timer >= idleTime)
+			{
+				_bWaiting = false;
+				_timer = 0.0f;
+			}
+		}
+
+		// Sun is in motion.
+		else
+		{
+			_sunAngle = glm::degrees(glm::acos(glm::dot(glm::normalize(_lightPos), glm::normalize(glm::vec3(1.0f, 0.0f, 1.0f)))));
+			float dir = _bReverseSun ? -1.0f : 1.0f;
+			float targetSpeed = sunDesiredSpeed * dir;
+
+			// If sun is approaching the horizon
+			if ((_sunAngle < 89.9f && !_bReverseSun) || (_sunAngle > 90.1f && _bReverseSun))
+			{
+				_sunVel += glm::mix(deltaTime * sunDesiredSpeed * dir, 0.0f, EaseInOutSine(deltaTime) * 120);	    // Slow down
+				_lightDiffuse = glm::mix(_lightDiffuse, ORANGE, EaseInOutSine(deltaTime) * 10);					    // Appear orange
+				_exposure = glm::mix(_exposure, minExposure, EaseInOutSine(deltaTime) * 10);						    // Make scene dimmer
+			}
+
+			// If sun is approaching the zenith
+			else
+			{
+				_sunVel += glm::mix(deltaTime * sunDesiredSpeed * dir, targetSpeed, EaseInOutSine(deltaTime) * 3);   // Speed up
+				_lightDiffuse = glm::mix(_lightDiffuse, WHITE, EaseInOutSine(deltaTime) * 10);					    // Appear white
+				_exposure = glm::mix(_exposure, maxExposure, EaseInOutSine(deltaTime) * 10);						    // Make scene brighter
+			}
+
+			// Travel diagonally across the terrain in a semicircle
+			_lightPos.x = sunRadius * -cos(_sunVel);
+			_lightPos.z = sunRadius * -cos(_sunVel);
+			_lightPos.y = sunRadius * sin(_sunVel);
+		}
+
+		// Check if sun is at either horizon
+		if (_sunAngle < 5.0f && !_bReverseSun)
+		{
+			_bWaiting = true;
+			_bReverseSun = true;
+		}
+		else if (_sunAngle > 175.0f && _bReverseSun)
+		{
+			_bWaiting = true;
+			_bReverseSun = false;
+		}
+	}
+}
+
+void Simulation::PublishFrame()
+{
+	FrameState& frame = frames.WriteBuffer();
+	frame.cameraPos = _cameraPos;
+	frame.cameraFront = _cameraFront;
+	frame.cameraUp = _cameraUp;
+	frame.FOV = _FOV;
+	frame.lightPos = _lightPos;
+	frame.lightDiffuse = _lightDiffuse;
+	frame.exposure = _exposure;
+	frames.Publish();
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <glm/glm.hpp>
+#include "tripleBuffer.h"
+#include "terrainQuery.h"
+
+// --- Sun colors and scene exposure, shared by the simulation (animation targets) and the renderer (initial uniforms)
+const float bloomFactor = 5.0f;
+const glm::vec3 WHITE = glm::vec3(1.0f, 0.85f, 0.55f) * bloomFactor;
+const glm::vec3 ORANGE = glm::vec3(1.0f, 0.5f, 0.05f) * bloomFactor;
+const float maxExposure = 0.75f;
+const float minExposure = 0.05f;
+
+enum class CameraMode
+{
+	Free, // Flies through everything
+	Fly,  // Flies, but slides along the terrain instead of passing through it
+	Walk  // Moves across the terrain at eye height above the ground
+};
+
+/// <summary>
+/// Raw input gathered on the GL/ GLFW thread (GLFW only allows polling there) and handed to the simulation thread.
+/// </summary>
+struct InputState
+{
+	bool bForward = false;
+	bool bBack = false;
+	bool bLeft = false;
+	bool bRight = false;
+	bool bSprint = false;
+	CameraMode cameraMode = CameraMode::Free;
+	bool bHasCursor = false; // False until the first cursor event arrives
+	double cursorX = 0.0;
+	double cursorY = 0.0;
+};
+
+/// <summary>
+/// Immutable snapshot of everything the renderer needs from the simulation for one frame.
+/// </summary>
+struct FrameState
+{
+	glm::vec3 cameraPos;
+	glm::vec3 cameraFront;
+	glm::vec3 cameraUp;
+	float FOV;
+	glm::vec3 lightPos;
+	glm::vec3 lightDiffuse;
+	float exposure;
+};
+
+/// <summary>
+/// Runs camera movement, mouse look and the sun animation on its own thread at a fixed rate. Input comes in and frame
+/// snapshots go out through lock-free triple buffers, so the render thread never waits on the simulation and a GPU stall
+/// on the render thread doesn't hold up simulation ticks. With a TerrainQuery, Fly and Walk mode collide the camera with the
+/// terrain's latest height field.
+/// </summary>
+class Simulation
+{
+public:
+	Simulation();
+	~Simulation();
+
+	void Start();
+	void Stop();
+	void SetTerrain(const TerrainQuery* terrainQuery); // Before Start(), enables the Fly and Walk camera modes
+
+	TripleBuffer<InputState> input;  // Written by the GL thread
+	TripleBuffer<FrameState> frames; // Read by the GL thread
+
+private:
+	void Run();
+	void ProcessInput(const InputState& inputState, float deltaTime);
+	void MoveCamera(const glm::vec3& offset);
+	void FollowGround(float deltaTime);
+	void ProcessMouse(const InputState& inputState);
+	void AnimateSun(float deltaTime);
+	void PublishFrame();
+
+	std::thread _thread;
+	std::atomic<bool> _bRunning;
+
+	// --- Camera
+	glm::vec3 _cameraPos;
+	glm::vec3 _cameraFront;
+	glm::vec3 _cameraUp;
+	bool _bFirstMouse;  // To prevent huge jump on screen when first starting program
+	float _pitch;       // Up-Down camera rotation (around the X-axis)
+	float _yaw;         // Left-Right camera rotation (around the Y-axis)
+	double _lastX, _lastY;
+	float _FOV;
+	float _cameraSpeed;
+	const TerrainQuery* _terrainQuery;
+	std::shared_ptr<const HeightField> _heightField; // The terrain as of this tick, null until the first one is built
+
+	// --- Sun
+	glm::vec3 _lightPos;
+	glm::vec3 _lightDiffuse;
+	float _exposure;
+	float _sunAngle;
+	float _sunVel;      // Sun's speed + direction
+	float _timer;
+	bool _bReverseSun;
+	bool _bWaiting;
+};
@@ -0,0 +1,222 @@
+#include "slopeUvMap.h"
+#include <algorithm>
+#include <cmath>
+#include "glad/glad.h"
+#include "memoryTracker.h"
+
+static const int COARSEST_SIZE = 16;    // The solve starts here, from planar coordinates
+static const int COARSEST_SWEEPS = 256; // Enough to converge at 16x16
+static const int SWEEPS_PER_LEVEL = 24; // Each finer level only has to fix what the upsampling couldn't represent
+static const int RELAX_BAND_ROWS = 32;  // Rows per job
+
+SlopeUvMap::SlopeUvMap() : _size(0), _heightScale(0.0f)
+{
+}
+
+JobHandle SlopeUvMap::Generate(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float heightScale)
+{
+	if (_pending)
+		jobSystem.Wait(_pending);
+
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	if (_size != textureSize)
+	{
+		_texture.Release();
+		_texture = Texture(textureSize, GL_RG32F); // Half floats would quantize 8k textures' coordinates to 8 texels
+		glBindTexture(GL_TEXTURE_2D, _texture._textureID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		_size = textureSize;
+
+		_levels.clear();
+		for (int size = textureSize; ; size /= 2)
+		{
+			Level level;
+			level.size = size;
+			const size_t texels = static_cast<size_t>(size) * size;
+			level.u.resize(texels); level.v.resize(texels);
+			level.jxx.resize(texels); level.jxy.resize(texels); level.jyy.resize(texels);
+			_levels.push_back(std::move(level));
+			if (size <= COARSEST_SIZE || size % 2 != 0) break;
+		}
+		_uv.resize(static_cast<size_t>(textureSize) * textureSize * 2);
+	}
+	_heightScale = heightScale;
+	_heightMap = heightMap;
+
+	// One job per row band, each pass waiting for the previous one
+	const int coarsest = static_cast<int>(_levels.size()) - 1;
+	std::vector<JobHandle> pass = jobSystem.ScheduleRows(textureSize, RELAX_BAND_ROWS, {}, [this](int firstRow, int lastRow) { ComputeTargets(firstRow, lastRow); });
+	for (int level = 1; level <= coarsest; ++level)
+		pass = { jobSystem.Schedule([this, level] { Restrict(level); }, pass) };
+	pass = { jobSystem.Schedule([this, coarsest]
+	{
+		Level& level = _levels[coarsest];
+		for (int y = 0; y < level.size; ++y)
+			for (int x = 0; x < level.size; ++x)
+			{
+				level.u[static_cast<size_t>(y) * level.size + x] = static_cast<float>(x);
+				level.v[static_cast<size_t>(y) * level.size + x] = static_cast<float>(y);
+			}
+		for (int sweep = 0; sweep < COARSEST_SWEEPS; ++sweep)
+			for (int color = 0; color < 2; ++color)
+				Relax(coarsest, 0, level.size, color);
+	}, pass) };
+	for (int level = coarsest - 1; level >= 0; --level)
+	{
+		const int size = _levels[level].size;
+		pass = jobSystem.ScheduleRows(size, RELAX_BAND_ROWS, pass, [this, level](int firstRow, int lastRow) { Prolong(level, firstRow, lastRow); });
+		for (int sweep = 0; sweep < SWEEPS_PER_LEVEL; ++sweep)
+			for (int color = 0; color < 2; ++color)
+				pass = jobSystem.ScheduleRows(size, RELAX_BAND_ROWS, pass, [this, level, color](int firstRow, int lastRow) { Relax(level, firstRow, lastRow, color); });
+	}
+	pass = { jobSystem.Schedule([this] { Finish(); }, pass) };
+	_pending = jobSystem.ScheduleOnMainThread([this]
+	{
+		glBindTexture(GL_TEXTURE_2D, _texture._textureID);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _size, _size, GL_RG, GL_FLOAT, _uv.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}, pass);
+	return _pending;
+}
+
+/// <summary>
+/// The wanted Jacobian at each texel of the finest level: the square root of the surface's metric, I + (s - 1) n n^T with n
+/// the slope's direction and s = sqrt(1 + |gradient|^2), i.e. a stretch of 1/cos(slope) along the slope only.
+/// </summary>
+void SlopeUvMap::ComputeTargets(int firstRow, int lastRow)
+{
+	Level& level = _levels[0];
+	const int size = level.size;
+	auto Altitude = [&](int x, int y)
+	{
+		x = std::min(std::max(x, 0), size - 1);
+		y = std::min(std::max(y, 0), size - 1);
+		return 1.0f - (*_heightMap)[static_cast<size_t>(y) * size + x] / 255.0f;
+	};
+	const float gradientScale = 0.5f * size * _heightScale; // Height in texels per texel, central differences span two
+
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			const float gx = (Altitude(x + 1, y) - Altitude(x - 1, y)) * gradientScale;
+			const float gy = (Altitude(x, y + 1) - Altitude(x, y - 1)) * gradientScale;
+			const float g2 = gx * gx + gy * gy;
+			const float stretch = g2 > 0.0f ? (std::sqrt(1.0f + g2) - 1.0f) / g2 : 0.0f; // (s - 1) / |g|^2, so n n^T is folded in
+			const size_t i = static_cast<size_t>(y) * size + x;
+			level.jxx[i] = 1.0f + stretch * gx * gx;
+			level.jxy[i] = stretch * gx * gy;
+			level.jyy[i] = 1.0f + stretch * gy * gy;
+		}
+	}
+}
+
+void SlopeUvMap::Restrict(int levelIndex)
+{
+	const Level& fine = _levels[levelIndex - 1];
+	Level& coarse = _levels[levelIndex];
+	for (int y = 0; y < coarse.size; ++y)
+	{
+		for (int x = 0; x < coarse.size; ++x)
+		{
+			const size_t i = static_cast<size_t>(y) * coarse.size + x;
+			const size_t f = static_cast<size_t>(2 * y) * fine.size + 2 * x;
+			coarse.jxx[i] = 0.25f * (fine.jxx[f] + fine.jxx[f + 1] + fine.jxx[f + fine.size] + fine.jxx[f + fine.size + 1]);
+			coarse.jxy[i] = 0.25f * (fine.jxy[f] + fine.jxy[f + 1] + fine.jxy[f + fine.size] + fine.jxy[f + fine.size + 1]);
+			coarse.jyy[i] = 0.25f * (fine.jyy[f] + fine.jyy[f + 1] + fine.jyy[f + fine.size] + fine.jyy[f + fine.size + 1]);
+		}
+	}
+}
+
+/// <summary>
+/// Bilinearly upsample the coarser solution. Coordinates are in texels of their level, so they double, and texel centers
+/// shift by half a texel.
+/// </summary>
+void SlopeUvMap::Prolong(int levelIndex, int firstRow, int lastRow)
+{
+	const Level& coarse = _levels[levelIndex + 1];
+	Level& fine = _levels[levelIndex];
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		const float cy = std::min(std::max((y + 0.5f) * 0.5f - 0.5f, 0.0f), coarse.size - 1.0f);
+		const int y0 = std::min(static_cast<int>(cy), coarse.size - 2);
+		const float fy = cy - y0;
+		for (int x = 0; x < fine.size; ++x)
+		{
+			const float cx = std::min(std::max((x + 0.5f) * 0.5f - 0.5f, 0.0f), coarse.size - 1.0f);
+			const int x0 = std::min(static_cast<int>(cx), coarse.size - 2);
+			const float fx = cx - x0;
+			const size_t c = static_cast<size_t>(y0) * coarse.size + x0;
+			auto Bilinear = [&](const std::vector<float>& values)
+			{
+				float top = values[c] + (values[c + 1] - values[c]) * fx;
+				float bottom = values[c + coarse.size] + (values[c + coarse.size + 1] - values[c + coarse.size]) * fx;
+				return top + (bottom - top) * fy;
+			};
+			const size_t i = static_cast<size_t>(y) * fine.size + x;
+			fine.u[i] = 2.0f * Bilinear(coarse.u) + 0.5f;
+			fine.v[i] = 2.0f * Bilinear(coarse.v) + 0.5f;
+		}
+	}
+}
+
+/// <summary>
+/// One Gauss-Seidel half sweep over the texels of one color of the checkerboard. Each texel takes the average of what its
+/// neighbours say it should be (their value minus the wanted difference along that edge), which for all texels at once
+/// is the least squares fit of the coordinates' differences to the wanted Jacobian. Edges at the border are left out,
+/// so the border is free. Texels of one color only read the other, so bands can run in parallel.
+/// </summary>
+void SlopeUvMap::Relax(int levelIndex, int firstRow, int lastRow, int color)
+{
+	Level& level = _levels[levelIndex];
+	const int size = level.size;
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		for (int x = (y + color) & 1; x < size; x += 2)
+		{
+			const size_t i = static_cast<size_t>(y) * size + x;
+			float sumU = 0.0f, sumV = 0.0f;
+			int count = 0;
+			auto Edge = [&](size_t neighbour, float direction, bool bAlongX)
+			{
+				// Wanted difference towards the neighbour: the Jacobian's column for this axis, averaged over the edge
+				float du = 0.5f * ((bAlongX ? level.jxx[i] + level.jxx[neighbour] : level.jxy[i] + level.jxy[neighbour]));
+				float dv = 0.5f * ((bAlongX ? level.jxy[i] + level.jxy[neighbour] : level.jyy[i] + level.jyy[neighbour]));
+				sumU += level.u[neighbour] - direction * du;
+				sumV += level.v[neighbour] - direction * dv;
+				++count;
+			};
+			if (x > 0) Edge(i - 1, -1.0f, true);
+			if (x < size - 1) Edge(i + 1, 1.0f, true);
+			if (y > 0) Edge(i - size, -1.0f, false);
+			if (y < size - 1) Edge(i + size, 1.0f, false);
+			level.u[i] = sumU / count;
+			level.v[i] = sumV / count;
+		}
+	}
+}
+
+/// <summary>
+/// The least squares solution is only defined up to a constant: pick the one that keeps the coordinates centered on the
+/// planar ones, then convert texels to texture coordinates.
+/// </summary>
+void SlopeUvMap::Finish()
+{
+	const Level& level = _levels[0];
+	double offsetU = 0.0, offsetV = 0.0;
+	for (int y = 0; y < level.size; ++y)
+		for (int x = 0; x < level.size; ++x)
+		{
+			offsetU += level.u[static_cast<size_t>(y) * level.size + x] - x;
+			offsetV += level.v[static_cast<size_t>(y) * level.size + x] - y;
+		}
+	const double texels = static_cast<double>(level.size) * level.size;
+	const float shiftU = static_cast<float>(offsetU / texels), shiftV = static_cast<float>(offsetV / texels);
+	for (size_t i = 0; i < level.u.size(); ++i)
+	{
+		_uv[2 * i] = (level.u[i] - shiftU + 0.5f) / level.size;
+		_uv[2 * i + 1] = (level.v[i] - shiftV + 0.5f) / level.size;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include "jobSystem.h"
+#include "texture.h"
+
+/// <summary>
+/// Texture coordinates for the terrain's materials that follow its surface instead of the flat quad, so steep slopes get as
+/// many texels per unit of surface as flat ground does instead of a few stretched ones. Triplanar mapping gets the same by
+/// sampling every layer three times; here a single fetch per layer reads through coordinates precomputed on the CPU.
+///
+/// The surface's metric at each texel (the height map scaled by heightScale) asks for a stretch of 1/cos(slope) along the
+/// slope and none across it. No flat parameterization can match that everywhere, so U and V are the least squares fit to
+/// it: a Poisson problem, solved coarse to fine (each level starts from the one below it, upsampled, then red-black
+/// Gauss-Seidel sweeps run in row bands on the job system). Flat ground keeps its planar coordinates, slopes spread out.
+/// The result is an RG32F map of the corrected coordinates, sampled with filtering so it costs one extra fetch shared by
+/// all layers.
+/// </summary>
+class SlopeUvMap
+{
+public:
+	SlopeUvMap();
+
+	/// <summary>
+	/// Schedule the solve from the read back height map, uploaded on the GL thread when done. Same rules as
+	/// SplatMap::Generate(): call from the GL thread, not from a job once a generation has been scheduled.
+	/// </summary>
+	JobHandle Generate(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float heightScale);
+
+	unsigned int TextureID() const { return _texture._textureID; }
+
+private:
+	struct Level
+	{
+		int size;
+		std::vector<float> u, v;          // Solution, in texels of this level
+		std::vector<float> jxx, jxy, jyy; // Wanted Jacobian of (u, v) per texel, symmetric
+	};
+
+	void ComputeTargets(int firstRow, int lastRow);
+	void Restrict(int level);          // Average the targets of level - 1 into level
+	void Prolong(int level, int firstRow, int lastRow); // Upsample the solution of level + 1 into level
+	void Relax(int level, int firstRow, int lastRow, int color);
+	void Finish();                     // Fix the free constant and pack the coordinates for the upload
+
+	Texture _texture;
+	int _size;
+	float _heightScale;
+	SharedHeightMap _heightMap;
+	std::vector<Level> _levels;
+	std::vector<float> _uv;
+	JobHandle _pending;
+};
@@ -0,0 +1,193 @@
+#include "terrainFarm.h"
+#include "terrainGenerator.h"
+#include "imageWriter.h"
+#include "jobSystem.h"
+#include "memoryTracker.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+const int ENCODE_BAND_ROWS = 128; // Rows per PNG band, i.e. per encode job
+
+bool ParseTerrainFarmJobs(const char* path, std::vector<TerrainFarmJob>& jobs)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "ERROR: Could not open terrain farm job list " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+	{
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		TerrainFarmJob job;
+		if (!(fields >> job.seed))
+		{
+			if (line.find_first_not_of(" \t\r") == std::string::npos) continue; // Blank or comment only
+			std::cerr << "ERROR: " << path << ":" << lineNumber << ": expected a seed" << std::endl;
+			return false;
+		}
+		fields >> job.textureSize >> job.scale >> job.octaves >> job.persistence >> job.lacunarity;
+		if (job.textureSize < 3 || job.octaves < 1)
+		{
+			std::cerr << "ERROR: " << path << ":" << lineNumber << ": bad size or octave count" << std::endl;
+			return false;
+		}
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+/// <summary>
+/// Everything one map needs between its jobs. Owned by the jobs' closures and released as soon as the files are written.
+/// </summary>
+struct FarmMap
+{
+	TerrainFarmJob job;
+	std::vector<unsigned char> height;
+	std::vector<unsigned char> normal; // RGB8
+	std::vector<PngChunk> heightBands;
+	std::vector<PngChunk> normalBands;
+	bool bFailed;
+};
+
+/// <summary>
+/// Peak bytes a map holds while in flight: the height map, the float normal map while it's converted, the RGB8 normal map,
+/// and the compressed bands (at most about the size of their input with the fixed Huffman code).
+/// </summary>
+static size_t EstimateMapBytes(const TerrainFarmJob& job)
+{
+	size_t texels = static_cast<size_t>(job.textureSize) * job.textureSize;
+	return texels * (1 + sizeof(float) * 3 + 3) + texels * (1 + 3);
+}
+
+static std::string MapPath(const std::string& directory, const TerrainFarmJob& job, const char* suffix)
+{
+	std::ostringstream path;
+	path << directory << "/terrain_" << job.seed << "_" << job.textureSize << "_" << suffix << ".png";
+	return path.str();
+}
+
+/// <summary>
+/// Schedule one encode job per band of rows; the bands are collected in order in bands.
+/// </summary>
+static void ScheduleEncode(JobSystem& jobSystem, const std::shared_ptr<FarmMap>& map, const std::vector<unsigned char>* pixels, int channels,
+	std::vector<PngChunk>* bands, const JobHandle& dependency, std::vector<JobHandle>& encodeJobs)
+{
+	const int size = map->job.textureSize;
+	const int bandCount = (size + ENCODE_BAND_ROWS - 1) / ENCODE_BAND_ROWS;
+	bands->resize(bandCount);
+	for (int band = 0; band < bandCount; ++band)
+	{
+		encodeJobs.push_back(jobSystem.Schedule([map, pixels, channels, bands, band, size]
+		{
+			MemoryScope memoryScope(MemorySubsystem::Terrain);
+			int firstRow = band * ENCODE_BAND_ROWS;
+			(*bands)[band] = EncodePngRows(size, size, channels, pixels->data(), firstRow, std::min(firstRow + ENCODE_BAND_ROWS, size));
+		}, { dependency }));
+	}
+}
+
+int RunTerrainFarm(const std::vector<TerrainFarmJob>& jobs, const TerrainFarmSettings& settings)
+{
+	// The main thread only schedules and waits here, so every hardware thread can be a worker
+	unsigned int workerCount = settings.workerCount;
+	if (workerCount == 0) workerCount = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int maxMapsInFlight = settings.maxMapsInFlight ? settings.maxMapsInFlight : workerCount * 2;
+
+	JobSystem jobSystem(workerCount);
+	std::mutex logMutex;
+	int failedMaps = 0;
+	size_t mapsWritten = 0;
+
+	struct InFlight { JobHandle done; size_t bytes; std::shared_ptr<FarmMap> map; };
+	std::deque<InFlight> inFlight;
+	size_t inFlightBytes = 0;
+	auto RetireOldest = [&]
+	{
+		jobSystem.Wait(inFlight.front().done);
+		inFlightBytes -= inFlight.front().bytes;
+		if (inFlight.front().map->bFailed) ++failedMaps;
+		inFlight.pop_front();
+	};
+
+	std::cout << "Terrain farm: " << jobs.size() << " maps on " << workerCount << " workers, at most " << maxMapsInFlight << " in flight" << std::endl;
+	auto start = std::chrono::steady_clock::now();
+	for (const TerrainFarmJob& job : jobs)
+	{
+		// Bound the working set; a single map over budget still runs, on its own
+		size_t bytes = EstimateMapBytes(job);
+		while (!inFlight.empty() && (inFlight.size() >= maxMapsInFlight || inFlightBytes + bytes > settings.memoryBudgetBytes))
+			RetireOldest();
+
+		std::shared_ptr<FarmMap> map = std::make_shared<FarmMap>();
+		map->job = job;
+		map->bFailed = false;
+
+		JobHandle heightJob = jobSystem.Schedule([map]
+		{
+			const TerrainFarmJob& job = map->job;
+			glm::vec2 offset(job.seed * 37.0f, job.seed * 11.0f); // Same step as pressing R in the demo
+			map->height = GenerateHeightMap(job.textureSize, job.scale, job.octaves, job.persistence, job.lacunarity, offset);
+		});
+		JobHandle normalJob = jobSystem.Schedule([map]
+		{
+			MemoryScope memoryScope(MemorySubsystem::Terrain);
+			std::vector<glm::vec3> normals = GenerateNormalMap(map->height, map->job.textureSize);
+			map->normal.resize(normals.size() * 3);
+			for (size_t i = 0; i < normals.size(); ++i)
+			{
+				map->normal[i * 3 + 0] = static_cast<unsigned char>(normals[i].x * 255.0f + 0.5f);
+				map->normal[i * 3 + 1] = static_cast<unsigned char>(normals[i].y * 255.0f + 0.5f);
+				map->normal[i * 3 + 2] = static_cast<unsigned char>(normals[i].z * 255.0f + 0.5f);
+			}
+		}, { heightJob });
+
+		std::vector<JobHandle> encodeJobs;
+		ScheduleEncode(jobSystem, map, &map->height, 1, &map->heightBands, heightJob, encodeJobs);
+		ScheduleEncode(jobSystem, map, &map->normal, 3, &map->normalBands, normalJob, encodeJobs);
+
+		const std::string& directory = settings.outputDirectory;
+		JobHandle writeJob = jobSystem.Schedule([map, directory, &logMutex, &mapsWritten, start]
+		{
+			MemoryScope memoryScope(MemorySubsystem::Terrain);
+			const int size = map->job.textureSize;
+			std::vector<unsigned char> heightPng = AssemblePng(size, size, 1, map->heightBands);
+			std::vector<unsigned char> normalPng = AssemblePng(size, size, 3, map->normalBands);
+			bool bHeightWritten = WriteRaw(MapPath(directory, map->job, "height").c_str(), heightPng.data(), heightPng.size());
+			bool bNormalWritten = WriteRaw(MapPath(directory, map->job, "normal").c_str(), normalPng.data(), normalPng.size());
+			map->bFailed = !bHeightWritten || !bNormalWritten;
+
+			// Free the map's buffers now rather than when the last handle goes away
+			std::vector<unsigned char>().swap(map->height);
+			std::vector<unsigned char>().swap(map->normal);
+			std::vector<PngChunk>().swap(map->heightBands);
+			std::vector<PngChunk>().swap(map->normalBands);
+
+			std::lock_guard<std::mutex> lock(logMutex);
+			++mapsWritten;
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "Terrain farm: seed " << map->job.seed << (map->bFailed ? " FAILED" : " done") << " (" << mapsWritten << " maps, "
+				<< mapsWritten * 60.0 / seconds << " maps/min)" << std::endl;
+		}, encodeJobs);
+
+		inFlight.push_back({ writeJob, bytes, map });
+		inFlightBytes += bytes;
+	}
+	while (!inFlight.empty())
+		RetireOldest();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Terrain farm: " << jobs.size() << " maps in " << seconds << " s, " << (seconds > 0.0 ? jobs.size() * 60.0 / seconds : 0.0)
+		<< " maps/min, " << failedMaps << " failed" << std::endl;
+	return failedMaps;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// One map for the terrain farm: the same parameters GenerateHeightMap() takes, with the noise offset derived from the seed.
+/// </summary>
+struct TerrainFarmJob
+{
+	unsigned int seed;
+	int textureSize;
+	float scale;
+	int octaves;
+	float persistence;
+	float lacunarity;
+
+	TerrainFarmJob() : seed(0), textureSize(512), scale(0.005f), octaves(6), persistence(0.5f), lacunarity(2.0f) {}
+};
+
+struct TerrainFarmSettings
+{
+	std::string outputDirectory;
+	unsigned int workerCount;   // 0 = one per hardware thread
+	unsigned int maxMapsInFlight; // 0 = twice the worker count
+	size_t memoryBudgetBytes;   // Upper bound on the estimated working set of the maps in flight
+
+	TerrainFarmSettings() : outputDirectory("."), workerCount(0), maxMapsInFlight(0), memoryBudgetBytes(512u * 1024 * 1024) {}
+};
+
+/// <summary>
+/// Read a job list, one map per line: "seed [size] [scale] [octaves] [persistence] [lacunarity]". Missing values keep the
+/// defaults, '#' starts a comment. Returns false if the file can't be read or a line doesn't parse.
+/// </summary>
+bool ParseTerrainFarmJobs(const char* path, std::vector<TerrainFarmJob>& jobs);
+
+/// <summary>
+/// Generate the height and normal maps of every job on the CPU and write them as PNGs (terrain_[seed]_[size]_height.png/
+/// _normal.png) into the output directory. Needs no GL context. Maps are generated concurrently on a bounded worker pool;
+/// each PNG is filtered and deflated in row bands on separate workers and stitched into one stream. Scheduling stops
+/// whenever the maps in flight reach maxMapsInFlight or the memory budget, and resumes as the oldest one is written.
+/// Prints the throughput in maps per minute. Returns the number of maps that failed to write.
+/// </summary>
+int RunTerrainFarm(const std::vector<TerrainFarmJob>& jobs, const TerrainFarmSettings& settings);
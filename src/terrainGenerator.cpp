@@ -0,0 +1,186 @@
+#include "terrainGenerator.h"
+#include <cmath>
+#include <cstdlib>
+#include "memoryTracker.h"
+#include "SimplexNoise.h" // Sebastien Rombauts' SimplexNoise implementation: https://github.com/SRombauts/SimplexNoise
+
+/// <summary>
+/// Fractional Brownian Motion function. Used to make terrain look less terrible by layering octaves of noise values on top of each other.
+/// </summary>
+/// <param name="x"> Heightmap X Value. </param>
+/// <param name="y"> Heightmap Y Value. </param>
+/// <param name="octaves"> Think of this like the layers of an onion bro. </param>
+/// <param name="lacunarity"> Controls increase in frequency between the octaves. </param>
+/// <param name="persistence"> Controls decrease in amplitude between the octaves. </param>
+float FBM(float x, float y, int octaves, float lacunarity, float persistence)
+{
+	float total = 0.0f;
+	float amplitude = 1.0f;
+	float frequency = 1.0f;
+	float maxValue = 0.0f;
+
+	for (int i = 0; i < octaves; ++i)
+	{
+		total += SimplexNoise::noise(x * frequency, y * frequency) * amplitude;
+		maxValue += amplitude;
+
+		amplitude *= persistence;
+		frequency *= lacunarity;
+	}
+	float fbmValue = total / maxValue; // -1 to 1 range
+
+	return (fbmValue + 1.0f) * 0.5f;  // 0 to 1 range
+}
+
+/// <summary>
+/// Generate a flattened 1D heightmap with 1-byte accuracy.
+/// </summary>
+/// <param name="textureSize"> The size of one side of a quad texture. E.g., 512 for a 512x512 texture. </param>
+/// <param name="scale"> Amount to scale the noise values by. Scaling down (e.g., using fractional values) will yield smoother results. </param>
+/// <param name="offset"> Offset into noise space, used to generate a different terrain with the same parameters. </param>
+std::vector<unsigned char> GenerateHeightMap(int textureSize, float scale, int octaves, float persistence, float lacunarity, glm::vec2 offset)
+{
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	std::vector<unsigned char> heightMap(textureSize * textureSize);
+
+	for (int y = 0; y < textureSize; ++y)
+	{
+		for (int x = 0; x < textureSize; ++x)
+		{
+			// Divide int values to small fractional values for better noise results
+			float dx = x * scale + offset.x;
+			float dy = y * scale + offset.y;
+			float noiseValue = FBM(dx, dy, octaves, lacunarity, persistence); // Apply fractal brownian motion
+			heightMap[(y * textureSize) + x] = static_cast<unsigned char>(noiseValue * 255);
+		}
+	}
+	return heightMap;
+}
+
+/// <summary>
+/// Given a height map of 1-byte accuracy, generate a normal map by calculating the partial derivatives at each point of the height map.
+/// Math from this StackOverflow post helped me: https://stackoverflow.com/questions/5281261/generating-a-normal-map-from-a-height-map.
+/// </summary>
+std::vector<glm::vec3> GenerateNormalMap(const std::vector<unsigned char>& heightMap, int textureSize)
+{
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	std::vector<glm::vec3> normalMap(heightMap.size());
+
+	for (int y = 1; y < textureSize - 1; ++y)
+	{
+		for (int x = 1; x < textureSize - 1; ++x)
+		{
+			float heightLeft = heightMap[y * textureSize + (x - 1)] / 255.0f;
+			float heightRight = heightMap[y * textureSize + (x + 1)] / 255.0f;
+			float heightDown = heightMap[(y + 1) * textureSize + x] / 255.0f;
+			float heightUp = heightMap[(y - 1) * textureSize + x] / 255.0f;
+
+			float dx = heightLeft - heightRight;
+			float dy = heightUp - heightDown;
+
+			glm::vec3 normal = glm::normalize(glm::vec3(dx, dy, 1.0f));
+			normalMap[(y * textureSize) + x] = normal * 0.5f + 0.5f; // normalize between 0-1
+		}
+	}
+	return normalMap;
+}
+
+// ------------------------------------ GPU Path ------------------------------------------------------------------
+const unsigned int COMPUTE_GROUP_SIZE = 16; // Must match local_size_x/y in the compute shaders
+
+ComputeTerrain::ComputeTerrain() : _heightMapShader("shaders/heightMap.COMP"), _normalMapShader("shaders/normalMap.COMP")
+{
+	_normalMapShader.use();
+	_normalMapShader.setInt("heightMap", 0);
+}
+
+/// <summary>
+/// Dispatch the simplex/FBM kernel, writing the heightmap directly into heightMapTexture's storage.
+/// </summary>
+void ComputeTerrain::GenerateHeightMap(Texture& heightMapTexture, int textureSize, float scale, int octaves, float persistence, float lacunarity, glm::vec2 offset)
+{
+	unsigned int groups = (textureSize + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE;
+
+	_heightMapShader.use();
+	_heightMapShader.setInt("textureSize", textureSize);
+	_heightMapShader.setFloat("scale", scale);
+	_heightMapShader.setInt("octaves", octaves);
+	_heightMapShader.setFloat("persistence", persistence);
+	_heightMapShader.setFloat("lacunarity", lacunarity);
+	_heightMapShader.setVec2("offset", offset);
+	glBindImageTexture(0, heightMapTexture._textureID, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+	_heightMapShader.dispatch(groups, groups);
+
+	// The normal kernel (and the terrain shader) sample the heightmap as a regular texture
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+/// <summary>
+/// Dispatch the normal kernel, reading heightMapTexture and writing into normalMapTexture's storage.
+/// </summary>
+void ComputeTerrain::GenerateNormalMap(Texture& heightMapTexture, Texture& normalMapTexture, int textureSize)
+{
+	unsigned int groups = (textureSize + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE;
+
+	_normalMapShader.use();
+	_normalMapShader.setInt("textureSize", textureSize);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, heightMapTexture._textureID);
+	glBindImageTexture(1, normalMapTexture._textureID, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	_normalMapShader.dispatch(groups, groups);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+/// <summary>
+/// Parity check between the CPU and compute-shader terrain paths. Needs a current GL 4.3 context, a software implementation
+/// (e.g. Mesa llvmpipe with LIBGL_ALWAYS_SOFTWARE=1) is enough. Each kernel is checked on identical input: the heightmaps are compared directly,
+/// and the normal kernels are both fed the GPU heightmap so a one-step rounding difference in height doesn't show up as a normal mismatch.
+/// </summary>
+/// <returns> True if the heightmaps are within 1 step of each other and the normal maps within floating point tolerance. </returns>
+bool VerifyComputeTerrainParity(int textureSize)
+{
+	const glm::vec2 offset(17.0f, -3.5f); // Exercise negative cell coordinates as well as the default terrain
+
+	ComputeTerrain computeTerrain;
+	Texture heightMapTexture(textureSize, GL_R8);
+	Texture normalMapTexture(textureSize, GL_RGBA32F);
+	computeTerrain.GenerateHeightMap(heightMapTexture, textureSize, 0.005f, 6, 0.5f, 2.0f, offset);
+	computeTerrain.GenerateNormalMap(heightMapTexture, normalMapTexture, textureSize);
+
+	// Read back the GPU results
+	std::vector<unsigned char> gpuHeightMap(textureSize * textureSize);
+	std::vector<glm::vec4> gpuNormalMap(textureSize * textureSize);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glBindTexture(GL_TEXTURE_2D, heightMapTexture._textureID);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_BYTE, gpuHeightMap.data());
+	glBindTexture(GL_TEXTURE_2D, normalMapTexture._textureID);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, gpuNormalMap.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	// Heightmap: truncation to a byte can land on either side of a step when the GPU rounds differently, so allow 1 step
+	std::vector<unsigned char> cpuHeightMap = GenerateHeightMap(textureSize, 0.005f, 6, 0.5f, 2.0f, offset);
+	int maxHeightError = 0, heightMismatches = 0;
+	for (size_t i = 0; i < cpuHeightMap.size(); ++i)
+	{
+		int error = std::abs(static_cast<int>(cpuHeightMap[i]) - static_cast<int>(gpuHeightMap[i]));
+		if (error > 0) heightMismatches++;
+		if (error > maxHeightError) maxHeightError = error;
+	}
+
+	std::vector<glm::vec3> cpuNormalMap = GenerateNormalMap(gpuHeightMap, textureSize);
+	float maxNormalError = 0.0f;
+	for (size_t i = 0; i < cpuNormalMap.size(); ++i)
+	{
+		glm::vec3 error = glm::abs(cpuNormalMap[i] - glm::vec3(gpuNormalMap[i]));
+		maxNormalError = glm::max(maxNormalError, glm::max(error.x, glm::max(error.y, error.z)));
+	}
+
+	bool bPassed = maxHeightError <= 1 && maxNormalError <= 1e-5f;
+	std::cout << "Compute terrain parity (" << textureSize << "x" << textureSize << "): "
+		<< "height max error " << maxHeightError << " (" << heightMismatches << " texels differ), "
+		<< "normal max error " << maxNormalError << " -> " << (bPassed ? "PASSED" : "FAILED") << std::endl;
+	return bPassed;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include "texture.h"
+
+// ------------------------------------ CPU Path ------------------------------------------------------------------
+float FBM(float x, float y, int octaves, float lacunarity, float persistence);
+std::vector<unsigned char> GenerateHeightMap(int textureSize, float scale = 0.005f, int octaves = 6, float persistence = 0.5f, float lacunarity = 2.0f, glm::vec2 offset = glm::vec2(0.0f));
+std::vector<glm::vec3> GenerateNormalMap(const std::vector<unsigned char>& heightMap, int textureSize);
+// ----------------------------------------------------------------------------------------------------------------
+
+/// <summary>
+/// GPU path for terrain generation. Runs the simplex/FBM and normal kernels as compute shaders that write straight into the
+/// height and normal textures, so nothing is generated on the host or uploaded with glTexImage2D.
+/// Expects the textures to have been created with GL_R8 (height) and GL_RGBA32F (normal) storage.
+/// </summary>
+class ComputeTerrain
+{
+public:
+	ComputeTerrain();
+	void GenerateHeightMap(Texture& heightMapTexture, int textureSize, float scale = 0.005f, int octaves = 6, float persistence = 0.5f, float lacunarity = 2.0f, glm::vec2 offset = glm::vec2(0.0f));
+	void GenerateNormalMap(Texture& heightMapTexture, Texture& normalMapTexture, int textureSize);
+
+private:
+	Shader _heightMapShader;
+	Shader _normalMapShader;
+};
+
+bool VerifyComputeTerrainParity(int textureSize);
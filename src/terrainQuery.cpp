@@ -0,0 +1,528 @@
+#include "terrainQuery.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include "memoryTracker.h"
+#include "terrainGenerator.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QUERY_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+const int QUERY_BAND_ROWS = 64;
+// Cast()'s traversal stack: each level down leaves at most three siblings behind, so 1 + 3 * levels entries (21 levels)
+const int CAST_STACK_SIZE = 64;
+
+HeightField::HeightField(int textureSize, float terrainSize, float heightRange)
+	: _size(textureSize), _terrainSize(terrainSize), _heightRange(heightRange), _gridScale(textureSize / terrainSize),
+	_heights(static_cast<size_t>(textureSize) * textureSize), _lift(static_cast<size_t>(textureSize) * textureSize)
+{
+	// Leaves first, then every level half the size (rounded up) down to the root
+	for (int across = textureSize + 1; ; across = (across + 1) / 2)
+	{
+		_levels.push_back({ across, std::vector<Bounds>(static_cast<size_t>(across) * across) });
+		if (across == 1) break;
+	}
+}
+
+bool HeightField::Contains(float x, float z) const
+{
+	const float half = _terrainSize * 0.5f;
+	return std::abs(x) <= half && std::abs(z) <= half;
+}
+
+float HeightField::Height(float x, float z) const
+{
+	return Surface(x, z, 0.0f);
+}
+
+float HeightField::ClearHeight(float x, float z, float radius) const
+{
+	// Sweeps only collide over the terrain
+	return Contains(x, z) ? Surface(x, z, radius) : -std::numeric_limits<float>::max();
+}
+
+float HeightField::Surface(float x, float z, float radius) const
+{
+	const float last = static_cast<float>(_size - 1);
+	float gx = std::min(std::max(GridX(x), 0.0f), last), gz = std::min(std::max(GridZ(z), 0.0f), last);
+	int ix = std::min(static_cast<int>(gx), _size - 2), iz = std::min(static_cast<int>(gz), _size - 2);
+	float a = gx - ix, b = gz - iz;
+	float h00 = Sample(ix, iz) + radius * Lift(ix, iz), h10 = Sample(ix + 1, iz) + radius * Lift(ix + 1, iz);
+	float h01 = Sample(ix, iz + 1) + radius * Lift(ix, iz + 1), h11 = Sample(ix + 1, iz + 1) + radius * Lift(ix + 1, iz + 1);
+	float top = h00 + (h10 - h00) * a;
+	float bottom = h01 + (h11 - h01) * a;
+	return top + (bottom - top) * b;
+}
+
+glm::vec3 HeightField::Normal(float x, float z) const
+{
+	const float last = static_cast<float>(_size - 1);
+	float gx = GridX(x), gz = GridZ(z);
+	// Flat across the clamped border
+	float slopeX = gx < 0.0f || gx > last ? 0.0f : 1.0f, slopeZ = gz < 0.0f || gz > last ? 0.0f : 1.0f;
+	gx = std::min(std::max(gx, 0.0f), last);
+	gz = std::min(std::max(gz, 0.0f), last);
+	int ix = std::min(static_cast<int>(gx), _size - 2), iz = std::min(static_cast<int>(gz), _size - 2);
+	float a = gx - ix, b = gz - iz;
+	float h00 = Sample(ix, iz), h10 = Sample(ix + 1, iz), h01 = Sample(ix, iz + 1), h11 = Sample(ix + 1, iz + 1);
+	// Height per world unit: texels are 1 / _gridScale apart, and z runs against the rows
+	float dx = ((h10 - h00) * (1.0f - b) + (h11 - h01) * b) * _gridScale * slopeX;
+	float dz = -((h01 - h00) * (1.0f - a) + (h11 - h10) * a) * _gridScale * slopeZ;
+	return glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+}
+
+/// <summary>
+/// Lift factors: the steeper of the two steps next to a texel along each axis stands in for its slope there.
+/// </summary>
+void HeightField::BuildLift(int firstRow, int lastRow)
+{
+	const int last = _size - 1;
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		for (int x = 0; x < _size; ++x)
+		{
+			float h = Sample(x, y);
+			float slopeX = std::max(std::abs(Sample(std::min(x + 1, last), y) - h), std::abs(h - Sample(std::max(x - 1, 0), y))) * _gridScale;
+			float slopeZ = std::max(std::abs(Sample(x, std::min(y + 1, last)) - h), std::abs(h - Sample(x, std::max(y - 1, 0)))) * _gridScale;
+			_lift[static_cast<size_t>(y) * _size + x] = std::min(std::sqrt(1.0f + slopeX * slopeX + slopeZ * slopeZ), SPHERE_MAX_LIFT);
+		}
+	}
+}
+
+/// <summary>
+/// Bounds of the bilinear patches: leaf p spans texel centers p - 1 to p (clamped, so the border ones are flat outwards).
+/// </summary>
+void HeightField::BuildLeaves(int firstRow, int lastRow)
+{
+	Level& leaves = _levels[0];
+	const int last = _size - 1;
+	for (int pz = firstRow; pz < lastRow; ++pz)
+	{
+		int z0 = std::max(pz - 1, 0), z1 = std::min(pz, last);
+		for (int px = 0; px < leaves.across; ++px)
+		{
+			int x0 = std::max(px - 1, 0), x1 = std::min(px, last);
+			float h00 = Sample(x0, z0), h10 = Sample(x1, z0), h01 = Sample(x0, z1), h11 = Sample(x1, z1);
+			float lift = std::max(std::max(Lift(x0, z0), Lift(x1, z0)), std::max(Lift(x0, z1), Lift(x1, z1)));
+			leaves.nodes[static_cast<size_t>(pz) * leaves.across + px] = { std::min(std::min(h00, h10), std::min(h01, h11)), std::max(std::max(h00, h10), std::max(h01, h11)), lift };
+		}
+	}
+}
+
+void HeightField::BuildLevels()
+{
+	for (size_t level = 1; level < _levels.size(); ++level)
+	{
+		const Level& below = _levels[level - 1];
+		Level& above = _levels[level];
+		for (int kz = 0; kz < above.across; ++kz)
+		{
+			for (int kx = 0; kx < above.across; ++kx)
+			{
+				Bounds bounds = { std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), 0.0f };
+				for (int cz = kz * 2; cz < std::min(kz * 2 + 2, below.across); ++cz)
+				{
+					for (int cx = kx * 2; cx < std::min(kx * 2 + 2, below.across); ++cx)
+					{
+						const Bounds& child = below.nodes[static_cast<size_t>(cz) * below.across + cx];
+						bounds.min = std::min(bounds.min, child.min);
+						bounds.max = std::max(bounds.max, child.max);
+						bounds.lift = std::max(bounds.lift, child.lift);
+					}
+				}
+				above.nodes[static_cast<size_t>(kz) * above.across + kx] = bounds;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Clip the ray's [tEnter, tExit] to the box [x0, x1] x [z0, z1] (in texel coordinates), false if nothing is left.
+/// </summary>
+static bool ClipToBox(const glm::vec3& origin, const glm::vec3& direction, float x0, float x1, float z0, float z1, float& tEnter, float& tExit)
+{
+	const float lows[2] = { x0, z0 }, highs[2] = { x1, z1 };
+	const float origins[2] = { origin.x, origin.z }, directions[2] = { direction.x, direction.z };
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		if (directions[axis] == 0.0f)
+		{
+			if (origins[axis] < lows[axis] || origins[axis] > highs[axis]) return false;
+			continue;
+		}
+		float t0 = (lows[axis] - origins[axis]) / directions[axis], t1 = (highs[axis] - origins[axis]) / directions[axis];
+		if (t0 > t1) std::swap(t0, t1);
+		tEnter = std::max(tEnter, t0);
+		tExit = std::min(tExit, t1);
+	}
+	return tEnter <= tExit;
+}
+
+/// <summary>
+/// First point in [tEnter, tExit] where the ray (in texel coordinates, y in world units) meets leaf (px, pz)'s bilinear
+/// patch, raised for a sphere of radius. Along the ray the patch's height is quadratic in t, so this is the first root of
+/// a quadratic.
+/// </summary>
+bool HeightField::IntersectPatch(int px, int pz, float radius, const glm::vec3& origin, const glm::vec3& direction, float tEnter, float tExit, float& t) const
+{
+	const int last = _size - 1;
+	int x0 = std::max(px - 1, 0), x1 = std::min(px, last), z0 = std::max(pz - 1, 0), z1 = std::min(pz, last);
+	float h00 = Sample(x0, z0) + radius * Lift(x0, z0), h10 = Sample(x1, z0) + radius * Lift(x1, z0);
+	float h01 = Sample(x0, z1) + radius * Lift(x0, z1), h11 = Sample(x1, z1) + radius * Lift(x1, z1);
+	float slopeA = h10 - h00, slopeB = h01 - h00, twist = h00 - h10 - h01 + h11;
+
+	// Patch coordinates (0..1 from texel center px - 1, pz - 1) and height where the ray enters
+	float a = origin.x + direction.x * tEnter - (px - 1), b = origin.z + direction.z * tEnter - (pz - 1), y = origin.y + direction.y * tEnter;
+	float c0 = y - (h00 + slopeA * a + slopeB * b + twist * a * b);
+	if (c0 <= 0.0f)
+	{
+		t = tEnter;
+		return true;
+	}
+	float c1 = direction.y - slopeA * direction.x - slopeB * direction.z - twist * (a * direction.z + b * direction.x);
+	float c2 = -twist * direction.x * direction.z;
+	const float span = tExit - tEnter, slack = 1e-5f * (span + 1.0f);
+
+	float roots[2];
+	int rootCount = 0;
+	if (std::abs(c2) * span < 1e-7f * (std::abs(c1) + std::abs(c0) + 1e-7f))
+	{
+		if (c1 != 0.0f) roots[rootCount++] = -c0 / c1;
+	}
+	else
+	{
+		float discriminant = c1 * c1 - 4.0f * c2 * c0;
+		if (discriminant < 0.0f) return false;
+		float q = -0.5f * (c1 + (c1 < 0.0f ? -1.0f : 1.0f) * std::sqrt(discriminant)); // The stable pair of roots
+		roots[rootCount++] = q / c2;
+		if (q != 0.0f) roots[rootCount++] = c0 / q;
+	}
+	float first = std::numeric_limits<float>::max();
+	for (int i = 0; i < rootCount; ++i)
+		if (roots[i] >= -slack && roots[i] <= span + slack)
+			first = std::min(first, std::max(roots[i], 0.0f));
+	if (first == std::numeric_limits<float>::max()) return false;
+	t = tEnter + std::min(first, span);
+	return true;
+}
+
+TerrainHit HeightField::Raycast(const TerrainRay& ray) const
+{
+	return Cast(ray, 0.0f);
+}
+
+TerrainHit HeightField::SweepSphere(const TerrainRay& ray, float radius) const
+{
+	return Cast(ray, radius);
+}
+
+TerrainHit HeightField::Cast(const TerrainRay& ray, float radius) const
+{
+	TerrainHit hit = { false, 0.0f, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f) };
+	const glm::vec3 origin(GridX(ray.origin.x), ray.origin.y, GridZ(ray.origin.z));
+	const glm::vec3 direction(ray.direction.x * _gridScale, ray.direction.y, -ray.direction.z * _gridScale);
+	const float domainLow = -0.5f, domainHigh = _size - 0.5f;
+
+	struct Node
+	{
+		int level, kx, kz;
+		float tEnter, tExit;
+	};
+	assert(1 + 3 * static_cast<int>(_levels.size()) <= CAST_STACK_SIZE);
+	Node stack[CAST_STACK_SIZE];
+	int stackSize = 0;
+	float tEnter = 0.0f, tExit = ray.maxDistance;
+	if (!ClipToBox(origin, direction, domainLow, domainHigh, domainLow, domainHigh, tEnter, tExit))
+		return hit;
+	stack[stackSize++] = { static_cast<int>(_levels.size()) - 1, 0, 0, tEnter, tExit };
+
+	float t = 0.0f;
+	while (stackSize > 0)
+	{
+		const Node node = stack[--stackSize];
+		const Level& level = _levels[node.level];
+		const Bounds& bounds = level.nodes[static_cast<size_t>(node.kz) * level.across + node.kx];
+		float y0 = origin.y + direction.y * node.tEnter, y1 = origin.y + direction.y * node.tExit;
+		if (std::min(y0, y1) > bounds.max + radius * bounds.lift)
+			continue; // Wholly above everything in the node
+		if (std::max(y0, y1) < bounds.min)
+		{
+			// Wholly below: nothing nearer was hit, so the ray is under the surface from where it enters the node
+			t = node.tEnter;
+			hit.bHit = true;
+			break;
+		}
+		if (node.level == 0)
+		{
+			if (IntersectPatch(node.kx, node.kz, radius, origin, direction, node.tEnter, node.tExit, t))
+			{
+				hit.bHit = true;
+				break;
+			}
+			continue;
+		}
+
+		// Children the ray passes through, pushed far to near so the nearest comes off first
+		const Level& below = _levels[node.level - 1];
+		const int childSpan = 1 << (node.level - 1);
+		Node children[4];
+		int childCount = 0;
+		for (int cz = node.kz * 2; cz < std::min(node.kz * 2 + 2, below.across); ++cz)
+		{
+			for (int cx = node.kx * 2; cx < std::min(node.kx * 2 + 2, below.across); ++cx)
+			{
+				// Leaves [c * span, (c + 1) * span) cover texel centers c * span - 1 to (c + 1) * span - 1
+				float x0 = std::max(static_cast<float>(cx * childSpan - 1), domainLow), x1 = std::min(static_cast<float>((cx + 1) * childSpan - 1), domainHigh);
+				float z0 = std::max(static_cast<float>(cz * childSpan - 1), domainLow), z1 = std::min(static_cast<float>((cz + 1) * childSpan - 1), domainHigh);
+				float childEnter = node.tEnter, childExit = node.tExit;
+				if (ClipToBox(origin, direction, x0, x1, z0, z1, childEnter, childExit))
+					children[childCount++] = { node.level - 1, cx, cz, childEnter, childExit };
+			}
+		}
+		// Insertion sort, furthest entry first: there are at most four, and std::sort's unrolled paths index past them
+		assert(childCount <= 4);
+		for (int i = 1; i < childCount; ++i)
+			for (int j = i; j > 0 && children[j - 1].tEnter < children[j].tEnter; --j)
+				std::swap(children[j - 1], children[j]);
+		assert(stackSize + childCount <= CAST_STACK_SIZE);
+		for (int i = 0; i < childCount; ++i)
+			stack[stackSize++] = children[i];
+	}
+	if (!hit.bHit) return hit;
+
+	hit.distance = t;
+	hit.position = ray.origin + ray.direction * t;
+	hit.normal = Normal(hit.position.x, hit.position.z);
+	return hit;
+}
+
+#ifdef QUERY_USE_SSE2
+/// <summary>
+/// Four points' bilinear cells: texel coordinates clamped to the texel centers, their cell's first texel (as an index) and
+/// the position within it. outsideX/Z are all ones where a point was clamped.
+/// </summary>
+static inline void Cells4(const glm::vec2* points, float gridScale, int size, __m128& a, __m128& b, int* indices, __m128& outsideX, __m128& outsideZ)
+{
+	__m128 first = _mm_loadu_ps(&points[0].x), second = _mm_loadu_ps(&points[2].x); // x z x z
+	__m128 x = _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)), z = _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1));
+	const __m128 center = _mm_set1_ps(size * 0.5f - 0.5f), zero = _mm_setzero_ps(), last = _mm_set1_ps(static_cast<float>(size - 1));
+	__m128 gx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(gridScale)), center);
+	__m128 gz = _mm_sub_ps(center, _mm_mul_ps(z, _mm_set1_ps(gridScale)));
+	outsideX = _mm_or_ps(_mm_cmplt_ps(gx, zero), _mm_cmpgt_ps(gx, last));
+	outsideZ = _mm_or_ps(_mm_cmplt_ps(gz, zero), _mm_cmpgt_ps(gz, last));
+	gx = _mm_min_ps(_mm_max_ps(gx, zero), last);
+	gz = _mm_min_ps(_mm_max_ps(gz, zero), last);
+	// Never negative, so truncation is floor. Indices stay far below 2^24, exact in floats
+	const __m128 lastCell = _mm_set1_ps(static_cast<float>(size - 2));
+	__m128 cellX = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gx)), lastCell);
+	__m128 cellZ = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gz)), lastCell);
+	a = _mm_sub_ps(gx, cellX);
+	b = _mm_sub_ps(gz, cellZ);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(cellZ, _mm_set1_ps(static_cast<float>(size))), cellX)));
+}
+
+static inline void Corners4(const float* heights, const int* indices, int size, __m128& h00, __m128& h10, __m128& h01, __m128& h11)
+{
+	h00 = _mm_setr_ps(heights[indices[0]], heights[indices[1]], heights[indices[2]], heights[indices[3]]);
+	h10 = _mm_setr_ps(heights[indices[0] + 1], heights[indices[1] + 1], heights[indices[2] + 1], heights[indices[3] + 1]);
+	h01 = _mm_setr_ps(heights[indices[0] + size], heights[indices[1] + size], heights[indices[2] + size], heights[indices[3] + size]);
+	h11 = _mm_setr_ps(heights[indices[0] + size + 1], heights[indices[1] + size + 1], heights[indices[2] + size + 1], heights[indices[3] + size + 1]);
+}
+#endif
+
+void HeightField::Heights(const glm::vec2* points, size_t count, float* heights) const
+{
+	size_t i = 0;
+#ifdef QUERY_USE_SSE2
+	int indices[4];
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 a, b, outsideX, outsideZ, h00, h10, h01, h11;
+		Cells4(points + i, _gridScale, _size, a, b, indices, outsideX, outsideZ);
+		Corners4(_heights.data(), indices, _size, h00, h10, h01, h11);
+		__m128 top = _mm_add_ps(h00, _mm_mul_ps(_mm_sub_ps(h10, h00), a));
+		__m128 bottom = _mm_add_ps(h01, _mm_mul_ps(_mm_sub_ps(h11, h01), a));
+		_mm_storeu_ps(heights + i, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), b)));
+	}
+#endif
+	for (; i < count; ++i)
+		heights[i] = Height(points[i].x, points[i].y);
+}
+
+void HeightField::Normals(const glm::vec2* points, size_t count, glm::vec3* normals) const
+{
+	size_t i = 0;
+#ifdef QUERY_USE_SSE2
+	int indices[4];
+	const __m128 one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(_gridScale);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 a, b, outsideX, outsideZ, h00, h10, h01, h11;
+		Cells4(points + i, _gridScale, _size, a, b, indices, outsideX, outsideZ);
+		Corners4(_heights.data(), indices, _size, h00, h10, h01, h11);
+		// Minus the height's slope along x and z (z runs against the rows), flat across the clamped border
+		__m128 dx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(h10, h00), _mm_sub_ps(one, b)), _mm_mul_ps(_mm_sub_ps(h11, h01), b)), scale);
+		__m128 dz = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(h01, h00), _mm_sub_ps(one, a)), _mm_mul_ps(_mm_sub_ps(h11, h10), a)), scale);
+		__m128 nx = _mm_andnot_ps(outsideX, _mm_sub_ps(_mm_setzero_ps(), dx));
+		__m128 nz = _mm_andnot_ps(outsideZ, dz);
+		__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(nz, nz)), one)));
+		float x[4], y[4], z[4];
+		_mm_storeu_ps(x, _mm_mul_ps(nx, inverseLength));
+		_mm_storeu_ps(y, inverseLength);
+		_mm_storeu_ps(z, _mm_mul_ps(nz, inverseLength));
+		for (int k = 0; k < 4; ++k)
+			normals[i + k] = glm::vec3(x[k], y[k], z[k]);
+	}
+#endif
+	for (; i < count; ++i)
+		normals[i] = Normal(points[i].x, points[i].y);
+}
+
+void HeightField::Raycast(const TerrainRay* rays, size_t count, TerrainHit* hits) const
+{
+	for (size_t i = 0; i < count; ++i)
+		hits[i] = Raycast(rays[i]);
+}
+
+JobHandle TerrainQuery::Build(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float terrainSize, float heightRange)
+{
+	if (_pending)
+		jobSystem.Wait(_pending);
+
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	_heightMap = heightMap;
+	_building = std::make_shared<HeightField>(textureSize, terrainSize, heightRange);
+
+	// One job per row band, each pass waiting for the previous one
+	HeightField* field = _building.get();
+	std::vector<JobHandle> pass = jobSystem.ScheduleRows(textureSize, QUERY_BAND_ROWS, {}, [this, field, heightRange](int firstRow, int lastRow)
+	{
+		// Height map steps (0 at the top) to world heights
+		const size_t first = static_cast<size_t>(firstRow) * field->_size, last = static_cast<size_t>(lastRow) * field->_size;
+		for (size_t i = first; i < last; ++i)
+			field->_heights[i] = -(*_heightMap)[i] / 255.0f * heightRange;
+	});
+	pass = jobSystem.ScheduleRows(textureSize, QUERY_BAND_ROWS, pass, [field](int firstRow, int lastRow) { field->BuildLift(firstRow, lastRow); });
+	pass = jobSystem.ScheduleRows(textureSize + 1, QUERY_BAND_ROWS, pass, [field](int firstRow, int lastRow) { field->BuildLeaves(firstRow, lastRow); });
+	_pending = jobSystem.Schedule([this, field]
+	{
+		field->BuildLevels();
+		std::atomic_store(&_current, _building); // Readers holding the old one keep it alive until they let go
+	}, pass);
+	return _pending;
+}
+
+std::shared_ptr<const HeightField> TerrainQuery::Current() const
+{
+	return std::atomic_load(&_current);
+}
+
+bool VerifyTerrainQuery(int textureSize)
+{
+	const float terrainSize = 4.0f, heightRange = 0.6f;
+	JobSystem jobSystem;
+	TerrainQuery query;
+	SharedHeightMap heightMap = std::make_shared<std::vector<unsigned char>>(GenerateHeightMap(textureSize, 0.005f, 6, 0.5f, 2.0f, glm::vec2(17.0f, -3.5f)));
+	jobSystem.Wait(query.Build(jobSystem, heightMap, textureSize, terrainSize, heightRange));
+	const std::shared_ptr<const HeightField> field = query.Current();
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> signedUnit(-1.0f, 1.0f);
+
+	// Points past the edges too, where both clamp
+	const size_t pointCount = 100003;
+	std::vector<glm::vec2> points(pointCount);
+	for (glm::vec2& point : points)
+		point = glm::vec2(signedUnit(random), signedUnit(random)) * terrainSize * 0.55f;
+	std::vector<float> heights(pointCount);
+	std::vector<glm::vec3> normals(pointCount);
+	field->Heights(points.data(), pointCount, heights.data());
+	field->Normals(points.data(), pointCount, normals.data());
+	float heightError = 0.0f, normalError = 0.0f;
+	for (size_t i = 0; i < pointCount; ++i)
+	{
+		heightError = std::max(heightError, std::abs(heights[i] - field->Height(points[i].x, points[i].y)));
+		normalError = std::max(normalError, glm::length(normals[i] - field->Normal(points[i].x, points[i].y)));
+	}
+
+	// Rays from above down across the terrain, a tenth of them grazing just under the top
+	const int rayCount = 20000;
+	std::vector<TerrainRay> rays(rayCount);
+	for (int i = 0; i < rayCount; ++i)
+	{
+		TerrainRay& ray = rays[i];
+		ray.origin = glm::vec3(signedUnit(random) * 3.0f, 0.7f + signedUnit(random) * 0.5f, signedUnit(random) * 3.0f);
+		glm::vec3 target(signedUnit(random) * 2.0f, -0.3f + signedUnit(random) * 0.3f, signedUnit(random) * 2.0f);
+		ray.direction = glm::normalize(target - ray.origin);
+		ray.maxDistance = 10.0f;
+		if (i < rayCount / 10)
+		{
+			ray.origin.y = -0.1f + signedUnit(random) * 0.1f;
+			ray.direction = glm::normalize(glm::vec3(ray.direction.x, signedUnit(random) * 0.02f, ray.direction.z));
+		}
+	}
+	std::vector<TerrainHit> hits(rayCount);
+	field->Raycast(rays.data(), rayCount, hits.data());
+
+	// The march is slow, so it runs in bands on the workers. Distances are -1 for a miss
+	std::vector<float> marched(rayCount);
+	const float step = terrainSize / textureSize / 8.0f;
+	std::vector<JobHandle> bands = jobSystem.ScheduleRows(rayCount, 256, {}, [&](int first, int last)
+	{
+		for (int i = first; i < last; ++i)
+		{
+			const TerrainRay& ray = rays[i];
+			auto Below = [&](float t)
+			{
+				glm::vec3 position = ray.origin + ray.direction * t;
+				return field->Contains(position.x, position.z) && position.y <= field->Height(position.x, position.z);
+			};
+			marched[i] = -1.0f;
+			if (Below(0.0f))
+			{
+				marched[i] = 0.0f;
+				continue;
+			}
+			for (float t = step, previous = 0.0f; t <= ray.maxDistance; previous = t, t += step)
+			{
+				if (!Below(t)) continue;
+				float low = previous, high = t;
+				for (int bisection = 0; bisection < 40; ++bisection)
+					(Below((low + high) * 0.5f) ? high : low) = (low + high) * 0.5f;
+				marched[i] = high;
+				break;
+			}
+		}
+	});
+	for (const JobHandle& band : bands)
+		jobSystem.Wait(band);
+
+	// The march steps over rays that only touch a ridge, so the tree may hit first: fine as long as its hit is on (or under)
+	// the surface, give or take a float error that grows with the distance along the ray. It must never hit later than the
+	// march, or miss what the march hits.
+	int rayHits = 0, rayMismatches = 0, grazes = 0;
+	float distanceError = 0.0f;
+	for (int i = 0; i < rayCount; ++i)
+	{
+		const bool bMarchedHit = marched[i] >= 0.0f;
+		rayHits += hits[i].bHit;
+		if (bMarchedHit && (!hits[i].bHit || hits[i].distance > marched[i] + step))
+			rayMismatches++;
+		else if (hits[i].bHit && hits[i].position.y > field->Height(hits[i].position.x, hits[i].position.z) + 1e-5f * (1.0f + hits[i].distance))
+			rayMismatches++;
+		else if (hits[i].bHit && (!bMarchedHit || hits[i].distance < marched[i] - step))
+			grazes++;
+		else if (hits[i].bHit)
+			distanceError = std::max(distanceError, std::abs(marched[i] - hits[i].distance));
+	}
+
+	bool bPassed = heightError <= 1e-5f && normalError <= 1e-4f && rayMismatches == 0 && distanceError <= step;
+	std::cout << "Terrain query (" << textureSize << "x" << textureSize << "): batched heights max error " << heightError << ", normals "
+		<< normalError << "; " << rayCount << " rays, " << rayHits << " hits (" << grazes << " grazing ones the march stepped over), " << rayMismatches
+		<< " wrong, distance max error " << distanceError << " -> " << (bPassed ? "PASSED" : "FAILED") << std::endl;
+	return bPassed;
+}
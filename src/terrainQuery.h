@@ -0,0 +1,128 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "jobSystem.h"
+#include "texture.h"
+
+const float SPHERE_MAX_LIFT = 4.0f; // Sphere sweeps stop treating slopes as steeper beyond ~76 degrees
+
+struct TerrainRay
+{
+	glm::vec3 origin;
+	glm::vec3 direction; // Need not be normalized: distances come back in multiples of it
+	float maxDistance;
+};
+
+struct TerrainHit
+{
+	bool bHit;
+	float distance; // Along the ray, in multiples of its direction
+	glm::vec3 position;
+	glm::vec3 normal;
+};
+
+/// <summary>
+/// The terrain's surface on the CPU, in world units: the height map's texel centers joined bilinearly (as the shaders sample
+/// it), clamped at the border. The terrain is centered on the origin, terrainSize across in x and z, its top at y = 0 and
+/// heightRange deep, with the height map's rows running towards -z (the quad's model matrix). Immutable once built, so any
+/// number of threads can query the same one.
+///
+/// Ray casts walk a min/max tree: the leaves bound the bilinear patches between four texel centers (the patches in the
+/// border half texel are clamped flat), every node above bounds up to 2x2 below it. Nodes the ray misses, or passes wholly
+/// above, are skipped; the rest are visited front to back, so the first patch hit is the answer. Everything under the
+/// surface counts as solid: a node the ray passes wholly below is hit where the ray enters it.
+///
+/// Sphere sweeps are ray casts of the sphere's center against the surface raised to keep it clear: each texel center is
+/// lifted by radius / cos(steepest slope next to it) (what a sphere resting on that slope needs, at most
+/// SPHERE_MAX_LIFT * radius on cliffs) and joined bilinearly like the heights. That surface is continuous, so a center
+/// put on or above it by ClearHeight() can always move on. Nodes keep the largest lift factor under them to skip by.
+/// </summary>
+class HeightField
+{
+public:
+	HeightField(int textureSize, float terrainSize, float heightRange);
+
+	bool Contains(float x, float z) const; // Over the terrain, as opposed to past its edges
+	float Height(float x, float z) const;  // Clamped to the edge outside
+	glm::vec3 Normal(float x, float z) const;
+	TerrainHit Raycast(const TerrainRay& ray) const; // A ray starting under the surface hits at its origin
+	TerrainHit SweepSphere(const TerrainRay& ray, float radius) const; // Positions are the sphere's center
+	float ClearHeight(float x, float z, float radius) const; // Lowest center height there that sweeps treat as clear (none past the edges)
+
+	// Batched: heights and normals four at a time with SSE2 when available. Rays go one at a time, their traversals diverge
+	// after the first few nodes
+	void Heights(const glm::vec2* points, size_t count, float* heights) const; // Points are (x, z)
+	void Normals(const glm::vec2* points, size_t count, glm::vec3* normals) const;
+	void Raycast(const TerrainRay* rays, size_t count, TerrainHit* hits) const;
+
+	int Size() const { return _size; }
+	float TerrainSize() const { return _terrainSize; }
+	float HeightRange() const { return _heightRange; }
+
+private:
+	friend class TerrainQuery;
+
+	struct Bounds
+	{
+		float min, max;
+		float lift; // Largest lift factor of the texels under the node
+	};
+
+	struct Level
+	{
+		int across; // Nodes per side
+		std::vector<Bounds> nodes;
+	};
+
+	float Sample(int x, int y) const { return _heights[static_cast<size_t>(y) * _size + x]; }
+	float Lift(int x, int y) const { return _lift[static_cast<size_t>(y) * _size + x]; }
+	// World x/ z to texel coordinates: texel i's center is at i, rows run towards -z
+	float GridX(float x) const { return x * _gridScale + _size * 0.5f - 0.5f; }
+	float GridZ(float z) const { return -z * _gridScale + _size * 0.5f - 0.5f; }
+	float Surface(float x, float z, float radius) const; // Bilinear height raised for a sphere of radius
+	void BuildLift(int firstRow, int lastRow);
+	void BuildLeaves(int firstRow, int lastRow);
+	void BuildLevels();
+	bool IntersectPatch(int px, int pz, float radius, const glm::vec3& origin, const glm::vec3& direction, float tEnter, float tExit, float& t) const;
+	TerrainHit Cast(const TerrainRay& ray, float radius) const;
+
+	int _size;             // Texels across
+	float _terrainSize, _heightRange;
+	float _gridScale;      // World units to texels
+	std::vector<float> _heights; // World y per texel center
+	std::vector<float> _lift;    // Per texel center, 1 / cos(steepest slope next to it), at most SPHERE_MAX_LIFT
+	std::vector<Level> _levels;  // Leaves (size + 1 patches across, the border ones half inside) first, root last
+};
+
+/// <summary>
+/// Keeps the HeightField of the current height map. Build() replaces it in the background, and readers on other threads
+/// (the simulation, placement jobs) take a snapshot that stays valid however long they hold it.
+/// </summary>
+class TerrainQuery
+{
+public:
+	/// <summary>
+	/// Schedule the build from the read back height map. Same rules as SplatMap::Generate(): call from the GL thread, not from
+	/// a job once a build has been scheduled.
+	/// </summary>
+	JobHandle Build(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float terrainSize, float heightRange);
+
+	std::shared_ptr<const HeightField> Current() const; // Null until the first build is done, callable from any thread
+	// The field the last Build() fills: only for jobs that depend on its handle, which see it complete whatever builds follow
+	std::shared_ptr<const HeightField> Building() const { return _building; }
+
+private:
+	std::shared_ptr<HeightField> _current; // Read and written with the atomic shared_ptr functions
+	std::shared_ptr<HeightField> _building;
+	SharedHeightMap _heightMap;
+	JobHandle _pending;
+};
+
+/// <summary>
+/// Check the queries on a generated height map, CPU only: the batched heights and normals against the single point ones, and
+/// ray casts against a brute force march along each ray (1/8 texel steps, then bisection).
+/// </summary>
+/// <returns> True if the batched queries agree within float tolerance and every ray hits (or misses) as the march does. </returns>
+bool VerifyTerrainQuery(int textureSize);
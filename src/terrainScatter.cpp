@@ -0,0 +1,218 @@
+#include "terrainScatter.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include "memoryTracker.h"
+
+static const int SCATTER_BATCH = 256; // Candidates looked up at once
+
+/// <summary>
+/// PCG32: small, fast and good enough for placement, with the whole state in one 64 bit word so every tile gets its own.
+/// </summary>
+struct ScatterRandom
+{
+	uint64_t state;
+
+	explicit ScatterRandom(uint64_t seed) : state(seed) {}
+
+	uint32_t Next()
+	{
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+		uint32_t shifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27), rotation = static_cast<uint32_t>(old >> 59);
+		return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+	}
+
+	float Next01() { return (Next() >> 8) * (1.0f / 16777216.0f); } // [0, 1) in 24 bits
+};
+
+/// <summary>
+/// SplitMix64's finalizer: neighbouring keys (tile x, tile x + 1) come out as unrelated seeds.
+/// </summary>
+static uint64_t MixSeed(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+TerrainScatter::TerrainScatter() : _seed(0), _generation(0), _buildMilliseconds(0.0)
+{
+}
+
+JobHandle TerrainScatter::Generate(JobSystem& jobSystem, std::shared_ptr<const HeightField> field, const JobHandle& fieldReady, const std::vector<ScatterLayer>& layers, uint32_t seed)
+{
+	if (_pending)
+		jobSystem.Wait(_pending);
+	// A candidate reads two cells (spacing / sqrt(2) across) either side of its own, which can stick out of the tile by one
+	// more: three cells must stay within the tile between it and the next one running in the same phase
+	const float tileSize = field->TerrainSize() / SCATTER_TILES, maxSpacing = tileSize * std::sqrt(2.0f) / 3.0f;
+	for (const ScatterLayer& layer : layers)
+	{
+		if (layer.spacing <= 0.0f || layer.spacing > maxSpacing)
+		{
+			std::cerr << "ERROR: Scatter layer " << layer.name << " needs a spacing above 0 and at most " << maxSpacing << " (a tile * sqrt(2) / 3)" << std::endl;
+			return _pending = JobHandle();
+		}
+	}
+
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	_field = std::move(field);
+	_layers = layers;
+	_seed = seed;
+	_states.resize(layers.size());
+	for (size_t layer = 0; layer < layers.size(); ++layer)
+	{
+		LayerState& state = _states[layer];
+		state.cellSize = layers[layer].spacing / std::sqrt(2.0f);
+		state.cellsAcross = static_cast<int>(std::ceil(_field->TerrainSize() / state.cellSize));
+		state.cells.assign(static_cast<size_t>(state.cellsAcross) * state.cellsAcross, glm::vec2(std::numeric_limits<float>::infinity()));
+		state.tiles.assign(SCATTER_TILES * SCATTER_TILES, std::vector<ScatterInstance>());
+		state.tileCandidates.assign(SCATTER_TILES * SCATTER_TILES, 0);
+	}
+	_startTime = std::chrono::steady_clock::now();
+
+	// Per layer, four phases of a 2x2 checkerboard, each waiting for the one before
+	std::vector<JobHandle> layersDone;
+	for (int layer = 0; layer < static_cast<int>(layers.size()); ++layer)
+	{
+		std::vector<JobHandle> previous = { fieldReady };
+		for (int phase = 0; phase < 4; ++phase)
+		{
+			std::vector<JobHandle> tiles;
+			for (int tz = phase >> 1; tz < SCATTER_TILES; tz += 2)
+				for (int tx = phase & 1; tx < SCATTER_TILES; tx += 2)
+					tiles.push_back(jobSystem.Schedule([this, layer, tx, tz] { ScatterTile(layer, tx, tz); }, previous));
+			previous = std::move(tiles);
+		}
+		layersDone.insert(layersDone.end(), previous.begin(), previous.end());
+	}
+	JobHandle merged = jobSystem.Schedule([this] { Merge(); }, layersDone);
+	_pending = jobSystem.ScheduleOnMainThread([this]
+	{
+		_instances.swap(_building);
+		++_generation;
+		_field.reset(); // Don't keep an old height field alive
+		std::cout << "Scatter:";
+		size_t candidates = 0;
+		for (size_t layer = 0; layer < _instances.size(); ++layer)
+		{
+			std::cout << (layer ? ", " : " ") << _instances[layer].instances.size() << " " << _layers[layer].name;
+			candidates += _instances[layer].candidates;
+		}
+		std::cout << " from " << candidates << " candidates in " << _buildMilliseconds << " ms" << std::endl;
+	}, { merged });
+	return _pending;
+}
+
+/// <summary>
+/// Throw one tile's darts, SCATTER_BATCH at a time: positions first, then their heights and normals in one batched lookup,
+/// then the rules and the spacing test in order.
+/// </summary>
+void TerrainScatter::ScatterTile(int layer, int tx, int tz)
+{
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	const ScatterLayer& settings = _layers[layer];
+	LayerState& state = _states[layer];
+	const HeightField& field = *_field;
+	const float half = field.TerrainSize() * 0.5f, tileSize = field.TerrainSize() / SCATTER_TILES;
+	const float x0 = tx * tileSize - half, z0 = tz * tileSize - half;
+	const size_t tile = static_cast<size_t>(tz) * SCATTER_TILES + tx;
+	ScatterRandom random(MixSeed(MixSeed(_seed) ^ (static_cast<uint64_t>(layer) << 32) ^ tile));
+
+	const float cellsPerTile = tileSize / state.cellSize;
+	const size_t candidateCount = static_cast<size_t>(SCATTER_CANDIDATES_PER_CELL * cellsPerTile * cellsPerTile + 0.5f);
+	const float radiansToDegrees = 57.2957795f, spacingSquared = settings.spacing * settings.spacing;
+	// The slope rule's ends as cosines: past either end its coverage is flat, so most candidates need no acos
+	const float gentlest = std::min(settings.slope.from, settings.slope.to), steepest = std::max(settings.slope.from, settings.slope.to);
+	const float cosGentlest = std::cos(gentlest / radiansToDegrees), cosSteepest = std::cos(steepest / radiansToDegrees);
+	const float gentleCoverage = settings.slope.Coverage(gentlest), steepCoverage = settings.slope.Coverage(steepest);
+	auto SlopeCoverage = [&](float normalY)
+	{
+		if (normalY >= cosGentlest) return gentleCoverage;
+		if (normalY <= cosSteepest) return steepCoverage;
+		return settings.slope.Coverage(std::acos(normalY) * radiansToDegrees);
+	};
+	const float inverseCellSize = 1.0f / state.cellSize;
+	const int lastCell = state.cellsAcross - 1;
+	std::vector<ScatterInstance>& instances = state.tiles[tile];
+	instances.clear();
+
+	// A batch at a time on the stack: the whole tile's candidates would be megabytes of fresh pages every tile
+	glm::vec2 points[SCATTER_BATCH];
+	float heights[SCATTER_BATCH];
+	glm::vec3 normals[SCATTER_BATCH];
+	for (size_t first = 0; first < candidateCount; first += SCATTER_BATCH)
+	{
+		const size_t count = std::min(candidateCount - first, static_cast<size_t>(SCATTER_BATCH));
+		for (size_t i = 0; i < count; ++i)
+		{
+			points[i].x = x0 + random.Next01() * tileSize;
+			points[i].y = z0 + random.Next01() * tileSize;
+		}
+		field.Heights(points, count, heights);
+		field.Normals(points, count, normals);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const glm::vec2 point = points[i];
+			float keep = random.Next01(), altitudeCoverage = settings.altitude.Coverage(1.0f + heights[i] / field.HeightRange());
+			if (keep >= altitudeCoverage || keep >= altitudeCoverage * SlopeCoverage(normals[i].y))
+				continue;
+
+			// Anything closer than the spacing is at most two cells away
+			int cx = std::min(static_cast<int>((point.x + half) * inverseCellSize), lastCell);
+			int cz = std::min(static_cast<int>((point.y + half) * inverseCellSize), lastCell);
+			bool bClear = true;
+			for (int z = std::max(cz - 2, 0); z <= std::min(cz + 2, lastCell) && bClear; ++z)
+			{
+				for (int x = std::max(cx - 2, 0); x <= std::min(cx + 2, lastCell); ++x)
+				{
+					glm::vec2 offset = state.cells[static_cast<size_t>(z) * state.cellsAcross + x] - point; // Empty cells are infinitely far
+					if (glm::dot(offset, offset) < spacingSquared) { bClear = false; break; }
+				}
+			}
+			if (!bClear) continue;
+
+			state.cells[static_cast<size_t>(cz) * state.cellsAcross + cx] = point;
+			float scale = settings.minScale + (settings.maxScale - settings.minScale) * random.Next01();
+			ScatterInstance instance;
+			instance.position = glm::vec3(point.x, heights[i], point.y);
+			instance.yaw = static_cast<uint16_t>(random.Next() >> 16);
+			instance.scale = static_cast<uint16_t>(std::min(scale / settings.maxScale, 1.0f) * 65535.0f + 0.5f);
+			instances.push_back(instance);
+		}
+	}
+	state.tileCandidates[tile] = candidateCount;
+}
+
+/// <summary>
+/// Concatenate each layer's tiles into one compact array with an offset per tile.
+/// </summary>
+void TerrainScatter::Merge()
+{
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	_building.assign(_states.size(), ScatterInstances());
+	for (size_t layer = 0; layer < _states.size(); ++layer)
+	{
+		LayerState& state = _states[layer];
+		ScatterInstances& result = _building[layer];
+		size_t total = 0;
+		for (const std::vector<ScatterInstance>& tile : state.tiles)
+			total += tile.size();
+		result.instances.reserve(total);
+		result.tileOffsets.reserve(state.tiles.size() + 1);
+		for (size_t tile = 0; tile < state.tiles.size(); ++tile)
+		{
+			result.tileOffsets.push_back(static_cast<uint32_t>(result.instances.size()));
+			result.instances.insert(result.instances.end(), state.tiles[tile].begin(), state.tiles[tile].end());
+			result.candidates += state.tileCandidates[tile];
+			std::vector<ScatterInstance>().swap(state.tiles[tile]);
+		}
+		result.tileOffsets.push_back(static_cast<uint32_t>(result.instances.size()));
+		std::vector<glm::vec2>().swap(state.cells); // Only needed while scattering
+	}
+	_buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _startTime).count();
+}
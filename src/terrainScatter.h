@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "jobSystem.h"
+#include "materialLayers.h"
+#include "terrainQuery.h"
+
+const int SCATTER_TILES = 16;                 // Tiles across the terrain, each one job per layer and one run of instances
+const int SCATTER_CANDIDATES_PER_CELL = 4;   // Darts thrown per Poisson-disk grid cell (spacing / sqrt(2) across)
+
+/// <summary>
+/// One kind of instance to scatter (rocks, trees) and where it grows. The rules work like MaterialLayer's: altitude is a
+/// fraction of the height range (0 at its bottom, 1 at its top, not the map's own lowest and highest points), slope in
+/// degrees, and their product is the chance a candidate spot is kept.
+/// </summary>
+struct ScatterLayer
+{
+	std::string name;
+	float spacing;  // No two instances of the layer closer than this, in world units. At most a tile * sqrt(2) / 3 across
+	MaterialRule altitude, slope;
+	float minScale, maxScale;
+};
+
+/// <summary>
+/// 16 bytes, as the instanced draw reads it.
+/// </summary>
+struct ScatterInstance
+{
+	glm::vec3 position; // On the terrain, in world units
+	uint16_t yaw;       // In 65536ths of a turn
+	uint16_t scale;     // In 65535ths of the layer's maxScale (never below its minScale)
+};
+static_assert(sizeof(ScatterInstance) == 16, "ScatterInstance is a 16 byte instance attribute");
+
+/// <summary>
+/// A layer's instances, tile by tile: tile (tx, tz) (x and z from the terrain's -x, -z corner, SCATTER_TILES across) holds
+/// instances [tileOffsets[t], tileOffsets[t + 1]) with t = tz * SCATTER_TILES + tx.
+/// </summary>
+struct ScatterInstances
+{
+	std::vector<ScatterInstance> instances;
+	std::vector<uint32_t> tileOffsets;
+	size_t candidates = 0; // Darts thrown for the layer
+};
+
+/// <summary>
+/// Places instances on the terrain with a blue noise (Poisson-disk) distribution per layer: darts are thrown at random and
+/// kept where the layer's rules allow and nothing of the layer is closer than its spacing. Each tile is a job with its own
+/// random sequence, seeded from the seed, the layer and the tile, and the tiles run in four phases of a 2x2 checkerboard:
+/// tiles running at the same time are a tile apart, so they never see each other's instances, and every tile sees its
+/// earlier phase neighbours' complete. The result only depends on the seed and the terrain, however the jobs are scheduled.
+///
+/// Candidates are generated a tile at a time and their heights and normals looked up in batches (HeightField's SSE2
+/// path) before the darts are tested one by one against a grid of cells spacing / sqrt(2) across, which holds at most one
+/// instance each.
+/// </summary>
+class TerrainScatter
+{
+public:
+	TerrainScatter();
+
+	/// <summary>
+	/// Schedule the scatter on field once fieldReady is done (TerrainQuery::Building() and the handle Build() returned). The
+	/// result replaces the previous one on the GL thread. Same rules as SplatMap::Generate(): call from the GL thread, not
+	/// from a job once a scatter has been scheduled.
+	/// </summary>
+	JobHandle Generate(JobSystem& jobSystem, std::shared_ptr<const HeightField> field, const JobHandle& fieldReady, const std::vector<ScatterLayer>& layers, uint32_t seed);
+
+	const std::vector<ScatterInstances>& Instances() const { return _instances; } // Per layer, GL thread only
+	const std::vector<ScatterLayer>& Layers() const { return _layers; }
+	unsigned int Generation() const { return _generation; } // Goes up every time Instances() is replaced, GL thread only
+
+private:
+	struct LayerState
+	{
+		float cellSize;
+		int cellsAcross;
+		std::vector<glm::vec2> cells; // The instance in each cell, x = +infinity when empty
+		std::vector<std::vector<ScatterInstance>> tiles;
+		std::vector<size_t> tileCandidates;
+	};
+
+	void ScatterTile(int layer, int tx, int tz);
+	void Merge();
+
+	std::shared_ptr<const HeightField> _field;
+	std::vector<ScatterLayer> _layers;
+	uint32_t _seed;
+	std::vector<LayerState> _states;
+	std::vector<ScatterInstances> _building, _instances;
+	unsigned int _generation;
+	JobHandle _pending;
+
+	// --- Stats
+	std::chrono::steady_clock::time_point _startTime;
+	double _buildMilliseconds;
+};
@@ -0,0 +1,258 @@
+#include "terrainTessellation.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "frustum.h"
+#include "glad/glad.h"
+#include "memoryTracker.h"
+
+static const int ANALYSIS_BAND_PATCH_ROWS = 2; // Patch rows per job
+
+TerrainTessellation::TerrainTessellation()
+	: _patchesAcross(0), _textureSize(0), _heightScale(0.0f), _terrainSize(0.0f), _drawFirsts(nullptr), _drawCounts(nullptr), _drawRuns(0),
+	_levelBuffer(0), _emptyVAO(0), _frames(0), _patchesDrawn(0), _triangles(0)
+{
+}
+
+JobHandle TerrainTessellation::Analyze(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float heightScale, float terrainSize)
+{
+	if (_pending)
+		jobSystem.Wait(_pending);
+	if (textureSize % TESSELLATION_PATCH_TEXELS != 0)
+	{
+		std::cerr << "ERROR: Terrain tessellation needs a height map size divisible by " << TESSELLATION_PATCH_TEXELS << std::endl;
+		return _pending = JobHandle();
+	}
+
+	MemoryScope memoryScope(MemorySubsystem::Terrain);
+	_textureSize = textureSize;
+	_heightScale = heightScale;
+	_terrainSize = terrainSize;
+	_heightMap = heightMap;
+	const int patchesAcross = textureSize / TESSELLATION_PATCH_TEXELS;
+	_analyzing.resize(static_cast<size_t>(patchesAcross) * patchesAcross);
+
+	std::vector<JobHandle> bands = jobSystem.ScheduleRows(patchesAcross, ANALYSIS_BAND_PATCH_ROWS, {}, [this](int firstRow, int lastRow) { AnalyzeRows(firstRow, lastRow); });
+	_pending = jobSystem.ScheduleOnMainThread([this, patchesAcross]
+	{
+		_patches.swap(_analyzing);
+		_patchesAcross = patchesAcross;
+	}, bands);
+	return _pending;
+}
+
+/// <summary>
+/// Errors and height ranges for a band of patch rows. The surface is the height map filtered bilinearly between texel
+/// centers, as procTerrainTess.TESE samples it; the mesh at level L samples it on an (L + 1)^2 grid and interpolates in
+/// between. Comparing the two at every texel center of the patch gives the level's error.
+/// </summary>
+void TerrainTessellation::AnalyzeRows(int firstRow, int lastRow)
+{
+	const int size = _textureSize, patchesAcross = size / TESSELLATION_PATCH_TEXELS;
+	auto Texel = [&](int x, int y)
+	{
+		x = std::min(std::max(x, 0), size - 1);
+		y = std::min(std::max(y, 0), size - 1);
+		return static_cast<float>((*_heightMap)[static_cast<size_t>(y) * size + x]);
+	};
+	auto Surface = [&](float u, float v) // Bilinear, clamped to the outer texels' centers
+	{
+		float x = std::min(std::max(u * size - 0.5f, 0.0f), size - 1.0f);
+		float y = std::min(std::max(v * size - 0.5f, 0.0f), size - 1.0f);
+		int x0 = static_cast<int>(x), y0 = static_cast<int>(y);
+		float fx = x - x0, fy = y - y0;
+		float bottom = Texel(x0, y0) + (Texel(x0 + 1, y0) - Texel(x0, y0)) * fx;
+		float top = Texel(x0, y0 + 1) + (Texel(x0 + 1, y0 + 1) - Texel(x0, y0 + 1)) * fx;
+		return bottom + (top - bottom) * fy;
+	};
+	const float toWorld = _heightScale * _terrainSize / 255.0f;
+	std::vector<float> grid((TESSELLATION_PATCH_TEXELS + 1) * (TESSELLATION_PATCH_TEXELS + 1));
+
+	for (int py = firstRow; py < lastRow; ++py)
+	{
+		for (int px = 0; px < patchesAcross; ++px)
+		{
+			Patch& patch = _analyzing[static_cast<size_t>(py) * patchesAcross + px];
+			const int x0 = px * TESSELLATION_PATCH_TEXELS, y0 = py * TESSELLATION_PATCH_TEXELS;
+
+			// The mesh's bilinear samples reach half a texel past the patch, so its range does too
+			float minDepth = 255.0f, maxDepth = 0.0f;
+			for (int y = y0 - 1; y <= y0 + TESSELLATION_PATCH_TEXELS; ++y)
+				for (int x = x0 - 1; x <= x0 + TESSELLATION_PATCH_TEXELS; ++x)
+				{
+					minDepth = std::min(minDepth, Texel(x, y));
+					maxDepth = std::max(maxDepth, Texel(x, y));
+				}
+			patch.minDepth = minDepth / 255.0f;
+			patch.maxDepth = maxDepth / 255.0f;
+
+			for (int level = 0; level < LEVEL_COUNT; ++level)
+			{
+				const int cells = 1 << level;
+				for (int j = 0; j <= cells; ++j)
+					for (int i = 0; i <= cells; ++i)
+						grid[j * (cells + 1) + i] = Surface((px + static_cast<float>(i) / cells) / patchesAcross, (py + static_cast<float>(j) / cells) / patchesAcross);
+
+				float error = 0.0f;
+				for (int y = y0; y < y0 + TESSELLATION_PATCH_TEXELS; ++y)
+				{
+					for (int x = x0; x < x0 + TESSELLATION_PATCH_TEXELS; ++x)
+					{
+						// Where this texel's center falls on the level's grid
+						float s = ((x + 0.5f) / TESSELLATION_PATCH_TEXELS - px) * cells;
+						float t = ((y + 0.5f) / TESSELLATION_PATCH_TEXELS - py) * cells;
+						int i = std::min(static_cast<int>(s), cells - 1), j = std::min(static_cast<int>(t), cells - 1);
+						float fs = s - i, ft = t - j;
+						const float* cell = &grid[j * (cells + 1) + i];
+						float bottom = cell[0] + (cell[1] - cell[0]) * fs;
+						float top = cell[cells + 1] + (cell[cells + 2] - cell[cells + 1]) * fs;
+						error = std::max(error, std::abs(Texel(x, y) - (bottom + (top - bottom) * ft)));
+					}
+				}
+				patch.error[level] = error * toWorld;
+			}
+		}
+	}
+}
+
+void TerrainTessellation::Update(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model, const glm::vec3& cameraPos, int viewportHeight,
+	float maxPixelError, LinearArena& frameArena)
+{
+	if (!IsReady()) return;
+	const int patchesAcross = _patchesAcross;
+	const size_t patchCount = _patches.size();
+	ArenaVector<float> levels(patchCount, 0.0f, ArenaAllocator<float>(frameArena)); // Per patch
+	ArenaVector<PatchLevels> patchLevels(patchCount, PatchLevels(), ArenaAllocator<PatchLevels>(frameArena));
+	ArenaVector<int> drawFirsts{ ArenaAllocator<int>(frameArena) }, drawCounts{ ArenaAllocator<int>(frameArena) };
+	drawFirsts.reserve(patchCount); // At most a run per patch, reserved so the arena doesn't keep every size they grow through
+	drawCounts.reserve(patchCount);
+
+	// The quad in world space: the patch at (u, v) starts at origin + u * uAxis + v * vAxis, depth pushes it along down
+	const glm::vec3 origin = glm::vec3(model * glm::vec4(-1.0f, -1.0f, 0.0f, 1.0f));
+	const glm::vec3 uAxis = glm::vec3(model * glm::vec4(2.0f, 0.0f, 0.0f, 0.0f)) / static_cast<float>(patchesAcross);
+	const glm::vec3 vAxis = glm::vec3(model * glm::vec4(0.0f, 2.0f, 0.0f, 0.0f)) / static_cast<float>(patchesAcross);
+	const glm::vec3 down = -glm::normalize(glm::transpose(glm::inverse(glm::mat3(model))) * glm::vec3(0.0f, 0.0f, 1.0f)) * _heightScale * _terrainSize;
+
+	const Frustum frustum = Frustum::FromViewProjection(projection * view);
+	const float pixelsPerUnit = viewportHeight * 0.5f * projection[1][1]; // At a distance of one unit
+
+	unsigned int patchesDrawn = 0;
+	for (int py = 0; py < patchesAcross; ++py)
+	{
+		for (int px = 0; px < patchesAcross; ++px)
+		{
+			const size_t index = static_cast<size_t>(py) * patchesAcross + px;
+			const Patch& patch = _patches[index];
+			glm::vec3 corner = origin + uAxis * static_cast<float>(px) + vAxis * static_cast<float>(py);
+			glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+			for (int i = 0; i < 8; ++i)
+			{
+				glm::vec3 point = corner + uAxis * static_cast<float>(i & 1) + vAxis * static_cast<float>((i >> 1) & 1) + down * (i & 4 ? patch.maxDepth : patch.minDepth);
+				boundsMin = glm::min(boundsMin, point);
+				boundsMax = glm::max(boundsMax, point);
+			}
+
+			const bool bVisible = frustum.IntersectsBox(boundsMin, boundsMax);
+
+			// Lowest level whose error, seen from the closest point of the patch's bounds, stays within maxPixelError
+			float distance = glm::length(glm::max(glm::max(boundsMin - cameraPos, cameraPos - boundsMax), glm::vec3(0.0f)));
+			float scale = pixelsPerUnit / std::max(distance, 1e-3f);
+			float level = static_cast<float>(1 << (LEVEL_COUNT - 1));
+			for (int i = 0; i < LEVEL_COUNT; ++i)
+			{
+				if (patch.error[i] * scale > maxPixelError) continue;
+				if (i == 0)
+					level = 1.0f;
+				else
+				{
+					// Between the two powers of two, by how much of the coarser level's excess error is left
+					float coarse = patch.error[i - 1] * scale, fine = patch.error[i] * scale;
+					float t = std::min(std::max((coarse - maxPixelError) / std::max(coarse - fine, 1e-6f), 0.0f), 1.0f);
+					level = static_cast<float>(1 << (i - 1)) * (1.0f + t);
+				}
+				break;
+			}
+			levels[index] = level;
+			if (bVisible)
+			{
+				// Runs of visible patches along a row become one draw each
+				if (!drawCounts.empty() && drawFirsts.back() + drawCounts.back() == static_cast<int>(index) && px > 0)
+					++drawCounts.back();
+				else
+				{
+					drawFirsts.push_back(static_cast<int>(index));
+					drawCounts.push_back(1);
+				}
+				++patchesDrawn;
+			}
+		}
+	}
+
+	// Shared edges take the finer of the two patches' levels, so both sides agree
+	unsigned long long triangles = 0;
+	for (int py = 0; py < patchesAcross; ++py)
+	{
+		for (int px = 0; px < patchesAcross; ++px)
+		{
+			const size_t index = static_cast<size_t>(py) * patchesAcross + px;
+			PatchLevels& patchLevel = patchLevels[index];
+			const float own = levels[index];
+			patchLevel.outer[0] = px > 0 ? std::max(own, levels[index - 1]) : own;
+			patchLevel.outer[1] = py > 0 ? std::max(own, levels[index - patchesAcross]) : own;
+			patchLevel.outer[2] = px < patchesAcross - 1 ? std::max(own, levels[index + 1]) : own;
+			patchLevel.outer[3] = py < patchesAcross - 1 ? std::max(own, levels[index + patchesAcross]) : own;
+			patchLevel.inner[0] = patchLevel.inner[1] = own;
+		}
+	}
+	for (size_t run = 0; run < drawFirsts.size(); ++run)
+	{
+		for (int index = drawFirsts[run]; index < drawFirsts[run] + drawCounts[run]; ++index)
+		{
+			const float cells = std::max(2.0f, std::ceil(levels[index] / 2.0f) * 2.0f); // Fractional even spacing rounds up to even
+			triangles += static_cast<unsigned long long>(2.0f * cells * cells);
+		}
+	}
+
+	if (!_levelBuffer)
+	{
+		glGenVertexArrays(1, &_emptyVAO);
+		glGenBuffers(1, &_levelBuffer);
+		TrackGpuResource(GpuResourceType::Buffer, _levelBuffer, patchCount * sizeof(PatchLevels), "terrain tessellation levels");
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _levelBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, patchCount * sizeof(PatchLevels), patchLevels.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	_drawFirsts = drawFirsts.data();
+	_drawCounts = drawCounts.data();
+	_drawRuns = static_cast<int>(drawFirsts.size());
+
+	++_frames;
+	_patchesDrawn += patchesDrawn;
+	_triangles += triangles;
+}
+
+void TerrainTessellation::Draw() const
+{
+	if (!_levelBuffer || _drawRuns == 0) return;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _levelBuffer);
+	glPatchParameteri(GL_PATCH_VERTICES, 1);
+	glBindVertexArray(_emptyVAO);
+	glMultiDrawArrays(GL_PATCHES, _drawFirsts, _drawCounts, _drawRuns);
+	glBindVertexArray(0);
+}
+
+void TerrainTessellation::PrintStats() const
+{
+	if (_frames == 0) return;
+	std::cout << "Terrain tessellation: " << _patches.size() << " patches, " << _patchesDrawn / _frames << " drawn and ~"
+		<< _triangles / _frames << " triangles per frame on average" << std::endl;
+}
+
+void TerrainTessellation::Shutdown()
+{
+	if (!_levelBuffer) return;
+	UntrackGpuResource(GpuResourceType::Buffer, _levelBuffer);
+	glDeleteBuffers(1, &_levelBuffer);
+	glDeleteVertexArrays(1, &_emptyVAO);
+	_levelBuffer = _emptyVAO = 0;
+}
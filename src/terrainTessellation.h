@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "frameArena.h"
+#include "jobSystem.h"
+#include "texture.h"
+
+const int TESSELLATION_PATCH_TEXELS = 16; // Height map texels across a patch, also its highest tessellation level
+
+/// <summary>
+/// Tessellated terrain, the alternative to parallax occlusion mapping: the quad is split into patches that the tessellator
+/// subdivides and procTerrainTess.TESE displaces by the height map, so triangles go where the silhouette and the closest
+/// ground need them instead of every pixel marching through the height map.
+///
+/// Levels are picked on the CPU. Analyze() precomputes per patch how far the surface strays from the tessellated mesh at
+/// each power of two level (the patch's roughness: 0 for flat ground, large for cliffs) and its height range. Update() then
+/// projects those errors to pixels for the current view and picks, per patch, the lowest level whose error stays under the
+/// pixel budget, blending between powers of two so levels change smoothly. Each edge takes the higher level of the two
+/// patches sharing it, so both sides split it the same way and the mesh has no cracks. Patches outside the view frustum
+/// (their height range included) aren't drawn: the visible ones go out as one draw per run along a patch row, and each
+/// patch finds its levels in the buffer by its vertex's index.
+/// </summary>
+class TerrainTessellation
+{
+public:
+	TerrainTessellation();
+	~TerrainTessellation() { Shutdown(); }
+
+	/// <summary>
+	/// Schedule the patch analysis of the read back height map on the workers. The new results replace the old ones on the GL
+	/// thread once all of them are ready, so Update() never waits and never mixes two height maps.
+	/// </summary>
+	JobHandle Analyze(JobSystem& jobSystem, const SharedHeightMap& heightMap, int textureSize, float heightScale, float terrainSize);
+
+	/// <summary>
+	/// Pick this frame's levels and upload them. model is the terrain quad's, maxPixelError the allowed screen space error.
+	/// The levels and the draw runs are built in frameArena, so Draw() must come before the arena is reset.
+	/// </summary>
+	void Update(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model, const glm::vec3& cameraPos, int viewportHeight,
+		float maxPixelError, LinearArena& frameArena);
+	void Draw() const; // The patches as GL_PATCHES, for procTerrainTess.*
+
+	bool IsReady() const { return !_patches.empty(); }
+	int PatchesAcross() const { return _patchesAcross; }
+	void PrintStats() const;
+	void Shutdown(); // Releases the level buffer (needs the GL context)
+
+private:
+	static const int LEVEL_COUNT = 5; // 1, 2, 4, 8, 16: up to TESSELLATION_PATCH_TEXELS
+
+	struct Patch
+	{
+		float error[LEVEL_COUNT]; // Largest height difference between the surface and the mesh at level 2^i, in world units
+		float minDepth, maxDepth; // Height map range under the patch, 0 at the top
+	};
+
+	struct PatchLevels // Matches procTerrainTess.TESC
+	{
+		float outer[4]; // Edges at u = 0, v = 0, u = 1, v = 1
+		float inner[2];
+		float padding[2];
+	};
+
+	void AnalyzeRows(int firstRow, int lastRow);
+
+	int _patchesAcross;
+	int _textureSize;
+	float _heightScale, _terrainSize;
+	SharedHeightMap _heightMap;
+	std::vector<Patch> _analyzing; // Filled by the workers
+	std::vector<Patch> _patches;   // In use
+	JobHandle _pending;
+
+	const int* _drawFirsts; // Runs of visible patches this frame, in the frame arena Update() was given
+	const int* _drawCounts;
+	int _drawRuns;
+	unsigned int _levelBuffer;
+	unsigned int _emptyVAO;
+
+	// --- Stats
+	unsigned long long _frames, _patchesDrawn, _triangles;
+};
@@ -1,8 +1,43 @@
 #include "texture.h"
 #include "glad/glad.h"
+#include "memoryTracker.h"
 #define STB_IMAGE_IMPLEMENTATION
+#define STBI_MALLOC(size) TrackedMalloc(size) // Route decoded pixels through the memory tracker
+#define STBI_REALLOC(pointer, size) TrackedRealloc(pointer, size)
+#define STBI_FREE(pointer) TrackedFree(pointer)
 #include "stb_image.h"
 
+/// <summary>
+/// Decode an image file with stb. Safe to call from any thread: the vertical flip is set per thread and no GL calls are made.
+/// </summary>
+/// <param name="desiredChannels"> Force the number of channels, 0 keeps the file's own channel count. </param>
+Image DecodeImage(const char* path, bool flipVertically, int desiredChannels)
+{
+	MemoryScope memoryScope(MemorySubsystem::Textures);
+	Image image;
+	stbi_set_flip_vertically_on_load_thread(flipVertically);
+	image.data = stbi_load(path, &image.width, &image.height, &image.nrChannels, desiredChannels);
+	if (!image.data)
+		std::cerr << "ERROR: Failed to load image texture at path: " << path << std::endl;
+	else if (desiredChannels != 0)
+		image.nrChannels = desiredChannels;
+	return image;
+}
+
+/// <summary>
+/// Read an image's size and channel count from its header, without decoding it. Thread-safe.
+/// </summary>
+bool ReadImageInfo(const char* path, int& width, int& height, int& nrChannels)
+{
+	return stbi_info(path, &width, &height, &nrChannels) != 0;
+}
+
+void FreeImage(Image& image)
+{
+	stbi_image_free(image.data);
+	image.data = nullptr;
+}
+
 /// <summary>
 /// Constructor for loading in an already existing texture file.
 /// </summary>
@@ -10,24 +45,31 @@
 Texture::Texture(const char *textureName, bool clamp)
 {
 	// flip textures horizontally since OpenGL 0.0 y-axis coordinate is opposite of images.
-	stbi_set_flip_vertically_on_load(true);
+	Image image = DecodeImage(textureName, true);
+	*this = Texture(image, clamp);
+	FreeImage(image);
+}
 
+/// <summary>
+/// Constructor for uploading an already decoded image.
+/// </summary>
+Texture::Texture(const Image& image, bool clamp)
+{
 	glGenTextures(1, &_textureID);
 
-	// import texture using stb
-	int width, height, nrChannels;
-	unsigned char* data = stbi_load(textureName, &width, &height, &nrChannels, 0);
-	if (data)
+	if (image.data)
 	{
 		GLenum format = GL_RED;
-		if (nrChannels == 3)
+		if (image.nrChannels == 3)
 			format = GL_RGB;
-		else if (nrChannels == 4)
+		else if (image.nrChannels == 4)
 			format = GL_RGBA;
 
 		glBindTexture(GL_TEXTURE_2D, _textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		TrackGpuResource(GpuResourceType::Texture, _textureID, TextureByteSize(image.width, image.height, format, MipLevelCount(image.width, image.height)),
+			"image " + std::to_string(image.width) + "x" + std::to_string(image.height));
 
 		// set the texture wrapping/filtering options (on currently bound texture)
 		if (clamp)
@@ -43,16 +85,8 @@ Texture::Texture(const char *textureName, bool clamp)
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-		// Free the texture source image memory
-		stbi_image_free(data);
-
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
-	else
-	{
-		std::cerr << "ERROR: Failed to load image texture" << std::endl;
-		stbi_image_free(data);
-	}
 }
 
 /// <summary>
@@ -66,6 +100,7 @@ Texture::Texture(std::vector<unsigned char> heightMap, int textureSize)
 
 	// Upload height data as a single-channel grayscale texture
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, textureSize, textureSize, 0, GL_RED, GL_UNSIGNED_BYTE, heightMap.data());
+	TrackGpuResource(GpuResourceType::Texture, _textureID, TextureByteSize(textureSize, textureSize, GL_R8), "heightmap");
 
 	// Set filtering & wrapping
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -87,6 +122,7 @@ Texture::Texture(std::vector<glm::vec3> normalMap, int textureSize)
 
 	// Upload height data as a triple-channel rgb texture
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, textureSize, textureSize, 0, GL_RGB, GL_FLOAT, normalMap.data());
+	TrackGpuResource(GpuResourceType::Texture, _textureID, TextureByteSize(textureSize, textureSize, GL_RGB32F), "normal map");
 
 	// Set filtering & wrapping
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -102,27 +138,35 @@ Texture::Texture(std::vector<glm::vec3> normalMap, int textureSize)
 /// </summary>
 /// <param name="faces"> Order of faces must be: Right, Left, Top, Bottom, Front, Back. </param>
 Texture::Texture(std::vector<std::string> faces)
+{
+	std::vector<Image> images;
+	for (unsigned int i = 0; i < faces.size(); i++)
+		images.push_back(DecodeImage(faces[i].c_str(), false, 4));
+
+	*this = Texture(images);
+	for (Image& image : images)
+		FreeImage(image);
+}
+
+/// <summary>
+/// Constructor for a cubemap texture from already decoded RGBA faces.
+/// </summary>
+/// <param name="faces"> Order of faces must be: Right, Left, Top, Bottom, Front, Back. </param>
+Texture::Texture(const std::vector<Image>& faces)
 {
 	glGenTextures(1, &_textureID);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, _textureID);
 
-	stbi_set_flip_vertically_on_load(false);
-
-	int width, height, nrChannels;
+	size_t bytes = 0;
 	for (unsigned int i = 0; i < faces.size(); i++)
 	{
-		unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 4);
-		if (data)
+		if (faces[i].data)
 		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, faces[i].width, faces[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, faces[i].data);
+			bytes += TextureByteSize(faces[i].width, faces[i].height, GL_RGBA);
 		}
 	}
+	TrackGpuResource(GpuResourceType::Texture, _textureID, bytes, "cubemap");
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -130,4 +174,109 @@ Texture::Texture(std::vector<std::string> faces)
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
 	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-}
\ No newline at end of file
+}
+
+/// <summary>
+/// Upload decoded images as the layers of a texture array, e.g. the terrain's material layers.
+/// </summary>
+Texture CreateTextureArray(const std::vector<Image>& layers, bool clamp)
+{
+	Texture texture;
+	if (layers.empty()) return texture;
+	for (const Image& layer : layers)
+	{
+		if (!layer.data || layer.nrChannels != 3 || layer.width != layers[0].width || layer.height != layers[0].height)
+		{
+			std::cerr << "ERROR: Texture array layers must be RGB images of the same size" << std::endl;
+			return texture;
+		}
+	}
+
+	const int width = layers[0].width, height = layers[0].height, mipLevels = MipLevelCount(width, height);
+	glGenTextures(1, &texture._textureID);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture._textureID);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, mipLevels, GL_RGB8, width, height, static_cast<GLsizei>(layers.size()));
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < layers.size(); ++i)
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>(i), width, height, 1, GL_RGB, GL_UNSIGNED_BYTE, layers[i].data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	TrackGpuResource(GpuResourceType::Texture, texture._textureID, TextureByteSize(width, height, GL_RGB8, mipLevels, static_cast<int>(layers.size())),
+		"image array " + std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(layers.size()));
+
+	GLint wrap = clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return texture;
+}
+
+/// <summary>
+/// Constructor for an empty, immutable-storage texture. Used for the generated terrain maps, which are filled either by a compute shader or by Upload().
+/// </summary>
+/// <param name="internalFormat"> Sized internal format, e.g. GL_R8 for a heightmap or GL_RGBA32F for a normal map (image load/store has no RGB32F). </param>
+Texture::Texture(int textureSize, unsigned int internalFormat)
+{
+	glGenTextures(1, &_textureID);
+	glBindTexture(GL_TEXTURE_2D, _textureID);
+
+	glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, textureSize, textureSize);
+	TrackGpuResource(GpuResourceType::Texture, _textureID, TextureByteSize(textureSize, textureSize, internalFormat), "terrain storage " + std::to_string(textureSize) + "x" + std::to_string(textureSize));
+
+	// Set filtering & wrapping
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/// <summary>
+/// Overwrite the contents of an already allocated heightmap texture with a CPU generated heightmap.
+/// </summary>
+void Texture::Upload(const std::vector<unsigned char>& heightMap, int textureSize)
+{
+	glBindTexture(GL_TEXTURE_2D, _textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, textureSize, textureSize, GL_RED, GL_UNSIGNED_BYTE, heightMap.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/// <summary>
+/// Overwrite the contents of an already allocated normal map texture with a CPU generated normal map.
+/// </summary>
+void Texture::Upload(const std::vector<glm::vec3>& normalMap, int textureSize)
+{
+	glBindTexture(GL_TEXTURE_2D, _textureID);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, textureSize, textureSize, GL_RGB, GL_FLOAT, normalMap.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/// <summary>
+/// Read a heightmap texture back into CPU memory (synchronous, meant for the small terrain maps).
+/// </summary>
+SharedHeightMap Texture::Download(int textureSize) const
+{
+	std::shared_ptr<std::vector<unsigned char>> heightMap = std::make_shared<std::vector<unsigned char>>(static_cast<size_t>(textureSize) * textureSize);
+	glBindTexture(GL_TEXTURE_2D, _textureID);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_BYTE, heightMap->data());
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return heightMap;
+}
+
+/// <summary>
+/// Delete the GL texture and stop accounting for it. The object is left empty and can be assigned again.
+/// </summary>
+void Texture::Release()
+{
+	if (_textureID == 0) return;
+	UntrackGpuResource(GpuResourceType::Texture, _textureID);
+	glDeleteTextures(1, &_textureID);
+	_textureID = 0;
+}
@@ -1,19 +1,53 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <string>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+/// <summary>
+/// Decoded image pixels. Decoding is kept separate from the GL upload so it can run on a worker thread.
+/// </summary>
+struct Image
+{
+	int width = 0;
+	int height = 0;
+	int nrChannels = 0;
+	unsigned char* data = nullptr; // Owned, release with FreeImage()
+};
+
+Image DecodeImage(const char* path, bool flipVertically, int desiredChannels = 0); // Thread-safe, needs no GL context
+bool ReadImageInfo(const char* path, int& width, int& height, int& nrChannels); // From the file's header, without decoding
+void FreeImage(Image& image);
+
+// A height map as read back (0 at the highest point), shared by every job deriving something from it
+typedef std::shared_ptr<const std::vector<unsigned char>> SharedHeightMap;
+
 class Texture
 {
 public:
 	unsigned int _textureID;
 
+	Texture() : _textureID(0) {}
 	Texture(const char* textureName, bool clamp = false);
+	Texture(const Image& image, bool clamp = false);
 	Texture(std::vector<unsigned char> heightMap, int textureSize);
 	Texture(std::vector<glm::vec3> normalMap, int textureSize);
 	Texture(std::vector<std::string> faces);
-};
\ No newline at end of file
+	Texture(const std::vector<Image>& faces);
+	Texture(int textureSize, unsigned int internalFormat);
+
+	void Upload(const std::vector<unsigned char>& heightMap, int textureSize);
+	void Upload(const std::vector<glm::vec3>& normalMap, int textureSize);
+	SharedHeightMap Download(int textureSize) const; // Read a heightmap back, e.g. one the compute shaders wrote
+	void Release(); // Delete the GL texture, e.g. when swapping in another resolution
+};
+
+/// <summary>
+/// Upload same sized RGB images as the layers of a mip-mapped GL_TEXTURE_2D_ARRAY. Returns an empty texture (id 0) if any
+/// image failed to decode or the sizes differ.
+/// </summary>
+Texture CreateTextureArray(const std::vector<Image>& layers, bool clamp = false);
\ No newline at end of file
@@ -0,0 +1,288 @@
+#include "textureManager.h"
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include "glad/glad.h"
+#include "memoryTracker.h"
+
+static const int TIER_SIZES_K[] = { 1, 2, 4, 8, 16 }; // The _<N>k suffixes looked for
+
+// ------------------------------------ Tiers ---------------------------------------------------------------------
+static bool ReadTier(const std::string& path, TextureTier& tier)
+{
+	int nrChannels;
+	if (!ReadImageInfo(path.c_str(), tier.width, tier.height, nrChannels))
+		return false;
+	tier.path = path;
+	GLenum format = nrChannels == 4 ? GL_RGBA : (nrChannels == 3 ? GL_RGB : GL_RED);
+	tier.bytes = TextureByteSize(tier.width, tier.height, format, MipLevelCount(tier.width, tier.height));
+	return true;
+}
+
+/// <summary>
+/// Find the "_<N>k" in the file name (not in a directory name) and report where its digits start and end.
+/// </summary>
+static bool FindTierSuffix(const std::string& path, size_t& digitsBegin, size_t& digitsEnd)
+{
+	size_t nameBegin = path.find_last_of("/\\");
+	nameBegin = nameBegin == std::string::npos ? 0 : nameBegin + 1;
+	for (size_t k = path.size(); k-- > nameBegin + 1;)
+	{
+		if (path[k] != 'k') continue;
+		size_t begin = k;
+		while (begin > nameBegin && std::isdigit(static_cast<unsigned char>(path[begin - 1])))
+			--begin;
+		if (begin == k || begin == nameBegin || path[begin - 1] != '_') continue;
+		if (k + 1 < path.size() && path[k + 1] != '.' && path[k + 1] != '_') continue;
+		digitsBegin = begin;
+		digitsEnd = k;
+		return true;
+	}
+	return false;
+}
+
+std::vector<TextureTier> FindTextureTiers(const std::string& path)
+{
+	std::vector<TextureTier> tiers;
+	TextureTier tier;
+	size_t digitsBegin, digitsEnd;
+	if (!FindTierSuffix(path, digitsBegin, digitsEnd))
+	{
+		if (ReadTier(path, tier))
+			tiers.push_back(tier);
+		return tiers;
+	}
+
+	for (int sizeK : TIER_SIZES_K)
+		if (ReadTier(path.substr(0, digitsBegin) + std::to_string(sizeK) + path.substr(digitsEnd), tier))
+			tiers.push_back(tier);
+	std::stable_sort(tiers.begin(), tiers.end(), [](const TextureTier& a, const TextureTier& b) { return a.bytes < b.bytes; });
+	return tiers;
+}
+// ----------------------------------------------------------------------------------------------------------------
+
+// ------------------------------------ Texture Manager -----------------------------------------------------------
+TextureManager::TextureManager(JobSystem& jobSystem, size_t textureBudgetBytes, size_t memoryBudgetBytes)
+	: _jobSystem(jobSystem), _textureBudgetBytes(textureBudgetBytes), _memoryBudgetBytes(memoryBudgetBytes), _bUpgrading(false),
+	  _upgrades(0), _downgrades(0)
+{
+}
+
+void TextureManager::Load(Texture& texture, const std::string& path, bool clamp)
+{
+	Add(texture, { path }, clamp, false);
+}
+
+void TextureManager::LoadArray(Texture& texture, const std::vector<std::string>& layerPaths, bool clamp)
+{
+	Add(texture, layerPaths, clamp, true);
+}
+
+void TextureManager::Add(Texture& texture, const std::vector<std::string>& layerPaths, bool clamp, bool bArray)
+{
+	std::unique_ptr<Entry> entry(new Entry());
+	entry->texture = &texture;
+	entry->clamp = clamp;
+	entry->bArray = bArray;
+	entry->tier = 0;
+	entry->bBaseLoaded = false;
+
+	// Only the sizes every layer ships in are tiers
+	std::vector<std::vector<TextureTier>> layerTiers;
+	for (const std::string& path : layerPaths)
+		layerTiers.push_back(FindTextureTiers(path));
+	for (const TextureTier& candidate : layerTiers.empty() ? std::vector<TextureTier>() : layerTiers[0])
+	{
+		TextureTier tier = candidate;
+		std::vector<std::string> paths;
+		for (const std::vector<TextureTier>& tiers : layerTiers)
+		{
+			auto match = std::find_if(tiers.begin(), tiers.end(), [&](const TextureTier& t) { return t.width == tier.width && t.height == tier.height; });
+			if (match == tiers.end()) break;
+			paths.push_back(match->path);
+		}
+		if (paths.size() != layerPaths.size()) continue;
+		if (bArray) // Array layers are always uploaded as RGB8
+			tier.bytes = TextureByteSize(tier.width, tier.height, GL_RGB8, MipLevelCount(tier.width, tier.height), static_cast<int>(paths.size()));
+		entry->tiers.push_back(tier);
+		entry->paths.push_back(paths);
+	}
+	entry->maxTier = static_cast<int>(entry->tiers.size()) - 1;
+	if (entry->tiers.empty())
+	{
+		std::cerr << "ERROR: Failed to load image texture at path: " << (layerPaths.empty() ? std::string() : layerPaths[0]) << std::endl;
+		return;
+	}
+
+	// Same two steps as any other texture load: decode on the workers, upload on the GL thread
+	Entry* loading = entry.get();
+	loading->pending = _jobSystem.ScheduleOnMainThread([loading]
+	{
+		loading->base = Upload(*loading);
+		*loading->texture = loading->base;
+		loading->bBaseLoaded = loading->base._textureID != 0;
+	}, ScheduleDecode(*loading, 0));
+	_entries.push_back(std::move(entry));
+}
+
+/// <summary>
+/// One decode job per layer of the tier.
+/// </summary>
+std::vector<JobHandle> TextureManager::ScheduleDecode(Entry& entry, int tier)
+{
+	Entry* decoding = &entry;
+	entry.images.assign(entry.paths[tier].size(), Image());
+	std::vector<JobHandle> decodeJobs;
+	for (size_t layer = 0; layer < entry.paths[tier].size(); ++layer)
+		decodeJobs.push_back(_jobSystem.Schedule([decoding, tier, layer]
+		{
+			decoding->images[layer] = DecodeImage(decoding->paths[tier][layer].c_str(), true, decoding->bArray ? 3 : 0);
+		}));
+	return decodeJobs;
+}
+
+Texture TextureManager::Upload(Entry& entry)
+{
+	Texture texture;
+	bool bDecoded = std::all_of(entry.images.begin(), entry.images.end(), [](const Image& image) { return image.data != nullptr; });
+	if (bDecoded)
+		texture = entry.bArray ? CreateTextureArray(entry.images, entry.clamp) : Texture(entry.images[0], entry.clamp);
+	for (Image& image : entry.images)
+		FreeImage(image);
+	return texture;
+}
+
+size_t TextureManager::ResidentBytes() const
+{
+	size_t bytes = 0;
+	for (const auto& entry : _entries)
+	{
+		if (entry->bBaseLoaded)
+			bytes += entry->tiers[0].bytes;
+		if (entry->tier > 0)
+			bytes += entry->tiers[entry->tier].bytes;
+	}
+	return bytes;
+}
+
+void TextureManager::Update()
+{
+	if (Downgrade())
+		return; // Let the freed memory show up before deciding on anything else
+	if (!_bUpgrading)
+		StartUpgrade();
+}
+
+/// <summary>
+/// Over the memory budget: drop the largest upgraded texture back to its resident lowest tier, and cap it below the tier
+/// it dropped from so it doesn't come straight back.
+/// </summary>
+bool TextureManager::Downgrade()
+{
+	if (_memoryBudgetBytes == 0) return false;
+	MemoryStats stats = GetMemoryStats();
+	if (stats.cpuTotalLiveBytes + stats.gpuTotalLiveBytes <= _memoryBudgetBytes) return false;
+
+	Entry* largest = nullptr;
+	for (const auto& entry : _entries)
+		if (entry->tier > 0 && (!largest || entry->tiers[entry->tier].bytes > largest->tiers[largest->tier].bytes))
+			largest = entry.get();
+	if (!largest) return false;
+
+	std::cout << "Texture memory pressure: " << largest->tiers[largest->tier].path << " back to " << largest->tiers[0].width << "x"
+		<< largest->tiers[0].height << std::endl;
+	largest->maxTier = largest->tier - 1;
+	largest->tier = 0;
+	*largest->texture = largest->base;
+	largest->upgraded.Release();
+	++_downgrades;
+	return true;
+}
+
+/// <summary>
+/// Upgrade the texture with the least resident by one tier, if the tier fits both budgets.
+/// </summary>
+bool TextureManager::StartUpgrade()
+{
+	MemoryStats stats = GetMemoryStats();
+	size_t residentBytes = ResidentBytes();
+	Entry* next = nullptr;
+	for (const auto& entry : _entries)
+	{
+		if (!entry->bBaseLoaded || entry->tier >= entry->maxTier) continue;
+		const TextureTier& tier = entry->tiers[entry->tier + 1];
+		size_t currentBytes = entry->tier > 0 ? entry->tiers[entry->tier].bytes : 0;
+
+		// The old tier is only released once the new one is up, and the decoded pixels (up to 4 bytes a texel per layer) are held until then
+		if (_textureBudgetBytes && residentBytes - currentBytes + tier.bytes > _textureBudgetBytes) continue;
+		size_t decodedBytes = static_cast<size_t>(tier.width) * tier.height * 4 * entry->paths[entry->tier + 1].size();
+		if (_memoryBudgetBytes && stats.cpuTotalLiveBytes + stats.gpuTotalLiveBytes + tier.bytes + decodedBytes > _memoryBudgetBytes) continue;
+
+		if (!next || entry->tiers[entry->tier].bytes < next->tiers[next->tier].bytes)
+			next = entry.get();
+	}
+	if (!next) return false;
+
+	int tier = next->tier + 1;
+	_bUpgrading = true;
+	next->pending = _jobSystem.ScheduleOnMainThread([this, next, tier] { FinishUpgrade(*next, tier); }, ScheduleDecode(*next, tier));
+	return true;
+}
+
+void TextureManager::FinishUpgrade(Entry& entry, int tier)
+{
+	_bUpgrading = false;
+	if (tier > entry.maxTier) // Downgraded in the meantime
+	{
+		for (Image& image : entry.images)
+			FreeImage(image);
+		return;
+	}
+
+	Texture upgraded = Upload(entry);
+	if (upgraded._textureID == 0) // Failed to decode, stay at this tier
+	{
+		entry.maxTier = entry.tier;
+		return;
+	}
+	entry.upgraded.Release();
+	entry.upgraded = upgraded;
+	entry.tier = tier;
+	*entry.texture = upgraded;
+	++_upgrades;
+}
+
+void TextureManager::FinishUpgrades()
+{
+	for (const auto& entry : _entries)
+		if (entry->pending)
+			_jobSystem.Wait(entry->pending);
+	while (!Downgrade() && StartUpgrade())
+		for (const auto& entry : _entries)
+			if (entry->pending)
+				_jobSystem.Wait(entry->pending);
+}
+
+void TextureManager::Shutdown()
+{
+	for (const auto& entry : _entries)
+	{
+		if (entry->pending)
+			_jobSystem.Wait(entry->pending);
+		entry->upgraded.Release();
+		entry->base.Release();
+		entry->texture->_textureID = 0;
+	}
+	_entries.clear();
+}
+
+void TextureManager::PrintStats() const
+{
+	std::cout << "Textures: " << ResidentBytes() / (1024 * 1024) << " MB resident";
+	if (_textureBudgetBytes)
+		std::cout << " of a " << _textureBudgetBytes / (1024 * 1024) << " MB budget";
+	std::cout << ", " << _upgrades << " upgrades, " << _downgrades << " downgrades" << std::endl;
+	for (const auto& entry : _entries)
+		std::cout << "  " << entry->tiers[entry->tier].path << " (" << entry->tiers[entry->tier].width << "x" << entry->tiers[entry->tier].height << ")" << std::endl;
+}
+// ----------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "jobSystem.h"
+#include "texture.h"
+
+/// <summary>
+/// One resolution of a texture on disk, sized from the file's header.
+/// </summary>
+struct TextureTier
+{
+	std::string path;
+	int width, height;
+	size_t bytes; // On the GPU, with mipmaps
+};
+
+/// <summary>
+/// The resolutions a texture ships in: path names its _<N>k variant (any of them), the others are found next to it.
+/// Lowest first. A path without a _<N>k suffix is its own single tier; missing or unreadable files are left out.
+/// </summary>
+std::vector<TextureTier> FindTextureTiers(const std::string& path);
+
+/// <summary>
+/// Picks the resolution of each texture from a memory budget, so the same build starts fast and stays within budget on
+/// small and large machines alike:
+///  - The lowest tier is loaded with the rest of the startup graph and stays resident, so every texture can be sampled
+///    from the first frame and dropping back to it never has to wait.
+///  - Update() then upgrades textures one tier at a time in the background (decoded on a worker, uploaded and swapped in
+///    on the GL thread), the texture with the least resident first, as long as the next tier fits the texture budget
+///    and the overall memory budget leaves room for it and its decoded pixels.
+///  - When overall memory use goes over the memory budget, the largest upgraded texture falls back to its lowest tier at
+///    once, and is kept below the tier it dropped from.
+/// Textures are swapped by their GL name, so the Texture objects passed to Load() can be bound as usual. Texture arrays
+/// (LoadArray()) move between tiers as a whole, over the resolutions all their layers ship in.
+/// </summary>
+class TextureManager
+{
+public:
+	/// <summary>
+	/// textureBudgetBytes caps the GPU memory of the managed textures, memoryBudgetBytes the tracked CPU + GPU total
+	/// (see memoryTracker.h). Zero means no limit.
+	/// </summary>
+	TextureManager(JobSystem& jobSystem, size_t textureBudgetBytes, size_t memoryBudgetBytes);
+	~TextureManager() { Shutdown(); }
+
+	/// <summary>
+	/// Schedule the lowest tier's decode and upload. texture must outlive the manager.
+	/// </summary>
+	void Load(Texture& texture, const std::string& path, bool clamp = false);
+	void LoadArray(Texture& texture, const std::vector<std::string>& layerPaths, bool clamp = false); // GL_TEXTURE_2D_ARRAY, one layer per path
+
+	void Update();         // Once per frame on the GL thread, after its main thread jobs: downgrades under pressure, starts an upgrade
+	void FinishUpgrades(); // Upgrade as far as the budgets allow, blocking. For offline renders
+	void Shutdown();       // Finishes outstanding loads and releases the textures (needs the GL context)
+
+	size_t ResidentBytes() const;
+	void PrintStats() const;
+
+private:
+	struct Entry
+	{
+		Texture* texture;
+		bool clamp;
+		bool bArray;
+		std::vector<TextureTier> tiers;               // Bytes are for all layers, the path is the first layer's
+		std::vector<std::vector<std::string>> paths;  // Per tier, every layer's file
+		Texture base;         // The lowest tier, always resident once loaded
+		Texture upgraded;     // The current tier when above the lowest
+		int tier;             // Tier the texture currently shows
+		int maxTier;          // Upgrades stop here, lowered by downgrades
+		bool bBaseLoaded;
+		JobHandle pending;    // The upgrade in flight, if any
+		std::vector<Image> images; // Its decoded layers, between the decode and the upload
+	};
+
+	void Add(Texture& texture, const std::vector<std::string>& layerPaths, bool clamp, bool bArray);
+	std::vector<JobHandle> ScheduleDecode(Entry& entry, int tier);
+	static Texture Upload(Entry& entry); // Frees the decoded layers
+	bool StartUpgrade();
+	bool Downgrade();
+	void FinishUpgrade(Entry& entry, int tier);
+
+	JobSystem& _jobSystem;
+	size_t _textureBudgetBytes, _memoryBudgetBytes;
+	std::vector<std::unique_ptr<Entry>> _entries;
+	bool _bUpgrading;
+
+	// --- Stats
+	unsigned int _upgrades, _downgrades;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/// <summary>
+/// Lock-free single producer/ single consumer triple buffer. The writer fills WriteBuffer() and calls Publish(), the reader
+/// calls Update() and then reads ReadBuffer(). Neither side ever blocks: the writer always has a free slot and the reader always
+/// sees the most recently published complete value, skipping any it was too slow to pick up.
+/// </summary>
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : _middle(1), _writeIndex(0), _readIndex(2) {}
+
+	// --- Writer side
+	T& WriteBuffer() { return _slots[_writeIndex].value; }
+	void Publish()
+	{
+		// Hand the written slot over as the new middle and take the old middle to write into next
+		uint8_t previous = _middle.exchange(static_cast<uint8_t>(_writeIndex | DIRTY_BIT), std::memory_order_acq_rel);
+		_writeIndex = previous & INDEX_MASK;
+	}
+
+	// --- Reader side
+	bool Update() // Returns true if a newer value was published since the last call
+	{
+		if ((_middle.load(std::memory_order_relaxed) & DIRTY_BIT) == 0)
+			return false;
+		uint8_t previous = _middle.exchange(_readIndex, std::memory_order_acq_rel);
+		_readIndex = previous & INDEX_MASK;
+		return true;
+	}
+	const T& ReadBuffer() const { return _slots[_readIndex].value; }
+
+private:
+	static const uint8_t INDEX_MASK = 0x03;
+	static const uint8_t DIRTY_BIT = 0x04;
+
+	struct alignas(64) Slot { T value; }; // Keep the writer's and reader's slots on separate cache lines
+
+	Slot _slots[3];
+	std::atomic<uint8_t> _middle; // Index of the slot in between writer and reader, plus whether it holds unread data
+	uint8_t _writeIndex;          // Only touched by the writer
+	uint8_t _readIndex;           // Only touched by the reader
+};
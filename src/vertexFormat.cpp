@@ -0,0 +1,324 @@
+#include "vertexFormat.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERTEX_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+const int TERRAIN_VERTEX_STRIDE = sizeof(TerrainVertex) / sizeof(float);
+
+// Round to nearest even and fold by the sign bit, like the SSE2 path, so both give the same bits
+static inline int RoundToInt(float value)
+{
+	return static_cast<int>(std::nearbyint(value));
+}
+
+static inline float PositionScale(float extent)
+{
+	return extent > 0.0f ? 65535.0f / extent : 0.0f;
+}
+
+/// <summary>
+/// Project a unit vector onto the octahedron |x| + |y| + |z| = 1 and unfold its lower half over the upper one's diagonals,
+/// giving a point in the -1..1 square.
+/// </summary>
+static glm::vec2 OctahedralEncode(const glm::vec3& direction)
+{
+	glm::vec2 folded = glm::vec2(direction) / (std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z));
+	if (direction.z < 0.0f)
+		folded = glm::vec2((1.0f - std::abs(folded.y)) * (std::signbit(folded.x) ? -1.0f : 1.0f), (1.0f - std::abs(folded.x)) * (std::signbit(folded.y) ? -1.0f : 1.0f));
+	return folded;
+}
+
+static glm::vec3 OctahedralDecode(const glm::vec2& encoded)
+{
+	glm::vec3 direction(encoded, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+	if (direction.z < 0.0f)
+		direction = glm::vec3((1.0f - std::abs(encoded.y)) * (std::signbit(encoded.x) ? -1.0f : 1.0f), (1.0f - std::abs(encoded.x)) * (std::signbit(encoded.y) ? -1.0f : 1.0f), direction.z);
+	return glm::normalize(direction);
+}
+
+static void PackVertex(const TerrainVertex& vertex, const VertexBounds& bounds, PackedTerrainVertex& packed)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float quantized = (vertex.position[axis] - bounds.min[axis]) * PositionScale(bounds.extent[axis]);
+		packed.position[axis] = static_cast<uint16_t>(RoundToInt(std::min(std::max(quantized, 0.0f), 65535.0f)));
+	}
+	packed.position[3] = glm::dot(glm::cross(vertex.normal, vertex.tangent), vertex.bitangent) >= 0.0f ? 65535 : 0;
+	for (int axis = 0; axis < 2; ++axis)
+		packed.texCoords[axis] = static_cast<uint16_t>(RoundToInt(std::min(std::max(vertex.texCoords[axis], 0.0f), 1.0f) * 65535.0f));
+	glm::vec2 normal = OctahedralEncode(vertex.normal), tangent = OctahedralEncode(vertex.tangent);
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		packed.normal[axis] = static_cast<int8_t>(RoundToInt(normal[axis] * 127.0f));
+		packed.tangent[axis] = static_cast<int8_t>(RoundToInt(tangent[axis] * 127.0f));
+	}
+}
+
+static void UnpackVertex(const PackedTerrainVertex& packed, const VertexBounds& bounds, TerrainVertex& vertex)
+{
+	for (int axis = 0; axis < 3; ++axis)
+		vertex.position[axis] = bounds.min[axis] + packed.position[axis] * (bounds.extent[axis] / 65535.0f);
+	// Multiplied by the reciprocals like the SSE2 path, so both give the same bits
+	vertex.texCoords = glm::vec2(packed.texCoords[0], packed.texCoords[1]) * (1.0f / 65535.0f);
+	// Signed normalized decoding as GL does it: -128 and -127 are both -1
+	vertex.normal = OctahedralDecode(glm::max(glm::vec2(packed.normal[0], packed.normal[1]) * (1.0f / 127.0f), -1.0f));
+	vertex.tangent = OctahedralDecode(glm::max(glm::vec2(packed.tangent[0], packed.tangent[1]) * (1.0f / 127.0f), -1.0f));
+	vertex.bitangent = glm::cross(vertex.normal, vertex.tangent) * (packed.position[3] > 32767 ? 1.0f : -1.0f);
+}
+
+#ifdef VERTEX_USE_SSE2
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/// <summary>
+/// Four floats starting at `offset` in each of four vertices, transposed: a holds the first of them for all four vertices.
+/// </summary>
+static inline void LoadTransposed(const TerrainVertex* vertices, int offset, __m128& a, __m128& b, __m128& c, __m128& d)
+{
+	const float* base = reinterpret_cast<const float*>(vertices) + offset;
+	a = _mm_loadu_ps(base);
+	b = _mm_loadu_ps(base + TERRAIN_VERTEX_STRIDE);
+	c = _mm_loadu_ps(base + 2 * TERRAIN_VERTEX_STRIDE);
+	d = _mm_loadu_ps(base + 3 * TERRAIN_VERTEX_STRIDE);
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+}
+
+static inline void StoreTransposed(TerrainVertex* vertices, int offset, __m128 a, __m128 b, __m128 c, __m128 d)
+{
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+	float* base = reinterpret_cast<float*>(vertices) + offset;
+	_mm_storeu_ps(base, a);
+	_mm_storeu_ps(base + TERRAIN_VERTEX_STRIDE, b);
+	_mm_storeu_ps(base + 2 * TERRAIN_VERTEX_STRIDE, c);
+	_mm_storeu_ps(base + 3 * TERRAIN_VERTEX_STRIDE, d);
+}
+
+static inline void OctahedralEncode4(__m128 x, __m128 y, __m128 z, __m128& u, __m128& v)
+{
+	const __m128 signBit = _mm_set1_ps(-0.0f), one = _mm_set1_ps(1.0f);
+	__m128 length = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signBit, x), _mm_andnot_ps(signBit, y)), _mm_andnot_ps(signBit, z));
+	x = _mm_div_ps(x, length);
+	y = _mm_div_ps(y, length);
+	// 1 - |y| is never negative, so the sign can be or'ed in
+	__m128 foldedX = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, y)), _mm_and_ps(signBit, x));
+	__m128 foldedY = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, x)), _mm_and_ps(signBit, y));
+	__m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+	u = Select(lower, foldedX, x);
+	v = Select(lower, foldedY, y);
+}
+
+static inline void OctahedralDecode4(__m128 u, __m128 v, __m128& x, __m128& y, __m128& z)
+{
+	const __m128 signBit = _mm_set1_ps(-0.0f), one = _mm_set1_ps(1.0f);
+	z = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, u)), _mm_andnot_ps(signBit, v));
+	__m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+	x = Select(lower, _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, v)), _mm_and_ps(signBit, u)), u);
+	y = Select(lower, _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, u)), _mm_and_ps(signBit, v)), v);
+	__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z))));
+	x = _mm_mul_ps(x, inverseLength);
+	y = _mm_mul_ps(y, inverseLength);
+	z = _mm_mul_ps(z, inverseLength);
+}
+
+static inline __m128i Quantize(__m128 value, __m128 minimum, __m128 maximum)
+{
+	return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(value, minimum), maximum));
+}
+
+static void PackVertices4(const TerrainVertex* vertices, const VertexBounds& bounds, PackedTerrainVertex* packed)
+{
+	// Each load is four consecutive floats of every vertex: (px py pz nx) (ny nz u v) (tx ty tz bx) (tz bx by bz)
+	__m128 px, py, pz, nx, ny, nz, u, v, tx, ty, tz, bx, by, bz, unused0, unused1;
+	LoadTransposed(vertices, 0, px, py, pz, nx);
+	LoadTransposed(vertices, 4, ny, nz, u, v);
+	LoadTransposed(vertices, 8, tx, ty, tz, bx);
+	LoadTransposed(vertices, 10, unused0, unused1, by, bz);
+
+	const __m128 zero = _mm_setzero_ps(), unorm16 = _mm_set1_ps(65535.0f), one = _mm_set1_ps(1.0f), snorm8 = _mm_set1_ps(127.0f);
+	__m128i x = Quantize(_mm_mul_ps(_mm_sub_ps(px, _mm_set1_ps(bounds.min.x)), _mm_set1_ps(PositionScale(bounds.extent.x))), zero, unorm16);
+	__m128i y = Quantize(_mm_mul_ps(_mm_sub_ps(py, _mm_set1_ps(bounds.min.y)), _mm_set1_ps(PositionScale(bounds.extent.y))), zero, unorm16);
+	__m128i z = Quantize(_mm_mul_ps(_mm_sub_ps(pz, _mm_set1_ps(bounds.min.z)), _mm_set1_ps(PositionScale(bounds.extent.z))), zero, unorm16);
+
+	// Handedness: which side of the normal x tangent plane the bitangent is on
+	__m128 crossX = _mm_sub_ps(_mm_mul_ps(ny, tz), _mm_mul_ps(nz, ty));
+	__m128 crossY = _mm_sub_ps(_mm_mul_ps(nz, tx), _mm_mul_ps(nx, tz));
+	__m128 crossZ = _mm_sub_ps(_mm_mul_ps(nx, ty), _mm_mul_ps(ny, tx));
+	__m128 side = _mm_add_ps(_mm_add_ps(_mm_mul_ps(crossX, bx), _mm_mul_ps(crossY, by)), _mm_mul_ps(crossZ, bz));
+	__m128i handedness = _mm_and_si128(_mm_castps_si128(_mm_cmpge_ps(side, zero)), _mm_set1_epi32(0xFFFF));
+
+	__m128i texU = Quantize(_mm_mul_ps(_mm_min_ps(_mm_max_ps(u, zero), one), unorm16), zero, unorm16);
+	__m128i texV = Quantize(_mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), unorm16), zero, unorm16);
+
+	__m128 normalU, normalV, tangentU, tangentV;
+	OctahedralEncode4(nx, ny, nz, normalU, normalV);
+	OctahedralEncode4(tx, ty, tz, tangentU, tangentV);
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	__m128i directions = _mm_or_si128(
+		_mm_or_si128(_mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(normalU, snorm8)), byteMask), _mm_slli_epi32(_mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(normalV, snorm8)), byteMask), 8)),
+		_mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(tangentU, snorm8)), byteMask), 16), _mm_slli_epi32(_mm_cvtps_epi32(_mm_mul_ps(tangentV, snorm8)), 24)));
+
+	// Four 32 bit words per vertex, one register per word: transpose to one register per vertex
+	__m128 word0 = _mm_castsi128_ps(_mm_or_si128(x, _mm_slli_epi32(y, 16)));
+	__m128 word1 = _mm_castsi128_ps(_mm_or_si128(z, _mm_slli_epi32(handedness, 16)));
+	__m128 word2 = _mm_castsi128_ps(_mm_or_si128(texU, _mm_slli_epi32(texV, 16)));
+	__m128 word3 = _mm_castsi128_ps(directions);
+	_MM_TRANSPOSE4_PS(word0, word1, word2, word3);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(packed), _mm_castps_si128(word0));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(packed + 1), _mm_castps_si128(word1));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(packed + 2), _mm_castps_si128(word2));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(packed + 3), _mm_castps_si128(word3));
+}
+
+static void UnpackVertices4(const PackedTerrainVertex* packed, const VertexBounds& bounds, TerrainVertex* vertices)
+{
+	__m128 word0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(packed)));
+	__m128 word1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + 1)));
+	__m128 word2 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + 2)));
+	__m128 word3 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + 3)));
+	_MM_TRANSPOSE4_PS(word0, word1, word2, word3);
+	const __m128i lowHalf = _mm_set1_epi32(0xFFFF);
+	auto Low = [&](__m128 word) { return _mm_cvtepi32_ps(_mm_and_si128(_mm_castps_si128(word), lowHalf)); };
+	auto High = [&](__m128 word) { return _mm_cvtepi32_ps(_mm_srli_epi32(_mm_castps_si128(word), 16)); };
+
+	const __m128 inverseUnorm16 = _mm_set1_ps(1.0f / 65535.0f);
+	__m128 px = _mm_add_ps(_mm_set1_ps(bounds.min.x), _mm_mul_ps(Low(word0), _mm_set1_ps(bounds.extent.x / 65535.0f)));
+	__m128 py = _mm_add_ps(_mm_set1_ps(bounds.min.y), _mm_mul_ps(High(word0), _mm_set1_ps(bounds.extent.y / 65535.0f)));
+	__m128 pz = _mm_add_ps(_mm_set1_ps(bounds.min.z), _mm_mul_ps(Low(word1), _mm_set1_ps(bounds.extent.z / 65535.0f)));
+	__m128 handedness = Select(_mm_cmpgt_ps(High(word1), _mm_set1_ps(32767.0f)), _mm_set1_ps(1.0f), _mm_set1_ps(-1.0f));
+	__m128 u = _mm_mul_ps(Low(word2), inverseUnorm16);
+	__m128 v = _mm_mul_ps(High(word2), inverseUnorm16);
+
+	// Sign extend each byte of the last word, then decode like GL's signed normalized attributes
+	__m128i directions = _mm_castps_si128(word3);
+	const __m128 inverseSnorm8 = _mm_set1_ps(1.0f / 127.0f), minusOne = _mm_set1_ps(-1.0f);
+	auto Byte = [&](int shift) { return _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(directions, 24 - shift), 24)), inverseSnorm8), minusOne); };
+	__m128 nx, ny, nz, tx, ty, tz;
+	OctahedralDecode4(Byte(0), Byte(8), nx, ny, nz);
+	OctahedralDecode4(Byte(16), Byte(24), tx, ty, tz);
+	__m128 bx = _mm_mul_ps(handedness, _mm_sub_ps(_mm_mul_ps(ny, tz), _mm_mul_ps(nz, ty)));
+	__m128 by = _mm_mul_ps(handedness, _mm_sub_ps(_mm_mul_ps(nz, tx), _mm_mul_ps(nx, tz)));
+	__m128 bz = _mm_mul_ps(handedness, _mm_sub_ps(_mm_mul_ps(nx, ty), _mm_mul_ps(ny, tx)));
+
+	StoreTransposed(vertices, 0, px, py, pz, nx);
+	StoreTransposed(vertices, 4, ny, nz, u, v);
+	StoreTransposed(vertices, 8, tx, ty, tz, bx);
+	StoreTransposed(vertices, 10, tz, bx, by, bz); // Overlaps the last store with the same values
+}
+#endif
+
+void PackTerrainVertices(const TerrainVertex* vertices, size_t count, const VertexBounds& bounds, PackedTerrainVertex* packed)
+{
+	size_t i = 0;
+#ifdef VERTEX_USE_SSE2
+	for (; i + 4 <= count; i += 4)
+		PackVertices4(vertices + i, bounds, packed + i);
+#endif
+	for (; i < count; ++i)
+		PackVertex(vertices[i], bounds, packed[i]);
+}
+
+void UnpackTerrainVertices(const PackedTerrainVertex* packed, size_t count, const VertexBounds& bounds, TerrainVertex* vertices)
+{
+	size_t i = 0;
+#ifdef VERTEX_USE_SSE2
+	for (; i + 4 <= count; i += 4)
+		UnpackVertices4(packed + i, bounds, vertices + i);
+#endif
+	for (; i < count; ++i)
+		UnpackVertex(packed[i], bounds, vertices[i]);
+}
+
+bool VerifyVertexPacking()
+{
+	// A box like the RTIN mesh's and the flat quad's, and a count that leaves a scalar tail after the groups of four
+	const VertexBounds boxes[2] = { { glm::vec3(-1.0f, -1.0f, -0.3f), glm::vec3(2.0f, 2.0f, 0.3f) }, { glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(2.0f, 2.0f, 0.0f) } };
+	const glm::vec3 axes[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+	const size_t count = 100003;
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f), signedUnit(-1.0f, 1.0f);
+	auto RandomDirection = [&]
+	{
+		glm::vec3 direction;
+		do direction = glm::vec3(signedUnit(random), signedUnit(random), signedUnit(random));
+		while (glm::dot(direction, direction) > 1.0f || glm::dot(direction, direction) < 1e-4f);
+		return glm::normalize(direction);
+	};
+	auto Degrees = [](const glm::vec3& a, const glm::vec3& b) { return glm::degrees(std::acos(std::min(glm::dot(a, b) / (glm::length(a) * glm::length(b)), 1.0f))); };
+
+	std::vector<TerrainVertex> vertices(count), unpacked(count), scalarUnpacked(count);
+	std::vector<PackedTerrainVertex> packed(count), scalarPacked(count);
+	float positionError = 0.0f, texCoordError = 0.0f, directionError = 0.0f, bitangentError = 0.0f; // In half steps and degrees
+	size_t mismatches = 0, outOfBounds = 0;
+	const float rounding = 2.0f * std::numeric_limits<float>::epsilon(); // Of the coordinates, all within -1..1
+	for (const VertexBounds& bounds : boxes)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			// The box's corners and the axes first: the quantization's ends and the octahedron's folds
+			TerrainVertex& vertex = vertices[i];
+			glm::vec3 fraction = i < 8 ? glm::vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1) : glm::vec3(unit(random), unit(random), unit(random));
+			vertex.position = bounds.min + fraction * bounds.extent;
+			vertex.texCoords = glm::vec2(unit(random), unit(random));
+			vertex.normal = i < 6 ? axes[i] : RandomDirection();
+			vertex.tangent = glm::normalize(glm::cross(vertex.normal, std::abs(vertex.normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0)));
+			vertex.tangent = glm::normalize(vertex.tangent * signedUnit(random) + glm::cross(vertex.normal, vertex.tangent) * signedUnit(random));
+			vertex.bitangent = glm::cross(vertex.normal, vertex.tangent) * (unit(random) < 0.5f ? 1.0f : -1.0f);
+		}
+
+		PackTerrainVertices(vertices.data(), count, bounds, packed.data());
+		UnpackTerrainVertices(packed.data(), count, bounds, unpacked.data());
+		for (size_t i = 0; i < count; ++i)
+		{
+			PackVertex(vertices[i], bounds, scalarPacked[i]);
+			UnpackVertex(packed[i], bounds, scalarUnpacked[i]);
+			mismatches += std::memcmp(&packed[i], &scalarPacked[i], sizeof(PackedTerrainVertex)) != 0 || std::memcmp(&unpacked[i], &scalarUnpacked[i], sizeof(TerrainVertex)) != 0;
+
+			bool bOutOfBounds = false;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				float error = std::abs(unpacked[i].position[axis] - vertices[i].position[axis]);
+				bOutOfBounds |= error > bounds.extent[axis] / 131070.0f + rounding;
+				if (bounds.extent[axis] > 0.0f) positionError = std::max(positionError, error / bounds.extent[axis] * 131070.0f);
+			}
+			for (int axis = 0; axis < 2; ++axis)
+			{
+				float error = std::abs(unpacked[i].texCoords[axis] - vertices[i].texCoords[axis]);
+				bOutOfBounds |= error > 1.0f / 131070.0f + rounding;
+				texCoordError = std::max(texCoordError, error * 131070.0f);
+			}
+			float direction = std::max(Degrees(unpacked[i].normal, vertices[i].normal), Degrees(unpacked[i].tangent, vertices[i].tangent));
+			float bitangent = Degrees(unpacked[i].bitangent, vertices[i].bitangent);
+			bOutOfBounds |= direction > 0.95f || bitangent > 1.2f; // As measured, under PACKED_DIRECTION_MAX_ERROR_DEGREES
+			directionError = std::max(directionError, direction);
+			bitangentError = std::max(bitangentError, bitangent);
+			outOfBounds += bOutOfBounds;
+		}
+	}
+
+	bool bPassed = mismatches == 0 && outOfBounds == 0;
+	std::cout << "Vertex packing (" << count << " vertices in 2 boxes): position max error " << positionError << " half steps, texcoords "
+		<< texCoordError << " half steps, normal/ tangent " << directionError << " degrees, bitangent " << bitangentError << " degrees ("
+		<< outOfBounds << " vertices out of bounds), " << mismatches << " differ between the SSE2 and scalar paths -> " << (bPassed ? "PASSED" : "FAILED") << std::endl;
+	return bPassed;
+}
+
+void PackUnitPositions(const glm::vec3* positions, size_t count, int16_t* packed)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+			packed[i * 4 + axis] = static_cast<int16_t>(RoundToInt(std::min(std::max(positions[i][axis], -1.0f), 1.0f) * 32767.0f));
+		packed[i * 4 + 3] = 0;
+	}
+}
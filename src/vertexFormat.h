@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/// <summary>
+/// A terrain vertex as the meshes build it, 56 bytes: the quad's layout of position, normal, texcoords and tangent frame.
+/// </summary>
+struct TerrainVertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texCoords;
+	glm::vec3 tangent;
+	glm::vec3 bitangent;
+};
+static_assert(sizeof(TerrainVertex) == 14 * sizeof(float), "TerrainVertex must stay tightly packed for the SSE2 loads");
+
+/// <summary>
+/// The box a mesh's (or a chunk's) positions are quantized in. An extent of 0 along an axis (the flat quad's depth) is fine.
+/// </summary>
+struct VertexBounds
+{
+	glm::vec3 min;
+	glm::vec3 extent;
+};
+
+/// <summary>
+/// TerrainVertex in 16 bytes, as procTerrain.VERT reads it:
+/// - position: 16 bit unsigned normalized within the VertexBounds, extent / 131070 off per axis at most (plus float
+///   rounding). w is the tangent frame's handedness, 0 or 65535 for -1 or 1 (the bitangent is handedness *
+///   cross(normal, tangent)).
+/// - texCoords: 16 bit unsigned normalized, clamped to 0..1, at most 1 / 131070 off.
+/// - normal and tangent: unit vectors folded onto an octahedron, as pairs of 8 bit signed normalized values, at most
+///   PACKED_DIRECTION_MAX_ERROR_DEGREES off (the bitangent, built from both, up to 1.2 degrees).
+/// </summary>
+struct PackedTerrainVertex
+{
+	uint16_t position[4];
+	uint16_t texCoords[2];
+	int8_t normal[2];
+	int8_t tangent[2];
+};
+static_assert(sizeof(PackedTerrainVertex) == 16, "PackedTerrainVertex is read by procTerrain.VERT with a 16 byte stride");
+
+const float PACKED_DIRECTION_MAX_ERROR_DEGREES = 1.0f; // Measured over 10^7 random directions: 0.95
+
+/// <summary>
+/// Quantize vertices into bounds (which must hold them), four at a time with SSE2 when available. The tangent frame is
+/// assumed orthonormal: only the bitangent's side survives.
+/// </summary>
+void PackTerrainVertices(const TerrainVertex* vertices, size_t count, const VertexBounds& bounds, PackedTerrainVertex* packed);
+
+/// <summary>
+/// The reverse, as procTerrain.VERT decodes them: unit normal and tangent, bitangent = handedness * cross(normal, tangent).
+/// </summary>
+void UnpackTerrainVertices(const PackedTerrainVertex* packed, size_t count, const VertexBounds& bounds, TerrainVertex* vertices);
+
+/// <summary>
+/// Round trips random vertices through PackTerrainVertices() and UnpackTerrainVertices() and checks them against the bounds
+/// PackedTerrainVertex documents, and the SSE2 path against the scalar one bit for bit. CPU only.
+/// </summary>
+/// <returns> True if every vertex is within bounds and both paths agree. </returns>
+bool VerifyVertexPacking();
+
+/// <summary>
+/// Positions within -1..1 (e.g. a unit sphere's) as four 16 bit signed normalized values each, the last one 0. They are
+/// read as a plain vec3, at most 1 / 65534 off per axis.
+/// </summary>
+void PackUnitPositions(const glm::vec3* positions, size_t count, int16_t* packed);
+
+/// <summary>
+/// A vertex of the instanced models (rocks, trees), 20 bytes: the position in world units (the model is scaled per instance),
+/// an 8 bit signed normalized normal (w unused) and an 8 bit color, as instance.VERT reads them.
+/// </summary>
+struct ModelVertex
+{
+	glm::vec3 position;
+	int8_t normal[4];
+	uint8_t color[4];
+};
+static_assert(sizeof(ModelVertex) == 20, "ModelVertex is read by instance.VERT with a 20 byte stride");
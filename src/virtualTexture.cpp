@@ -0,0 +1,796 @@
+#include "virtualTexture.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include "glad/glad.h"
+#include "imageWriter.h"
+#include "memoryTracker.h"
+#include "texture.h"
+
+static const char VT_MAGIC[4] = { 'V', 'T', 'E', 'X' };
+static const uint32_t VT_VERSION = 1;
+static const uint32_t INVALID_PAGE = 0xFFFFFFFFu;
+static const int MAX_PAGES_ACROSS = 256; // Page coordinates are 8 bit in the page keys and the feedback buffer
+static const unsigned int FEEDBACK_READBACKS = 3;
+static const GLuint64 FENCE_TIMEOUT = 1000000000; // 1 second, in nanoseconds. Only hit if the GPU has hung
+
+// ------------------------------------ File Layout ---------------------------------------------------------------
+// Header, then every page's BC7 blocks (level 0 first, pages row-major and bottom row first like GL, blocks likewise).
+struct VirtualTextureHeader
+{
+	char magic[4]; // Written last, so an interrupted build is detected and redone
+	uint32_t version;
+	uint64_t sourceBytes;
+	uint32_t size;
+	uint32_t pageSize;
+	uint32_t border;
+	uint32_t levelCount;
+};
+static_assert(sizeof(VirtualTextureHeader) == 32, "Virtual texture file layout changed");
+
+static uint64_t FileBytes(const char* path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	return file ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+static size_t PageCount(int size, int levelCount)
+{
+	size_t count = 0;
+	for (int level = 0; level < levelCount; ++level)
+	{
+		size_t pagesAcross = static_cast<size_t>(size / VT_PAGE_SIZE) >> level;
+		count += pagesAcross * pagesAcross;
+	}
+	return count;
+}
+
+/// <summary>
+/// Map a page file and check it is complete and belongs to the current source file.
+/// </summary>
+static bool OpenPageFile(MappedFile& file, const char* path, uint64_t sourceBytes, int& size, int& levelCount)
+{
+	if (FileBytes(path) < sizeof(VirtualTextureHeader) || !file.OpenRead(path)) return false;
+	VirtualTextureHeader header;
+	std::memcpy(&header, file.Data(), sizeof(header));
+	if (std::memcmp(header.magic, VT_MAGIC, sizeof(header.magic)) != 0 || header.version != VT_VERSION || header.sourceBytes != sourceBytes ||
+		header.pageSize != VT_PAGE_SIZE || header.border != VT_PAGE_BORDER || header.levelCount == 0 || header.size < VT_PAGE_SIZE ||
+		(header.size >> (header.levelCount - 1)) != VT_PAGE_SIZE)
+		return false;
+
+	size = static_cast<int>(header.size);
+	levelCount = static_cast<int>(header.levelCount);
+	return file.Size() == sizeof(header) + PageCount(size, levelCount) * VT_PAGE_BYTES;
+}
+// ----------------------------------------------------------------------------------------------------------------
+
+// ------------------------------------ BC7 -----------------------------------------------------------------------
+static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 }; // 4 bit index interpolation, in 64ths
+
+/// <summary>
+/// Little-endian bit packing into a zeroed 16 byte block.
+/// </summary>
+struct BlockWriter
+{
+	unsigned char* block;
+	int position;
+
+	void Put(uint32_t value, int bits)
+	{
+		for (int i = 0; i < bits; ++i, ++position)
+			block[position >> 3] |= static_cast<unsigned char>(((value >> i) & 1) << (position & 7));
+	}
+};
+
+/// <summary>
+/// Compress a 4x4 block of RGB texels to BC7 mode 6. The endpoints span the block's colors along their principal axis (a few
+/// power iterations on the covariance), each endpoint is quantized to 7 bits plus the p-bit that suits it best, and every
+/// texel takes the closest of the 16 interpolated colors. Alpha is left opaque.
+/// </summary>
+static void EncodeBc7Block(const unsigned char* texels, size_t rowBytes, unsigned char* block)
+{
+	float colors[16][3];
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			colors[i][c] = texels[(i / 4) * rowBytes + (i % 4) * 3 + c];
+			mean[c] += colors[i][c] / 16.0f;
+		}
+	}
+	float covariance[3][3] = {};
+	for (int i = 0; i < 16; ++i)
+		for (int a = 0; a < 3; ++a)
+			for (int b = 0; b < 3; ++b)
+				covariance[a][b] += (colors[i][a] - mean[a]) * (colors[i][b] - mean[b]);
+	float axis[3] = { 0.577f, 0.577f, 0.577f };
+	for (int iteration = 0; iteration < 6; ++iteration)
+	{
+		float next[3];
+		for (int a = 0; a < 3; ++a)
+			next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+		const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (length < 1e-6f) break; // Flat block, any axis does
+		for (int a = 0; a < 3; ++a)
+			axis[a] = next[a] / length;
+	}
+	float minT = 0.0f, maxT = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		const float t = (colors[i][0] - mean[0]) * axis[0] + (colors[i][1] - mean[1]) * axis[1] + (colors[i][2] - mean[2]) * axis[2];
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+
+	// Endpoints are 7 bits per channel plus a p-bit shared by the channels, together 8 bits
+	int quantized[2][3], pBits[2], endpoints[2][3];
+	for (int e = 0; e < 2; ++e)
+	{
+		const float t = e == 0 ? minT : maxT;
+		float bestError = 1e30f;
+		for (int p = 0; p < 2; ++p)
+		{
+			int candidate[3];
+			float error = 0.0f;
+			for (int c = 0; c < 3; ++c)
+			{
+				const float value = std::min(std::max(mean[c] + t * axis[c], 0.0f), 255.0f);
+				candidate[c] = std::min(std::max(static_cast<int>(std::floor((value - p) * 0.5f + 0.5f)), 0), 127);
+				const float difference = static_cast<float>(candidate[c] * 2 + p) - value;
+				error += difference * difference;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pBits[e] = p;
+				for (int c = 0; c < 3; ++c)
+					quantized[e][c] = candidate[c];
+			}
+		}
+		for (int c = 0; c < 3; ++c)
+			endpoints[e][c] = quantized[e][c] * 2 + pBits[e];
+	}
+
+	int palette[16][3];
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 3; ++c)
+			palette[i][c] = ((64 - BC7_WEIGHTS[i]) * endpoints[0][c] + BC7_WEIGHTS[i] * endpoints[1][c] + 32) >> 6;
+	int indices[16];
+	for (int i = 0; i < 16; ++i)
+	{
+		int bestError = 1 << 30;
+		for (int j = 0; j < 16; ++j)
+		{
+			int error = 0;
+			for (int c = 0; c < 3; ++c)
+			{
+				const int difference = palette[j][c] - static_cast<int>(colors[i][c]);
+				error += difference * difference;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				indices[i] = j;
+			}
+		}
+	}
+
+	// The first texel's index is stored with 3 bits, so its top bit has to be 0: swap the endpoints if it isn't
+	if (indices[0] & 8)
+	{
+		for (int c = 0; c < 3; ++c)
+			std::swap(quantized[0][c], quantized[1][c]);
+		std::swap(pBits[0], pBits[1]);
+		for (int i = 0; i < 16; ++i)
+			indices[i] = 15 - indices[i];
+	}
+
+	std::memset(block, 0, 16);
+	BlockWriter writer = { block, 0 };
+	writer.Put(1 << 6, 7); // Mode 6
+	for (int c = 0; c < 3; ++c)
+	{
+		writer.Put(quantized[0][c], 7);
+		writer.Put(quantized[1][c], 7);
+	}
+	writer.Put(127, 7); // Alpha
+	writer.Put(127, 7);
+	writer.Put(pBits[0], 1);
+	writer.Put(pBits[1], 1);
+	writer.Put(indices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		writer.Put(indices[i], 4);
+}
+// ----------------------------------------------------------------------------------------------------------------
+
+// ------------------------------------ Building ------------------------------------------------------------------
+bool BuildVirtualTextureFile(const char* sourcePath, const char* tiledPath, JobSystem& jobSystem)
+{
+	MemoryScope memoryScope(MemorySubsystem::Textures);
+	auto start = std::chrono::steady_clock::now();
+	const uint64_t sourceBytes = FileBytes(sourcePath);
+	Image image = DecodeImage(sourcePath, true, 3); // Bottom row first, like every other texture upload
+	if (!image.data) return false;
+	const int size = image.width;
+	if (image.width != image.height || (size & (size - 1)) != 0 || size < VT_PAGE_SIZE || size / VT_PAGE_SIZE > MAX_PAGES_ACROSS)
+	{
+		std::cerr << "ERROR: Virtual textures have to be square, a power of two, and " << VT_PAGE_SIZE << " to " << VT_PAGE_SIZE * MAX_PAGES_ACROSS
+			<< " texels across: " << sourcePath << " is " << image.width << "x" << image.height << std::endl;
+		FreeImage(image);
+		return false;
+	}
+
+	// Mip chain down to a single page, each level box-filtered from the one above in row bands
+	int levelCount = 1;
+	while ((size >> (levelCount - 1)) > VT_PAGE_SIZE)
+		++levelCount;
+	std::vector<std::vector<unsigned char>> mips(levelCount);
+	std::vector<const unsigned char*> levelPixels(levelCount);
+	levelPixels[0] = image.data;
+	for (int level = 1; level < levelCount; ++level)
+	{
+		const int width = size >> level;
+		mips[level].resize(static_cast<size_t>(width) * width * 3);
+		const unsigned char* above = levelPixels[level - 1];
+		unsigned char* below = mips[level].data();
+		std::vector<JobHandle> bands = jobSystem.ScheduleRows(width, 64, {}, [above, below, width](int firstRow, int lastRow)
+		{
+			const size_t aboveRowBytes = static_cast<size_t>(width) * 2 * 3;
+			for (int y = firstRow; y < lastRow; ++y)
+			{
+				const unsigned char* row0 = above + 2 * y * aboveRowBytes;
+				const unsigned char* row1 = row0 + aboveRowBytes;
+				unsigned char* out = below + static_cast<size_t>(y) * width * 3;
+				for (int x = 0; x < width * 3; ++x)
+				{
+					const int i = (x / 3) * 6 + x % 3;
+					out[x] = static_cast<unsigned char>((row0[i] + row0[i + 3] + row1[i] + row1[i + 3] + 2) >> 2);
+				}
+			}
+		});
+		for (const JobHandle& band : bands)
+			jobSystem.Wait(band);
+		levelPixels[level] = below;
+	}
+
+	std::ofstream file(tiledPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cerr << "ERROR: Could not open " << tiledPath << " for writing" << std::endl;
+		FreeImage(image);
+		return false;
+	}
+	VirtualTextureHeader header = {};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// One job per page row, its pages compressed back to back
+	OrderedRowWriter<std::vector<unsigned char>> writer(jobSystem, [&](std::vector<unsigned char>& row)
+	{
+		file.write(reinterpret_cast<const char*>(row.data()), row.size());
+	});
+
+	for (int level = 0; level < levelCount; ++level)
+	{
+		const int width = size >> level;
+		const int pagesAcross = width / VT_PAGE_SIZE;
+		const unsigned char* pixels = levelPixels[level];
+		for (int pageY = 0; pageY < pagesAcross; ++pageY)
+		{
+			writer.Add(std::make_shared<std::vector<unsigned char>>(VT_PAGE_BYTES * pagesAcross), [pixels, width, pagesAcross, pageY](std::vector<unsigned char>& row)
+			{
+				MemoryScope memoryScope(MemorySubsystem::Textures);
+				const size_t pageRowBytes = VT_PHYSICAL_PAGE_SIZE * 3;
+				std::vector<unsigned char> page(VT_PHYSICAL_PAGE_SIZE * pageRowBytes);
+				for (int pageX = 0; pageX < pagesAcross; ++pageX)
+				{
+					// The border repeats the neighbouring pages' texels, clamped at the texture's edges
+					for (int y = 0; y < VT_PHYSICAL_PAGE_SIZE; ++y)
+					{
+						const int sourceY = std::min(std::max(pageY * VT_PAGE_SIZE - VT_PAGE_BORDER + y, 0), width - 1);
+						const unsigned char* sourceRow = pixels + static_cast<size_t>(sourceY) * width * 3;
+						for (int x = 0; x < VT_PHYSICAL_PAGE_SIZE; ++x)
+						{
+							const int sourceX = std::min(std::max(pageX * VT_PAGE_SIZE - VT_PAGE_BORDER + x, 0), width - 1);
+							std::memcpy(&page[y * pageRowBytes + x * 3], sourceRow + sourceX * 3, 3);
+						}
+					}
+					unsigned char* blocks = &row[VT_PAGE_BYTES * pageX];
+					for (int blockY = 0; blockY < VT_PHYSICAL_PAGE_SIZE; blockY += 4)
+						for (int blockX = 0; blockX < VT_PHYSICAL_PAGE_SIZE; blockX += 4, blocks += 16)
+							EncodeBc7Block(&page[blockY * pageRowBytes + blockX * 3], pageRowBytes, blocks);
+				}
+			});
+		}
+	}
+	writer.Flush();
+	FreeImage(image);
+
+	std::memcpy(header.magic, VT_MAGIC, sizeof(header.magic));
+	header.version = VT_VERSION;
+	header.sourceBytes = sourceBytes;
+	header.size = static_cast<uint32_t>(size);
+	header.pageSize = VT_PAGE_SIZE;
+	header.border = VT_PAGE_BORDER;
+	header.levelCount = static_cast<uint32_t>(levelCount);
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.close();
+	if (!file)
+	{
+		std::cerr << "ERROR: Failed writing " << tiledPath << std::endl;
+		return false;
+	}
+	std::cout << "Virtual texture " << tiledPath << ": " << PageCount(size, levelCount) << " pages in " << levelCount << " levels, "
+		<< PageCount(size, levelCount) * VT_PAGE_BYTES / (1024.0 * 1024.0) << " MB, built in "
+		<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+	return true;
+}
+// ----------------------------------------------------------------------------------------------------------------
+
+// ------------------------------------ Virtual Texture -----------------------------------------------------------
+VirtualTexture::VirtualTexture(JobSystem& jobSystem)
+	: _jobSystem(jobSystem), _size(0), _levelCount(0), _atlas(0), _pageTable(0), _slotsAcross(0), _bPageTableDirty(false), _pendingPages(0),
+	_maxPendingPages(0), _frame(0), _feedbackFBO(0), _feedbackColor(0), _feedbackDepth(0), _feedbackWidth(0), _feedbackHeight(0),
+	_feedbackLodBias(0.0f), _readbackHead(0), _pagesLoaded(0), _pagesEvicted(0), _requestsDeferred(0)
+{
+}
+
+bool VirtualTexture::Open(const std::vector<std::string>& sourcePaths, size_t budgetBytes, int feedbackWidth, int feedbackHeight, float feedbackScale)
+{
+	MemoryScope memoryScope(MemorySubsystem::Textures);
+	std::vector<Layer> layers(sourcePaths.size());
+	_layers.swap(layers);
+	for (size_t i = 0; i < sourcePaths.size(); ++i)
+	{
+		const std::string tiledPath = sourcePaths[i] + ".vt";
+		const uint64_t sourceBytes = FileBytes(sourcePaths[i].c_str());
+		int size = 0, levelCount = 0;
+		if (!OpenPageFile(_layers[i].file, tiledPath.c_str(), sourceBytes, size, levelCount))
+		{
+			_layers[i].file.Close();
+			std::cout << "Building virtual texture pages for " << sourcePaths[i] << " (only on the first run)" << std::endl;
+			if (!BuildVirtualTextureFile(sourcePaths[i].c_str(), tiledPath.c_str(), _jobSystem) ||
+				!OpenPageFile(_layers[i].file, tiledPath.c_str(), sourceBytes, size, levelCount))
+			{
+				std::cerr << "ERROR: Could not open virtual texture pages " << tiledPath << std::endl;
+				_layers.clear();
+				return false;
+			}
+		}
+		if (i > 0 && size != _size)
+		{
+			std::cerr << "ERROR: Virtual texture layers differ in size: " << sourcePaths[i] << std::endl;
+			_layers.clear();
+			return false;
+		}
+		_size = size;
+		_levelCount = levelCount;
+		_layers[i].pages = _layers[i].file.Data() + sizeof(VirtualTextureHeader);
+	}
+	const int layerCount = static_cast<int>(_layers.size());
+	_firstPage.assign(_levelCount, 0);
+	for (int level = 1; level < _levelCount; ++level)
+		_firstPage[level] = _firstPage[level - 1] + static_cast<size_t>(PagesAcross(level - 1)) * PagesAcross(level - 1);
+
+	// --- Atlas: as many slots as the budget holds, in a square, but never more than there are pages
+	GLint maxTextureSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	const size_t slotBytes = TextureByteSize(VT_PHYSICAL_PAGE_SIZE, VT_PHYSICAL_PAGE_SIZE, GL_COMPRESSED_RGBA_BPTC_UNORM, 1, layerCount);
+	const int pageCount = static_cast<int>(PageCount(_size, _levelCount));
+	_slotsAcross = static_cast<int>(std::sqrt(static_cast<double>(budgetBytes / slotBytes)));
+	_slotsAcross = std::min(_slotsAcross, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(pageCount)))));
+	_slotsAcross = std::min(_slotsAcross, std::min(MAX_PAGES_ACROSS, maxTextureSize / VT_PHYSICAL_PAGE_SIZE));
+	if (_slotsAcross < 2)
+	{
+		std::cout << "WARNING: The virtual texture budget is too small, using 4 pages" << std::endl;
+		_slotsAcross = 2;
+	}
+	const int atlasSize = _slotsAcross * VT_PHYSICAL_PAGE_SIZE;
+	glGenTextures(1, &_atlas);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _atlas);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_COMPRESSED_RGBA_BPTC_UNORM, atlasSize, atlasSize, layerCount);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	TrackGpuResource(GpuResourceType::Texture, _atlas, TextureByteSize(atlasSize, atlasSize, GL_COMPRESSED_RGBA_BPTC_UNORM, 1, layerCount),
+		"virtual texture atlas " + std::to_string(_slotsAcross) + "x" + std::to_string(_slotsAcross) + " pages");
+
+	// --- Page table: one texel per page, one mip level per level
+	glGenTextures(1, &_pageTable);
+	glBindTexture(GL_TEXTURE_2D, _pageTable);
+	glTexStorage2D(GL_TEXTURE_2D, _levelCount, GL_RGBA8UI, PagesAcross(0), PagesAcross(0));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST); // Integer textures can't be filtered
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, _levelCount - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	TrackGpuResource(GpuResourceType::Texture, _pageTable, TextureByteSize(PagesAcross(0), PagesAcross(0), GL_RGBA8, _levelCount), "virtual texture page table");
+	_pageTableLevels.resize(_levelCount);
+	for (int level = 0; level < _levelCount; ++level)
+		_pageTableLevels[level].assign(static_cast<size_t>(PagesAcross(level)) * PagesAcross(level), 0);
+
+	_slots.resize(static_cast<size_t>(_slotsAcross) * _slotsAcross);
+	for (uint32_t i = 0; i < _slots.size(); ++i)
+	{
+		Slot& slot = _slots[i];
+		slot.page = INVALID_PAGE;
+		slot.bResident = false;
+		slot.bPinned = false;
+		slot.lastUsed = 0;
+		slot.lru = _lru.insert(_lru.end(), i);
+	}
+
+	// The coarsest level is loaded right away and never evicted, so every texel always has something to fall back to
+	{
+		const uint32_t page = PageKey(_levelCount - 1, 0, 0);
+		const uint32_t slotIndex = _lru.back();
+		std::vector<unsigned char> blocks(VT_PAGE_BYTES * layerCount);
+		for (int i = 0; i < layerCount; ++i)
+			ReadPage(_layers[i], page, &blocks[VT_PAGE_BYTES * i]);
+		_slots[slotIndex].page = page;
+		_slots[slotIndex].bPinned = true;
+		_lru.erase(_slots[slotIndex].lru);
+		_pageSlots[page] = slotIndex;
+		++_pendingPages;
+		UploadPage(slotIndex, blocks);
+	}
+
+	// --- Feedback target, read back through a small PBO ring
+	_feedbackWidth = feedbackWidth;
+	_feedbackHeight = feedbackHeight;
+	_feedbackLodBias = -std::log2(feedbackScale);
+	glGenFramebuffers(1, &_feedbackFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, _feedbackFBO);
+	glGenRenderbuffers(1, &_feedbackColor);
+	glBindRenderbuffer(GL_RENDERBUFFER, _feedbackColor);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _feedbackWidth, _feedbackHeight);
+	TrackGpuResource(GpuResourceType::Renderbuffer, _feedbackColor, TextureByteSize(_feedbackWidth, _feedbackHeight, GL_RGBA8), "virtual texture feedback");
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _feedbackColor);
+	glGenRenderbuffers(1, &_feedbackDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, _feedbackDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, _feedbackWidth, _feedbackHeight);
+	TrackGpuResource(GpuResourceType::Renderbuffer, _feedbackDepth, TextureByteSize(_feedbackWidth, _feedbackHeight, GL_DEPTH_COMPONENT24), "virtual texture feedback depth");
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _feedbackDepth);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Virtual texture feedback framebuffer not complete!" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	const size_t feedbackBytes = static_cast<size_t>(_feedbackWidth) * _feedbackHeight * 4;
+	_readbacks.resize(FEEDBACK_READBACKS);
+	for (Readback& readback : _readbacks)
+	{
+		glGenBuffers(1, &readback.pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, feedbackBytes, nullptr, GL_STREAM_READ);
+		TrackGpuResource(GpuResourceType::Buffer, readback.pbo, feedbackBytes, "virtual texture feedback PBO");
+		readback.fence = nullptr;
+		readback.bInFlight = false;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	_feedbackPages.reserve(static_cast<size_t>(_feedbackWidth) * _feedbackHeight);
+	_maxPendingPages = std::max(4u, _jobSystem.WorkerCount() * 4);
+	RefreshPageTable();
+
+	const size_t residentBytes = TextureByteSize(_size, _size, GL_RGB8, MipLevelCount(_size, _size), layerCount);
+	std::cout << "Virtual texturing: " << layerCount << " layers of " << _size << "x" << _size << " in " << _slots.size() << " pages of "
+		<< VT_PAGE_SIZE << "x" << VT_PAGE_SIZE << ", " << TextureByteSize(atlasSize, atlasSize, GL_COMPRESSED_RGBA_BPTC_UNORM, 1, layerCount) / (1024.0 * 1024.0)
+		<< " MB resident instead of " << residentBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+	return true;
+}
+
+size_t VirtualTexture::PageIndex(int level, int x, int y) const
+{
+	return _firstPage[level] + static_cast<size_t>(y) * PagesAcross(level) + x;
+}
+
+/// <summary>
+/// Copy one page of one layer out of its mapped file, VT_PAGE_BYTES. Thread-safe; this is where the file is actually read.
+/// </summary>
+void VirtualTexture::ReadPage(const Layer& layer, uint32_t page, unsigned char* blocks) const
+{
+	std::memcpy(blocks, layer.pages + PageIndex(page >> 16, page & 0xFF, (page >> 8) & 0xFF) * VT_PAGE_BYTES, VT_PAGE_BYTES);
+}
+
+void VirtualTexture::Bind(Shader& shader, int pageTableUnit, int atlasUnit) const
+{
+	glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+	glBindTexture(GL_TEXTURE_2D, _pageTable);
+	glActiveTexture(GL_TEXTURE0 + atlasUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _atlas);
+	shader.setInt("pageTable", pageTableUnit);
+	shader.setInt("physicalPages", atlasUnit);
+	shader.setBool("bVirtualTexturing", true);
+	shader.setFloat("vtSize", static_cast<float>(_size));
+	shader.setInt("vtMaxLevel", _levelCount - 1);
+	shader.setFloat("vtAtlasSize", static_cast<float>(_slotsAcross * VT_PHYSICAL_PAGE_SIZE));
+}
+
+void VirtualTexture::BeginFeedback(Shader& shader)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, _feedbackFBO);
+	glViewport(0, 0, _feedbackWidth, _feedbackHeight);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f); // Alpha 0: no page needed
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	shader.use();
+	shader.setBool("bVirtualTextureFeedback", true);
+	shader.setFloat("vtFeedbackLodBias", _feedbackLodBias);
+}
+
+void VirtualTexture::EndFeedback(Shader& shader, int viewportWidth, int viewportHeight)
+{
+	shader.use();
+	shader.setBool("bVirtualTextureFeedback", false);
+
+	// Feedback is only a hint: if the GPU hasn't caught up with the oldest read back yet, skip this one rather than wait
+	Readback& readback = _readbacks[_readbackHead];
+	if (!readback.bInFlight)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+		glReadPixels(0, 0, _feedbackWidth, _feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr); // Into the PBO, returns without waiting
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readback.bInFlight = true;
+		_readbackHead = (_readbackHead + 1) % _readbacks.size();
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, viewportWidth, viewportHeight);
+}
+
+/// <summary>
+/// Process every read back that has finished, oldest first. With bWait, waits for all of them.
+/// </summary>
+bool VirtualTexture::CollectReadbacks(bool bWait)
+{
+	bool bCollected = false;
+	for (unsigned int i = 0; i < _readbacks.size(); ++i)
+	{
+		Readback& readback = _readbacks[(_readbackHead + i) % _readbacks.size()];
+		if (!readback.bInFlight) continue;
+		GLenum status = glClientWaitSync(static_cast<GLsync>(readback.fence), bWait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, bWait ? FENCE_TIMEOUT : 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break; // Later ones can't be done either
+		glDeleteSync(static_cast<GLsync>(readback.fence));
+		readback.fence = nullptr;
+		readback.bInFlight = false;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+		const unsigned char* mapped = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+			static_cast<size_t>(_feedbackWidth) * _feedbackHeight * 4, GL_MAP_READ_BIT));
+		if (mapped)
+		{
+			ProcessFeedback(mapped);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			bCollected = true;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	return bCollected;
+}
+
+/// <summary>
+/// Turn one feedback buffer into page requests. Every page seen is marked as used, along with the ancestor the shader falls
+/// back to while it isn't resident. Missing pages are requested with their missing ancestors, coarsest level first (one
+/// coarse page improves a large part of the screen), then by how many pixels want them.
+/// </summary>
+void VirtualTexture::ProcessFeedback(const unsigned char* pixels)
+{
+	++_frame;
+	_feedbackPages.clear();
+	const size_t pixelCount = static_cast<size_t>(_feedbackWidth) * _feedbackHeight;
+	for (size_t i = 0; i < pixelCount; ++i)
+	{
+		const unsigned char* pixel = pixels + i * 4;
+		if (pixel[3] == 0 || pixel[2] >= _levelCount || pixel[0] >= PagesAcross(pixel[2]) || pixel[1] >= PagesAcross(pixel[2])) continue;
+		_feedbackPages.push_back(PageKey(pixel[2], pixel[0], pixel[1]));
+	}
+	std::sort(_feedbackPages.begin(), _feedbackPages.end());
+
+	struct Request
+	{
+		uint32_t page;
+		uint32_t pixels;
+	};
+	std::vector<Request> requests;
+	for (size_t i = 0; i < _feedbackPages.size();)
+	{
+		const uint32_t page = _feedbackPages[i];
+		size_t end = i;
+		while (end < _feedbackPages.size() && _feedbackPages[end] == page)
+			++end;
+		const uint32_t count = static_cast<uint32_t>(end - i);
+		i = end;
+
+		// Walk up to the first page that is resident (or on its way), requesting everything below it
+		int level = static_cast<int>(page >> 16);
+		int x = page & 0xFF, y = (page >> 8) & 0xFF;
+		for (; level < _levelCount; ++level, x /= 2, y /= 2)
+		{
+			auto slot = _pageSlots.find(PageKey(level, x, y));
+			if (slot != _pageSlots.end())
+			{
+				Touch(slot->second);
+				break;
+			}
+			Request request = { PageKey(level, x, y), count };
+			requests.push_back(request);
+		}
+	}
+
+	std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b) { return a.page < b.page; });
+	size_t merged = 0;
+	for (size_t i = 0; i < requests.size(); ++i)
+	{
+		if (merged > 0 && requests[merged - 1].page == requests[i].page)
+			requests[merged - 1].pixels += requests[i].pixels;
+		else
+			requests[merged++] = requests[i];
+	}
+	requests.resize(merged);
+	std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b)
+	{
+		return (a.page >> 16) != (b.page >> 16) ? (a.page >> 16) > (b.page >> 16) : a.pixels > b.pixels;
+	});
+
+	for (size_t i = 0; i < requests.size(); ++i)
+	{
+		if (_pendingPages >= _maxPendingPages || !RequestPage(requests[i].page))
+		{
+			_requestsDeferred += requests.size() - i; // Asked for again by the next feedback
+			break;
+		}
+	}
+}
+
+/// <summary>
+/// Give the page the least recently used slot and schedule its read (workers) and upload (GL thread). Fails when that slot
+/// was needed by the current feedback as well, i.e. the view needs more pages than the atlas holds: then the page has to make
+/// do with a coarser one.
+/// </summary>
+bool VirtualTexture::RequestPage(uint32_t page)
+{
+	if (_lru.empty()) return false;
+	const uint32_t slotIndex = _lru.back();
+	Slot& slot = _slots[slotIndex];
+	if (slot.page != INVALID_PAGE && (slot.lastUsed >= _frame || !slot.bResident)) return false;
+	if (slot.page != INVALID_PAGE)
+	{
+		_pageSlots.erase(slot.page);
+		_pagesEvicted++;
+		_bPageTableDirty = true;
+	}
+	slot.page = page;
+	slot.bResident = false;
+	_pageSlots[page] = slotIndex;
+	Touch(slotIndex);
+	++_pendingPages;
+
+	std::shared_ptr<std::vector<unsigned char>> blocks = std::make_shared<std::vector<unsigned char>>();
+	JobHandle readJob = _jobSystem.Schedule([this, page, blocks]
+	{
+		MemoryScope memoryScope(MemorySubsystem::Textures);
+		blocks->resize(VT_PAGE_BYTES * _layers.size());
+		for (size_t i = 0; i < _layers.size(); ++i)
+			ReadPage(_layers[i], page, &(*blocks)[VT_PAGE_BYTES * i]);
+	});
+	_jobSystem.ScheduleOnMainThread([this, slotIndex, blocks] { UploadPage(slotIndex, *blocks); }, { readJob });
+	return true;
+}
+
+/// <summary>
+/// Copy a page's blocks (every layer) into its slot of the atlas. The page table picks it up on the next refresh.
+/// </summary>
+void VirtualTexture::UploadPage(uint32_t slot, const std::vector<unsigned char>& blocks)
+{
+	--_pendingPages;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _atlas);
+	glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, (slot % _slotsAcross) * VT_PHYSICAL_PAGE_SIZE, (slot / _slotsAcross) * VT_PHYSICAL_PAGE_SIZE, 0,
+		VT_PHYSICAL_PAGE_SIZE, VT_PHYSICAL_PAGE_SIZE, static_cast<GLsizei>(_layers.size()), GL_COMPRESSED_RGBA_BPTC_UNORM,
+		static_cast<GLsizei>(blocks.size()), blocks.data());
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	_slots[slot].bResident = true;
+	_pagesLoaded++;
+	_bPageTableDirty = true;
+}
+
+void VirtualTexture::Touch(uint32_t slot)
+{
+	if (_slots[slot].bPinned) return;
+	_slots[slot].lastUsed = _frame;
+	_lru.splice(_lru.begin(), _lru, _slots[slot].lru);
+}
+
+/// <summary>
+/// Rebuild and upload every level of the page table, coarsest first, so a page that isn't resident inherits its parent's
+/// entry. At 8k that is about 5000 texels, cheaper than tracking which ones changed.
+/// </summary>
+void VirtualTexture::RefreshPageTable()
+{
+	glBindTexture(GL_TEXTURE_2D, _pageTable);
+	for (int level = _levelCount - 1; level >= 0; --level)
+	{
+		const int pagesAcross = PagesAcross(level);
+		std::vector<uint32_t>& entries = _pageTableLevels[level];
+		for (int y = 0; y < pagesAcross; ++y)
+		{
+			for (int x = 0; x < pagesAcross; ++x)
+			{
+				uint32_t& entry = entries[static_cast<size_t>(y) * pagesAcross + x];
+				auto slot = _pageSlots.find(PageKey(level, x, y));
+				if (slot != _pageSlots.end() && _slots[slot->second].bResident)
+					entry = (slot->second % _slotsAcross) | (slot->second / _slotsAcross) << 8 | static_cast<uint32_t>(level) << 16;
+				else if (level + 1 < _levelCount)
+					entry = _pageTableLevels[level + 1][static_cast<size_t>(y / 2) * (pagesAcross / 2) + x / 2];
+			}
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pagesAcross, pagesAcross, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	_bPageTableDirty = false;
+}
+
+void VirtualTexture::Update()
+{
+	if (!IsOpen()) return;
+	CollectReadbacks(false);
+	_jobSystem.RunMainThreadJobs(); // Uploads of the pages read so far
+	if (_bPageTableDirty)
+		RefreshPageTable();
+}
+
+void VirtualTexture::LoadVisiblePages(Shader& shader, const std::function<void()>& drawTerrain, int viewportWidth, int viewportHeight)
+{
+	if (!IsOpen()) return;
+	const unsigned int maxPendingPages = _maxPendingPages;
+	_maxPendingPages = static_cast<unsigned int>(_slots.size());
+	for (int pass = 0; pass < _levelCount + 1; ++pass) // Each pass can only ask for pages the previous one made visible
+	{
+		const unsigned long long loadedBefore = _pagesLoaded;
+		BeginFeedback(shader);
+		drawTerrain();
+		EndFeedback(shader, viewportWidth, viewportHeight);
+		CollectReadbacks(true);
+		_jobSystem.WaitAll();
+		if (_bPageTableDirty)
+			RefreshPageTable();
+		if (_pagesLoaded == loadedBefore) break;
+	}
+	_maxPendingPages = maxPendingPages;
+}
+
+void VirtualTexture::Shutdown()
+{
+	if (!IsOpen()) return;
+	_jobSystem.WaitAll(); // Outstanding reads, and their uploads
+
+	for (Readback& readback : _readbacks)
+	{
+		if (readback.bInFlight)
+			glDeleteSync(static_cast<GLsync>(readback.fence));
+		UntrackGpuResource(GpuResourceType::Buffer, readback.pbo);
+		glDeleteBuffers(1, &readback.pbo);
+	}
+	_readbacks.clear();
+	UntrackGpuResource(GpuResourceType::Renderbuffer, _feedbackColor);
+	UntrackGpuResource(GpuResourceType::Renderbuffer, _feedbackDepth);
+	glDeleteRenderbuffers(1, &_feedbackColor);
+	glDeleteRenderbuffers(1, &_feedbackDepth);
+	glDeleteFramebuffers(1, &_feedbackFBO);
+	UntrackGpuResource(GpuResourceType::Texture, _pageTable);
+	UntrackGpuResource(GpuResourceType::Texture, _atlas);
+	glDeleteTextures(1, &_pageTable);
+	glDeleteTextures(1, &_atlas);
+	_atlas = _pageTable = _feedbackFBO = _feedbackColor = _feedbackDepth = 0;
+	_layers.clear();
+}
+
+void VirtualTexture::PrintStats() const
+{
+	std::cout << "Virtual texture: " << _pagesLoaded << " pages loaded, " << _pagesEvicted << " evicted, " << _requestsDeferred
+		<< " requests deferred, " << _pageSlots.size() << "/" << _slots.size() << " slots in use" << std::endl;
+}
+// ----------------------------------------------------------------------------------------------------------------
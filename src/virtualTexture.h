@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "jobSystem.h"
+#include "mappedFile.h"
+#include "shader.h"
+
+const int VT_PAGE_SIZE = 128;  // Texels across a page, without its border
+const int VT_PAGE_BORDER = 2;  // Bilinear filtering reads one texel past the page's edge, two keep pages on the 4x4 block grid
+const int VT_PHYSICAL_PAGE_SIZE = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+const size_t VT_PAGE_BYTES = (VT_PHYSICAL_PAGE_SIZE / 4) * (VT_PHYSICAL_PAGE_SIZE / 4) * 16; // BC7 blocks
+
+/// <summary>
+/// Cut a square, power of two texture into pages for virtual texturing (.vt): the image is decoded once and box-filtered down
+/// to a single page, and every page of every level is compressed, with its border, to BC7 (mode 6 only, one set of 8 bit
+/// endpoints and 16 colors per 4x4 block). The GPU samples BC7 directly, so pages are uploaded as they are stored and an 8k
+/// texture takes a quarter of the disk and atlas space it would as RGBA. Mip levels are filtered and pages compressed on the
+/// job system, and pages are streamed to the file a page row at a time. Blocks the calling thread, which must not be a job.
+/// </summary>
+bool BuildVirtualTextureFile(const char* sourcePath, const char* tiledPath, JobSystem& jobSystem);
+
+/// <summary>
+/// Sparse virtual texturing for the terrain's diffuse textures. Instead of keeping every texel of every level resident, a
+/// fixed size atlas of physical pages holds only what the camera currently sees:
+///  - A feedback pass renders the terrain at low resolution, writing the page and mip level each pixel needs. It is read back
+///    through a PBO ring behind fences, so the CPU picks it up a frame or two later without stalling.
+///  - Pages that are needed but not resident are read from the memory-mapped, pre-tiled files on the workers (so page faults
+///    on the files never stall the GL thread), coarse levels first, and uploaded on the GL thread into atlas slots taken from
+///    the least recently used pages.
+///  - An indirection texture (one texel per page, one mip per level) tells the shader which slot holds a page. Pages that
+///    aren't loaded yet point at their closest resident ancestor, and the coarsest level is always resident, so every texel
+///    can be sampled, just blurrier until its page arrives.
+/// All layers (here: the terrain's material layers) share one page layout, so a slot holds the same page of each and one feedback pass and
+/// page table serve both. GPU memory is the atlas plus the small page table, regardless of the source resolution.
+/// </summary>
+class VirtualTexture
+{
+public:
+	explicit VirtualTexture(JobSystem& jobSystem);
+	~VirtualTexture() { Shutdown(); }
+
+	/// <summary>
+	/// Open (building on first use) the page files of the layers, <source>.vt, and create the atlas within budgetBytes.
+	/// Needs the GL context. Sources must have the same size.
+	/// </summary>
+	bool Open(const std::vector<std::string>& sourcePaths, size_t budgetBytes, int feedbackWidth, int feedbackHeight, float feedbackScale);
+	bool IsOpen() const { return _atlas != 0; }
+
+	void Bind(Shader& shader, int pageTableUnit, int atlasUnit) const; // Sets the sampler units and uniforms for procTerrain.FRAG
+
+	// --- The feedback pass: render the terrain with the shader in between, into a small framebuffer of its own
+	void BeginFeedback(Shader& shader);
+	void EndFeedback(Shader& shader, int viewportWidth, int viewportHeight);
+
+	/// <summary>
+	/// Once per frame: pick up finished feedback read backs, evict/ request pages, run the uploads of pages that have been
+	/// read, and refresh the page table.
+	/// </summary>
+	void Update();
+
+	/// <summary>
+	/// Render feedback and load pages until nothing more is requested (or the atlas is full), blocking. For offline renders
+	/// that can't wait for pages to stream in over several frames.
+	/// </summary>
+	void LoadVisiblePages(Shader& shader, const std::function<void()>& drawTerrain, int viewportWidth, int viewportHeight);
+
+	void Shutdown();  // Finishes outstanding reads and releases the GL objects (needs the GL context)
+	void PrintStats() const;
+
+private:
+	struct Layer
+	{
+		MappedFile file;
+		const unsigned char* pages; // VT_PAGE_BYTES per page, levels in order
+	};
+
+	struct Slot
+	{
+		uint32_t page;         // Key of the page held, INVALID_PAGE if free
+		bool bResident;        // False while the page is being read
+		bool bPinned;          // The coarsest level, never evicted
+		unsigned long long lastUsed;
+		std::list<uint32_t>::iterator lru;
+	};
+
+	struct Readback
+	{
+		unsigned int pbo;
+		void* fence; // GLsync
+		bool bInFlight;
+	};
+
+	static uint32_t PageKey(int level, int x, int y) { return static_cast<uint32_t>(level) << 16 | static_cast<uint32_t>(y) << 8 | static_cast<uint32_t>(x); }
+	int PagesAcross(int level) const { return (_size / VT_PAGE_SIZE) >> level; }
+	size_t PageIndex(int level, int x, int y) const;
+	void ReadPage(const Layer& layer, uint32_t page, unsigned char* blocks) const;
+
+	void ProcessFeedback(const unsigned char* pixels);
+	bool RequestPage(uint32_t page);
+	void UploadPage(uint32_t slot, const std::vector<unsigned char>& blocks);
+	void Touch(uint32_t slot);
+	void RefreshPageTable();
+	bool CollectReadbacks(bool bWait);
+
+	JobSystem& _jobSystem;
+	std::vector<Layer> _layers;
+	int _size, _levelCount;
+	std::vector<size_t> _firstPage; // Index of each level's first page
+
+	// --- Physical pages and the page table
+	unsigned int _atlas, _pageTable;
+	int _slotsAcross;
+	std::vector<Slot> _slots;
+	std::list<uint32_t> _lru;                     // Unpinned slots, most recently used first
+	std::unordered_map<uint32_t, uint32_t> _pageSlots; // Page key -> slot, resident or loading
+	std::vector<std::vector<uint32_t>> _pageTableLevels; // RGBA8: slot x, slot y, level held, unused
+	bool _bPageTableDirty;
+	unsigned int _pendingPages, _maxPendingPages;
+	unsigned long long _frame;
+
+	// --- Feedback
+	unsigned int _feedbackFBO, _feedbackColor, _feedbackDepth;
+	int _feedbackWidth, _feedbackHeight;
+	float _feedbackLodBias;
+	std::vector<Readback> _readbacks;
+	unsigned int _readbackHead;
+	std::vector<uint32_t> _feedbackPages;
+
+	// --- Stats
+	unsigned long long _pagesLoaded, _pagesEvicted, _requestsDeferred;
+};
@@ -0,0 +1,135 @@
+#include "yuvConvert.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YUV_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// BT.709 limited range in 8.8 fixed point. Each row of chroma weights sums to zero so grey stays exactly at 128.
+const int Y_R = 47, Y_G = 157, Y_B = 16;
+const int U_R = -26, U_G = -86, U_B = 112;
+const int V_R = 112, V_G = -102, V_B = -10;
+
+static inline unsigned char LumaOf(int r, int g, int b)
+{
+	return static_cast<unsigned char>(((Y_R * r + Y_G * g + Y_B * b + 128) >> 8) + 16);
+}
+
+/// <summary>
+/// Scalar conversion of the 2x2 blocks starting at columns [firstBlock, lastBlock) of the row pair at row y. Blocks hanging
+/// off the right or bottom edge reuse the last column/ row.
+/// </summary>
+static void ConvertBlocksScalar(const unsigned char* rgba, int width, int height, int row, int firstBlock, int lastBlock,
+	unsigned char* yPlane, unsigned char* uPlane, unsigned char* vPlane)
+{
+	const int chromaWidth = (width + 1) / 2;
+	const int nextRow = row + 1 < height ? row + 1 : row;
+	for (int block = firstBlock; block < lastBlock; ++block)
+	{
+		int x0 = block * 2;
+		int x1 = x0 + 1 < width ? x0 + 1 : x0;
+		int sumR = 0, sumG = 0, sumB = 0;
+		const int rows[2] = { row, nextRow };
+		const int columns[2] = { x0, x1 };
+		for (int j = 0; j < 2; ++j)
+		{
+			for (int i = 0; i < 2; ++i)
+			{
+				const unsigned char* pixel = rgba + (static_cast<size_t>(rows[j]) * width + columns[i]) * 4;
+				sumR += pixel[0];
+				sumG += pixel[1];
+				sumB += pixel[2];
+				yPlane[static_cast<size_t>(rows[j]) * width + columns[i]] = LumaOf(pixel[0], pixel[1], pixel[2]);
+			}
+		}
+		int r = (sumR + 2) >> 2, g = (sumG + 2) >> 2, b = (sumB + 2) >> 2;
+		size_t chromaIndex = static_cast<size_t>(row / 2) * chromaWidth + block;
+		uPlane[chromaIndex] = static_cast<unsigned char>(((U_R * r + U_G * g + U_B * b + 128) >> 8) + 128);
+		vPlane[chromaIndex] = static_cast<unsigned char>(((V_R * r + V_G * g + V_B * b + 128) >> 8) + 128);
+	}
+}
+
+#ifdef YUV_USE_SSE2
+/// <summary>
+/// Split 8 RGBA pixels into 16 bit R, G and B lanes.
+/// </summary>
+static inline void LoadRgb8(const unsigned char* rgba, __m128i& r, __m128i& g, __m128i& b)
+{
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba));
+	__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + 16));
+	r = _mm_packs_epi32(_mm_and_si128(lo, byteMask), _mm_and_si128(hi, byteMask));
+	g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), byteMask), _mm_and_si128(_mm_srli_epi32(hi, 8), byteMask));
+	b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), byteMask), _mm_and_si128(_mm_srli_epi32(hi, 16), byteMask));
+}
+
+static inline __m128i Luma8(__m128i r, __m128i g, __m128i b)
+{
+	// The weighted sum is at most 220 * 255 + 128, which fits in an unsigned 16 bit lane, so a logical shift is exact
+	__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(Y_R)), _mm_mullo_epi16(g, _mm_set1_epi16(Y_G))),
+		_mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(Y_B)), _mm_set1_epi16(128)));
+	return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+static inline __m128i Chroma8(__m128i r, __m128i g, __m128i b, int weightR, int weightG, int weightB)
+{
+	// |sum| <= 112 * 255 + 128 fits in a signed 16 bit lane
+	__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(static_cast<short>(weightR))), _mm_mullo_epi16(g, _mm_set1_epi16(static_cast<short>(weightG)))),
+		_mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(static_cast<short>(weightB))), _mm_set1_epi16(128)));
+	return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+
+/// <summary>
+/// Average the vertical pairs already summed in top + bottom (8 pixels each for two groups) down to 8 chroma samples.
+/// </summary>
+static inline __m128i Average2x2(__m128i sumA, __m128i sumB)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i blockSums = _mm_packs_epi32(_mm_madd_epi16(sumA, ones), _mm_madd_epi16(sumB, ones));
+	return _mm_srli_epi16(_mm_add_epi16(blockSums, _mm_set1_epi16(2)), 2);
+}
+
+/// <summary>
+/// 16 pixels wide x 2 rows per iteration: 32 luma samples and 8 of each chroma.
+/// </summary>
+static void ConvertRowPairSse2(const unsigned char* top, const unsigned char* bottom, int blocks, unsigned char* yTop, unsigned char* yBottom, unsigned char* u, unsigned char* v)
+{
+	for (int block = 0; block + 8 <= blocks; block += 8)
+	{
+		__m128i r[4], g[4], b[4]; // Top left/ right half, bottom left/ right half
+		LoadRgb8(top + block * 8, r[0], g[0], b[0]);
+		LoadRgb8(top + block * 8 + 32, r[1], g[1], b[1]);
+		LoadRgb8(bottom + block * 8, r[2], g[2], b[2]);
+		LoadRgb8(bottom + block * 8 + 32, r[3], g[3], b[3]);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(yTop + block * 2), _mm_packus_epi16(Luma8(r[0], g[0], b[0]), Luma8(r[1], g[1], b[1])));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(yBottom + block * 2), _mm_packus_epi16(Luma8(r[2], g[2], b[2]), Luma8(r[3], g[3], b[3])));
+
+		__m128i averageR = Average2x2(_mm_add_epi16(r[0], r[2]), _mm_add_epi16(r[1], r[3]));
+		__m128i averageG = Average2x2(_mm_add_epi16(g[0], g[2]), _mm_add_epi16(g[1], g[3]));
+		__m128i averageB = Average2x2(_mm_add_epi16(b[0], b[2]), _mm_add_epi16(b[1], b[3]));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(u + block), _mm_packus_epi16(Chroma8(averageR, averageG, averageB, U_R, U_G, U_B), _mm_setzero_si128()));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(v + block), _mm_packus_epi16(Chroma8(averageR, averageG, averageB, V_R, V_G, V_B), _mm_setzero_si128()));
+	}
+}
+#endif
+
+void ConvertRgbaToYuv420(const unsigned char* rgba, int width, int height, unsigned char* y, unsigned char* u, unsigned char* v)
+{
+	const int chromaWidth = (width + 1) / 2;
+	for (int row = 0; row < height; row += 2)
+	{
+		int firstScalarBlock = 0;
+#ifdef YUV_USE_SSE2
+		if (row + 1 < height)
+		{
+			int simdBlocks = (width / 16) * 8; // Whole 16 pixel groups only
+			ConvertRowPairSse2(rgba + static_cast<size_t>(row) * width * 4, rgba + static_cast<size_t>(row + 1) * width * 4, simdBlocks,
+				y + static_cast<size_t>(row) * width, y + static_cast<size_t>(row + 1) * width,
+				u + static_cast<size_t>(row / 2) * chromaWidth, v + static_cast<size_t>(row / 2) * chromaWidth);
+			firstScalarBlock = simdBlocks;
+		}
+#endif
+		ConvertBlocksScalar(rgba, width, height, row, firstScalarBlock, chromaWidth, y, u, v);
+	}
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+/// <summary>
+/// RGBA8 -> planar YUV 4:2:0 (BT.709, limited range), as expected by video encoders reading Y4M. Chroma is the average of
+/// each 2x2 block. Uses SSE2 when available, with a scalar path for the edges and other targets.
+/// The planes must hold width * height (y) and ((width + 1) / 2) * ((height + 1) / 2) (u, v) bytes.
+/// </summary>
+void ConvertRgbaToYuv420(const unsigned char* rgba, int width, int height, unsigned char* y, unsigned char* u, unsigned char* v);